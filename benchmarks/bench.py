@@ -0,0 +1,283 @@
+#!/usr/bin/env python3
+"""Runs the benchmark corpus and compares it against a stored baseline.
+
+Every benchmark runs under each mode a few times. The best wall time and the
+largest resident set are kept, and one more run with --stats counts the
+instructions the VM executed, the objects the heap allocated and the
+collections it ran. Every mode must print the same output as the first one.
+
+Counts are the same on every machine, so they are what baseline.json holds
+and what is checked by default. Times and RSS depend on the machine, so
+they are only compared with --timing, against a baseline recorded on this
+machine: the first --timing run records it, and later ones compare with it.
+"""
+
+import argparse
+import json
+import os
+import re
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+
+# Arguments given to mitscript before the program
+MODES = {
+    "interpret": ["interpret"],
+    "closures": ["interpret", "--closures"],
+    "vm": ["run"],
+    "register": ["run", "--tier", "register"],
+    "jit": ["run", "--tier", "jit"],
+    "O2": ["run", "-O2"],
+}
+
+DEFAULT_MODES = ["interpret", "vm"]
+
+# Programs named after their file in this directory, except parse, which is
+# generated
+BENCHMARKS = ["fib", "structs", "strings", "closures", "gc_lists", "parse"]
+
+STATS = re.compile(
+    r"\[stats\] (?:(\d+) instructions executed, )?(\d+) objects allocated"
+    r".*?(\d+) collections")
+
+# Fields that depend only on the program and the binary, and those that
+# depend on the machine too
+COUNTS = ["instructions", "allocations", "collections"]
+MEASURES = ["time", "rss"]
+
+
+def generate_parse(path, functions=4000):
+    """A large program that mostly costs lexing, parsing and compiling: many
+    small functions, each called once"""
+    with open(path, "w") as out:
+        out.write("// Generated by bench.py\n")
+        out.write("total = 0;\n")
+        for i in range(functions):
+            out.write(
+                "f%d = fun(a, b) {\n"
+                "  r = {x: a; y: b; name: \"f%d\";};\n"
+                "  if (a < b & !(a == %d)) {\n"
+                "    r.x = (a + %d) * (b - %d) / 3;\n"
+                "  } else {\n"
+                "    r.y = r.y + a * 2 - %d;\n"
+                "  }\n"
+                "  while (r.x > 100) {\n"
+                "    r.x = r.x / 2;\n"
+                "  }\n"
+                "  return r.x + r.y;\n"
+                "};\n"
+                "total = total + f%d(%d, %d);\n"
+                % (i, i, i, i % 17, i % 13, i % 11, i, i % 29, i % 31))
+        out.write("print(total);\n")
+
+
+def program(name, work_dir):
+    if name == "parse":
+        path = os.path.join(work_dir, "parse.mit")
+        if not os.path.exists(path):
+            generate_parse(path)
+        return path
+    return os.path.join(HERE, name + ".mit")
+
+
+def run(binary, args, path, stats=False):
+    """Runs one program and returns its output, error output, wall time in
+    seconds and maximum resident set in KB"""
+    command = [binary] + args + [path] + (["--stats"] if stats else [])
+    with tempfile.TemporaryFile() as out, tempfile.TemporaryFile() as err:
+        start = time.perf_counter()
+        process = subprocess.Popen(command, stdin=subprocess.DEVNULL,
+                                   stdout=out, stderr=err)
+        # Reaped here rather than by Popen, for the child's resource usage
+        _, status, usage = os.wait4(process.pid, 0)
+        elapsed = time.perf_counter() - start
+        out.seek(0)
+        err.seek(0)
+        output = out.read()
+        errors = err.read().decode(errors="replace")
+    code = os.waitstatus_to_exitcode(status)
+    if code != 0:
+        raise RuntimeError("%s failed with status %d:\n%s"
+                           % (" ".join(command), code, errors))
+    rss = usage.ru_maxrss
+    # Linux reports KB and macOS bytes
+    if sys.platform == "darwin":
+        rss //= 1024
+    return output, errors, elapsed, rss
+
+
+def measure(binary, name, mode, work_dir, repeat):
+    path = program(name, work_dir)
+    args = MODES[mode]
+    best = None
+    rss = 0
+    for _ in range(repeat):
+        _, _, elapsed, used = run(binary, args, path)
+        best = elapsed if best is None else min(best, elapsed)
+        rss = max(rss, used)
+    out, err, _, _ = run(binary, args, path, stats=True)
+    match = STATS.search(err)
+    instructions = None
+    allocations = None
+    collections = None
+    if match:
+        if match.group(1) is not None:
+            instructions = int(match.group(1))
+        allocations = int(match.group(2))
+        collections = int(match.group(3))
+    return out, {
+        "time": round(best, 4),
+        "instructions": instructions,
+        "allocations": allocations,
+        "collections": collections,
+        "rss": rss,
+    }
+
+
+def change(current, base):
+    if current is None or base is None or base == 0:
+        return None
+    return (current - base) / base
+
+
+def regressions(key, result, base, args):
+    found = []
+    limits = [(field, args.count_threshold) for field in COUNTS]
+    if args.timing:
+        limits += [("time", args.time_threshold),
+                   ("rss", args.rss_threshold)]
+    for field, limit in limits:
+        delta = change(result.get(field), base.get(field))
+        if delta is not None and delta > limit:
+            before, after = base[field], result[field]
+            if field == "time":
+                before = "%.1f ms" % (before * 1000)
+                after = "%.1f ms" % (after * 1000)
+            found.append("%s %s: %s -> %s (%+.1f%%)"
+                         % (key, field, before, after, delta * 100))
+    return found
+
+
+def cell(value):
+    return "-" if value is None else str(value)
+
+
+def load(path):
+    if not os.path.exists(path):
+        return {}
+    with open(path) as f:
+        return json.load(f)
+
+
+def save(path, baseline, results, fields):
+    for key, result in results.items():
+        baseline[key] = {field: result[field] for field in fields}
+    with open(path, "w") as f:
+        json.dump(baseline, f, indent=2, sort_keys=True)
+        f.write("\n")
+    print("Baseline written to %s" % path)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--binary", required=True,
+                        help="mitscript binary to measure")
+    parser.add_argument("--baseline",
+                        default=os.path.join(HERE, "baseline.json"),
+                        help="counts to compare against")
+    parser.add_argument("--update", action="store_true",
+                        help="write the results as the new baselines")
+    parser.add_argument("--work-dir", default=os.getcwd(),
+                        help="where generated programs are written")
+    parser.add_argument("--timing", action="store_true",
+                        help="also compare times and RSS, against the "
+                        "timing baseline")
+    parser.add_argument("--timing-baseline",
+                        help="times and RSS recorded on this machine "
+                        "(default: timing.json in the work directory)")
+    parser.add_argument("--modes", default=",".join(DEFAULT_MODES),
+                        help="comma-separated modes out of "
+                        + ", ".join(MODES))
+    parser.add_argument("--only", default=",".join(BENCHMARKS),
+                        help="comma-separated benchmarks to run")
+    parser.add_argument("--repeat", type=int, default=3,
+                        help="timed runs of each benchmark and mode")
+    parser.add_argument("--time-threshold", type=float, default=0.10,
+                        help="slowdown reported as a regression")
+    parser.add_argument("--rss-threshold", type=float, default=0.10,
+                        help="growth in max RSS reported as a regression")
+    parser.add_argument("--count-threshold", type=float, default=0.0,
+                        help="growth in instructions or allocations "
+                        "reported as a regression")
+    args = parser.parse_args()
+
+    modes = args.modes.split(",")
+    for mode in modes:
+        if mode not in MODES:
+            parser.error("unknown mode '%s'" % mode)
+    names = args.only.split(",")
+    for name in names:
+        if name not in BENCHMARKS:
+            parser.error("unknown benchmark '%s'" % name)
+
+    os.makedirs(args.work_dir, exist_ok=True)
+    if args.timing_baseline is None:
+        args.timing_baseline = os.path.join(args.work_dir, "timing.json")
+    baseline = load(args.baseline)
+    timing = load(args.timing_baseline)
+    # Nothing recorded on this machine yet, so this run becomes the baseline
+    record_timing = args.update or (args.timing and not timing)
+
+    results = {}
+    problems = []
+    print("%-10s %-10s %10s %8s %13s %12s %11s %11s"
+          % ("benchmark", "mode", "time (ms)", "vs base", "instructions",
+             "allocations", "collections", "max RSS KB"))
+    for name in names:
+        expected = None
+        times = {}
+        for mode in modes:
+            key = "%s/%s" % (name, mode)
+            out, result = measure(args.binary, name, mode, args.work_dir,
+                                  args.repeat)
+            if expected is None:
+                expected = out
+            elif out != expected:
+                problems.append("%s prints something other than %s/%s"
+                                % (key, name, modes[0]))
+            results[key] = result
+            times[mode] = result["time"]
+            base = dict(baseline.get(key, {}))
+            base.update(timing.get(key, {}))
+            delta = change(result["time"], base.get("time"))
+            print("%-10s %-10s %10.1f %8s %13s %12s %11s %11d"
+                  % (name, mode, result["time"] * 1000,
+                     "-" if delta is None else "%+.1f%%" % (delta * 100),
+                     cell(result["instructions"]),
+                     cell(result["allocations"]),
+                     cell(result["collections"]), result["rss"]))
+            problems += regressions(key, result, base, args)
+        if "interpret" in times and "vm" in times and times["vm"] > 0:
+            print("%-21s vm is %.2fx as fast as interpret"
+                  % ("", times["interpret"] / times["vm"]))
+
+    if args.update:
+        save(args.baseline, baseline, results, COUNTS)
+    if record_timing:
+        save(args.timing_baseline, timing, results, MEASURES)
+
+    if problems:
+        print()
+        print("Regressions:")
+        for problem in problems:
+            print("  " + problem)
+        if not args.update:
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -1,9 +1,16 @@
 #pragma once
 
-#include <string>
-#include <vector>
-#include <map>
+#include "symbol.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
 #include <memory>
+#include <new>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace ast
 {
@@ -27,6 +34,106 @@ namespace ast
     class NoneConstant;
     class Identifier;
 
+    // The concrete class of a node, so that consumers can switch on it
+    enum class Kind : uint8_t
+    {
+        Block,
+        Assignment,
+        Global,
+        IfStatement,
+        WhileLoop,
+        Return,
+        FunctionDeclaration,
+        BinaryExpression,
+        UnaryExpression,
+        FieldDereference,
+        IndexExpression,
+        Call,
+        Record,
+        IntegerConstant,
+        StringConstant,
+        BooleanConstant,
+        NoneConstant,
+        Identifier
+    };
+
+    // A fixed sequence of items stored in an Arena
+    template <typename T>
+    struct List
+    {
+        T *items = nullptr;
+        size_t count = 0;
+
+        T *begin() const { return items; }
+        T *end() const { return items + count; }
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+        T &operator[](size_t i) const { return items[i]; }
+    };
+
+    /*
+      Bump allocator holding a whole tree.  Nodes, their lists and their
+      strings are carved out of large blocks, and nothing in them needs a
+      destructor, so the tree is freed a block at a time when the arena is
+      destroyed instead of node by node.  The arena must outlive every use of
+      the tree, including the layouts and caches the interpreter keeps.
+    */
+    class Arena
+    {
+    public:
+        Arena() = default;
+        Arena(const Arena &) = delete;
+        Arena &operator=(const Arena &) = delete;
+
+        template <typename T, typename... Args>
+        T *make(Args &&...args)
+        {
+            static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+            return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        }
+
+        template <typename T>
+        List<T> list(const std::vector<T> &items)
+        {
+            static_assert(std::is_trivially_destructible_v<T>, "arena objects are never destroyed");
+            if (items.empty())
+                return {};
+            T *data = static_cast<T *>(allocate(sizeof(T) * items.size(), alignof(T)));
+            std::uninitialized_copy(items.begin(), items.end(), data);
+            return {data, items.size()};
+        }
+
+        std::string_view string(std::string_view text)
+        {
+            if (text.empty())
+                return {};
+            char *data = static_cast<char *>(allocate(text.size(), 1));
+            std::copy(text.begin(), text.end(), data);
+            return {data, text.size()};
+        }
+
+    private:
+        static constexpr size_t kBlockSize = 64 * 1024;
+
+        void *allocate(size_t size, size_t align)
+        {
+            size_t used = (used_ + align - 1) & ~(align - 1);
+            if (blocks_.empty() || used + size > capacity_)
+            {
+                // Blocks come from new[], so they are aligned for any node
+                capacity_ = std::max(kBlockSize, size);
+                blocks_.emplace_back(new char[capacity_]);
+                used = 0;
+            }
+            used_ = used + size;
+            return blocks_.back().get() + used;
+        }
+
+        std::vector<std::unique_ptr<char[]>> blocks_;
+        size_t used_ = 0;
+        size_t capacity_ = 0;
+    };
+
     // Visitor pattern
     class Visitor
     {
@@ -53,82 +160,111 @@ namespace ast
         virtual void visit(FunctionDeclaration &stmt) = 0;
     };
 
+    // Nodes have no virtual functions: accept() dispatches on kind, and as()
+    // is the checked downcast
     class ASTNode
     {
     public:
-        virtual void accept(Visitor &visitor) = 0;
+        const Kind kind;
+        // Source line the node starts on, for profiles.  Set on statements,
+        // calls and functions; 0 on other nodes and when unknown.
+        int line = 0;
+
+        void accept(Visitor &visitor);
+
+        // This node as a T, or nullptr when it is another kind of node
+        template <typename T>
+        T *as()
+        {
+            return kind == T::kKind ? static_cast<T *>(this) : nullptr;
+        }
+
+    protected:
+        explicit ASTNode(Kind k) : kind(k) {}
     };
 
     // Statements
     class Block : public ASTNode
     {
     public:
-        std::vector<std::unique_ptr<ASTNode>> statements;
-        Block(std::vector<std::unique_ptr<ASTNode>> stmts) : statements(std::move(stmts)) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        static constexpr Kind kKind = Kind::Block;
+
+        List<ASTNode *> statements;
+        Block(List<ASTNode *> stmts) : ASTNode(kKind), statements(stmts) {}
     };
 
     class Assignment : public ASTNode
     {
     public:
-        std::unique_ptr<ASTNode> lhs;
-        std::unique_ptr<ASTNode> expr;
-        Assignment(std::unique_ptr<ASTNode> l, std::unique_ptr<ASTNode> e)
-            : lhs(std::move(l)), expr(std::move(e)) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        static constexpr Kind kKind = Kind::Assignment;
+
+        ASTNode *lhs;
+        ASTNode *expr;
+        Assignment(ASTNode *l, ASTNode *e)
+            : ASTNode(kKind), lhs(l), expr(e) {}
     };
 
     class Global : public ASTNode
     {
     public:
-        std::string name;
-        Global(std::string n) : name(std::move(n)) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        static constexpr Kind kKind = Kind::Global;
+
+        Symbol name;
+        Global(Symbol n) : ASTNode(kKind), name(n) {}
     };
 
     class IfStatement : public ASTNode
     {
     public:
-        std::unique_ptr<ASTNode> condition;
-        std::unique_ptr<ASTNode> thenPart;
-        std::unique_ptr<ASTNode> elsePart; // Can be null
-        IfStatement(std::unique_ptr<ASTNode> cond, std::unique_ptr<ASTNode> then, std::unique_ptr<ASTNode> els = nullptr)
-            : condition(std::move(cond)), thenPart(std::move(then)), elsePart(std::move(els)) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        static constexpr Kind kKind = Kind::IfStatement;
+
+        ASTNode *condition;
+        ASTNode *thenPart;
+        ASTNode *elsePart; // Can be null
+        IfStatement(ASTNode *cond, ASTNode *then, ASTNode *els)
+            : ASTNode(kKind), condition(cond), thenPart(then), elsePart(els) {}
     };
 
     class WhileLoop : public ASTNode
     {
     public:
-        std::unique_ptr<ASTNode> condition;
-        std::unique_ptr<ASTNode> body;
-        WhileLoop(std::unique_ptr<ASTNode> cond, std::unique_ptr<ASTNode> b)
-            : condition(std::move(cond)), body(std::move(b)) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        static constexpr Kind kKind = Kind::WhileLoop;
+
+        ASTNode *condition;
+        ASTNode *body;
+        WhileLoop(ASTNode *cond, ASTNode *b)
+            : ASTNode(kKind), condition(cond), body(b) {}
     };
 
     class Return : public ASTNode
     {
     public:
-        std::unique_ptr<ASTNode> expression;
-        Return(std::unique_ptr<ASTNode> expr) : expression(std::move(expr)) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        static constexpr Kind kKind = Kind::Return;
+
+        ASTNode *expression;
+        Return(ASTNode *expr) : ASTNode(kKind), expression(expr) {}
     };
 
     class FunctionDeclaration : public ASTNode
     {
     public:
-        std::vector<std::string> arguments;
-        std::unique_ptr<ASTNode> body;
-        FunctionDeclaration(std::vector<std::string> args, std::unique_ptr<ASTNode> b)
-            : arguments(std::move(args)), body(std::move(b)) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        static constexpr Kind kKind = Kind::FunctionDeclaration;
+
+        List<Symbol> arguments;
+        ASTNode *body;
+        // Index of this function's layout in the interpreter, filled in by
+        // its resolution pass so that creating a closure needs no lookup
+        int layout = -1;
+        FunctionDeclaration(List<Symbol> args, ASTNode *b)
+            : ASTNode(kKind), arguments(args), body(b) {}
     };
 
     // Expressions
     class BinaryExpression : public ASTNode
     {
     public:
+        static constexpr Kind kKind = Kind::BinaryExpression;
+
         enum BinaryOp
         {
             Add,
@@ -144,107 +280,200 @@ namespace ast
             Or
         };
 
-        std::unique_ptr<ASTNode> leftOperand;
+        ASTNode *leftOperand;
         BinaryOp op;
-        std::unique_ptr<ASTNode> rightOperand;
+        ASTNode *rightOperand;
 
-        BinaryExpression(std::unique_ptr<ASTNode> left, BinaryOp operator_, std::unique_ptr<ASTNode> right)
-            : leftOperand(std::move(left)), op(operator_), rightOperand(std::move(right)) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        BinaryExpression(ASTNode *left, BinaryOp operator_, ASTNode *right)
+            : ASTNode(kKind), leftOperand(left), op(operator_), rightOperand(right) {}
     };
 
     class UnaryExpression : public ASTNode
     {
     public:
+        static constexpr Kind kKind = Kind::UnaryExpression;
+
         enum UnaryOp
         {
             Neg, // unary minus
             Not  // logical not
         };
 
-        std::unique_ptr<ASTNode> operand;
+        ASTNode *operand;
         UnaryOp op;
 
-        UnaryExpression(UnaryOp operator_, std::unique_ptr<ASTNode> operand_)
-            : operand(std::move(operand_)), op(operator_) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        UnaryExpression(UnaryOp operator_, ASTNode *operand_)
+            : ASTNode(kKind), operand(operand_), op(operator_) {}
     };
 
     class FieldDereference : public ASTNode
     {
     public:
-        std::unique_ptr<ASTNode> baseExpression;
-        std::string field;
-        FieldDereference(std::unique_ptr<ASTNode> base, std::string f)
-            : baseExpression(std::move(base)), field(std::move(f)) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        static constexpr Kind kKind = Kind::FieldDereference;
+
+        ASTNode *baseExpression;
+        Symbol field;
+        // Index of this site's inline cache in the interpreter, filled in by
+        // its resolution pass
+        int cache = -1;
+        FieldDereference(ASTNode *base, Symbol f)
+            : ASTNode(kKind), baseExpression(base), field(f) {}
     };
 
     class IndexExpression : public ASTNode
     {
     public:
-        std::unique_ptr<ASTNode> baseExpression;
-        std::unique_ptr<ASTNode> index;
-        IndexExpression(std::unique_ptr<ASTNode> base, std::unique_ptr<ASTNode> idx)
-            : baseExpression(std::move(base)), index(std::move(idx)) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        static constexpr Kind kKind = Kind::IndexExpression;
+
+        ASTNode *baseExpression;
+        ASTNode *index;
+        IndexExpression(ASTNode *base, ASTNode *idx)
+            : ASTNode(kKind), baseExpression(base), index(idx) {}
     };
 
     class Call : public ASTNode
     {
     public:
-        std::unique_ptr<ASTNode> targetExpression;
-        std::vector<std::unique_ptr<ASTNode>> arguments;
-        Call(std::unique_ptr<ASTNode> target, std::vector<std::unique_ptr<ASTNode>> args)
-            : targetExpression(std::move(target)), arguments(std::move(args)) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        static constexpr Kind kKind = Kind::Call;
+
+        ASTNode *targetExpression;
+        List<ASTNode *> arguments;
+        Call(ASTNode *target, List<ASTNode *> args)
+            : ASTNode(kKind), targetExpression(target), arguments(args) {}
     };
 
     class Record : public ASTNode
     {
     public:
-        std::vector<std::pair<std::string, std::unique_ptr<ast::ASTNode>>> fields;
-        Record(std::vector<std::pair<std::string, std::unique_ptr<ast::ASTNode>>> f) : fields(std::move(f)) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        static constexpr Kind kKind = Kind::Record;
+
+        List<std::pair<Symbol, ASTNode *>> fields;
+        // First of the consecutive inline caches used for the field stores,
+        // one per field, filled in by the interpreter's resolution pass
+        int cache = -1;
+        Record(List<std::pair<Symbol, ASTNode *>> f) : ASTNode(kKind), fields(f) {}
     };
 
     // Constants and Identifiers
     class IntegerConstant : public ASTNode
     {
     public:
+        static constexpr Kind kKind = Kind::IntegerConstant;
+
         int value;
-        IntegerConstant(int v) : value(v) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        IntegerConstant(int v) : ASTNode(kKind), value(v) {}
     };
 
     class StringConstant : public ASTNode
     {
     public:
-        std::string value;
-        StringConstant(std::string s) : value(std::move(s)) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        static constexpr Kind kKind = Kind::StringConstant;
+
+        std::string_view value; // in the arena
+        StringConstant(std::string_view s) : ASTNode(kKind), value(s) {}
     };
 
     class BooleanConstant : public ASTNode
     {
     public:
+        static constexpr Kind kKind = Kind::BooleanConstant;
+
         bool value;
-        BooleanConstant(bool v) : value(v) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        BooleanConstant(bool v) : ASTNode(kKind), value(v) {}
     };
 
     class NoneConstant : public ASTNode
     {
     public:
-        NoneConstant() {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        static constexpr Kind kKind = Kind::NoneConstant;
+
+        NoneConstant() : ASTNode(kKind) {}
+    };
+
+    // Where a variable lives at runtime, filled in by the interpreter's
+    // resolution pass before the program runs
+    struct VariableSlot
+    {
+        enum Kind
+        {
+            Unresolved,
+            Global, // index into the interpreter's global slots
+            Local,  // index into the current frame's locals
+            Cell,   // index into the current frame's reference cells
+            Free    // index into the running closure's captured cells
+        };
+        Kind kind = Unresolved;
+        int index = -1;
     };
 
     class Identifier : public ASTNode
     {
     public:
-        std::string name;
-        Identifier(std::string n) : name(std::move(n)) {}
-        void accept(Visitor &visitor) override { visitor.visit(*this); }
+        static constexpr Kind kKind = Kind::Identifier;
+
+        Symbol name;
+        VariableSlot slot;
+        Identifier(Symbol n) : ASTNode(kKind), name(n) {}
     };
+
+    inline void ASTNode::accept(Visitor &visitor)
+    {
+        switch (kind)
+        {
+        case Kind::Block:
+            visitor.visit(static_cast<Block &>(*this));
+            break;
+        case Kind::Assignment:
+            visitor.visit(static_cast<Assignment &>(*this));
+            break;
+        case Kind::Global:
+            visitor.visit(static_cast<Global &>(*this));
+            break;
+        case Kind::IfStatement:
+            visitor.visit(static_cast<IfStatement &>(*this));
+            break;
+        case Kind::WhileLoop:
+            visitor.visit(static_cast<WhileLoop &>(*this));
+            break;
+        case Kind::Return:
+            visitor.visit(static_cast<Return &>(*this));
+            break;
+        case Kind::FunctionDeclaration:
+            visitor.visit(static_cast<FunctionDeclaration &>(*this));
+            break;
+        case Kind::BinaryExpression:
+            visitor.visit(static_cast<BinaryExpression &>(*this));
+            break;
+        case Kind::UnaryExpression:
+            visitor.visit(static_cast<UnaryExpression &>(*this));
+            break;
+        case Kind::FieldDereference:
+            visitor.visit(static_cast<FieldDereference &>(*this));
+            break;
+        case Kind::IndexExpression:
+            visitor.visit(static_cast<IndexExpression &>(*this));
+            break;
+        case Kind::Call:
+            visitor.visit(static_cast<Call &>(*this));
+            break;
+        case Kind::Record:
+            visitor.visit(static_cast<Record &>(*this));
+            break;
+        case Kind::IntegerConstant:
+            visitor.visit(static_cast<IntegerConstant &>(*this));
+            break;
+        case Kind::StringConstant:
+            visitor.visit(static_cast<StringConstant &>(*this));
+            break;
+        case Kind::BooleanConstant:
+            visitor.visit(static_cast<BooleanConstant &>(*this));
+            break;
+        case Kind::NoneConstant:
+            visitor.visit(static_cast<NoneConstant &>(*this));
+            break;
+        case Kind::Identifier:
+            visitor.visit(static_cast<Identifier &>(*this));
+            break;
+        }
+    }
 }
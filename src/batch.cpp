@@ -0,0 +1,210 @@
+#include "batch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+
+namespace
+{
+  struct BatchResult
+  {
+    std::string output;
+    std::string errors;
+    int status = 0;
+    bool done = false;
+  };
+
+  std::string resolve(const std::string &field, const std::filesystem::path &base)
+  {
+    if (field == "-")
+    {
+      return "";
+    }
+    std::filesystem::path path(field);
+    return path.is_absolute() ? field : (base / path).string();
+  }
+
+  // Runs job with its files open, keeping what it prints for standard
+  // output and standard error in result
+  void run_job(const BatchJob &job, const BatchTask &task, BatchResult &result)
+  {
+    std::ostringstream errors;
+    std::unique_ptr<std::FILE, int (*)(std::FILE *)> input(nullptr, std::fclose);
+    std::ostringstream captured;
+    std::ofstream file;
+    std::ostream *out = &captured;
+    result.status = 1;
+    if (!job.input.empty())
+    {
+      input.reset(std::fopen(job.input.c_str(), "rb"));
+      if (!input)
+      {
+        result.errors = "Error: Cannot read input '" + job.input + "'\n";
+        return;
+      }
+    }
+    if (!job.output.empty())
+    {
+      file.open(job.output);
+      if (!file)
+      {
+        result.errors = "Error: Cannot write output '" + job.output + "'\n";
+        return;
+      }
+      out = &file;
+    }
+
+    try
+    {
+      result.status = task(job, input.get(), *out, errors);
+    }
+    catch (const std::exception &e)
+    {
+      errors << e.what() << '\n';
+    }
+    out->flush();
+    result.output = captured.str();
+    result.errors = errors.str();
+  }
+
+  void write_errors(const std::string &script, const std::string &errors, std::ostream &err)
+  {
+    size_t begin = 0;
+    while (begin < errors.size())
+    {
+      size_t end = std::min(errors.find('\n', begin), errors.size());
+      err << script << ": " << std::string_view(errors).substr(begin, end - begin) << '\n';
+      begin = end + 1;
+    }
+  }
+}
+
+std::vector<BatchJob> read_manifest(std::istream &in, const std::filesystem::path &base)
+{
+  std::vector<BatchJob> jobs;
+  std::string line;
+  for (size_t number = 1; std::getline(in, line); ++number)
+  {
+    std::istringstream fields(line);
+    std::vector<std::string> names;
+    std::string name;
+    while (fields >> name && name[0] != '#')
+    {
+      names.push_back(name);
+    }
+    if (names.empty())
+    {
+      continue;
+    }
+    if (names.size() > 3)
+    {
+      throw std::runtime_error("Manifest line " + std::to_string(number) +
+                               " has more than a script, an input and an output");
+    }
+    names.resize(3, "-");
+    if (names[0] == "-")
+    {
+      throw std::runtime_error("Manifest line " + std::to_string(number) + " has no script");
+    }
+    jobs.push_back(BatchJob{resolve(names[0], base), resolve(names[1], base), resolve(names[2], base)});
+  }
+  return jobs;
+}
+
+BatchPrograms::BatchPrograms(Compile compile) : compile_(std::move(compile)) {}
+
+const BatchProgram &BatchPrograms::get(const std::string &script)
+{
+  // The map keeps a copy of every future, so the program a future refers
+  // to lives as long as this does
+  std::promise<BatchProgram> promise;
+  std::shared_future<BatchProgram> program;
+  bool first = false;
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = programs_.find(script);
+    if (it != programs_.end())
+    {
+      program = it->second;
+    }
+    else
+    {
+      program = promise.get_future().share();
+      programs_.emplace(script, program);
+      first = true;
+    }
+  }
+  if (first)
+  {
+    try
+    {
+      promise.set_value(compile_(script));
+    }
+    catch (...)
+    {
+      promise.set_exception(std::current_exception());
+    }
+  }
+  return program.get();
+}
+
+size_t run_batch(const std::vector<BatchJob> &jobs, unsigned threads, const BatchTask &task,
+                 std::ostream &out, std::ostream &err)
+{
+  std::vector<BatchResult> results(jobs.size());
+  std::mutex lock;
+  std::condition_variable finished;
+  std::atomic<size_t> next{0};
+
+  auto work = [&]()
+  {
+    for (size_t i = next++; i < jobs.size(); i = next++)
+    {
+      BatchResult result;
+      run_job(jobs[i], task, result);
+      {
+        std::lock_guard<std::mutex> guard(lock);
+        results[i] = std::move(result);
+        results[i].done = true;
+      }
+      finished.notify_all();
+    }
+  };
+  std::vector<std::thread> workers;
+  size_t count = std::min<size_t>(std::max(threads, 1u), jobs.size());
+  for (size_t i = 0; i < count; ++i)
+  {
+    workers.emplace_back(work);
+  }
+
+  size_t failed = 0;
+  for (size_t i = 0; i < jobs.size(); ++i)
+  {
+    BatchResult result;
+    {
+      std::unique_lock<std::mutex> guard(lock);
+      finished.wait(guard, [&]
+                    { return results[i].done; });
+      result = std::move(results[i]);
+    }
+    out << result.output;
+    out.flush();
+    write_errors(jobs[i].script, result.errors, err);
+    if (result.status != 0)
+    {
+      ++failed;
+    }
+  }
+  for (std::thread &worker : workers)
+  {
+    worker.join();
+  }
+  return failed;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include "bytecode/types.hpp"
+
+#include <cstddef>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/*
+  The batch subcommand: the scripts a manifest lists run in one process on
+  a pool of worker threads, instead of in one process each.  Every job gets
+  a virtual machine and a heap of its own, so the workers share nothing but
+  the symbol table, which is locked, and the compiled scripts, which nothing
+  changes once they are compiled.
+*/
+
+// A script to run, the file input() reads, if any, and the file its output
+// goes to, or standard output if none is given
+struct BatchJob
+{
+  std::string script;
+  std::string input;
+  std::string output;
+};
+
+// Reads a manifest.  Each line that is neither blank nor a comment starting
+// with '#' names a script and then, optionally, an input file and an output
+// file, separated by whitespace; '-' stands for no file.  Relative paths are
+// taken from base.  A line with more fields throws std::runtime_error.
+std::vector<BatchJob> read_manifest(std::istream &in, const std::filesystem::path &base);
+
+// A script compiled once for every job that runs it.  A script that does not
+// compile has no function, and output and errors hold what a run prints
+// about it on standard output and standard error.
+struct BatchProgram
+{
+  std::unique_ptr<const bytecode::Function> function;
+  std::string output;
+  std::string errors;
+};
+
+class BatchPrograms
+{
+public:
+  using Compile = std::function<BatchProgram(const std::string &script)>;
+
+  explicit BatchPrograms(Compile compile);
+
+  // The program compiled from script.  The first job to ask compiles it and
+  // the jobs asking meanwhile wait for it; an exception compile threw is
+  // thrown to each of them.
+  const BatchProgram &get(const std::string &script);
+
+private:
+  Compile compile_;
+  std::mutex lock_;
+  std::unordered_map<std::string, std::shared_future<BatchProgram>> programs_;
+};
+
+// Runs one job, writing what it prints to out and err, and returns its exit
+// status.  input() reads input, or nothing when it is null.
+using BatchTask = std::function<int(const BatchJob &job, std::FILE *input, std::ostream &out,
+                                    std::ostream &err)>;
+
+// Runs the jobs on threads workers.  The output of jobs without an output
+// file goes to out and every job's errors go to err, each line after the
+// job's script, all in the order of the manifest, as soon as the jobs
+// before have finished.  Returns how many jobs failed.
+size_t run_batch(const std::vector<BatchJob> &jobs, unsigned threads, const BatchTask &task,
+                 std::ostream &out, std::ostream &err);
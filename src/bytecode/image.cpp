@@ -0,0 +1,414 @@
+#include "./image.hpp"
+#include "./instructions.hpp"
+#include <cstdlib>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BYTECODE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define BYTECODE_MMAP 0
+#endif
+
+namespace bytecode {
+
+namespace {
+
+enum ConstantKind : uint32_t {
+    NoneConstant,
+    BooleanConstant,
+    IntegerConstant,
+    StringConstant,
+};
+
+constexpr char kMagic[4] = {'M', 'I', 'T', 'B'};
+constexpr uint32_t kHasOperand = 1u << 31;
+constexpr uint32_t kLastOperation = static_cast<uint32_t>(Operation::Pop);
+constexpr size_t kHeaderWords = 8;
+constexpr size_t kFunctionWords = 15;
+
+size_t padded_words(size_t bytes) { return (bytes + 3) / 4; }
+
+class Writer {
+public:
+    void write(const Function *main, std::ostream &os) {
+        flatten(main);
+        for (const Function *function : order_) {
+            add(function);
+        }
+
+        std::vector<uint32_t> header = {
+            kImageVersion,
+            static_cast<uint32_t>(string_entries_.size() / 2),
+            static_cast<uint32_t>(constants_.size() / 2),
+            static_cast<uint32_t>(order_.size()),
+            static_cast<uint32_t>(lists_.size()),
+            static_cast<uint32_t>(instructions_.size() / 2),
+            static_cast<uint32_t>(string_bytes_.size()),
+        };
+        out_.append(kMagic, sizeof(kMagic));
+        put(header);
+        put(string_entries_);
+        out_ += string_bytes_;
+        out_.append(padded_words(string_bytes_.size()) * 4 - string_bytes_.size(),
+                    '\0');
+        put(constants_);
+        put(functions_);
+        put(lists_);
+        put(instructions_);
+        os.write(out_.data(), static_cast<std::streamsize>(out_.size()));
+    }
+
+private:
+    void flatten(const Function *function) {
+        if (!index_.emplace(function, order_.size()).second) {
+            return;
+        }
+        order_.push_back(function);
+        for (const Function *child : function->functions_) {
+            flatten(child);
+        }
+    }
+
+    void add(const Function *function) {
+        functions_.push_back(function->parameter_count_);
+
+        range(function->functions_.size(), lists_.size());
+        for (const Function *child : function->functions_) {
+            lists_.push_back(index_.at(child));
+        }
+
+        range(function->constants_.size(), constants_.size() / 2);
+        for (const Constant *constant : function->constants_) {
+            if (auto *b = dynamic_cast<const Constant::Boolean *>(constant)) {
+                constants_.insert(constants_.end(), {BooleanConstant, b->value});
+            } else if (auto *i = dynamic_cast<const Constant::Integer *>(constant)) {
+                constants_.insert(constants_.end(),
+                                  {IntegerConstant, static_cast<uint32_t>(i->value)});
+            } else if (auto *s = dynamic_cast<const Constant::String *>(constant)) {
+                constants_.insert(constants_.end(), {StringConstant, string(s->value)});
+            } else {
+                constants_.insert(constants_.end(), {NoneConstant, 0});
+            }
+        }
+
+        for (const std::vector<Symbol> *names :
+             {&function->local_vars_, &function->local_reference_vars_,
+              &function->free_vars_, &function->names_}) {
+            range(names->size(), lists_.size());
+            for (const Symbol &name : *names) {
+                lists_.push_back(string(name.str()));
+            }
+        }
+
+        range(function->instructions.size(), instructions_.size() / 2);
+        for (const Instruction &inst : function->instructions) {
+            uint32_t operation = static_cast<uint32_t>(inst.operation);
+            instructions_.push_back(inst.operand0 ? operation | kHasOperand
+                                                  : operation);
+            instructions_.push_back(static_cast<uint32_t>(inst.operand0.value_or(0)));
+        }
+    }
+
+    void range(size_t count, size_t first) {
+        functions_.push_back(static_cast<uint32_t>(first));
+        functions_.push_back(static_cast<uint32_t>(count));
+    }
+
+    uint32_t string(const std::string &text) {
+        auto [it, inserted] =
+            strings_.emplace(text, static_cast<uint32_t>(strings_.size()));
+        if (inserted) {
+            string_entries_.push_back(static_cast<uint32_t>(string_bytes_.size()));
+            string_entries_.push_back(static_cast<uint32_t>(text.size()));
+            string_bytes_ += text;
+        }
+        return it->second;
+    }
+
+    void put(const std::vector<uint32_t> &words) {
+        for (uint32_t word : words) {
+            for (int i = 0; i < 4; ++i) {
+                out_.push_back(static_cast<char>(word >> (8 * i)));
+            }
+        }
+    }
+
+    std::vector<const Function *> order_;
+    std::unordered_map<const Function *, uint32_t> index_;
+    std::unordered_map<std::string, uint32_t> strings_;
+    std::vector<uint32_t> string_entries_;
+    std::string string_bytes_;
+    std::vector<uint32_t> constants_;
+    std::vector<uint32_t> functions_;
+    std::vector<uint32_t> lists_;
+    std::vector<uint32_t> instructions_;
+    std::string out_;
+};
+
+struct ImageError {
+    std::string message;
+};
+
+[[noreturn]] void fail(const std::string &message) { throw ImageError{message}; }
+
+class Loader {
+public:
+    explicit Loader(std::string_view data) : data_(data) {}
+
+    Function *load() {
+        if (data_.size() < kHeaderWords * 4 || !is_image(data_)) {
+            fail("Truncated bytecode image");
+        }
+        if (word(1) != kImageVersion) {
+            fail("Unsupported bytecode image version " + std::to_string(word(1)));
+        }
+        uint64_t strings = word(2);
+        uint64_t constants = word(3);
+        uint64_t functions = word(4);
+        uint64_t lists = word(5);
+        uint64_t instructions = word(6);
+        uint64_t string_bytes = word(7);
+
+        strings_at_ = kHeaderWords;
+        bytes_at_ = strings_at_ + 2 * strings;
+        constants_at_ = bytes_at_ + padded_words(string_bytes);
+        functions_at_ = constants_at_ + 2 * constants;
+        lists_at_ = functions_at_ + kFunctionWords * functions;
+        instructions_at_ = lists_at_ + lists;
+        uint64_t end = instructions_at_ + 2 * instructions;
+        if (end * 4 != data_.size() || functions == 0) {
+            fail("Bytecode image does not match its header");
+        }
+        lists_ = lists;
+        functions_count_ = functions;
+        instructions_ = instructions;
+
+        std::string_view bytes = data_.substr(bytes_at_ * 4, string_bytes);
+        for (uint64_t i = 0; i < strings; ++i) {
+            uint64_t offset = word(strings_at_ + 2 * i);
+            uint64_t length = word(strings_at_ + 2 * i + 1);
+            if (offset + length > bytes.size()) {
+                fail("Bytecode image string out of range");
+            }
+            texts_.push_back(bytes.substr(offset, length));
+        }
+
+        constants_ = constants;
+        for (uint64_t i = 0; i < constants; ++i) {
+            uint32_t kind = word(constants_at_ + 2 * i);
+            if (kind > StringConstant) {
+                fail("Bytecode image constant of unknown kind");
+            }
+            if (kind == StringConstant) {
+                text(word(constants_at_ + 2 * i + 1));
+            }
+        }
+
+        // Functions are linked to their parents only once all of them have
+        // loaded, so that until then each is freed on its own
+        children_.resize(functions);
+        nested_.assign(functions, false);
+        for (uint64_t i = 0; i < functions; ++i) {
+            functions_.emplace_back(new Function());
+            function(i);
+        }
+        for (uint64_t i = 1; i < functions; ++i) {
+            if (!nested_[i]) {
+                fail("Bytecode image function not nested in any other");
+            }
+        }
+        for (uint64_t i = 0; i < functions; ++i) {
+            for (uint64_t child : children_[i]) {
+                functions_[i]->functions_.push_back(functions_[child].get());
+            }
+        }
+        for (uint64_t i = 1; i < functions; ++i) {
+            functions_[i].release();
+        }
+        return functions_[0].release();
+    }
+
+private:
+    uint32_t word(uint64_t index) const {
+        const unsigned char *p =
+            reinterpret_cast<const unsigned char *>(data_.data()) + index * 4;
+        return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+               static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+    }
+
+    std::string_view text(uint64_t index) const {
+        if (index >= texts_.size()) {
+            fail("Bytecode image string index out of range");
+        }
+        return texts_[index];
+    }
+
+    // The first index and count stored at word at, checked against the size
+    // of the section they index
+    std::pair<uint64_t, uint64_t> range(uint64_t at, uint64_t size) const {
+        uint64_t first = word(at);
+        uint64_t count = word(at + 1);
+        if (first + count > size) {
+            fail("Bytecode image function range out of bounds");
+        }
+        return {first, count};
+    }
+
+    // A new copy of constant index, which has been checked
+    Constant *constant(uint64_t index) const {
+        uint32_t value = word(constants_at_ + 2 * index + 1);
+        switch (word(constants_at_ + 2 * index)) {
+        case BooleanConstant:
+            return new Constant::Boolean(value != 0);
+        case IntegerConstant:
+            return new Constant::Integer(static_cast<int32_t>(value));
+        case StringConstant:
+            return new Constant::String(std::string(text(value)));
+        default:
+            return new Constant::None();
+        }
+    }
+
+    std::vector<Symbol> names(uint64_t at) const {
+        auto [first, count] = range(at, lists_);
+        std::vector<Symbol> result;
+        result.reserve(count);
+        for (uint64_t j = 0; j < count; ++j) {
+            result.emplace_back(text(word(lists_at_ + first + j)));
+        }
+        return result;
+    }
+
+    void function(uint64_t i) {
+        Function &function = *functions_[i];
+        uint64_t at = functions_at_ + kFunctionWords * i;
+        function.parameter_count_ = word(at);
+
+        // Children come after their parent in preorder, which also rules out
+        // cycles
+        auto [first_child, children] = range(at + 1, lists_);
+        for (uint64_t j = 0; j < children; ++j) {
+            uint64_t child = word(lists_at_ + first_child + j);
+            if (child <= i || child >= functions_count_) {
+                fail("Bytecode image function index out of range");
+            }
+            // A function nested twice would be freed twice
+            if (nested_[child]) {
+                fail("Bytecode image function nested more than once");
+            }
+            nested_[child] = true;
+            children_[i].push_back(child);
+        }
+
+        auto [first_constant, constants] = range(at + 3, constants_);
+        for (uint64_t j = 0; j < constants; ++j) {
+            function.constants_.push_back(constant(first_constant + j));
+        }
+
+        function.local_vars_ = names(at + 5);
+        function.local_reference_vars_ = names(at + 7);
+        function.free_vars_ = names(at + 9);
+        function.names_ = names(at + 11);
+
+        auto [first_instruction, count] = range(at + 13, instructions_);
+        function.instructions.reserve(count);
+        for (uint64_t j = 0; j < count; ++j) {
+            uint64_t inst = instructions_at_ + 2 * (first_instruction + j);
+            uint32_t operation = word(inst) & ~kHasOperand;
+            if (operation > kLastOperation) {
+                fail("Bytecode image instruction of unknown operation");
+            }
+            std::optional<int32_t> operand;
+            if (word(inst) & kHasOperand) {
+                operand = static_cast<int32_t>(word(inst + 1));
+            }
+            function.instructions.emplace_back(static_cast<Operation>(operation),
+                                               operand);
+        }
+    }
+
+    std::string_view data_;
+    uint64_t strings_at_ = 0;
+    uint64_t bytes_at_ = 0;
+    uint64_t constants_at_ = 0;
+    uint64_t functions_at_ = 0;
+    uint64_t lists_at_ = 0;
+    uint64_t instructions_at_ = 0;
+    uint64_t lists_ = 0;
+    uint64_t functions_count_ = 0;
+    uint64_t instructions_ = 0;
+    std::vector<std::string_view> texts_;
+    uint64_t constants_ = 0;
+    std::vector<std::unique_ptr<Function>> functions_;
+    std::vector<std::vector<uint64_t>> children_;
+    std::vector<bool> nested_;
+};
+
+} // namespace
+
+bool is_image(std::string_view data) {
+    return data.size() >= sizeof(kMagic) &&
+           data.compare(0, sizeof(kMagic), kMagic, sizeof(kMagic)) == 0;
+}
+
+void write_image(const Function *function, std::ostream &os) {
+    Writer().write(function, os);
+}
+
+std::unique_ptr<Function> load_image(std::string_view data) {
+    try {
+        return std::unique_ptr<Function>(Loader(data).load());
+    } catch (const ImageError &error) {
+        std::cerr << "Error: " << error.message << std::endl;
+        std::exit(1);
+    }
+}
+
+std::unique_ptr<Function> try_load_image(std::string_view data) {
+    try {
+        return std::unique_ptr<Function>(Loader(data).load());
+    } catch (const ImageError &) {
+        return nullptr;
+    }
+}
+
+#if BYTECODE_MMAP
+
+MappedFile::MappedFile(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *data = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ,
+                          MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            data_ = data;
+            size_ = static_cast<size_t>(st.st_size);
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        munmap(data_, size_);
+    }
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &) {}
+
+MappedFile::~MappedFile() {}
+
+#endif
+
+} // namespace bytecode
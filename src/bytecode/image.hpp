@@ -0,0 +1,63 @@
+#pragma once
+
+#include "./types.hpp"
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+
+namespace bytecode {
+
+// A compact binary form of a function and everything nested in it, which
+// loads without lexing or parsing. All fields are little-endian 32-bit
+// words:
+//
+//   header        magic "MITB", version, then the number of strings,
+//                 constants, functions, list entries and instructions, and
+//                 the size of the string bytes
+//   strings       offset and length of each string in the string bytes
+//   string bytes  the texts back to back, padded to a word
+//   constants     kind (none, boolean, integer, string) and value; a
+//                 string constant's value is its index in the strings
+//   functions     in preorder, the outermost at index 0: parameter count,
+//                 then first index and count of its functions and its
+//                 variable name lists in the lists, of its constants, and
+//                 of its instructions
+//   lists         function indices and string indices the functions refer
+//                 to through ranges
+//   instructions  operation, with bit 31 set when there is an operand, and
+//                 the operand
+constexpr uint32_t kImageVersion = 1;
+
+// Whether data starts like an image, of any version
+bool is_image(std::string_view data);
+
+void write_image(const Function *function, std::ostream &os);
+
+// Rebuilds the functions an image describes. Like parse(), reports a
+// malformed image and exits.
+std::unique_ptr<Function> load_image(std::string_view data);
+
+// The same, returning nullptr for a malformed image
+std::unique_ptr<Function> try_load_image(std::string_view data);
+
+// A file mapped read-only into memory, or nothing when it cannot be, as
+// for pipes
+class MappedFile {
+public:
+    explicit MappedFile(const std::string &path);
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+
+    bool mapped() const { return data_ != nullptr; }
+    std::string_view data() const {
+        return std::string_view(static_cast<const char *>(data_), size_);
+    }
+
+private:
+    void *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+} // namespace bytecode
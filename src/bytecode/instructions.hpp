@@ -251,6 +251,9 @@ struct Instruction {
 
   Operation operation;
   std::optional<int32_t> operand0;
+  // Source line the instruction was compiled from, for profiles, or 0 for
+  // bytecode read from text or an image
+  int32_t line = 0;
 };
 
 typedef std::vector<Instruction> InstructionList;
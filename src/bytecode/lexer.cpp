@@ -5,6 +5,7 @@
 #include <iostream>
 #include <optional>
 #include <sstream>
+#include <tuple>
 #include <vector>
 
 static std::vector<std::tuple<std::string, bytecode::TokenKind>>
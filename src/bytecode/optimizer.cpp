@@ -0,0 +1,669 @@
+#include "./optimizer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <utility>
+
+namespace bytecode {
+
+namespace {
+
+bool is_jump(const Instruction &inst) {
+  return (inst.operation == Operation::Goto ||
+          inst.operation == Operation::If) &&
+         inst.operand0.has_value();
+}
+
+// Where the jump at pc lands; a jump that leaves the code lands on the end,
+// as it does in the VM
+size_t target_of(size_t pc, const Instruction &inst, size_t size) {
+  int64_t target = static_cast<int64_t>(pc) + *inst.operand0;
+  if (target < 0 || target > static_cast<int64_t>(size)) {
+    return size;
+  }
+  return static_cast<size_t>(target);
+}
+
+// The number of jump targets before each index, with one entry past the
+// end, so ranges of instructions can be checked for targets at once
+std::vector<size_t> targets_before(const InstructionList &code) {
+  size_t size = code.size();
+  std::vector<bool> target(size + 1, false);
+  for (size_t pc = 0; pc < size; ++pc) {
+    if (is_jump(code[pc])) {
+      target[target_of(pc, code[pc], size)] = true;
+    }
+  }
+  std::vector<size_t> before(size + 2, 0);
+  for (size_t i = 0; i <= size; ++i) {
+    before[i + 1] = before[i] + (target[i] ? 1 : 0);
+  }
+  return before;
+}
+
+// Whether a jump lands after first and at or before last. A pattern may
+// be rewritten only when nothing jumps into its middle.
+bool targeted(const std::vector<size_t> &before, size_t first, size_t last) {
+  return before[last + 1] != before[first + 1];
+}
+
+// Drops the instructions marked dead. A jump to a dropped instruction goes
+// to the first one kept after it instead.
+bool compact(Function &function, const std::vector<bool> &dead) {
+  InstructionList &code = function.instructions;
+  size_t size = code.size();
+  std::vector<int32_t> index(size + 1);
+  int32_t kept = 0;
+  for (size_t pc = 0; pc < size; ++pc) {
+    index[pc] = kept;
+    if (!dead[pc]) {
+      ++kept;
+    }
+  }
+  index[size] = kept;
+  if (static_cast<size_t>(kept) == size) {
+    return false;
+  }
+
+  InstructionList result;
+  result.reserve(kept);
+  for (size_t pc = 0; pc < size; ++pc) {
+    if (dead[pc]) {
+      continue;
+    }
+    Instruction inst = code[pc];
+    if (is_jump(inst)) {
+      inst.operand0 = index[target_of(pc, inst, size)] - index[pc];
+    }
+    result.push_back(inst);
+  }
+  code = std::move(result);
+  return true;
+}
+
+bool in_range(int32_t i, size_t size) {
+  return i >= 0 && static_cast<size_t>(i) < size;
+}
+
+// A push that cannot fail and has no other effect, so dropping it along
+// with the pop of its value changes nothing
+bool pure_push(const Function &function, const Instruction &inst) {
+  if (!inst.operand0) {
+    return false;
+  }
+  int32_t i = *inst.operand0;
+  switch (inst.operation) {
+  case Operation::LoadConst:
+    return in_range(i, function.constants_.size());
+  case Operation::LoadFunc:
+    return in_range(i, function.functions_.size());
+  case Operation::LoadLocal:
+    return in_range(i, function.local_vars_.size());
+  case Operation::PushReference:
+    return in_range(i, function.local_reference_vars_.size() +
+                           function.free_vars_.size());
+  default:
+    return false;
+  }
+}
+
+const Constant *constant_at(const Function &function,
+                            const Instruction &inst) {
+  if (inst.operation != Operation::LoadConst || !inst.operand0 ||
+      !in_range(*inst.operand0, function.constants_.size())) {
+    return nullptr;
+  }
+  return function.constants_[*inst.operand0];
+}
+
+template <typename T> const T *as(const Constant *c) {
+  return dynamic_cast<const T *>(c);
+}
+
+// Equality as the VM's eq sees it: values of different types are never
+// equal
+bool same_constant(const Constant *a, const Constant *b) {
+  if (as<Constant::None>(a)) {
+    return as<Constant::None>(b) != nullptr;
+  } else if (auto *v = as<Constant::Integer>(a)) {
+    auto *o = as<Constant::Integer>(b);
+    return o && o->value == v->value;
+  } else if (auto *v = as<Constant::Boolean>(a)) {
+    auto *o = as<Constant::Boolean>(b);
+    return o && o->value == v->value;
+  } else if (auto *v = as<Constant::String>(a)) {
+    auto *o = as<Constant::String>(b);
+    return o && o->value == v->value;
+  }
+  return false;
+}
+
+// The index of c among the function's constants, adding it if no equal
+// constant is there yet
+int32_t add_constant(Function &function, Constant *c) {
+  auto &constants = function.constants_;
+  for (size_t i = 0; i < constants.size(); ++i) {
+    if (same_constant(c, constants[i])) {
+      delete c;
+      return static_cast<int32_t>(i);
+    }
+  }
+  constants.push_back(c);
+  return static_cast<int32_t>(constants.size() - 1);
+}
+
+// The text print would give a constant
+std::string text_of(const Constant *c) {
+  if (auto *v = as<Constant::String>(c)) {
+    return v->value;
+  } else if (auto *v = as<Constant::Integer>(c)) {
+    return std::to_string(v->value);
+  } else if (auto *v = as<Constant::Boolean>(c)) {
+    return v->value ? "true" : "false";
+  }
+  return "None";
+}
+
+int32_t wrap(uint32_t value) { return static_cast<int32_t>(value); }
+
+// The result of op on constants, or nullptr where the VM would raise an
+// error, which is left for it to raise
+Constant *fold_unary(Operation op, const Constant *value) {
+  if (op == Operation::Neg) {
+    if (auto *v = as<Constant::Integer>(value)) {
+      return new Constant::Integer(wrap(0u - static_cast<uint32_t>(v->value)));
+    }
+  } else if (op == Operation::Not) {
+    if (auto *v = as<Constant::Boolean>(value)) {
+      return new Constant::Boolean(!v->value);
+    }
+  }
+  return nullptr;
+}
+
+Constant *fold_binary(Operation op, const Constant *left,
+                      const Constant *right) {
+  if (op == Operation::Eq) {
+    return new Constant::Boolean(same_constant(left, right));
+  }
+  if (op == Operation::Add &&
+      (as<Constant::String>(left) || as<Constant::String>(right))) {
+    return new Constant::String(text_of(left) + text_of(right));
+  }
+
+  auto *li = as<Constant::Integer>(left);
+  auto *ri = as<Constant::Integer>(right);
+  if (li && ri) {
+    uint32_t l = static_cast<uint32_t>(li->value);
+    uint32_t r = static_cast<uint32_t>(ri->value);
+    switch (op) {
+    case Operation::Add:
+      return new Constant::Integer(wrap(l + r));
+    case Operation::Sub:
+      return new Constant::Integer(wrap(l - r));
+    case Operation::Mul:
+      return new Constant::Integer(wrap(l * r));
+    case Operation::Div:
+      if (ri->value == 0) {
+        return nullptr;
+      }
+      return new Constant::Integer(ri->value == -1 ? wrap(0u - l)
+                                                   : li->value / ri->value);
+    case Operation::Gt:
+      return new Constant::Boolean(li->value > ri->value);
+    case Operation::Geq:
+      return new Constant::Boolean(li->value >= ri->value);
+    default:
+      return nullptr;
+    }
+  }
+
+  auto *lb = as<Constant::Boolean>(left);
+  auto *rb = as<Constant::Boolean>(right);
+  if (lb && rb) {
+    if (op == Operation::And) {
+      return new Constant::Boolean(lb->value && rb->value);
+    } else if (op == Operation::Or) {
+      return new Constant::Boolean(lb->value || rb->value);
+    }
+  }
+  return nullptr;
+}
+
+// Drops the constants no instruction loads any more, as folding leaves
+// the operands it replaced behind and dead code the ones it loaded
+void drop_unused_constants(Function &function) {
+  auto &constants = function.constants_;
+  std::vector<int32_t> index(constants.size(), -1);
+  for (const Instruction &inst : function.instructions) {
+    if (inst.operation == Operation::LoadConst && inst.operand0 &&
+        in_range(*inst.operand0, constants.size())) {
+      index[*inst.operand0] = 0;
+    }
+  }
+  std::vector<Constant *> used;
+  for (size_t i = 0; i < constants.size(); ++i) {
+    if (index[i] >= 0) {
+      index[i] = static_cast<int32_t>(used.size());
+      used.push_back(constants[i]);
+    } else {
+      delete constants[i];
+    }
+  }
+  if (used.size() == constants.size()) {
+    return;
+  }
+  for (Instruction &inst : function.instructions) {
+    if (inst.operation == Operation::LoadConst && inst.operand0 &&
+        in_range(*inst.operand0, constants.size())) {
+      inst.operand0 = index[*inst.operand0];
+    }
+  }
+  constants = std::move(used);
+}
+
+bool is_binary(Operation op) {
+  switch (op) {
+  case Operation::Add:
+  case Operation::Sub:
+  case Operation::Mul:
+  case Operation::Div:
+  case Operation::Gt:
+  case Operation::Geq:
+  case Operation::Eq:
+  case Operation::And:
+  case Operation::Or:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Both fold and peephole match patterns on the instructions kept so far,
+// in order, so a pattern can span instructions that an earlier rewrite in
+// the same scan left next to each other. live holds their indices.
+
+class Fold : public Pass {
+public:
+  const char *name() const override { return "fold"; }
+
+  bool run(Function &function) override {
+    InstructionList &code = function.instructions;
+    size_t size = code.size();
+    std::vector<size_t> before = targets_before(code);
+    std::vector<bool> dead(size, false);
+    std::vector<size_t> live;
+    bool changed = false;
+
+    for (size_t pc = 0; pc < size; ++pc) {
+      live.push_back(pc);
+      Operation op = code[pc].operation;
+      size_t n = live.size();
+
+      if ((op == Operation::Neg || op == Operation::Not) && n >= 2) {
+        size_t a = live[n - 2];
+        const Constant *value = constant_at(function, code[a]);
+        if (value && !targeted(before, a, pc)) {
+          if (Constant *result = fold_unary(op, value)) {
+            code[a].operand0 = add_constant(function, result);
+            dead[pc] = true;
+            live.pop_back();
+            changed = true;
+          }
+        }
+      } else if (is_binary(op) && n >= 3) {
+        size_t a = live[n - 3];
+        size_t b = live[n - 2];
+        const Constant *left = constant_at(function, code[a]);
+        const Constant *right = constant_at(function, code[b]);
+        if (left && right && !targeted(before, a, pc)) {
+          if (Constant *result = fold_binary(op, left, right)) {
+            code[a].operand0 = add_constant(function, result);
+            dead[b] = dead[pc] = true;
+            live.resize(n - 2);
+            changed = true;
+          }
+        }
+      } else if (is_jump(code[pc]) && op == Operation::If && n >= 2) {
+        // A branch on a constant either always jumps or never does
+        size_t a = live[n - 2];
+        auto *test = as<Constant::Boolean>(constant_at(function, code[a]));
+        if (test && !targeted(before, a, pc)) {
+          if (test->value) {
+            int64_t offset = static_cast<int64_t>(target_of(pc, code[pc], size)) -
+                             static_cast<int64_t>(a);
+            code[a].operation = Operation::Goto;
+            code[a].operand0 = static_cast<int32_t>(offset);
+            live.pop_back();
+          } else {
+            dead[a] = true;
+            live.resize(n - 2);
+          }
+          dead[pc] = true;
+          changed = true;
+        }
+      }
+    }
+    if (!changed) {
+      return false;
+    }
+    compact(function, dead);
+    drop_unused_constants(function);
+    return true;
+  }
+};
+
+class Jumps : public Pass {
+public:
+  const char *name() const override { return "jumps"; }
+
+  bool run(Function &function) override {
+    InstructionList &code = function.instructions;
+    size_t size = code.size();
+    std::vector<bool> dead(size, false);
+    bool changed = false;
+
+    for (size_t pc = 0; pc < size; ++pc) {
+      if (!is_jump(code[pc])) {
+        continue;
+      }
+      // Bounded, since a chain of gotos can loop
+      size_t target = target_of(pc, code[pc], size);
+      for (size_t steps = 0; steps < size && target < size &&
+                             code[target].operation == Operation::Goto &&
+                             code[target].operand0;
+           ++steps) {
+        target = target_of(target, code[target], size);
+      }
+      int32_t offset = static_cast<int32_t>(static_cast<int64_t>(target) -
+                                            static_cast<int64_t>(pc));
+      if (offset != *code[pc].operand0) {
+        code[pc].operand0 = offset;
+        changed = true;
+      }
+
+      if (code[pc].operation != Operation::Goto) {
+        continue;
+      }
+      if (target < size && code[target].operation == Operation::Return) {
+        code[pc] = code[target];
+        changed = true;
+      } else if (target == pc + 1) {
+        dead[pc] = true;
+      }
+    }
+    return compact(function, dead) || changed;
+  }
+};
+
+class Unreachable : public Pass {
+public:
+  const char *name() const override { return "unreachable"; }
+
+  bool run(Function &function) override {
+    const InstructionList &code = function.instructions;
+    size_t size = code.size();
+    std::vector<bool> dead(size, true);
+    std::vector<size_t> work;
+    auto reach = [&](size_t pc) {
+      if (pc < size && dead[pc]) {
+        dead[pc] = false;
+        work.push_back(pc);
+      }
+    };
+
+    reach(0);
+    while (!work.empty()) {
+      size_t pc = work.back();
+      work.pop_back();
+      const Instruction &inst = code[pc];
+      if (is_jump(inst)) {
+        reach(target_of(pc, inst, size));
+      }
+      if (inst.operation != Operation::Return &&
+          !(inst.operation == Operation::Goto && inst.operand0)) {
+        reach(pc + 1);
+      }
+    }
+    if (!compact(function, dead)) {
+      return false;
+    }
+    drop_unused_constants(function);
+    return true;
+  }
+};
+
+class Stores : public Pass {
+public:
+  const char *name() const override { return "stores"; }
+
+  bool run(Function &function) override {
+    InstructionList &code = function.instructions;
+    size_t size = code.size();
+    size_t locals = function.local_vars_.size();
+
+    // Locals that closures capture live in references, which outlast the
+    // frame, so stores to them are never dead
+    std::vector<bool> tracked(locals, true);
+    for (size_t l = 0; l < locals; ++l) {
+      for (const Symbol &name : function.local_reference_vars_) {
+        if (function.local_vars_[l] == name) {
+          tracked[l] = false;
+        }
+      }
+    }
+    auto local = [&](const Instruction &inst) -> int32_t {
+      if ((inst.operation != Operation::LoadLocal &&
+           inst.operation != Operation::StoreLocal) ||
+          !inst.operand0 || !in_range(*inst.operand0, locals) ||
+          !tracked[*inst.operand0]) {
+        return -1;
+      }
+      return *inst.operand0;
+    };
+    if (std::none_of(code.begin(), code.end(), [&](const Instruction &inst) {
+          return inst.operation == Operation::StoreLocal && local(inst) >= 0;
+        })) {
+      return false;
+    }
+
+    // A bit set per instruction of the locals read before being written
+    // again on some path from it, with the end of the function reading none
+    size_t words = (locals + 63) / 64;
+    std::vector<uint64_t> live_in((size + 1) * words, 0);
+    std::vector<uint64_t> out(words);
+    auto live_out = [&](size_t pc) {
+      std::fill(out.begin(), out.end(), 0);
+      auto merge = [&](size_t next) {
+        for (size_t w = 0; w < words; ++w) {
+          out[w] |= live_in[next * words + w];
+        }
+      };
+      const Instruction &inst = code[pc];
+      if (is_jump(inst)) {
+        merge(target_of(pc, inst, size));
+      }
+      if (inst.operation != Operation::Return &&
+          !(inst.operation == Operation::Goto && inst.operand0)) {
+        merge(pc + 1);
+      }
+    };
+    auto bit = [](int32_t l) { return uint64_t(1) << (l % 64); };
+
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (size_t pc = size; pc-- > 0;) {
+        live_out(pc);
+        int32_t l = local(code[pc]);
+        if (l >= 0 && code[pc].operation == Operation::LoadLocal) {
+          out[l / 64] |= bit(l);
+        } else if (l >= 0) {
+          out[l / 64] &= ~bit(l);
+        }
+        if (!std::equal(out.begin(), out.end(),
+                        live_in.begin() + pc * words)) {
+          std::copy(out.begin(), out.end(), live_in.begin() + pc * words);
+          changed = true;
+        }
+      }
+    }
+
+    bool removed = false;
+    for (size_t pc = 0; pc < size; ++pc) {
+      int32_t l = local(code[pc]);
+      if (l < 0 || code[pc].operation != Operation::StoreLocal) {
+        continue;
+      }
+      live_out(pc);
+      if (!(out[l / 64] & bit(l))) {
+        code[pc].operation = Operation::Pop;
+        code[pc].operand0 = std::nullopt;
+        removed = true;
+      }
+    }
+    return removed;
+  }
+};
+
+class Peephole : public Pass {
+public:
+  const char *name() const override { return "peephole"; }
+
+  bool run(Function &function) override {
+    InstructionList &code = function.instructions;
+    size_t size = code.size();
+    std::vector<size_t> before = targets_before(code);
+    std::vector<bool> dead(size, false);
+    std::vector<size_t> live;
+    bool changed = false;
+
+    for (size_t pc = 0; pc < size; ++pc) {
+      live.push_back(pc);
+      Operation op = code[pc].operation;
+      size_t n = live.size();
+      if (n < 2) {
+        continue;
+      }
+      size_t b = live[n - 2];
+      Operation previous = code[b].operation;
+
+      if (op == Operation::Pop && !targeted(before, b, pc) &&
+          (previous == Operation::Dup || pure_push(function, code[b]))) {
+        dead[b] = dead[pc] = true;
+        live.resize(n - 2);
+      } else if (op == Operation::Swap && previous == Operation::Swap &&
+                 !targeted(before, b, pc)) {
+        dead[b] = dead[pc] = true;
+        live.resize(n - 2);
+      } else if (op == Operation::Swap && n >= 3 &&
+                 pure_push(function, code[live[n - 3]]) &&
+                 pure_push(function, code[b]) &&
+                 !targeted(before, live[n - 3], pc)) {
+        // Two pushes swapped are the same pushes the other way round
+        std::swap(code[live[n - 3]], code[b]);
+        dead[pc] = true;
+        live.pop_back();
+        changed = true;
+      }
+    }
+    return compact(function, dead) || changed;
+  }
+};
+
+} // namespace
+
+void Pipeline::add(std::unique_ptr<Pass> pass) {
+  passes_.push_back(Entry{std::move(pass), PassStats()});
+}
+
+void Pipeline::run(Function *function) {
+  if (passes_.empty()) {
+    return;
+  }
+  run_one(*function);
+  for (Function *nested : function->functions_) {
+    run(nested);
+  }
+}
+
+void Pipeline::run_one(Function &function) {
+  for (unsigned round = 0; round < rounds_; ++round) {
+    bool changed = false;
+    for (Entry &entry : passes_) {
+      size_t instructions = function.instructions.size();
+      auto start = std::chrono::steady_clock::now();
+      bool result = entry.pass->run(function);
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+
+      PassStats &stats = entry.stats;
+      stats.runs++;
+      stats.changes += result ? 1 : 0;
+      stats.instructions_before += instructions;
+      stats.instructions_after += function.instructions.size();
+      stats.seconds += elapsed.count();
+      changed = changed || result;
+    }
+    if (!changed) {
+      break;
+    }
+  }
+}
+
+std::string Pipeline::describe() const {
+  std::string description;
+  for (const Entry &entry : passes_) {
+    if (!description.empty()) {
+      description += ",";
+    }
+    description += entry.pass->name();
+  }
+  return description + "*" + std::to_string(rounds_);
+}
+
+void Pipeline::report(std::ostream &os) const {
+  for (const Entry &entry : passes_) {
+    const PassStats &stats = entry.stats;
+    os << "[opt] " << std::left << std::setw(12) << entry.pass->name()
+       << std::right << stats.runs << " runs, " << stats.changes
+       << " changed, " << stats.instructions_before << " -> "
+       << stats.instructions_after << " instructions, " << std::fixed
+       << std::setprecision(3) << stats.seconds * 1000 << " ms\n";
+  }
+}
+
+std::unique_ptr<Pass> make_pass(std::string_view name) {
+  if (name == "fold") {
+    return std::make_unique<Fold>();
+  } else if (name == "jumps") {
+    return std::make_unique<Jumps>();
+  } else if (name == "unreachable") {
+    return std::make_unique<Unreachable>();
+  } else if (name == "stores") {
+    return std::make_unique<Stores>();
+  } else if (name == "peephole") {
+    return std::make_unique<Peephole>();
+  }
+  return nullptr;
+}
+
+Pipeline make_pipeline(unsigned level) {
+  Pipeline pipeline;
+  if (level == 0) {
+    return pipeline;
+  }
+  pipeline.add(make_pass("fold"));
+  pipeline.add(make_pass("jumps"));
+  pipeline.add(make_pass("unreachable"));
+  if (level >= 2) {
+    pipeline.add(make_pass("stores"));
+    pipeline.set_rounds(8);
+  }
+  pipeline.add(make_pass("peephole"));
+  return pipeline;
+}
+
+} // namespace bytecode
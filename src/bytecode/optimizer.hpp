@@ -0,0 +1,84 @@
+#pragma once
+
+#include "./types.hpp"
+
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bytecode {
+
+// A rewrite of one function's instructions that keeps the program's
+// output and the errors it raises. Passes see every function on its own,
+// nested functions included, and never the functions around it.
+class Pass {
+public:
+  virtual ~Pass() {}
+
+  // Short name, as given to --passes
+  virtual const char *name() const = 0;
+
+  // True when the instructions changed
+  virtual bool run(Function &function) = 0;
+};
+
+// What one pass did over a whole program
+struct PassStats {
+  size_t runs = 0;
+  // Runs that changed the function
+  size_t changes = 0;
+  size_t instructions_before = 0;
+  size_t instructions_after = 0;
+  double seconds = 0;
+};
+
+// Passes run in the order they were added, over each function in turn.
+// With more than one round the passes repeat on a function until none of
+// them changes it or the rounds run out.
+class Pipeline {
+public:
+  void add(std::unique_ptr<Pass> pass);
+  void set_rounds(unsigned rounds) { rounds_ = rounds; }
+
+  bool empty() const { return passes_.empty(); }
+
+  // Rewrites function and every function nested in it
+  void run(Function *function);
+
+  // The passes and rounds, which identify the code the pipeline produces
+  std::string describe() const;
+
+  // Time and instructions removed per pass, one line each
+  void report(std::ostream &os) const;
+
+private:
+  struct Entry {
+    std::unique_ptr<Pass> pass;
+    PassStats stats;
+  };
+
+  void run_one(Function &function);
+
+  std::vector<Entry> passes_;
+  unsigned rounds_ = 1;
+};
+
+// The pass called name, or nullptr when there is none:
+//
+//   fold         evaluates operations on constants, and branches on them
+//   jumps        threads jumps through gotos and drops jumps to the next
+//                instruction
+//   unreachable  drops instructions no path from the entry reaches
+//   stores       turns stores to locals that are never read again into pops
+//   peephole     drops pushes that are popped straight away and pairs of
+//                stack shuffles that undo each other
+std::unique_ptr<Pass> make_pass(std::string_view name);
+
+// The passes of an optimization level: none at 0, every pass but stores
+// once at 1, and all of them to a fixed point at 2
+Pipeline make_pipeline(unsigned level);
+
+} // namespace bytecode
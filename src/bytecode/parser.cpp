@@ -75,6 +75,20 @@ bytecode::Token bytecode::Parser::consume(TokenKind kind, const std::string& mes
     std::exit(1);
 }
 
+// Variable and field names may coincide with keywords or mnemonics (a
+// MITScript variable called `add`, say), so name lists accept any word token
+bool bytecode::Parser::check_name() const {
+    if (is_eof()) return false;
+    TokenKind kind = peek().kind;
+    return kind == TokenKind::IDENTIFIER ||
+           (kind >= TokenKind::NONE && kind <= TokenKind::POP);
+}
+
+bytecode::Token bytecode::Parser::consume_name(const std::string& message) {
+    if (check_name()) return advance();
+    return consume(TokenKind::IDENTIFIER, message);
+}
+
 bytecode::Function* bytecode::Parser::parse_function() {
     consume(TokenKind::FUNCTION, "Expected 'function' keyword");
     consume(TokenKind::LBRACE, "Expected '{' after function");
@@ -181,23 +195,23 @@ std::vector<bytecode::Function*>* bytecode::Parser::parse_function_list_plus() {
     return list;
 }
 
-std::vector<std::string>* bytecode::Parser::parse_ident_list_star() {
+std::vector<Symbol>* bytecode::Parser::parse_ident_list_star() {
     if (check(TokenKind::RBRACKET)) {
-        return new std::vector<std::string>();
+        return new std::vector<Symbol>();
     }
     return parse_ident_list_plus();
 }
 
-std::vector<std::string>* bytecode::Parser::parse_ident_list_plus() {
-    auto list = new std::vector<std::string>();
+std::vector<Symbol>* bytecode::Parser::parse_ident_list_plus() {
+    auto list = new std::vector<Symbol>();
 
-    auto ident = consume(TokenKind::IDENTIFIER, "Expected identifier");
-    list->push_back(ident.text);
+    auto ident = consume_name("Expected identifier");
+    list->push_back(Symbol(ident.text));
 
     while (match({TokenKind::COMMA})) {
-        if (check(TokenKind::IDENTIFIER)) {
-            auto next_ident = consume(TokenKind::IDENTIFIER, "Expected identifier after comma");
-            list->push_back(next_ident.text);
+        if (check_name()) {
+            auto next_ident = consume_name("Expected identifier after comma");
+            list->push_back(Symbol(next_ident.text));
         }
     }
 
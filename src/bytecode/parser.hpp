@@ -23,12 +23,14 @@ private:
     Token advance();
     bool match(std::initializer_list<TokenKind> kinds);
     Token consume(TokenKind kind, const std::string& message);
+    bool check_name() const;
+    Token consume_name(const std::string& message);
 
     Function* parse_function();
     std::vector<Function*>* parse_function_list_star();
     std::vector<Function*>* parse_function_list_plus();
-    std::vector<std::string>* parse_ident_list_star();
-    std::vector<std::string>* parse_ident_list_plus();
+    std::vector<Symbol>* parse_ident_list_star();
+    std::vector<Symbol>* parse_ident_list_plus();
     Constant* parse_constant();
     std::vector<Constant*>* parse_constant_list_star();
     std::vector<Constant*>* parse_constant_list_plus();
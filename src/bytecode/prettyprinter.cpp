@@ -74,7 +74,7 @@ std::ostream &PrettyPrinter::print_indent(std::ostream &os) {
 }
 
 void PrettyPrinter::print(const std::string &name,
-                          const std::vector<std::string> &names,
+                          const std::vector<Symbol> &names,
                           std::ostream &os) {
   print_indent(os) << name << " = [";
   for (size_t i = 0; i < names.size(); ++i) {
@@ -102,141 +102,25 @@ void PrettyPrinter::print(const Constant *constant, std::ostream &os) {
 }
 
 void PrettyPrinter::print(const Instruction &inst, std::ostream &os) {
+  os << mnemonic(inst.operation);
   switch (inst.operation) {
-  case Operation::LoadConst: {
-    os << "load_const\t" << inst.operand0.value();
+  case Operation::LoadConst:
+  case Operation::LoadFunc:
+  case Operation::LoadLocal:
+  case Operation::StoreLocal:
+  case Operation::LoadGlobal:
+  case Operation::StoreGlobal:
+  case Operation::PushReference:
+  case Operation::FieldLoad:
+  case Operation::FieldStore:
+  case Operation::AllocClosure:
+  case Operation::Call:
+  case Operation::Goto:
+  case Operation::If:
+    os << "\t" << inst.operand0.value();
     break;
-  }
-  case Operation::LoadFunc: {
-    os << "load_func\t" << inst.operand0.value();
-    break;
-  }
-  case Operation::LoadLocal: {
-    os << "load_local\t" << inst.operand0.value();
-    break;
-  }
-  case Operation::StoreLocal: {
-    os << "store_local\t" << inst.operand0.value();
-    break;
-  }
-  case Operation::LoadGlobal: {
-    os << "load_global\t" << inst.operand0.value();
-    break;
-  }
-  case Operation::StoreGlobal: {
-    os << "store_global\t" << inst.operand0.value();
-    break;
-  }
-  case Operation::PushReference: {
-    os << "push_ref\t" << inst.operand0.value();
-    break;
-  }
-  case Operation::LoadReference: {
-    os << "load_ref";
-    break;
-  }
-  case Operation::StoreReference: {
-    os << "store_ref";
-    break;
-  }
-  case Operation::AllocRecord: {
-    os << "alloc_record";
-    break;
-  }
-  case Operation::FieldLoad: {
-    os << "field_load\t" << inst.operand0.value();
-    break;
-  }
-  case Operation::FieldStore: {
-    os << "field_store\t" << inst.operand0.value();
-    break;
-  }
-  case Operation::IndexLoad: {
-    os << "index_load";
-    break;
-  }
-  case Operation::IndexStore: {
-    os << "index_store";
-    break;
-  }
-  case Operation::AllocClosure: {
-    os << "alloc_closure\t" << inst.operand0.value();
-    break;
-  }
-  case Operation::Call: {
-    os << "call\t" << inst.operand0.value();
-    break;
-  }
-  case Operation::Return: {
-    os << "return";
-    break;
-  }
-  case Operation::Add: {
-    os << "add";
-    break;
-  }
-  case Operation::Sub: {
-    os << "sub";
-    break;
-  }
-  case Operation::Mul: {
-    os << "mul";
-    break;
-  }
-  case Operation::Div: {
-    os << "div";
-    break;
-  }
-  case Operation::Neg: {
-    os << "neg";
-    break;
-  }
-  case Operation::Gt: {
-    os << "gt";
-    break;
-  }
-  case Operation::Geq: {
-    os << "geq";
-    break;
-  }
-  case Operation::Eq: {
-    os << "eq";
-    break;
-  }
-  case Operation::And: {
-    os << "and";
-    break;
-  }
-  case Operation::Or: {
-    os << "or";
-    break;
-  }
-  case Operation::Not: {
-    os << "not";
-    break;
-  }
-  case Operation::Goto: {
-    os << "goto\t" << inst.operand0.value();
-    break;
-  }
-  case Operation::If: {
-    os << "if\t" << inst.operand0.value();
-    break;
-  }
-  case Operation::Dup: {
-    os << "dup";
-    break;
-  }
-  case Operation::Swap: {
-    os << "swap";
-    break;
-  }
-  case Operation::Pop: {
-    os << "pop";
-    break;
-  }
   default:
-    assert(false && "Unhandled Operation");
+    break;
   }
 }
 
@@ -272,6 +156,79 @@ std::string PrettyPrinter::unescape(const std::string &str) {
   return ret;
 }
 
+const char *mnemonic(Operation op) {
+  switch (op) {
+  case Operation::LoadConst:
+    return "load_const";
+  case Operation::LoadFunc:
+    return "load_func";
+  case Operation::LoadLocal:
+    return "load_local";
+  case Operation::StoreLocal:
+    return "store_local";
+  case Operation::LoadGlobal:
+    return "load_global";
+  case Operation::StoreGlobal:
+    return "store_global";
+  case Operation::PushReference:
+    return "push_ref";
+  case Operation::LoadReference:
+    return "load_ref";
+  case Operation::StoreReference:
+    return "store_ref";
+  case Operation::AllocRecord:
+    return "alloc_record";
+  case Operation::FieldLoad:
+    return "field_load";
+  case Operation::FieldStore:
+    return "field_store";
+  case Operation::IndexLoad:
+    return "index_load";
+  case Operation::IndexStore:
+    return "index_store";
+  case Operation::AllocClosure:
+    return "alloc_closure";
+  case Operation::Call:
+    return "call";
+  case Operation::Return:
+    return "return";
+  case Operation::Add:
+    return "add";
+  case Operation::Sub:
+    return "sub";
+  case Operation::Mul:
+    return "mul";
+  case Operation::Div:
+    return "div";
+  case Operation::Neg:
+    return "neg";
+  case Operation::Gt:
+    return "gt";
+  case Operation::Geq:
+    return "geq";
+  case Operation::Eq:
+    return "eq";
+  case Operation::And:
+    return "and";
+  case Operation::Or:
+    return "or";
+  case Operation::Not:
+    return "not";
+  case Operation::Goto:
+    return "goto";
+  case Operation::If:
+    return "if";
+  case Operation::Dup:
+    return "dup";
+  case Operation::Swap:
+    return "swap";
+  case Operation::Pop:
+    return "pop";
+  }
+  assert(false && "Unhandled Operation");
+  return "";
+}
+
 void prettyprint(const Function *function, std::ostream &os) {
   PrettyPrinter().print(function, os);
 }
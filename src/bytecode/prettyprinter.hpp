@@ -14,7 +14,7 @@ private:
   void indent();
   void unindent();
   std::ostream &print_indent(std::ostream &os);
-  void print(const std::string &name, const std::vector<std::string> &names,
+  void print(const std::string &name, const std::vector<Symbol> &names,
              std::ostream &os);
   void print(const Constant *constant, std::ostream &os);
   void print(const Instruction &inst, std::ostream &os);
@@ -26,4 +26,7 @@ private:
 
 void prettyprint(const Function *function, std::ostream &os);
 
+// The mnemonic of op in the text form, such as load_const
+const char *mnemonic(Operation op);
+
 } // namespace bytecode
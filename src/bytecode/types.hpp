@@ -5,6 +5,7 @@
 #include <vector>
 
 #include "./instructions.hpp"
+#include "symbol.hpp"
 
 namespace bytecode {
 struct Constant {
@@ -44,7 +45,21 @@ struct Constant::Boolean : public Constant {
   virtual ~Boolean() {}
 };
 
+// A function owns the functions nested in it and its constants, so deleting
+// the outermost function of a program frees all of it
 struct Function {
+  Function() = default;
+  Function(const Function &) = delete;
+  Function &operator=(const Function &) = delete;
+  ~Function() {
+    for (Function *function : functions_) {
+      delete function;
+    }
+    for (Constant *constant : constants_) {
+      delete constant;
+    }
+  }
+
   // List of functions defined within this function (but not functions defined
   // inside of nested functions)
   std::vector<Function *> functions_;
@@ -59,18 +74,23 @@ struct Function {
   // List of local variables
   // The first parameter_count_ variables are the function's parameters
   // in their order as given in the paraemter list
-  std::vector<std::string> local_vars_;
+  std::vector<Symbol> local_vars_;
 
   // List of local variables accessed by reference (LocalReference)
-  std::vector<std::string> local_reference_vars_;
+  std::vector<Symbol> local_reference_vars_;
 
   // List of the names of non-global and non-local variables accessed by the
   // function
-  std::vector<std::string> free_vars_;
+  std::vector<Symbol> free_vars_;
 
   // List of global variable and field names used inside the function
-  std::vector<std::string> names_;
+  std::vector<Symbol> names_;
 
   InstructionList instructions;
+
+  // For profiles: the variable or field the function was assigned to where
+  // it was declared, if any, and the line of its declaration, or 0
+  Symbol name_;
+  int32_t line_ = 0;
 };
 }; // namespace bytecode
\ No newline at end of file
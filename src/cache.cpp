@@ -0,0 +1,172 @@
+#include "cache.hpp"
+
+#include "bytecode/image.hpp"
+#include "compiler/compiler.hpp"
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <system_error>
+
+namespace
+{
+  using Digest = std::array<unsigned char, 32>;
+
+  uint32_t rotr(uint32_t x, int n) { return x >> n | x << (32 - n); }
+
+  // SHA-256 (FIPS 180-4)
+  Digest sha256(std::string_view text)
+  {
+    static constexpr uint32_t k[64] = {
+        0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+        0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+        0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+        0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+        0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+        0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+        0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+        0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+    uint32_t h[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                     0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+    // The text, a one bit, zeros up to 56 mod 64 bytes, then the length in
+    // bits as a big-endian 64-bit number
+    std::string padded(text);
+    uint64_t bits = static_cast<uint64_t>(text.size()) * 8;
+    padded.push_back(static_cast<char>(0x80));
+    padded.resize((padded.size() + 8 + 63) / 64 * 64 - 8, '\0');
+    for (int i = 7; i >= 0; --i)
+    {
+      padded.push_back(static_cast<char>(bits >> (8 * i)));
+    }
+
+    for (size_t block = 0; block < padded.size(); block += 64)
+    {
+      const unsigned char *p = reinterpret_cast<const unsigned char *>(padded.data()) + block;
+      uint32_t w[64];
+      for (int i = 0; i < 16; ++i)
+      {
+        w[i] = static_cast<uint32_t>(p[4 * i]) << 24 | static_cast<uint32_t>(p[4 * i + 1]) << 16 |
+               static_cast<uint32_t>(p[4 * i + 2]) << 8 | static_cast<uint32_t>(p[4 * i + 3]);
+      }
+      for (int i = 16; i < 64; ++i)
+      {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+      }
+
+      uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], x = h[7];
+      for (int i = 0; i < 64; ++i)
+      {
+        uint32_t t1 = x + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        x = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+      }
+      h[0] += a;
+      h[1] += b;
+      h[2] += c;
+      h[3] += d;
+      h[4] += e;
+      h[5] += f;
+      h[6] += g;
+      h[7] += x;
+    }
+
+    Digest digest;
+    for (int i = 0; i < 32; ++i)
+    {
+      digest[i] = static_cast<unsigned char>(h[i / 4] >> (24 - 8 * (i % 4)));
+    }
+    return digest;
+  }
+}
+
+CompilationCache::CompilationCache(std::filesystem::path directory, std::string variant)
+    : directory_(std::move(directory)), variant_(std::move(variant))
+{
+}
+
+std::string CompilationCache::key(std::string_view source) const
+{
+  std::string versions = std::to_string(compiler::kVersion) + "." +
+                         std::to_string(bytecode::kImageVersion) + ":" +
+                         variant_ + ":";
+  Digest digest = sha256(versions + std::string(source));
+  return std::string(reinterpret_cast<const char *>(digest.data()), digest.size());
+}
+
+std::filesystem::path CompilationCache::entry(const std::string &key) const
+{
+  std::ostringstream name;
+  name << std::hex << std::setfill('0');
+  for (unsigned char c : key)
+  {
+    name << std::setw(2) << static_cast<int>(c);
+  }
+  name << ".mitb";
+  return directory_ / name.str();
+}
+
+// The name of an entry only says where to look: the digest stored in it
+// must match too, so a renamed, stale or planted file is a miss
+std::unique_ptr<bytecode::Function> CompilationCache::find(std::string_view source) const
+{
+  std::string digest = key(source);
+  bytecode::MappedFile file(entry(digest).string());
+  if (!file.mapped() || file.data().substr(0, digest.size()) != digest)
+  {
+    return nullptr;
+  }
+  std::string_view image = file.data().substr(digest.size());
+  if (!bytecode::is_image(image))
+  {
+    return nullptr;
+  }
+  return bytecode::try_load_image(image);
+}
+
+void CompilationCache::store(std::string_view source, const bytecode::Function *function) const
+{
+  std::error_code error;
+  std::filesystem::create_directories(directory_, error);
+  if (error)
+  {
+    return;
+  }
+
+  std::string digest = key(source);
+  std::filesystem::path path = entry(digest);
+  std::filesystem::path temporary = path;
+  temporary += ".tmp" + std::to_string(std::random_device()());
+  {
+    std::ofstream out(temporary, std::ios::binary);
+    if (!out)
+    {
+      return;
+    }
+    out.write(digest.data(), digest.size());
+    bytecode::write_image(function, out);
+    if (!out.flush())
+    {
+      out.close();
+      std::filesystem::remove(temporary, error);
+      return;
+    }
+  }
+  std::filesystem::rename(temporary, path, error);
+  if (error)
+  {
+    std::filesystem::remove(temporary, error);
+  }
+}
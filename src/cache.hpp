@@ -0,0 +1,40 @@
+#pragma once
+
+#include "bytecode/types.hpp"
+
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <string_view>
+
+/*
+  Compiled programs kept on disk as bytecode images, one file per program.
+  The key of a program is the SHA-256 digest of its source, of the compiler
+  and image versions and of the optimizations applied, so a changed source,
+  a newer build or other optimizations simply miss.  An entry is named by
+  its key in hex and holds the key followed by the image.  The cache only
+  ever saves work: an entry that cannot be read or written, or whose key
+  does not match, is treated as a miss.
+*/
+class CompilationCache
+{
+public:
+  // variant names the optimizations the stored code has had, if any
+  explicit CompilationCache(std::filesystem::path directory, std::string variant = "");
+
+  // The program compiled from source by an earlier run, or nullptr
+  std::unique_ptr<bytecode::Function> find(std::string_view source) const;
+
+  // Saves function as the compilation of source.  Entries are written to a
+  // temporary file and renamed into place, so concurrent runs of the same
+  // program never see half an entry.
+  void store(std::string_view source, const bytecode::Function *function) const;
+
+private:
+  // The raw digest identifying source
+  std::string key(std::string_view source) const;
+  std::filesystem::path entry(const std::string &key) const;
+
+  std::filesystem::path directory_;
+  std::string variant_;
+};
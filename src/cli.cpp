@@ -1,8 +1,11 @@
 #include "cli.hpp"
 
+#include <algorithm>
+#include <cstdlib>
 #include <filesystem>
 #include <iostream>
 #include <fstream>
+#include <thread>
 
 void print_help(char *argv0) {
     std::cout << "Usage: " << argv0 << " [SUBCOMMAND] [input_file] [OPTIONS]\n";
@@ -13,7 +16,37 @@ void print_help(char *argv0) {
     std::cout << "OPTIONS:\n";
     std::cout << "  -h,     --help              Print this help message and exit\n";
     std::cout << "  -o,     --output TEXT       Path to output file, use '-' for stdout\n";
-    std::cout << "  -m,     --mem UINT          Memory limit in MB -- Only enabled for VM subcommand\n";
+    std::cout << "  -m,     --mem UINT          Memory limit in MB for the collected heap\n";
+    std::cout << "          --gc-threads UINT   Threads that mark during full collections\n";
+    std::cout << "          --gc-stats          Report every collection on stderr, also\n";
+    std::cout << "                              enabled by setting MITSCRIPT_GC_STATS=1\n";
+    std::cout << "          --binary            Have compile write a binary bytecode image,\n";
+    std::cout << "                              which vm loads without parsing\n";
+    std::cout << "          --closures          Have interpret compile the program to\n";
+    std::cout << "                              closures once instead of walking the tree\n";
+    std::cout << "          --cache-dir TEXT    Keep compiled programs for run in this\n";
+    std::cout << "                              directory, also set by MITSCRIPT_CACHE_DIR\n";
+    std::cout << "  -O0, -O1, -O2               Optimize bytecode for compile, vm and\n";
+    std::cout << "                              run: not at all (default), once with\n";
+    std::cout << "                              every pass but stores, or with all of\n";
+    std::cout << "                              them until they change nothing\n";
+    std::cout << "          --passes LIST       Run just these comma-separated passes\n";
+    std::cout << "                              once instead: fold, jumps, unreachable,\n";
+    std::cout << "                              stores, peephole\n";
+    std::cout << "          --opt-stats         Report time and instructions removed for\n";
+    std::cout << "                              each pass on stderr\n";
+    std::cout << "          --stats             Report instructions executed and heap\n";
+    std::cout << "                              allocations on stderr after interpret,\n";
+    std::cout << "                              vm and run; counting keeps the JIT off\n";
+    std::cout << "          --profile TEXT      Have vm and run sample the stack into\n";
+    std::cout << "                              this file in folded form for\n";
+    std::cout << "                              flamegraph.pl, and count operations and\n";
+    std::cout << "                              calls on stderr; runs the stack tier\n";
+    std::cout << "  -j,     --jobs UINT         Scripts batch runs at once, by default\n";
+    std::cout << "                              one per core\n";
+    std::cout << "          --tier TEXT         VM code to run: 'stack' (default),\n";
+    std::cout << "                              'register', or 'jit' to compile hot\n";
+    std::cout << "                              functions to machine code\n";
     std::cout << "\n";
     std::cout << "SUBCOMMANDS:\n";
     std::cout << "  scan\n";
@@ -21,12 +54,31 @@ void print_help(char *argv0) {
     std::cout << "  compile\n";
     std::cout << "  interpret\n";
     std::cout << "  vm\n";
+    std::cout << "  run                         Compile source and execute it on the VM\n";
+    std::cout << "  batch                       Run the scripts that input_file lists,\n";
+    std::cout << "                              one per line as 'script [input [output]]'\n";
+    std::cout << "                              with '-' for none, on a pool of threads\n";
 }
 
 void cli_parse_internal(Command &c, int argc, char **argv) {
   std::string input_file = "-";
   std::string output_file = "-";
   size_t mem = 4;
+  unsigned long gc_threads = 1;
+  const char *stats_env = std::getenv("MITSCRIPT_GC_STATS");
+  TierKind tier = TierKind::STACK;
+  bool binary = false;
+  bool closures = false;
+  unsigned opt_level = 0;
+  std::string passes;
+  bool opt_stats = false;
+  bool stats = false;
+  std::string profile;
+  unsigned long jobs = std::max(1u, std::thread::hardware_concurrency());
+  const char *cache_env = std::getenv("MITSCRIPT_CACHE_DIR");
+  std::string cache_dir = cache_env != nullptr ? cache_env : "";
+  bool gc_stats = stats_env != nullptr && *stats_env != '\0' &&
+                  std::string(stats_env) != "0";
   CommandKind kind;
 
   if (argc < 2) {
@@ -46,6 +98,10 @@ void cli_parse_internal(Command &c, int argc, char **argv) {
     kind = CommandKind::INTERPRET;
   } else if (subcommand == "vm") {
     kind = CommandKind::VM;
+  } else if (subcommand == "run") {
+    kind = CommandKind::RUN;
+  } else if (subcommand == "batch") {
+    kind = CommandKind::BATCH;
   } else if (subcommand == "-h" || subcommand == "--help") {
     print_help(argv[0]);
     exit(0);
@@ -75,6 +131,78 @@ void cli_parse_internal(Command &c, int argc, char **argv) {
         std::cerr << "Error: -m/--mem requires a value\n";
         exit(1);
       }
+    } else if (arg == "--gc-threads") {
+      if (i + 1 < argc) {
+        gc_threads = std::stoul(argv[++i]);
+      } else {
+        std::cerr << "Error: --gc-threads requires a value\n";
+        exit(1);
+      }
+      if (gc_threads == 0 || gc_threads > 256) {
+        std::cerr << "Error: --gc-threads must be between 1 and 256\n";
+        exit(1);
+      }
+    } else if (arg == "--gc-stats") {
+      gc_stats = true;
+    } else if (arg == "--cache-dir") {
+      if (i + 1 < argc) {
+        cache_dir = argv[++i];
+      } else {
+        std::cerr << "Error: --cache-dir requires a value\n";
+        exit(1);
+      }
+    } else if (arg == "--binary") {
+      binary = true;
+    } else if (arg == "--closures") {
+      closures = true;
+    } else if (arg == "-O0" || arg == "-O1" || arg == "-O2") {
+      opt_level = static_cast<unsigned>(arg[2] - '0');
+    } else if (arg == "--passes") {
+      if (i + 1 < argc) {
+        passes = argv[++i];
+      } else {
+        std::cerr << "Error: --passes requires a value\n";
+        exit(1);
+      }
+    } else if (arg == "--opt-stats") {
+      opt_stats = true;
+    } else if (arg == "--stats") {
+      stats = true;
+    } else if (arg == "--profile") {
+      if (i + 1 < argc) {
+        profile = argv[++i];
+      } else {
+        std::cerr << "Error: --profile requires a value\n";
+        exit(1);
+      }
+    } else if (arg == "-j" || arg == "--jobs") {
+      if (i + 1 < argc) {
+        jobs = std::stoul(argv[++i]);
+      } else {
+        std::cerr << "Error: -j/--jobs requires a value\n";
+        exit(1);
+      }
+      if (jobs == 0 || jobs > 1024) {
+        std::cerr << "Error: --jobs must be between 1 and 1024\n";
+        exit(1);
+      }
+    } else if (arg == "--tier") {
+      if (i + 1 < argc) {
+        std::string name = argv[++i];
+        if (name == "stack") {
+          tier = TierKind::STACK;
+        } else if (name == "register") {
+          tier = TierKind::REGISTER;
+        } else if (name == "jit") {
+          tier = TierKind::JIT;
+        } else {
+          std::cerr << "Error: --tier must be 'stack', 'register' or 'jit'\n";
+          exit(1);
+        }
+      } else {
+        std::cerr << "Error: --tier requires a value\n";
+        exit(1);
+      }
     } else if (!input_file_set) {
       input_file = arg;
       input_file_set = true;
@@ -84,6 +212,12 @@ void cli_parse_internal(Command &c, int argc, char **argv) {
     }
   }
 
+  // The timer a profile samples with belongs to the whole process
+  if (kind == CommandKind::BATCH && !profile.empty()) {
+    std::cerr << "Error: --profile cannot be used with batch\n";
+    exit(1);
+  }
+
   if (input_file != "-" && !std::filesystem::exists(input_file)) {
     std::cerr << "Error: Input file '" << input_file << "' does not exist"
               << std::endl;
@@ -97,6 +231,18 @@ void cli_parse_internal(Command &c, int argc, char **argv) {
   c.input_filename = input_file;
   c.kind = kind;
   c.mem = mem;
+  c.gc_threads = static_cast<unsigned>(gc_threads);
+  c.gc_stats = gc_stats;
+  c.tier = tier;
+  c.binary = binary;
+  c.closures = closures;
+  c.cache_dir = cache_dir;
+  c.opt_level = opt_level;
+  c.passes = passes;
+  c.opt_stats = opt_stats;
+  c.stats = stats;
+  c.profile = profile;
+  c.jobs = static_cast<unsigned>(jobs);
 }
 
 Command cli_parse(int argc, char **argv) {
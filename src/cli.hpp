@@ -2,7 +2,9 @@
 
 #include <iostream>
 
-enum class CommandKind { SCAN, PARSE, COMPILE, INTERPRET, VM };
+enum class CommandKind { SCAN, PARSE, COMPILE, INTERPRET, VM, RUN, BATCH };
+
+enum class TierKind { STACK, REGISTER, JIT };
 
 struct Command {
   CommandKind kind;
@@ -11,9 +13,21 @@ struct Command {
   std::string input_filename;
   std::string output_filename;
   size_t mem;
+  unsigned gc_threads;
+  bool gc_stats;
+  TierKind tier;
+  bool binary;
+  bool closures;
+  std::string cache_dir;
+  unsigned opt_level;
+  std::string passes;
+  bool opt_stats;
+  bool stats;
+  std::string profile;
+  unsigned jobs;
 
   Command()
-      : input_stream(nullptr), output_stream(nullptr), input_filename(""), output_filename("") {}
+      : input_stream(nullptr), output_stream(nullptr), input_filename(""), output_filename(""), mem(4), gc_threads(1), gc_stats(false), tier(TierKind::STACK), binary(false), closures(false), cache_dir(""), opt_level(0), passes(""), opt_stats(false), stats(false), profile(""), jobs(1) {}
 
   ~Command() {
     if (input_stream && input_stream != &std::cin) {
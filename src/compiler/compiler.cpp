@@ -0,0 +1,436 @@
+#include "./compiler.hpp"
+
+#include "./escape.hpp"
+
+#include <algorithm>
+
+namespace compiler {
+
+using bytecode::Operation;
+
+Compiler::Compiler(ast::ASTNode &root) : root_(root), scopes_(root) {}
+
+bytecode::Function *Compiler::compile() {
+  return compileFunction(root_, scopes_.global());
+}
+
+bytecode::Function *Compiler::compileFunction(ast::ASTNode &body,
+                                              Scope &scope) {
+  bytecode::Function *enclosing = function_;
+  Scope *enclosingScope = scope_;
+
+  function_ = new bytecode::Function();
+  scope_ = &scope;
+  function_->parameter_count_ = scope.parameter_count;
+  function_->local_vars_ = scope.locals;
+  function_->local_reference_vars_ = scope.ref_vars;
+  function_->free_vars_ = scope.free_vars;
+
+  // Fields of records that never escape get locals after the others, under
+  // names no variable has
+  auto enclosingScalars = std::move(scalars_);
+  scalars_.clear();
+  EscapeAnalysis escapes(body, scope);
+  for (const Symbol &local : escapes.locals()) {
+    auto &fields = scalars_[local];
+    for (const Symbol &field : escapes.scalar(local)->fields) {
+      std::string name = local.str() + "_" + field.str();
+      auto &locals = function_->local_vars_;
+      while (std::find(locals.begin(), locals.end(), Symbol(name)) !=
+             locals.end()) {
+        name += "_";
+      }
+      fields.emplace_back(field, static_cast<int32_t>(locals.size()));
+      locals.emplace_back(name);
+    }
+  }
+
+  body.accept(*this);
+
+  // Every function, including the top level, ends by returning None
+  emit(Operation::LoadConst, constant(new bytecode::Constant::None()));
+  emit(Operation::Return);
+
+  bytecode::Function *result = function_;
+  function_ = enclosing;
+  scope_ = enclosingScope;
+  scalars_ = std::move(enclosingScalars);
+  return result;
+}
+
+size_t Compiler::emit(Operation op) {
+  function_->instructions.emplace_back(op, std::nullopt);
+  function_->instructions.back().line = line_;
+  return function_->instructions.size() - 1;
+}
+
+size_t Compiler::emit(Operation op, int32_t operand) {
+  function_->instructions.emplace_back(op, operand);
+  function_->instructions.back().line = line_;
+  return function_->instructions.size() - 1;
+}
+
+void Compiler::patch(size_t from) {
+  function_->instructions[from].operand0 =
+      static_cast<int32_t>(function_->instructions.size() - from);
+}
+
+int32_t Compiler::constant(bytecode::Constant *c) {
+  auto &constants = function_->constants_;
+  for (size_t i = 0; i < constants.size(); ++i) {
+    bool same = false;
+    if (dynamic_cast<bytecode::Constant::None *>(c)) {
+      same = dynamic_cast<bytecode::Constant::None *>(constants[i]) != nullptr;
+    } else if (auto *v = dynamic_cast<bytecode::Constant::Integer *>(c)) {
+      auto *o = dynamic_cast<bytecode::Constant::Integer *>(constants[i]);
+      same = o && o->value == v->value;
+    } else if (auto *v = dynamic_cast<bytecode::Constant::Boolean *>(c)) {
+      auto *o = dynamic_cast<bytecode::Constant::Boolean *>(constants[i]);
+      same = o && o->value == v->value;
+    } else if (auto *v = dynamic_cast<bytecode::Constant::String *>(c)) {
+      auto *o = dynamic_cast<bytecode::Constant::String *>(constants[i]);
+      same = o && o->value == v->value;
+    }
+    if (same) {
+      delete c;
+      return static_cast<int32_t>(i);
+    }
+  }
+  constants.push_back(c);
+  return static_cast<int32_t>(constants.size() - 1);
+}
+
+int32_t Compiler::name(Symbol n) {
+  auto &names = function_->names_;
+  auto it = std::find(names.begin(), names.end(), n);
+  if (it != names.end()) {
+    return static_cast<int32_t>(it - names.begin());
+  }
+  names.push_back(n);
+  return static_cast<int32_t>(names.size() - 1);
+}
+
+// Index of a captured variable in the push_ref numbering: this function's
+// reference locals first, followed by its free variables
+int32_t Compiler::reference(Symbol n) {
+  int32_t ref = scope_->refIndex(n);
+  if (ref >= 0) {
+    return ref;
+  }
+  return static_cast<int32_t>(scope_->ref_vars.size()) + scope_->freeIndex(n);
+}
+
+void Compiler::load(Symbol n) {
+  switch (scope_->resolve(n)) {
+  case VarKind::Global:
+    emit(Operation::LoadGlobal, name(n));
+    break;
+  case VarKind::Local:
+    emit(Operation::LoadLocal, scope_->localIndex(n));
+    break;
+  case VarKind::Free:
+    emit(Operation::PushReference, reference(n));
+    emit(Operation::LoadReference);
+    break;
+  }
+}
+
+void Compiler::store(Symbol n) {
+  switch (scope_->resolve(n)) {
+  case VarKind::Global:
+    emit(Operation::StoreGlobal, name(n));
+    break;
+  case VarKind::Local:
+    emit(Operation::StoreLocal, scope_->localIndex(n));
+    break;
+  case VarKind::Free:
+    // Assigned names are always local, so this only guards against a
+    // scope analysis that classifies differently
+    emit(Operation::PushReference, reference(n));
+    emit(Operation::Swap);
+    emit(Operation::StoreReference);
+    break;
+  }
+}
+
+int32_t Compiler::scalarField(ast::ASTNode &local, Symbol field) const {
+  auto *ident = local.as<ast::Identifier>();
+  if (!ident) {
+    return -1;
+  }
+  auto it = scalars_.find(ident->name);
+  if (it == scalars_.end()) {
+    return -1;
+  }
+  for (const auto &[name, index] : it->second) {
+    if (name == field) {
+      return index;
+    }
+  }
+  return -1;
+}
+
+void Compiler::storeScalar(Symbol local, ast::Record &record) {
+  // The literal cannot mention the record it replaces, so its fields can be
+  // stored as they are evaluated
+  const auto &fields = scalars_.at(local);
+  for (auto &field : record.fields) {
+    field.second->accept(*this);
+    auto it = std::find_if(fields.begin(), fields.end(), [&](const auto &f) {
+      return f.first == field.first;
+    });
+    emit(Operation::StoreLocal, it->second);
+  }
+  for (const auto &[name, index] : fields) {
+    if (std::none_of(record.fields.begin(), record.fields.end(),
+                     [&](const auto &field) { return field.first == name; })) {
+      emit(Operation::LoadConst, constant(new bytecode::Constant::None()));
+      emit(Operation::StoreLocal, index);
+    }
+  }
+}
+
+void Compiler::visit(ast::BinaryExpression &expr) {
+  expr.leftOperand->accept(*this);
+  expr.rightOperand->accept(*this);
+
+  switch (expr.op) {
+  case ast::BinaryExpression::Add:
+    emit(Operation::Add);
+    break;
+  case ast::BinaryExpression::Sub:
+    emit(Operation::Sub);
+    break;
+  case ast::BinaryExpression::Mul:
+    emit(Operation::Mul);
+    break;
+  case ast::BinaryExpression::Div:
+    emit(Operation::Div);
+    break;
+  case ast::BinaryExpression::Eq:
+    emit(Operation::Eq);
+    break;
+  // a < b is b > a; operands are still evaluated left to right
+  case ast::BinaryExpression::Lt:
+    emit(Operation::Swap);
+    emit(Operation::Gt);
+    break;
+  case ast::BinaryExpression::Gt:
+    emit(Operation::Gt);
+    break;
+  case ast::BinaryExpression::Leq:
+    emit(Operation::Swap);
+    emit(Operation::Geq);
+    break;
+  case ast::BinaryExpression::Geq:
+    emit(Operation::Geq);
+    break;
+  case ast::BinaryExpression::And:
+    emit(Operation::And);
+    break;
+  case ast::BinaryExpression::Or:
+    emit(Operation::Or);
+    break;
+  }
+}
+
+void Compiler::visit(ast::UnaryExpression &expr) {
+  expr.operand->accept(*this);
+  switch (expr.op) {
+  case ast::UnaryExpression::Neg:
+    emit(Operation::Neg);
+    break;
+  case ast::UnaryExpression::Not:
+    emit(Operation::Not);
+    break;
+  }
+}
+
+void Compiler::visit(ast::FieldDereference &expr) {
+  int32_t scalar = scalarField(*expr.baseExpression, expr.field);
+  if (scalar >= 0) {
+    emit(Operation::LoadLocal, scalar);
+    return;
+  }
+  expr.baseExpression->accept(*this);
+  emit(Operation::FieldLoad, name(expr.field));
+}
+
+void Compiler::visit(ast::IndexExpression &expr) {
+  expr.baseExpression->accept(*this);
+  expr.index->accept(*this);
+  emit(Operation::IndexLoad);
+}
+
+void Compiler::visit(ast::Call &expr) {
+  // A call inside a statement spanning lines belongs to the line it is on
+  int enclosing = line_;
+  if (expr.line > 0) {
+    line_ = expr.line;
+  }
+  expr.targetExpression->accept(*this);
+  for (auto &arg : expr.arguments) {
+    arg->accept(*this);
+  }
+  emit(Operation::Call, static_cast<int32_t>(expr.arguments.size()));
+  line_ = enclosing;
+}
+
+void Compiler::visit(ast::Record &expr) {
+  emit(Operation::AllocRecord);
+  for (auto &field : expr.fields) {
+    emit(Operation::Dup);
+    field.second->accept(*this);
+    emit(Operation::FieldStore, name(field.first));
+  }
+}
+
+void Compiler::visit(ast::IntegerConstant &expr) {
+  emit(Operation::LoadConst,
+       constant(new bytecode::Constant::Integer(expr.value)));
+}
+
+void Compiler::visit(ast::StringConstant &expr) {
+  emit(Operation::LoadConst,
+       constant(new bytecode::Constant::String(std::string(expr.value))));
+}
+
+void Compiler::visit(ast::BooleanConstant &expr) {
+  emit(Operation::LoadConst,
+       constant(new bytecode::Constant::Boolean(expr.value)));
+}
+
+void Compiler::visit(ast::NoneConstant &) {
+  emit(Operation::LoadConst, constant(new bytecode::Constant::None()));
+}
+
+void Compiler::visit(ast::Identifier &expr) { load(expr.name); }
+
+void Compiler::visit(ast::Block &stmt) {
+  // What a loop or branch emits after its block belongs to its own line
+  int enclosing = line_;
+  for (auto &statement : stmt.statements) {
+    line_ = statement->line;
+    statement->accept(*this);
+    // A call used as a statement discards its result
+    if (statement->kind == ast::Kind::Call) {
+      emit(Operation::Pop);
+    }
+  }
+  line_ = enclosing;
+}
+
+void Compiler::visit(ast::Assignment &stmt) {
+  switch (stmt.lhs->kind) {
+  case ast::Kind::Identifier: {
+    auto *ident = static_cast<ast::Identifier *>(stmt.lhs);
+    if (scalars_.count(ident->name)) {
+      storeScalar(ident->name, *stmt.expr->as<ast::Record>());
+      break;
+    }
+    if (stmt.expr->kind == ast::Kind::FunctionDeclaration) {
+      name_ = ident->name;
+    }
+    stmt.expr->accept(*this);
+    store(ident->name);
+    break;
+  }
+  case ast::Kind::FieldDereference: {
+    auto *field = static_cast<ast::FieldDereference *>(stmt.lhs);
+    int32_t scalar = scalarField(*field->baseExpression, field->field);
+    if (scalar < 0) {
+      field->baseExpression->accept(*this);
+    }
+    if (stmt.expr->kind == ast::Kind::FunctionDeclaration) {
+      name_ = field->field;
+    }
+    stmt.expr->accept(*this);
+    if (scalar >= 0) {
+      emit(Operation::StoreLocal, scalar);
+    } else {
+      emit(Operation::FieldStore, name(field->field));
+    }
+    break;
+  }
+  case ast::Kind::IndexExpression: {
+    auto *index = static_cast<ast::IndexExpression *>(stmt.lhs);
+    index->baseExpression->accept(*this);
+    index->index->accept(*this);
+    stmt.expr->accept(*this);
+    emit(Operation::IndexStore);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void Compiler::visit(ast::Global &) {}
+
+void Compiler::visit(ast::IfStatement &stmt) {
+  //     <condition>
+  //     if then
+  //     <else part>
+  //     goto end
+  // then:
+  //     <then part>
+  // end:
+  stmt.condition->accept(*this);
+  size_t toThen = emit(Operation::If, 0);
+  if (stmt.elsePart) {
+    stmt.elsePart->accept(*this);
+  }
+  size_t toEnd = emit(Operation::Goto, 0);
+  patch(toThen);
+  stmt.thenPart->accept(*this);
+  patch(toEnd);
+}
+
+void Compiler::visit(ast::WhileLoop &stmt) {
+  // cond:
+  //     <condition>
+  //     if body
+  //     goto end
+  // body:
+  //     <body>
+  //     goto cond
+  // end:
+  size_t cond = function_->instructions.size();
+  stmt.condition->accept(*this);
+  size_t toBody = emit(Operation::If, 0);
+  size_t toEnd = emit(Operation::Goto, 0);
+  patch(toBody);
+  stmt.body->accept(*this);
+  size_t back = emit(Operation::Goto, 0);
+  function_->instructions[back].operand0 =
+      static_cast<int32_t>(cond) - static_cast<int32_t>(back);
+  patch(toEnd);
+}
+
+void Compiler::visit(ast::Return &stmt) {
+  stmt.expression->accept(*this);
+  emit(Operation::Return);
+}
+
+void Compiler::visit(ast::FunctionDeclaration &stmt) {
+  Scope &child = scopes_.of(stmt);
+  Symbol declared = name_;
+  name_ = Symbol();
+  bytecode::Function *function = compileFunction(*stmt.body, child);
+  function->name_ = declared;
+  function->line_ = stmt.line;
+  function_->functions_.push_back(function);
+
+  emit(Operation::LoadFunc,
+       static_cast<int32_t>(function_->functions_.size() - 1));
+  for (const auto &free : child.free_vars) {
+    emit(Operation::PushReference, reference(free));
+  }
+  emit(Operation::AllocClosure, static_cast<int32_t>(child.free_vars.size()));
+}
+
+std::unique_ptr<bytecode::Function> compile(ast::ASTNode &root) {
+  return std::unique_ptr<bytecode::Function>(Compiler(root).compile());
+}
+
+} // namespace compiler
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "ast.hpp"
+#include "bytecode/types.hpp"
+#include "./scope.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace compiler {
+
+// Changes whenever the compiler starts emitting different bytecode for the
+// same program, so that compiled code cached by older builds is not reused
+constexpr uint32_t kVersion = 2;
+
+// Lowers a parsed program into the top-level bytecode function. All variable
+// resolution happens here, so the VM never looks names up by scope.
+class Compiler : public ast::Visitor {
+public:
+  explicit Compiler(ast::ASTNode &root);
+
+  bytecode::Function *compile();
+
+private:
+  void visit(ast::BinaryExpression &expr) override;
+  void visit(ast::UnaryExpression &expr) override;
+  void visit(ast::FieldDereference &expr) override;
+  void visit(ast::IndexExpression &expr) override;
+  void visit(ast::Call &expr) override;
+  void visit(ast::Record &expr) override;
+  void visit(ast::IntegerConstant &expr) override;
+  void visit(ast::StringConstant &expr) override;
+  void visit(ast::BooleanConstant &expr) override;
+  void visit(ast::NoneConstant &expr) override;
+  void visit(ast::Identifier &expr) override;
+  void visit(ast::Block &stmt) override;
+  void visit(ast::Assignment &stmt) override;
+  void visit(ast::Global &stmt) override;
+  void visit(ast::IfStatement &stmt) override;
+  void visit(ast::WhileLoop &stmt) override;
+  void visit(ast::Return &stmt) override;
+  void visit(ast::FunctionDeclaration &stmt) override;
+
+  bytecode::Function *compileFunction(ast::ASTNode &body, Scope &scope);
+
+  size_t emit(bytecode::Operation op);
+  size_t emit(bytecode::Operation op, int32_t operand);
+  // Points the jump at index `from` to the next instruction to be emitted
+  void patch(size_t from);
+
+  int32_t constant(bytecode::Constant *constant);
+  int32_t name(Symbol name);
+  int32_t reference(Symbol name);
+
+  void load(Symbol name);
+  void store(Symbol name);
+
+  // The local holding field of the record in local, if that record never
+  // escapes, or -1
+  int32_t scalarField(ast::ASTNode &local, Symbol field) const;
+  // Builds the record as the locals of its fields, with any field it lacks
+  // reset to None
+  void storeScalar(Symbol local, ast::Record &record);
+
+  ast::ASTNode &root_;
+  ScopeAnalysis scopes_;
+
+  bytecode::Function *function_ = nullptr;
+  Scope *scope_ = nullptr;
+  // Line of the statement or call being compiled, given to what it emits
+  int line_ = 0;
+  // Name for the function declared right on the right of an assignment
+  Symbol name_;
+  // For each local of the function that holds records which never escape
+  // it, the locals their fields are kept in instead of on the heap
+  std::unordered_map<Symbol, std::vector<std::pair<Symbol, int32_t>>>
+      scalars_;
+};
+
+std::unique_ptr<bytecode::Function> compile(ast::ASTNode &root);
+
+} // namespace compiler
@@ -0,0 +1,212 @@
+#include "./escape.hpp"
+
+#include <algorithm>
+
+namespace compiler {
+
+namespace {
+
+struct Candidate {
+  bool escapes = false;
+  // The block of the first literal assigned to the local, which every other
+  // mention must come later in
+  const ast::ASTNode *block = nullptr;
+  size_t mentions = 0;
+  std::vector<Symbol> fields;
+
+  void addField(Symbol field) {
+    if (std::find(fields.begin(), fields.end(), field) == fields.end()) {
+      fields.push_back(field);
+    }
+  }
+};
+
+} // namespace
+
+// Walks one function body in the order it runs, leaving nested function
+// bodies out: a local they use is captured, and the scope has excluded it.
+class EscapeAnalysis::Collector : public ast::Visitor {
+public:
+  explicit Collector(std::unordered_map<Symbol, Candidate> &candidates)
+      : candidates_(candidates) {}
+
+  void visit(ast::BinaryExpression &expr) override {
+    expr.leftOperand->accept(*this);
+    expr.rightOperand->accept(*this);
+  }
+
+  void visit(ast::UnaryExpression &expr) override {
+    expr.operand->accept(*this);
+  }
+
+  void visit(ast::FieldDereference &expr) override {
+    if (Candidate *c = candidate(*expr.baseExpression)) {
+      use(*c, expr.field);
+      return;
+    }
+    expr.baseExpression->accept(*this);
+  }
+
+  void visit(ast::IndexExpression &expr) override {
+    expr.baseExpression->accept(*this);
+    expr.index->accept(*this);
+  }
+
+  void visit(ast::Call &expr) override {
+    expr.targetExpression->accept(*this);
+    for (auto &arg : expr.arguments) {
+      arg->accept(*this);
+    }
+  }
+
+  void visit(ast::Record &expr) override {
+    for (auto &field : expr.fields) {
+      field.second->accept(*this);
+    }
+  }
+
+  void visit(ast::IntegerConstant &) override {}
+  void visit(ast::StringConstant &) override {}
+  void visit(ast::BooleanConstant &) override {}
+  void visit(ast::NoneConstant &) override {}
+
+  // Any use of the record itself rather than of a field lets it escape
+  void visit(ast::Identifier &expr) override {
+    if (Candidate *c = candidate(expr)) {
+      escape(*c);
+    }
+  }
+
+  void visit(ast::Block &stmt) override {
+    for (auto &statement : stmt.statements) {
+      statement->accept(*this);
+    }
+  }
+
+  void visit(ast::Assignment &stmt) override {
+    if (Candidate *c = candidate(*stmt.lhs)) {
+      auto *record = stmt.expr->as<ast::Record>();
+      if (!record) {
+        stmt.expr->accept(*this);
+        escape(*c);
+        return;
+      }
+      size_t mentions = c->mentions;
+      record->accept(*this);
+      if (c->mentions != mentions) {
+        c->escapes = true;
+      }
+      if (!c->block) {
+        c->block = blocks_.back();
+      } else {
+        check(*c);
+      }
+      c->mentions++;
+      for (auto &field : record->fields) {
+        c->addField(field.first);
+      }
+      return;
+    }
+    if (auto *field = stmt.lhs->as<ast::FieldDereference>()) {
+      if (Candidate *c = candidate(*field->baseExpression)) {
+        use(*c, field->field);
+        stmt.expr->accept(*this);
+        return;
+      }
+    }
+    stmt.lhs->accept(*this);
+    stmt.expr->accept(*this);
+  }
+
+  void visit(ast::Global &) override {}
+
+  void visit(ast::IfStatement &stmt) override {
+    stmt.condition->accept(*this);
+    nested(*stmt.thenPart);
+    if (stmt.elsePart) {
+      nested(*stmt.elsePart);
+    }
+  }
+
+  void visit(ast::WhileLoop &stmt) override {
+    stmt.condition->accept(*this);
+    nested(*stmt.body);
+  }
+
+  void visit(ast::Return &stmt) override { stmt.expression->accept(*this); }
+
+  void visit(ast::FunctionDeclaration &) override {}
+
+  // Visits a function body, branch or loop body, which may not run
+  void nested(ast::ASTNode &block) {
+    blocks_.push_back(&block);
+    block.accept(*this);
+    blocks_.pop_back();
+  }
+
+private:
+  Candidate *candidate(ast::ASTNode &node) {
+    auto *ident = node.as<ast::Identifier>();
+    if (!ident) {
+      return nullptr;
+    }
+    auto it = candidates_.find(ident->name);
+    return it == candidates_.end() ? nullptr : &it->second;
+  }
+
+  // A mention outside the block of the first literal, or before it, may
+  // run when no record has been built
+  void check(Candidate &c) {
+    if (std::find(blocks_.begin(), blocks_.end(), c.block) == blocks_.end()) {
+      c.escapes = true;
+    }
+  }
+
+  void use(Candidate &c, Symbol field) {
+    check(c);
+    c.mentions++;
+    c.addField(field);
+  }
+
+  void escape(Candidate &c) {
+    c.escapes = true;
+    c.mentions++;
+  }
+
+  std::unordered_map<Symbol, Candidate> &candidates_;
+  // The bodies around the statement being visited, innermost last
+  std::vector<const ast::ASTNode *> blocks_;
+};
+
+EscapeAnalysis::EscapeAnalysis(ast::ASTNode &body, const Scope &scope) {
+  // Variables of the top level are globals, which any function can see
+  if (scope.is_global) {
+    return;
+  }
+  std::unordered_map<Symbol, Candidate> candidates;
+  for (size_t l = scope.parameter_count; l < scope.locals.size(); ++l) {
+    if (scope.refIndex(scope.locals[l]) < 0) {
+      candidates[scope.locals[l]];
+    }
+  }
+  if (candidates.empty()) {
+    return;
+  }
+  Collector collector(candidates);
+  collector.nested(body);
+
+  for (const Symbol &local : scope.locals) {
+    auto it = candidates.find(local);
+    if (it != candidates.end() && it->second.block && !it->second.escapes) {
+      records_[local] = ScalarRecord{std::move(it->second.fields)};
+      locals_.push_back(local);
+    }
+  }
+}
+
+const ScalarRecord *EscapeAnalysis::scalar(Symbol local) const {
+  auto it = records_.find(local);
+  return it == records_.end() ? nullptr : &it->second;
+}
+
+} // namespace compiler
@@ -0,0 +1,46 @@
+#pragma once
+
+#include "ast.hpp"
+#include "./scope.hpp"
+
+#include <unordered_map>
+#include <vector>
+
+namespace compiler {
+
+// The fields of a record that never escapes the function building it
+struct ScalarRecord {
+  // Every field a literal assigned to the local has, or that the function
+  // reads or writes, in order of first appearance
+  std::vector<Symbol> fields;
+};
+
+// Finds the locals of one function that only ever hold records this
+// function builds and that nothing else can see. Such a local is assigned
+// nothing but record literals, and every other use of it reads or writes one
+// of its fields: it is never returned, passed, stored, compared, printed,
+// indexed or captured by a nested function. Its records then need no heap
+// object, and each of their fields can live in a local of its own.
+//
+// A field read before any write reads None, as on a record, as long as the
+// record exists. So the first mention of the local must assign it a
+// literal, every other mention must come after that in the same block,
+// nested or not, and no literal assigned to it may mention it.
+class EscapeAnalysis {
+public:
+  EscapeAnalysis(ast::ASTNode &body, const Scope &scope);
+
+  // The record in local, or nullptr if it needs a real one
+  const ScalarRecord *scalar(Symbol local) const;
+
+  // The locals that qualify, in the order of the scope's locals
+  const std::vector<Symbol> &locals() const { return locals_; }
+
+private:
+  class Collector;
+
+  std::unordered_map<Symbol, ScalarRecord> records_;
+  std::vector<Symbol> locals_;
+};
+
+} // namespace compiler
@@ -0,0 +1,182 @@
+#include "./scope.hpp"
+
+#include <algorithm>
+
+namespace compiler {
+
+static int32_t indexOf(const std::vector<Symbol> &names,
+                       Symbol name) {
+  auto it = std::find(names.begin(), names.end(), name);
+  return it == names.end() ? -1 : static_cast<int32_t>(it - names.begin());
+}
+
+static void addUnique(std::vector<Symbol> &names,
+                      Symbol name) {
+  if (indexOf(names, name) < 0) {
+    names.push_back(name);
+  }
+}
+
+int32_t Scope::localIndex(Symbol name) const {
+  auto it = local_index_.find(name);
+  return it == local_index_.end() ? -1 : it->second;
+}
+
+int32_t Scope::refIndex(Symbol name) const {
+  return indexOf(ref_vars, name);
+}
+
+int32_t Scope::freeIndex(Symbol name) const {
+  return indexOf(free_vars, name);
+}
+
+void Scope::addLocal(Symbol name) {
+  if (local_index_.count(name)) {
+    return;
+  }
+  local_index_[name] = static_cast<int32_t>(locals.size());
+  locals.push_back(name);
+}
+
+VarKind Scope::resolve(Symbol name) {
+  if (is_global || globals.count(name)) {
+    return VarKind::Global;
+  }
+  if (localIndex(name) >= 0) {
+    return VarKind::Local;
+  }
+
+  VarKind outer = parent->resolve(name);
+  if (outer == VarKind::Global) {
+    return VarKind::Global;
+  }
+  if (outer == VarKind::Local) {
+    addUnique(parent->ref_vars, name);
+  }
+  addUnique(free_vars, name);
+  return VarKind::Free;
+}
+
+// Records, for every function, its parameters, global declarations, assigned
+// names and used names. Nested function bodies are attributed to their own
+// scope.
+class ScopeAnalysis::Collector : public ast::Visitor {
+public:
+  Collector(ScopeAnalysis &analysis, Scope *scope)
+      : analysis_(analysis), scope_(scope) {}
+
+  void visit(ast::BinaryExpression &expr) override {
+    expr.leftOperand->accept(*this);
+    expr.rightOperand->accept(*this);
+  }
+
+  void visit(ast::UnaryExpression &expr) override {
+    expr.operand->accept(*this);
+  }
+
+  void visit(ast::FieldDereference &expr) override {
+    expr.baseExpression->accept(*this);
+  }
+
+  void visit(ast::IndexExpression &expr) override {
+    expr.baseExpression->accept(*this);
+    expr.index->accept(*this);
+  }
+
+  void visit(ast::Call &expr) override {
+    expr.targetExpression->accept(*this);
+    for (auto &arg : expr.arguments) {
+      arg->accept(*this);
+    }
+  }
+
+  void visit(ast::Record &expr) override {
+    for (auto &field : expr.fields) {
+      field.second->accept(*this);
+    }
+  }
+
+  void visit(ast::IntegerConstant &) override {}
+  void visit(ast::StringConstant &) override {}
+  void visit(ast::BooleanConstant &) override {}
+  void visit(ast::NoneConstant &) override {}
+
+  void visit(ast::Identifier &expr) override {
+    addUnique(scope_->uses, expr.name);
+  }
+
+  void visit(ast::Block &stmt) override {
+    for (auto &statement : stmt.statements) {
+      statement->accept(*this);
+    }
+  }
+
+  void visit(ast::Assignment &stmt) override {
+    if (auto *ident = stmt.lhs->as<ast::Identifier>()) {
+      addUnique(scope_->assigned_, ident->name);
+    }
+    stmt.lhs->accept(*this);
+    stmt.expr->accept(*this);
+  }
+
+  void visit(ast::Global &stmt) override { scope_->globals.insert(stmt.name); }
+
+  void visit(ast::IfStatement &stmt) override {
+    stmt.condition->accept(*this);
+    stmt.thenPart->accept(*this);
+    if (stmt.elsePart) {
+      stmt.elsePart->accept(*this);
+    }
+  }
+
+  void visit(ast::WhileLoop &stmt) override {
+    stmt.condition->accept(*this);
+    stmt.body->accept(*this);
+  }
+
+  void visit(ast::Return &stmt) override { stmt.expression->accept(*this); }
+
+  void visit(ast::FunctionDeclaration &stmt) override {
+    auto scope = std::make_unique<Scope>();
+    scope->parent = scope_;
+    for (const auto &argument : stmt.arguments) {
+      scope->addLocal(argument);
+    }
+    scope->parameter_count = scope->locals.size();
+
+    Scope *child = scope.get();
+    analysis_.ordered_.push_back(child);
+    analysis_.functions_[&stmt] = std::move(scope);
+
+    Collector collector(analysis_, child);
+    stmt.body->accept(collector);
+  }
+
+private:
+  ScopeAnalysis &analysis_;
+  Scope *scope_;
+};
+
+ScopeAnalysis::ScopeAnalysis(ast::ASTNode &root)
+    : global_(std::make_unique<Scope>()) {
+  global_->is_global = true;
+  Collector collector(*this, global_.get());
+  root.accept(collector);
+
+  // Locals must be complete everywhere before any name is resolved, since
+  // resolution inspects enclosing scopes
+  for (Scope *scope : ordered_) {
+    for (const auto &name : scope->assigned_) {
+      if (!scope->globals.count(name)) {
+        scope->addLocal(name);
+      }
+    }
+  }
+  for (Scope *scope : ordered_) {
+    for (const auto &name : scope->uses) {
+      scope->resolve(name);
+    }
+  }
+}
+
+} // namespace compiler
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "ast.hpp"
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace compiler {
+
+enum class VarKind { Global, Local, Free };
+
+// Static name resolution for one function body (or for the top level, whose
+// variables are all global).
+struct Scope {
+  Scope *parent = nullptr;
+  bool is_global = false;
+
+  // Parameters first, in declaration order, then every other variable
+  // assigned in the body that is not declared global
+  std::vector<Symbol> locals;
+  size_t parameter_count = 0;
+  std::unordered_set<Symbol> globals;
+
+  // Locals captured by a nested function
+  std::vector<Symbol> ref_vars;
+  // Variables of an enclosing function used here or in a nested function
+  std::vector<Symbol> free_vars;
+
+  // Every name read or assigned in this body, excluding nested functions
+  std::vector<Symbol> uses;
+
+  int32_t localIndex(Symbol name) const;
+  int32_t refIndex(Symbol name) const;
+  int32_t freeIndex(Symbol name) const;
+
+  // Classifies name as seen from this scope, registering it as a free and
+  // reference variable along the chain of enclosing scopes when captured
+  VarKind resolve(Symbol name);
+
+private:
+  std::unordered_map<Symbol, int32_t> local_index_;
+  std::vector<Symbol> assigned_;
+
+  void addLocal(Symbol name);
+
+  friend class ScopeAnalysis;
+};
+
+class ScopeAnalysis {
+public:
+  explicit ScopeAnalysis(ast::ASTNode &root);
+
+  Scope &global() { return *global_; }
+  Scope &of(const ast::FunctionDeclaration &function) {
+    return *functions_.at(&function);
+  }
+
+private:
+  class Collector;
+
+  std::unique_ptr<Scope> global_;
+  std::unordered_map<const ast::FunctionDeclaration *, std::unique_ptr<Scope>>
+      functions_;
+  // Scopes in the order their functions appear in the source
+  std::vector<Scope *> ordered_;
+};
+
+} // namespace compiler
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <exception>
+
+class UninitializedVariableException : public std::exception
+{
+public:
+    const char *what() const noexcept override
+    {
+        return "UninitializedVariableException";
+    }
+};
+
+class IllegalCastException : public std::exception
+{
+public:
+    const char *what() const noexcept override
+    {
+        return "IllegalCastException";
+    }
+};
+
+class IllegalArithmeticException : public std::exception
+{
+public:
+    const char *what() const noexcept override
+    {
+        return "IllegalArithmeticException";
+    }
+};
+
+class RuntimeException : public std::exception
+{
+public:
+    const char *what() const noexcept override
+    {
+        return "RuntimeException";
+    }
+};
@@ -0,0 +1,112 @@
+#include "gc/gc.hpp"
+
+#include <cxxabi.h>
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <typeindex>
+#include <typeinfo>
+#include <unordered_map>
+
+namespace
+{
+  std::string demangle(const char *name)
+  {
+    int status = 0;
+    char *readable = abi::__cxa_demangle(name, nullptr, nullptr, &status);
+    if (status != 0 || readable == nullptr)
+    {
+      return name;
+    }
+    std::string result(readable);
+    std::free(readable);
+    return result;
+  }
+
+  std::string milliseconds(std::chrono::steady_clock::duration duration)
+  {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(3)
+        << std::chrono::duration<double, std::milli>(duration).count() << " ms";
+    return out.str();
+  }
+}
+
+/*
+  One line per collection, then one line per type of object still live,
+  largest first.  A full collection leaves its pages pending, so the census
+  counts only the marked objects on those.
+*/
+void CollectedHeap::reportCollection(bool full, Clock::duration pause, size_t roots, Census before)
+{
+  totalPause_ += pause;
+  maxPause_ = std::max(maxPause_, pause);
+  peakBytes_ = std::max(peakBytes_, before.bytes);
+
+  std::cerr << "[gc] " << collections_ << (full ? " full: " : " young: ")
+            << milliseconds(pause) << ", " << roots << " roots, "
+            << before.bytes << " -> " << bytes_ << " bytes, "
+            << before.objects << " -> " << objects_ << " objects" << std::endl;
+  for (const TypeCensus &type : liveByType())
+  {
+    std::cerr << "[gc]   " << type.name << ": " << type.live.objects << " objects, "
+              << type.live.bytes << " bytes" << std::endl;
+  }
+}
+
+void CollectedHeap::reportSummary() const
+{
+  std::cerr << "[gc] summary: " << collections_ << " collections ("
+            << fullCollections_ << " full), " << milliseconds(totalPause_)
+            << " total pause, " << milliseconds(maxPause_) << " max pause, "
+            << std::max(peakBytes_, bytes_) << " bytes peak, "
+            << allocatedBytes_ << " bytes allocated, " << bytes_
+            << " bytes held at exit" << std::endl;
+}
+
+std::vector<CollectedHeap::TypeCensus> CollectedHeap::liveByType() const
+{
+  std::vector<TypeCensus> types;
+  std::unordered_map<std::type_index, size_t> index;
+  auto count = [&](const Collectable *obj)
+  {
+    const std::type_info &type = typeid(*obj);
+    auto [it, inserted] = index.try_emplace(std::type_index(type), types.size());
+    if (inserted)
+    {
+      types.push_back(TypeCensus{demangle(type.name()), Census{0, 0}});
+    }
+    Census &live = types[it->second].live;
+    live.bytes += obj->size;
+    live.objects++;
+  };
+
+  for (const SizeClass &pool : classes_)
+  {
+    for (Page *page : pool.pages)
+    {
+      for (size_t i = 0; i < page->slotCount; i++)
+      {
+        if (!page->isUsed(i))
+        {
+          continue;
+        }
+        const Collectable *obj = reinterpret_cast<const Collectable *>(page->slot(i));
+        if (!page->pending || obj->mark)
+        {
+          count(obj);
+        }
+      }
+    }
+  }
+  for (const Collectable *obj = root; obj != nullptr; obj = obj->next)
+  {
+    count(obj);
+  }
+
+  std::sort(types.begin(), types.end(), [](const TypeCensus &a, const TypeCensus &b)
+            { return a.live.bytes != b.live.bytes ? a.live.bytes > b.live.bytes : a.name < b.name; });
+  return types;
+}
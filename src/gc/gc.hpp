@@ -1,9 +1,36 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
 class CollectedHeap;
 
+// How a CollectedHeap is sized and what it reports, usually taken from the
+// command line
+struct HeapOptions
+{
+  // Bytes the heap may hold before a collection is due
+  size_t limit = SIZE_MAX;
+  // Threads that mark during a full collection
+  unsigned markThreads = 1;
+  // Report every collection, and a summary when the heap is destroyed, on
+  // standard error
+  bool stats = false;
+};
+
 // Any object that inherits from collectable can be created and tracked by the
 // garbage collector.
 class Collectable
@@ -17,6 +44,13 @@ private:
   // these fields as the header for the object, which will include metadata that
   // is useful for the garbage collector.
   bool mark = false;
+  // Survived a collection (or was allocated) into the old generation
+  bool old = false;
+  // Old object listed in the remembered set
+  bool remembered = false;
+  // Bytes charged against the heap budget when this object was allocated
+  uint32_t size = 0;
+  // Only used for objects too large for the size-class pages
   Collectable *next = nullptr;
 
 protected:
@@ -41,12 +75,127 @@ protected:
   - keep track of all currently allocated objects
   - provide and implement a method that performs mark and sweep to deallocate
     objects that are not reachable from a given set of objects
+
+  Objects up to kMaxPooledSize bytes are placed in fixed-size slots carved out
+  of aligned pages, one set of pages per 16-byte size class.  Each page starts
+  with a bitmap of the slots that hold a live object, so the sweep walks pages
+  linearly instead of chasing a list through the heap, and freed slots are
+  threaded onto a per-class free list that allocation pops from.  Larger
+  objects fall back to operator new and the intrusive list starting at root.
+
+  The heap is generational without moving anything.  Pooled objects are born
+  young and listed in the nursery; a young collection marks from the roots
+  and the remembered set only, never tracing into old objects, then frees the
+  unmarked nursery objects and promotes the survivors to old in place.  Old
+  objects that may point at young ones are found through the remembered set,
+  which the mutator maintains by calling writeBarrier() after every store of
+  a value into an existing heap object.  Large objects are allocated old.  A
+  full collection marks everything, and runs when what survives a young
+  collection takes the whole heap past its threshold.
+
+  A full collection may mark on several threads, each with its own mark
+  stack; threads that run out of work steal batches from the others.  Its
+  sweep of the pages is lazy: every page is left pending, and the allocator
+  sweeps a pending page of a class when the class runs out of free slots, or
+  before it allocates into that page.  Whatever is still pending is swept
+  when the next collection starts.  Survivors are promoted as they are
+  marked, so the mutator never sees a live young object outside the nursery.
 */
 class CollectedHeap
 {
 public:
+  // Objects too large for any size class
   Collectable *root = nullptr;
 
+  CollectedHeap() = default;
+  CollectedHeap(const CollectedHeap &) = delete;
+  CollectedHeap &operator=(const CollectedHeap &) = delete;
+
+  ~CollectedHeap()
+  {
+    if (stats_)
+    {
+      reportSummary();
+    }
+
+    while (root != nullptr)
+    {
+      Collectable *temp = root;
+      root = root->next;
+      delete temp;
+    }
+
+    for (SizeClass &sizeClass : classes_)
+    {
+      for (Page *page : sizeClass.pages)
+      {
+        for (size_t i = 0; i < page->slotCount; i++)
+        {
+          if (page->isUsed(i))
+          {
+            reinterpret_cast<Collectable *>(page->slot(i))->~Collectable();
+          }
+        }
+        page->~Page();
+        ::operator delete(page, std::align_val_t(kPageSize));
+      }
+    }
+  }
+
+  /*
+  Sets the number of bytes the heap may hold before a collection is due.  The
+  first collection is scheduled at half the limit so that the objects that
+  survive it still leave room to grow.
+  */
+  void setLimit(size_t bytes)
+  {
+    limit_ = bytes;
+    threshold_ = bytes / 2;
+    nurseryLimit_ = bytes / 8;
+  }
+
+  void configure(const HeapOptions &options)
+  {
+    setLimit(options.limit);
+    setMarkThreads(options.markThreads);
+    stats_ = options.stats;
+  }
+
+  size_t bytes() const { return bytes_; }
+
+  // Objects and bytes allocated over the life of the heap, freed or not
+  size_t allocations() const { return allocations_; }
+  size_t allocatedBytes() const { return allocatedBytes_; }
+  // Collections run over the life of the heap, young or full
+  size_t collections() const { return collections_; }
+
+  /*
+  Sets the number of threads that mark during a full collection.  Young
+  collections only trace the nursery and always mark on the calling thread.
+  */
+  void setMarkThreads(unsigned threads) { markThreads_ = std::max(1u, threads); }
+
+  /*
+  True once the nursery is full or the whole heap exceeds the current
+  threshold.  The VM polls this at points where its whole root set is known
+  and calls gc(...) when it returns true.
+  */
+  bool shouldCollect() const { return youngBytes_ >= nurseryLimit_ || bytes_ >= threshold_; }
+
+  /*
+  Records that owner now holds a pointer to target.  Must be called after
+  every store into a field, cell or other slot of an object that may already
+  be old.  Only a store into an object that no collection has run since it
+  was allocated can skip the barrier.
+  */
+  void writeBarrier(Collectable *owner, Collectable *target)
+  {
+    if (owner->old && !owner->remembered && target != nullptr && !target->old)
+    {
+      remember(owner);
+    }
+  }
+
   /*
   This method allocates an object of type T, passing args to the constructor.
   T must be a subclass of Collectable.  Before returning the
@@ -58,32 +207,95 @@ public:
     static_assert(std::is_base_of_v<Collectable, T>, "T must derive from Collectable");
     static_assert(std::is_constructible_v<T, Args...>, "T must be constructible with Args");
 
-    T *obj = new T(std::forward<Args>(args)...);
+    T *obj;
+    if constexpr (sizeof(T) <= kMaxPooledSize && alignof(T) <= kGranule)
+    {
+      constexpr size_t sizeClass = (sizeof(T) + kGranule - 1) / kGranule - 1;
+      void *slot = takeSlot(sizeClass);
+      try
+      {
+        obj = new (slot) T(std::forward<Args>(args)...);
+      }
+      catch (...)
+      {
+        returnSlot(sizeClass, slot);
+        throw;
+      }
+      // The sweep finds objects through their slot address
+      assert(static_cast<void *>(static_cast<Collectable *>(obj)) == slot);
+      pageOf(slot)->setUsed(slot);
+      obj->size = static_cast<uint32_t>((sizeClass + 1) * kGranule);
+      nursery_.push_back(obj);
+    }
+    else
+    {
+      obj = new T(std::forward<Args>(args)...);
+      obj->next = root;
+      root = obj;
+      obj->size = static_cast<uint32_t>(sizeof(T));
+      // Freeing a young large object would mean unlinking it from the list,
+      // so they start old and are remembered in case they point at young
+      // objects from birth
+      obj->old = true;
+      remember(obj);
+    }
     obj->mark = false;
-    obj->next = root;
-    root = obj;
+
+    // Objects that own out-of-line storage, such as string contents, report
+    // it so that the budget reflects what they actually hold
+    if constexpr (requires { obj->extraBytes(); })
+    {
+      obj->size += static_cast<uint32_t>(obj->extraBytes());
+    }
+    bytes_ += obj->size;
+    youngBytes_ += obj->size;
+    objects_++;
+    allocations_++;
+    allocatedBytes_ += obj->size;
 
     return obj;
   }
 
-  /*
-  For performance reasons, you may also want to specialize the allocate
-  methods to allocate particular kinds of objects...
-  */
-
   /*
   This is the method that is called by the follow(...) method of a Collectable
   object.  This is how a Collectable object lets the garbage collector know
   about other Collectable objects pointed to by itself.
+
+  Marking recurses depth first, which visits structures in the order they
+  were allocated, but only kMaxMarkDepth levels deep.  Past that an object is
+  queued on an explicit worklist that is drained once the recursion unwinds,
+  so long linked lists and deep trees no longer overflow the C++ stack.
   */
   void markSuccessors(Collectable *next)
   {
-    if (next == nullptr || next->mark)
+    if (next == nullptr)
+    {
+      return;
+    }
+    if (marker_ != nullptr)
+    {
+      claim(*marker_, next);
+      return;
+    }
+    if (next->mark || (next->old && !fullCollection_))
     {
       return;
     }
     next->mark = true;
+    if (fullCollection_)
+    {
+      next->old = true;
+      markedBytes_ += next->size;
+      markedObjects_++;
+    }
+    if (markDepth_ >= kMaxMarkDepth)
+    {
+      worklist_.push_back(next);
+      return;
+    }
+    markDepth_++;
     next->follow(*this);
+    markDepth_--;
   }
 
   /*
@@ -97,22 +309,451 @@ public:
   The Iterator type should support comparison, assignment and the ++ operator.
   It should also be able to dereference an iterator to get a Collectable
   object.  This method will take iterators marking the [begin, end) range of
-  the rootset as arguments.
+  the rootset as arguments.  The range is walked a second time when a young
+  collection is followed by a full one.
   */
   template <typename Iterator>
   void gc(Iterator begin, Iterator end)
   {
-    // Mark phase - mark all roots and their successors
+    Clock::time_point start = stats_ ? Clock::now() : Clock::time_point();
+    Census before{bytes_, objects_};
+
+    finishSweeping();
+    // The old generation only grows through promotion, so a full collection
+    // is due once what survives the nursery takes the heap past its threshold
+    collectYoung(begin, end);
+    bool full = bytes_ >= threshold_;
+    if (full)
+    {
+      collectFull(begin, end);
+      fullCollections_++;
+    }
+    collections_++;
+
+    if (stats_)
+    {
+      Clock::duration pause = Clock::now() - start;
+      size_t roots = 0;
+      for (Iterator it = begin; it != end; ++it)
+      {
+        roots++;
+      }
+      reportCollection(full, pause, roots, before);
+    }
+  }
+
+private:
+  template <typename Iterator>
+  void markRoots(Iterator begin, Iterator end)
+  {
     for (Iterator it = begin; it != end; ++it)
     {
-      Collectable *obj = *it;
-      if (obj != nullptr)
+      markSuccessors(*it);
+    }
+    drainWorklist();
+  }
+
+  void drainWorklist()
+  {
+    while (!worklist_.empty())
+    {
+      Collectable *obj = worklist_.back();
+      worklist_.pop_back();
+      obj->follow(*this);
+    }
+  }
+
+  // Marks the young objects reachable from the roots and from remembered old
+  // objects, frees the rest of the nursery and promotes what survived.  The
+  // nursery is empty afterwards, so no old object points at a young one and
+  // the remembered set starts over.
+  template <typename Iterator>
+  void collectYoung(Iterator begin, Iterator end)
+  {
+    markRoots(begin, end);
+    for (Collectable *obj : remembered_)
+    {
+      obj->follow(*this);
+      obj->remembered = false;
+    }
+    remembered_.clear();
+    drainWorklist();
+
+    for (Collectable *obj : nursery_)
+    {
+      if (obj->mark)
       {
-        markSuccessors(obj);
+        obj->mark = false;
+        obj->old = true;
+        continue;
       }
+      bytes_ -= obj->size;
+      objects_--;
+      Page *page = pageOf(obj);
+      size_t sizeClass = page->slotSize / kGranule - 1;
+      obj->~Collectable();
+      page->clearUsed(page->indexOf(obj));
+      returnSlot(sizeClass, obj);
+    }
+    nursery_.clear();
+    youngBytes_ = 0;
+  }
+
+  template <typename Iterator>
+  void collectFull(Iterator begin, Iterator end)
+  {
+    for (Collectable *obj : remembered_)
+    {
+      obj->remembered = false;
+    }
+    remembered_.clear();
+    nursery_.clear();
+
+    // Only what is marked survives, so the marked bytes are what the heap
+    // holds once pending pages have been swept
+    fullCollection_ = true;
+    markedBytes_ = 0;
+    markedObjects_ = 0;
+    if (markThreads_ > 1)
+    {
+      markRootsParallel(begin, end);
+    }
+    else
+    {
+      markRoots(begin, end);
     }
+    fullCollection_ = false;
+    bytes_ = markedBytes_;
+    objects_ = markedObjects_;
+    youngBytes_ = 0;
 
-    // Sweep phase - deallocate unmarked objects and reset marks
+    sweepLarge();
+    for (SizeClass &pool : classes_)
+    {
+      for (Page *page : pool.pages)
+      {
+        page->pending = true;
+      }
+      pool.sweepCursor = 0;
+    }
+
+    // Let the heap grow to twice what survived, capped at the limit, but
+    // always leave some headroom so a nearly full heap does not collect on
+    // every poll
+    threshold_ = std::max(std::min(limit_, 2 * bytes_), bytes_ + limit_ / 8);
+  }
+
+  void remember(Collectable *obj)
+  {
+    obj->remembered = true;
+    remembered_.push_back(obj);
+  }
+
+  static constexpr size_t kStealBatch = 64;
+
+  // Mark stack of one thread of a parallel full collection.  The thread
+  // works on local without locking and moves batches from its bottom to
+  // shared whenever shared is empty, for idle threads to steal.
+  struct alignas(64) Marker
+  {
+    std::vector<Collectable *> local;
+    std::mutex lock;
+    std::vector<std::vector<Collectable *>> shared;
+    std::atomic<size_t> sharedCount{0};
+    size_t markedBytes = 0;
+    size_t markedObjects = 0;
+  };
+
+  // The marker of the current thread while it takes part in a parallel mark
+  static inline thread_local Marker *marker_ = nullptr;
+
+  // Marks obj for the calling marker unless another thread marked it first
+  void claim(Marker &marker, Collectable *obj)
+  {
+    std::atomic_ref<bool> mark(obj->mark);
+    if (mark.load(std::memory_order_relaxed) || mark.exchange(true, std::memory_order_relaxed))
+    {
+      return;
+    }
+    obj->old = true;
+    marker.markedBytes += obj->size;
+    marker.markedObjects++;
+    marker.local.push_back(obj);
+  }
+
+  template <typename Iterator>
+  void markRootsParallel(Iterator begin, Iterator end)
+  {
+    std::vector<std::unique_ptr<Marker>> markers;
+    for (unsigned i = 0; i < markThreads_; i++)
+    {
+      markers.push_back(std::make_unique<Marker>());
+    }
+    size_t next = 0;
+    for (Iterator it = begin; it != end; ++it)
+    {
+      if (*it != nullptr)
+      {
+        claim(*markers[next++ % markers.size()], *it);
+      }
+    }
+
+    std::atomic<unsigned> active(markThreads_);
+    std::vector<std::thread> threads;
+    for (unsigned i = 1; i < markThreads_; i++)
+    {
+      threads.emplace_back([this, &markers, &active, i]() { runMarker(markers, i, active); });
+    }
+    runMarker(markers, 0, active);
+    for (std::thread &thread : threads)
+    {
+      thread.join();
+    }
+
+    for (const std::unique_ptr<Marker> &marker : markers)
+    {
+      markedBytes_ += marker->markedBytes;
+      markedObjects_ += marker->markedObjects;
+    }
+  }
+
+  // Marks until every thread is out of work.  A thread only goes idle with
+  // its own stacks empty and only a busy thread pushes work, so once no
+  // thread is busy there is nothing left to mark.
+  void runMarker(std::vector<std::unique_ptr<Marker>> &markers, size_t self, std::atomic<unsigned> &active)
+  {
+    Marker &marker = *markers[self];
+    marker_ = &marker;
+    for (;;)
+    {
+      while (!marker.local.empty())
+      {
+        Collectable *obj = marker.local.back();
+        marker.local.pop_back();
+        obj->follow(*this);
+        if (marker.local.size() >= 2 * kStealBatch && marker.sharedCount.load(std::memory_order_relaxed) == 0)
+        {
+          share(marker);
+        }
+      }
+      if (steal(markers, self))
+      {
+        continue;
+      }
+
+      active.fetch_sub(1);
+      bool found = false;
+      while (!found && active.load() != 0)
+      {
+        for (const std::unique_ptr<Marker> &other : markers)
+        {
+          if (other->sharedCount.load() != 0)
+          {
+            active.fetch_add(1);
+            found = steal(markers, self);
+            if (!found)
+            {
+              active.fetch_sub(1);
+            }
+            break;
+          }
+        }
+        if (!found)
+        {
+          std::this_thread::yield();
+        }
+      }
+      if (!found)
+      {
+        break;
+      }
+    }
+    marker_ = nullptr;
+  }
+
+  void share(Marker &marker)
+  {
+    auto batchEnd = marker.local.begin() + kStealBatch;
+    std::vector<Collectable *> batch(marker.local.begin(), batchEnd);
+    marker.local.erase(marker.local.begin(), batchEnd);
+    std::lock_guard<std::mutex> guard(marker.lock);
+    marker.shared.push_back(std::move(batch));
+    marker.sharedCount.fetch_add(1);
+  }
+
+  // Moves a shared batch into the local stack of markers[self], trying its
+  // own batches first
+  bool steal(std::vector<std::unique_ptr<Marker>> &markers, size_t self)
+  {
+    for (size_t i = 0; i < markers.size(); i++)
+    {
+      Marker &victim = *markers[(self + i) % markers.size()];
+      if (victim.sharedCount.load() == 0)
+      {
+        continue;
+      }
+      std::lock_guard<std::mutex> guard(victim.lock);
+      if (victim.shared.empty())
+      {
+        continue;
+      }
+      markers[self]->local = std::move(victim.shared.back());
+      victim.shared.pop_back();
+      victim.sharedCount.fetch_sub(1);
+      return true;
+    }
+    return false;
+  }
+
+  static constexpr size_t kPageSize = 64 * 1024;
+  static constexpr size_t kGranule = 16;
+  static constexpr size_t kClassCount = 16;
+  static constexpr size_t kMaxPooledSize = kGranule * kClassCount;
+  static constexpr size_t kUsedWords = kPageSize / kGranule / 64;
+
+  // A free slot holds the link to the next free slot of its class
+  struct FreeSlot
+  {
+    FreeSlot *next;
+  };
+
+  // Header at the start of every kPageSize-aligned page; the slots follow it
+  struct Page
+  {
+    size_t slotSize;
+    size_t slotCount;
+    // Holds objects of a full collection that have not been swept yet
+    bool pending = false;
+    uint64_t used[kUsedWords] = {};
+
+    char *slot(size_t i) { return reinterpret_cast<char *>(this) + kSlotsOffset + i * slotSize; }
+    size_t indexOf(const void *slot) const
+    {
+      return (static_cast<const char *>(slot) - reinterpret_cast<const char *>(this) - kSlotsOffset) / slotSize;
+    }
+
+    bool isUsed(size_t i) const { return (used[i / 64] >> (i % 64)) & 1; }
+    void setUsed(const void *slot)
+    {
+      size_t i = indexOf(slot);
+      used[i / 64] |= uint64_t{1} << (i % 64);
+    }
+    void clearUsed(size_t i) { used[i / 64] &= ~(uint64_t{1} << (i % 64)); }
+  };
+
+  static constexpr size_t kSlotsOffset = (sizeof(Page) + kGranule - 1) / kGranule * kGranule;
+
+  struct SizeClass
+  {
+    std::vector<Page *> pages;
+    FreeSlot *free = nullptr;
+    // Pages before this one have been swept since the last full collection
+    size_t sweepCursor = 0;
+  };
+
+  static Page *pageOf(const void *slot)
+  {
+    return reinterpret_cast<Page *>(reinterpret_cast<uintptr_t>(slot) & ~(kPageSize - 1));
+  }
+
+  void *takeSlot(size_t sizeClass)
+  {
+    SizeClass &pool = classes_[sizeClass];
+    while (pool.free == nullptr && pool.sweepCursor < pool.pages.size())
+    {
+      sweepPage(sizeClass, pool.pages[pool.sweepCursor++]);
+    }
+    if (pool.free == nullptr)
+    {
+      addPage(sizeClass);
+    }
+    FreeSlot *slot = pool.free;
+    pool.free = slot->next;
+    // An unmarked new object would be taken for garbage by the pending sweep
+    Page *page = pageOf(slot);
+    if (page->pending)
+    {
+      sweepPage(sizeClass, page);
+    }
+    return slot;
+  }
+
+  void returnSlot(size_t sizeClass, void *slot)
+  {
+#ifndef NDEBUG
+    // Make reads through a pointer the collector missed fail loudly
+    std::memset(slot, 0xdb, (sizeClass + 1) * kGranule);
+#endif
+    FreeSlot *freed = static_cast<FreeSlot *>(slot);
+    freed->next = classes_[sizeClass].free;
+    classes_[sizeClass].free = freed;
+  }
+
+  void addPage(size_t sizeClass)
+  {
+    void *memory = ::operator new(kPageSize, std::align_val_t(kPageSize));
+    Page *page = new (memory) Page();
+    page->slotSize = (sizeClass + 1) * kGranule;
+    page->slotCount = (kPageSize - kSlotsOffset) / page->slotSize;
+
+    classes_[sizeClass].pages.push_back(page);
+    classes_[sizeClass].sweepCursor = classes_[sizeClass].pages.size();
+    // Thread the slots back to front so allocation proceeds in address order
+    for (size_t i = page->slotCount; i-- > 0;)
+    {
+      returnSlot(sizeClass, page->slot(i));
+    }
+  }
+
+  // Destroys every unmarked object of a pending page and pushes its slot
+  // onto the free list of its class.  The bitmap is walked one word at a
+  // time, so runs of empty slots cost nothing.  The heap budget already
+  // stopped counting these objects when the full collection ended.
+  void sweepPage(size_t sizeClass, Page *page)
+  {
+    if (!page->pending)
+    {
+      return;
+    }
+    page->pending = false;
+    for (size_t w = 0; w < kUsedWords; w++)
+    {
+      uint64_t bits = page->used[w];
+      while (bits != 0)
+      {
+        size_t i = w * 64 + std::countr_zero(bits);
+        bits &= bits - 1;
+
+        Collectable *obj = reinterpret_cast<Collectable *>(page->slot(i));
+        if (obj->mark)
+        {
+          obj->mark = false;
+          continue;
+        }
+        obj->~Collectable();
+        page->clearUsed(i);
+        returnSlot(sizeClass, page->slot(i));
+      }
+    }
+  }
+
+  // Marks start out clear in every collection
+  void finishSweeping()
+  {
+    for (size_t sizeClass = 0; sizeClass < kClassCount; sizeClass++)
+    {
+      SizeClass &pool = classes_[sizeClass];
+      while (pool.sweepCursor < pool.pages.size())
+      {
+        sweepPage(sizeClass, pool.pages[pool.sweepCursor++]);
+      }
+    }
+  }
+
+  // Sweep phase for large objects - deallocate unmarked objects and reset
+  // marks
+  void sweepLarge()
+  {
     Collectable *sweep = root;
     Collectable *prev = nullptr;
     while (sweep != nullptr)
@@ -141,4 +782,58 @@ public:
       }
     }
   }
+
+  using Clock = std::chrono::steady_clock;
+
+  struct Census
+  {
+    size_t bytes;
+    size_t objects;
+  };
+
+  // Live objects and bytes per dynamic type, for the statistics
+  struct TypeCensus
+  {
+    std::string name;
+    Census live;
+  };
+
+  // Defined in gc.cpp, since they only run with statistics on
+  void reportCollection(bool full, Clock::duration pause, size_t roots, Census before);
+  void reportSummary() const;
+  std::vector<TypeCensus> liveByType() const;
+
+  SizeClass classes_[kClassCount];
+
+  // Pooled objects allocated since the last collection
+  std::vector<Collectable *> nursery_;
+  // Old objects that may point at young ones
+  std::vector<Collectable *> remembered_;
+  static constexpr int kMaxMarkDepth = 256;
+
+  // Marked objects whose successors are still to be marked; kept between
+  // collections to reuse its storage
+  std::vector<Collectable *> worklist_;
+  int markDepth_ = 0;
+  bool fullCollection_ = false;
+  unsigned markThreads_ = 1;
+  size_t markedBytes_ = 0;
+  size_t markedObjects_ = 0;
+
+  size_t objects_ = 0;
+  bool stats_ = false;
+  // Totals over the life of the heap, for the summary and --stats
+  size_t collections_ = 0;
+  size_t fullCollections_ = 0;
+  size_t allocations_ = 0;
+  size_t allocatedBytes_ = 0;
+  size_t peakBytes_ = 0;
+  Clock::duration totalPause_{};
+  Clock::duration maxPause_{};
+
+  size_t bytes_ = 0;
+  size_t youngBytes_ = 0;
+  size_t limit_ = SIZE_MAX;
+  size_t threshold_ = SIZE_MAX;
+  size_t nurseryLimit_ = SIZE_MAX;
 };
@@ -0,0 +1,130 @@
+#pragma once
+#include <cassert>
+#include <cstdint>
+#include <type_traits>
+#include <variant>
+
+/*
+  A value packed into a single machine word.  None, booleans and 32-bit
+  integers are immediates; everything else is a pointer to one of the Pointees
+  types.  The low three bits of the word are the tag, which is why every
+  pointee must be at least 8-byte aligned (objects from CollectedHeap are
+  16-byte aligned), and immediates keep their payload in the upper 32 bits.
+
+  Two values are the same value exactly when their words are equal, which
+  gives by-value equality for immediates and identity for pointers.
+*/
+template <typename... Pointees>
+class TaggedValue
+{
+  static_assert(sizeof(uintptr_t) == 8, "TaggedValue needs 64-bit words");
+  static_assert(sizeof...(Pointees) <= 5, "only five pointer tags are available");
+
+public:
+  enum Tag : uintptr_t
+  {
+    NoneTag = 0,
+    BoolTag = 1,
+    IntTag = 2,
+    FirstPointerTag = 3,
+  };
+
+  static constexpr uintptr_t kTagMask = 7;
+
+  TaggedValue() : bits_(NoneTag) {}
+  TaggedValue(bool b) : bits_(static_cast<uintptr_t>(b) << 32 | BoolTag) {}
+  TaggedValue(int32_t n) : bits_(static_cast<uintptr_t>(static_cast<uint32_t>(n)) << 32 | IntTag) {}
+
+  template <typename T, typename = std::enable_if_t<(std::is_same_v<T, Pointees> || ...)>>
+  TaggedValue(T *p) : bits_(reinterpret_cast<uintptr_t>(p) | tagOf<T>())
+  {
+    assert(p != nullptr && (reinterpret_cast<uintptr_t>(p) & kTagMask) == 0);
+  }
+
+  uintptr_t tag() const { return bits_ & kTagMask; }
+  uintptr_t bits() const { return bits_; }
+
+  // T is std::monostate for None, bool, int32_t, or a pointer to one of the
+  // Pointees
+  template <typename T>
+  bool is() const
+  {
+    if constexpr (std::is_same_v<T, std::monostate>)
+    {
+      return bits_ == NoneTag;
+    }
+    else if constexpr (std::is_same_v<T, bool>)
+    {
+      return tag() == BoolTag;
+    }
+    else if constexpr (std::is_same_v<T, int32_t>)
+    {
+      return tag() == IntTag;
+    }
+    else
+    {
+      static_assert(std::is_pointer_v<T>, "not a type a TaggedValue can hold");
+      return tag() == tagOf<std::remove_pointer_t<T>>();
+    }
+  }
+
+  // The caller must have checked is<T>() first
+  template <typename T>
+  T as() const
+  {
+    assert(is<T>());
+    if constexpr (std::is_same_v<T, bool>)
+    {
+      return (bits_ >> 32) != 0;
+    }
+    else if constexpr (std::is_same_v<T, int32_t>)
+    {
+      return static_cast<int32_t>(static_cast<uint32_t>(bits_ >> 32));
+    }
+    else
+    {
+      return reinterpret_cast<T>(bits_ & ~kTagMask);
+    }
+  }
+
+  /*
+  The pointee viewed as a Base, or nullptr for immediates and for pointees
+  that do not derive from Base.  With Base = Collectable this is what a
+  collector needs to mark through a value.
+  */
+  template <typename Base>
+  Base *pointer() const
+  {
+    Base *result = nullptr;
+    ((result = is<Pointees *>() ? upcast<Base>(as<Pointees *>()) : result), ...);
+    return result;
+  }
+
+  bool operator==(const TaggedValue &other) const { return bits_ == other.bits_; }
+  bool operator!=(const TaggedValue &other) const { return bits_ != other.bits_; }
+
+private:
+  template <typename T>
+  static constexpr uintptr_t tagOf()
+  {
+    uintptr_t tag = FirstPointerTag;
+    uintptr_t result = 0;
+    ((result = std::is_same_v<T, Pointees> ? tag : result, ++tag), ...);
+    return result;
+  }
+
+  template <typename Base, typename T>
+  static Base *upcast(T *p)
+  {
+    if constexpr (std::is_base_of_v<Base, T>)
+    {
+      return p;
+    }
+    else
+    {
+      return nullptr;
+    }
+  }
+
+  uintptr_t bits_;
+};
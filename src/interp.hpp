@@ -3,17 +3,23 @@
 #include "parser.hpp"
 #include "ast.hpp"
 #include "gc/gc.hpp"
+#include "gc/tagged.hpp"
+#include "exceptions.hpp"
+#include "compiler/scope.hpp"
+#include "shape.hpp"
+#include "text.hpp"
+#include "io.hpp"
 
 #include <string>
 #include <vector>
-#include <stack>
-#include <optional>
 #include <algorithm>
+#include <functional>
+#include <optional>
 #include <unordered_map>
-#include <unordered_set>
 #include <iostream>
 #include <variant>
-#include <set>
+#include <cstdint>
+#include <sys/resource.h>
 
 #define DEBUG_INTERP false
 
@@ -21,292 +27,630 @@ class Value;
 class Record;
 class Function;
 
-class UninitializedVariableException : public std::exception
+// Concatenation extends a shared buffer in place where it can; see Text
+using String = Text;
+
+// Integers, booleans and None are immediates; strings, records and functions
+// point into the collected heap
+class Value : public TaggedValue<String, Record, Function>
 {
 public:
-    const char *what() const noexcept override
-    {
-        return "UninitializedVariableException";
-    }
+    using TaggedValue::TaggedValue;
+
+    Collectable *object() const;
+    void follow(CollectedHeap &heap) const;
 };
 
-class IllegalCastException : public std::exception
+// A variable captured by a nested function, shared between the frame that
+// owns it and every closure that captured it
+class Reference : public Collectable
 {
 public:
-    const char *what() const noexcept override
-    {
-        return "IllegalCastException";
-    }
+    Value value;
+
+    Reference(Value v) : value(v) {}
+
+protected:
+    void follow(CollectedHeap &heap) override;
 };
 
-class IllegalArithmeticException : public std::exception
+// The tree compiled to closures, for the closure execution mode. An
+// expression is called for its value, a test for the truth of a condition,
+// and a statement for the value of the return it executed, if it did.
+using CompiledExpr = std::function<Value()>;
+using CompiledTest = std::function<bool()>;
+using CompiledStmt = std::function<std::optional<Value>()>;
+
+// Static layout of one function body, computed once by the Resolver
+struct FunctionLayout
 {
-public:
-    const char *what() const noexcept override
-    {
-        return "IllegalArithmeticException";
-    }
+    ast::Block *body = nullptr;
+    size_t parameterCount = 0;
+    size_t localCount = 0;
+    // The local slot boxed by each reference cell, by cell index
+    std::vector<int> cellLocals;
+    // For each free variable, where the enclosing function keeps its cell
+    // (a Cell or Free slot) when a closure is created
+    std::vector<ast::VariableSlot> captures;
+    // The body, compiled before the program runs in the closure mode
+    CompiledStmt code;
 };
 
-class RuntimeException : public std::exception
+class Record : public Collectable
 {
 public:
-    const char *what() const noexcept override
-    {
-        return "RuntimeException";
-    }
+    ShapedFields<Value> fields;
+
+    explicit Record(Shape *empty) : fields(empty) {}
+
+protected:
+    void follow(CollectedHeap &heap) override;
 };
 
-class Frame : public Collectable
+class Function : public Collectable
 {
 public:
-    using VarMap = std::unordered_map<std::string, Value *>;
+    const FunctionLayout *layout;
+    std::vector<Reference *> freeCells;
 
-    struct GlobalInfo
-    {
-        std::unordered_set<std::string> globals;
-        Frame *globalFrame;
-    };
-
-private:
-    VarMap variables;
-    Frame *parent;
-    GlobalInfo global;
+    Function(const FunctionLayout *layoutAddr, std::vector<Reference *> cells)
+        : layout(layoutAddr), freeCells(std::move(cells)) {}
 
 protected:
     void follow(CollectedHeap &heap) override;
+};
 
-public:
-    Frame(Frame *parentAddr = nullptr)
-        : parent(parentAddr), global(parentAddr ? parent->global : GlobalInfo{{}, this}) {}
+// The activation of a call. Frames live on the interpreter's own stack, so
+// only their contents need to be reported to the collector.
+struct Frame
+{
+    Function *function;
+    std::vector<Value> locals;
+    std::vector<Reference *> cells;
+};
+
+inline void Reference::follow(CollectedHeap &heap)
+{
+    value.follow(heap);
+}
 
-    void setVar(const std::string &name, Value *addr)
+inline void Record::follow(CollectedHeap &heap)
+{
+    // Follow all values in the record's fields
+    for (const Value &v : fields.values())
     {
-        if (DEBUG_INTERP)
-            std::cerr << "[DEBUG] Setting variable '" << name << "' at frame " << this << std::endl;
-        variables[name] = addr;
+        v.follow(heap);
     }
+}
 
-    static Frame *lookupWrite(const std::string &name, Frame *currentFrame)
+inline void Function::follow(CollectedHeap &heap)
+{
+    // Follow the cells this closure captured
+    for (Reference *cell : freeCells)
     {
-        if (DEBUG_INTERP)
-            std::cerr << "[DEBUG] lookupWrite for '" << name << "'" << std::endl;
-        if (currentFrame->global.globals.find(name) != currentFrame->global.globals.end())
-        {
-            if (DEBUG_INTERP)
-                std::cerr << "[DEBUG] '" << name << "' is global, using global frame" << std::endl;
-            return currentFrame->global.globalFrame;
-        }
-        if (DEBUG_INTERP)
-            std::cerr << "[DEBUG] '" << name << "' is local" << std::endl;
-        return currentFrame;
+        heap.markSuccessors(cell);
     }
+}
+
+inline Collectable *Value::object() const
+{
+    return pointer<Collectable>();
+}
 
-    static Value *lookupRead(const std::string &name, Frame *currentFrame)
+inline void Value::follow(CollectedHeap &heap) const
+{
+    heap.markSuccessors(object());
+}
+
+/*
+  Assigns every identifier a fixed slot before execution, using the same scope
+  analysis as the bytecode compiler, and builds the layout of every function
+  declaration.  Global names are numbered into globalIndex as they are seen,
+  and every field access site is numbered for the interpreter's inline caches.
+*/
+class Resolver : public ast::Visitor
+{
+public:
+    Resolver(ast::ASTNode &root,
+             std::unordered_map<Symbol, int> &globalIndex,
+             std::vector<std::unique_ptr<FunctionLayout>> &layouts,
+             size_t &fieldSites)
+        : scopes_(root), scope_(&scopes_.global()), globalIndex_(globalIndex), layouts_(layouts),
+          fieldSites_(fieldSites)
     {
-        if (DEBUG_INTERP)
-            std::cerr << "[DEBUG] lookupRead for '" << name << "' at frame " << currentFrame << std::endl;
+        root.accept(*this);
+    }
 
-        // Check if it's a global variable
-        if (currentFrame->global.globals.find(name) != currentFrame->global.globals.end())
+private:
+    ast::VariableSlot slotFor(Symbol name)
+    {
+        switch (scope_->resolve(name))
         {
-            if (DEBUG_INTERP)
-                std::cerr << "[DEBUG] '" << name << "' is declared global" << std::endl;
-            Frame *globalFrame = currentFrame->global.globalFrame;
-            if (globalFrame->variables.find(name) != globalFrame->variables.end())
+        case compiler::VarKind::Global:
+        {
+            auto it = globalIndex_.emplace(name, static_cast<int>(globalIndex_.size())).first;
+            return {ast::VariableSlot::Global, it->second};
+        }
+        case compiler::VarKind::Local:
+            if (scope_->refIndex(name) >= 0)
             {
-                if (DEBUG_INTERP)
-                    std::cerr << "[DEBUG] Found '" << name << "' in global frame" << std::endl;
-                return globalFrame->variables[name];
+                return {ast::VariableSlot::Cell, scope_->refIndex(name)};
             }
-            if (DEBUG_INTERP)
-                std::cerr << "[DEBUG] '" << name << "' not initialized in global frame" << std::endl;
-            throw UninitializedVariableException();
+            return {ast::VariableSlot::Local, scope_->localIndex(name)};
+        case compiler::VarKind::Free:
+            return {ast::VariableSlot::Free, scope_->freeIndex(name)};
         }
+        return {};
+    }
+
+    void visit(ast::BinaryExpression &expr) override
+    {
+        expr.leftOperand->accept(*this);
+        expr.rightOperand->accept(*this);
+    }
+
+    void visit(ast::UnaryExpression &expr) override { expr.operand->accept(*this); }
+    void visit(ast::FieldDereference &expr) override
+    {
+        expr.cache = static_cast<int>(fieldSites_++);
+        expr.baseExpression->accept(*this);
+    }
+
+    void visit(ast::IndexExpression &expr) override
+    {
+        expr.baseExpression->accept(*this);
+        expr.index->accept(*this);
+    }
 
-        // Check if it's in the current frame
-        if (currentFrame->variables.find(name) != currentFrame->variables.end())
+    void visit(ast::Call &expr) override
+    {
+        expr.targetExpression->accept(*this);
+        for (auto &arg : expr.arguments)
         {
-            if (DEBUG_INTERP)
-                std::cerr << "[DEBUG] Found '" << name << "' in current frame" << std::endl;
-            return currentFrame->variables[name];
+            arg->accept(*this);
         }
+    }
 
-        // Check parent frame (if exists)
-        if (currentFrame->parent == nullptr)
+    void visit(ast::Record &expr) override
+    {
+        expr.cache = static_cast<int>(fieldSites_);
+        fieldSites_ += expr.fields.size();
+        for (auto &field : expr.fields)
         {
-            if (DEBUG_INTERP)
-                std::cerr << "[DEBUG] '" << name << "' not found, no parent frame" << std::endl;
-            throw UninitializedVariableException();
+            field.second->accept(*this);
         }
+    }
 
-        if (DEBUG_INTERP)
-            std::cerr << "[DEBUG] Looking up '" << name << "' in parent frame" << std::endl;
-        return lookupRead(name, currentFrame->parent);
+    void visit(ast::IntegerConstant &) override {}
+    void visit(ast::StringConstant &) override {}
+    void visit(ast::BooleanConstant &) override {}
+    void visit(ast::NoneConstant &) override {}
+
+    void visit(ast::Identifier &expr) override { expr.slot = slotFor(expr.name); }
+
+    void visit(ast::Block &stmt) override
+    {
+        for (auto &statement : stmt.statements)
+        {
+            statement->accept(*this);
+        }
+    }
+
+    void visit(ast::Assignment &stmt) override
+    {
+        stmt.lhs->accept(*this);
+        stmt.expr->accept(*this);
     }
 
-    Frame *getParent() const { return parent; }
-    void setParent(Frame *p) { parent = p; }
+    void visit(ast::Global &) override {}
 
-    void setGlobal(Frame *globalFrameAddr, const std::unordered_set<std::string> &globals)
+    void visit(ast::IfStatement &stmt) override
     {
-        global = GlobalInfo{globals, globalFrameAddr};
+        stmt.condition->accept(*this);
+        stmt.thenPart->accept(*this);
+        if (stmt.elsePart)
+        {
+            stmt.elsePart->accept(*this);
+        }
     }
 
-    std::optional<GlobalInfo> getGlobal() const { return global; }
-};
+    void visit(ast::WhileLoop &stmt) override
+    {
+        stmt.condition->accept(*this);
+        stmt.body->accept(*this);
+    }
 
-struct Record
-{
-    std::vector<std::pair<std::string, Value *>> fields;
-};
+    void visit(ast::Return &stmt) override { stmt.expression->accept(*this); }
 
-struct Function
-{
-    Frame *context;
-    std::vector<std::string> arguments;
-    ast::Block *body;
-};
+    void visit(ast::FunctionDeclaration &stmt) override
+    {
+        compiler::Scope &child = scopes_.of(stmt);
 
-class Value : public Collectable
-{
-public:
-    using VariantType = std::variant<bool,
-                                     int,
-                                     std::string,
-                                     Record *,
-                                     Function *,
-                                     std::monostate>;
-
-    VariantType data;
-
-    Value() : data(std::monostate{}) {}
-    Value(bool b) : data(b) {}
-    Value(int n) : data(n) {}
-    Value(const std::string &s) : data(s) {}
-    Value(const char *s) : data(std::string(s)) {}
-    Value(Record *a) : data(a) {}
-    Value(Function *f) : data(f) {}
+        auto layout = std::make_unique<FunctionLayout>();
+        layout->body = stmt.body->as<ast::Block>();
+        layout->parameterCount = child.parameter_count;
+        layout->localCount = child.locals.size();
+        for (const auto &name : child.ref_vars)
+        {
+            layout->cellLocals.push_back(child.localIndex(name));
+        }
+        // Captured cells are looked up in the enclosing scope
+        for (const auto &name : child.free_vars)
+        {
+            layout->captures.push_back(slotFor(name));
+        }
+        stmt.layout = static_cast<int>(layouts_.size());
+        layouts_.push_back(std::move(layout));
 
-protected:
-    void follow(CollectedHeap &heap) override;
+        compiler::Scope *enclosing = scope_;
+        scope_ = &child;
+        stmt.body->accept(*this);
+        scope_ = enclosing;
+    }
+
+    compiler::ScopeAnalysis scopes_;
+    compiler::Scope *scope_;
+    std::unordered_map<Symbol, int> &globalIndex_;
+    std::vector<std::unique_ptr<FunctionLayout>> &layouts_;
+    size_t &fieldSites_;
 };
 
-inline void Frame::follow(CollectedHeap &heap)
+class Interpreter : public ast::Visitor
 {
-    // Follow all Value* pointers in the variables map
-    for (auto &pair : variables)
+public:
+    // print writes to out and input reads lines of in, or nothing when it
+    // is null. options.limit is the number of bytes of interpreter objects
+    // that may be live before the garbage collector has to run, and an
+    // eighth of it bounds the record shapes, which are never freed. With
+    // closures the tree is compiled to closures once and those run instead
+    // of a visitor.
+    explicit Interpreter(std::ostream &out, std::FILE *in = stdin, const HeapOptions &options = HeapOptions(),
+                         bool closures = false)
+        : out_(out), in_(in, &out_), closures_(closures)
+    {
+        heap_.configure(options);
+        shapes_.setLimit(options.limit / 8);
+    }
+
+    void interpret(ast::ASTNode &root)
     {
-        if (pair.second != nullptr)
+        if (DEBUG_INTERP)
+            std::cerr << "[DEBUG] Starting interpretation" << std::endl;
+
+        // Create native functions with a layout without body to mark them
+        // as native
+        printLayout_.parameterCount = 1;
+        intcastLayout_.parameterCount = 1;
+        printNative_ = heap_.allocate<Function>(&printLayout_, std::vector<Reference *>{});
+        inputNative_ = heap_.allocate<Function>(&inputLayout_, std::vector<Reference *>{});
+        intcastNative_ = heap_.allocate<Function>(&intcastLayout_, std::vector<Reference *>{});
+
+        globalIndex_ = {{Symbol("print"), 0}, {Symbol("input"), 1}, {Symbol("intcast"), 2}};
+        size_t fieldSites = 0;
+        Resolver resolver(root, globalIndex_, layouts_, fieldSites);
+        fieldCaches_.assign(fieldSites, FieldCache{});
+
+        globals_.assign(globalIndex_.size(), Value());
+        globalDefined_.assign(globalIndex_.size(), false);
+        setGlobal(0, Value(printNative_));
+        setGlobal(1, Value(inputNative_));
+        setGlobal(2, Value(intcastNative_));
+
+        // The top level runs in a frame of its own whose variables are all
+        // global
+        char base;
+        uintptr_t top = reinterpret_cast<uintptr_t>(&base);
+        size_t budget = stackBudget();
+        stackFloor_ = top > budget ? top - budget : 0;
+        frames_.push_back(Frame{nullptr, {}, {}});
+        if (closures_)
+        {
+            compileStatement(root)();
+        }
+        else
         {
-            heap.markSuccessors(pair.second);
+            root.accept(*this);
         }
+
+        if (DEBUG_INTERP)
+            std::cerr << "[DEBUG] Interpretation complete" << std::endl;
     }
 
-    // Follow parent frame
-    if (parent != nullptr)
+    // What the program allocated, for --stats.  The tree is not made of
+    // instructions, so none are counted.
+    void report(std::ostream &os) const
     {
-        heap.markSuccessors(parent);
+        os << "[stats] " << heap_.allocations() << " objects allocated, "
+           << heap_.allocatedBytes() << " bytes allocated, "
+           << heap_.collections() << " collections" << std::endl;
     }
 
-    // Follow global frame if it's different from parent
-    if (global.globalFrame != nullptr && global.globalFrame != parent)
+private:
+    // Store pointers to native functions
+    Function *printNative_;
+    Function *inputNative_;
+    Function *intcastNative_;
+    FunctionLayout printLayout_;
+    FunctionLayout inputLayout_;
+    FunctionLayout intcastLayout_;
+
+    // Native stack kept free below the frames that called interpret(), for
+    // everything a call does before the next one checks again
+    static constexpr size_t kStackReserve = size_t(256) << 10;
+
+    static size_t stackBudget()
     {
-        heap.markSuccessors(global.globalFrame);
+        rlimit limit;
+        if (getrlimit(RLIMIT_STACK, &limit) != 0 || limit.rlim_cur == RLIM_INFINITY)
+            return size_t(64) << 20;
+        size_t bytes = limit.rlim_cur;
+        return bytes > 2 * kStackReserve ? bytes - kStackReserve : bytes / 2;
     }
-}
 
-inline void Value::follow(CollectedHeap &heap)
-{
-    // Follow pointers based on what's stored in the variant
-    if (std::holds_alternative<Record *>(data))
+    // The tree is walked recursively, so a program recursing too deeply
+    // would overflow the native stack and crash, losing buffered output.
+    // Running out of stack is an error of the program instead, as in the VM.
+    void checkStack() const
+    {
+        char here;
+        if (reinterpret_cast<uintptr_t>(&here) < stackFloor_)
+            throw RuntimeException();
+    }
+
+    void setGlobal(int index, Value v)
+    {
+        globals_[index] = v;
+        globalDefined_[index] = true;
+    }
+
+    // Keeps values that a visit method holds in C++ locals reachable while it
+    // evaluates a subexpression, since a call inside it may collect
+    class TempRoots
     {
-        Record *record = std::get<Record *>(data);
-        if (record != nullptr)
+    public:
+        explicit TempRoots(std::vector<Collectable *> &temps) : temps_(temps), mark_(temps.size()) {}
+        ~TempRoots() { temps_.resize(mark_); }
+        TempRoots(const TempRoots &) = delete;
+        TempRoots &operator=(const TempRoots &) = delete;
+
+        void add(Collectable *obj) { temps_.push_back(obj); }
+        void add(Value v)
         {
-            // Follow all Value* pointers in the record's fields
-            for (auto &field : record->fields)
+            if (Collectable *obj = v.object())
             {
-                if (field.second != nullptr)
-                {
-                    heap.markSuccessors(field.second);
-                }
+                temps_.push_back(obj);
             }
         }
+
+    private:
+        std::vector<Collectable *> &temps_;
+        size_t mark_;
+    };
+
+    Value makeString(std::string s)
+    {
+        return Value(heap_.allocate<String>(std::move(s)));
     }
-    else if (std::holds_alternative<Function *>(data))
+
+    // Integer arithmetic wraps around on overflow, as in the VM and the
+    // constant folder, so it is done on uint32_t, where that is defined
+    static int32_t wrappingAdd(int32_t a, int32_t b)
     {
-        Function *func = std::get<Function *>(data);
-        if (func != nullptr && func->context != nullptr)
-        {
-            // Follow the function's context (Frame*)
-            heap.markSuccessors(func->context);
-        }
+        return static_cast<int32_t>(static_cast<uint32_t>(a) + static_cast<uint32_t>(b));
     }
-}
 
-class Interpreter : public ast::Visitor
-{
-public:
-    void interpret(ast::ASTNode &root)
+    static int32_t wrappingSub(int32_t a, int32_t b)
+    {
+        return static_cast<int32_t>(static_cast<uint32_t>(a) - static_cast<uint32_t>(b));
+    }
+
+    static int32_t wrappingMul(int32_t a, int32_t b)
+    {
+        return static_cast<int32_t>(static_cast<uint32_t>(a) * static_cast<uint32_t>(b));
+    }
+
+    static int32_t wrappingNeg(int32_t a)
+    {
+        return static_cast<int32_t>(0u - static_cast<uint32_t>(a));
+    }
+
+    // The meaning of + and ==, and the natives, shared by both execution
+    // modes
+
+    Value add(Value left, Value right)
     {
+        if (left.is<int32_t>() && right.is<int32_t>())
+        {
+            return Value(wrappingAdd(left.as<int32_t>(), right.as<int32_t>()));
+        }
+        else if (left.is<String *>() && right.is<String *>())
+        {
+            return Value(String::concat(heap_, left.as<String *>(), right.as<String *>()->view()));
+        }
+        else if (left.is<String *>())
+        {
+            return Value(String::concat(heap_, left.as<String *>(), valueToString(right)));
+        }
+        else if (right.is<String *>())
+        {
+            std::string result = valueToString(left);
+            result += right.as<String *>()->view();
+            return makeString(result);
+        }
         if (DEBUG_INTERP)
-            std::cerr << "[DEBUG] Starting interpretation" << std::endl;
+            std::cerr << "[DEBUG] IllegalCastException in Add" << std::endl;
+        throw IllegalCastException();
+    }
 
-        Frame *globalFrame = new Frame();
-        globalFrame->setGlobal(globalFrame, {"print", "input", "intcast", "None"});
+    // == compares integers, booleans and strings by value, and records and
+    // functions by identity. This is the rule VirtualMachine::equals uses,
+    // so both backends agree on every comparison
+    bool equal(Value left, Value right)
+    {
+        if (left.is<int32_t>() && right.is<int32_t>())
+        {
+            return left.as<int32_t>() == right.as<int32_t>();
+        }
+        else if (left.is<String *>() && right.is<String *>())
+        {
+            return left.as<String *>()->view() == right.as<String *>()->view();
+        }
+        else if (left.is<Record *>() && right.is<Record *>())
+        {
+            return left.as<Record *>() == right.as<Record *>();
+        }
+        else if (left.is<Function *>() && right.is<Function *>())
+        {
+            // Every evaluation of a function declaration makes a new
+            // closure, so two closures of one declaration are unequal
+            return left.as<Function *>() == right.as<Function *>();
+        }
+        else if (left.is<bool>() && right.is<bool>())
+        {
+            return left.as<bool>() == right.as<bool>();
+        }
+        // None equals only None; values of different types are unequal
+        return left.is<std::monostate>() && right.is<std::monostate>();
+    }
 
-        // Create native functions with nullptr body to mark them as native
-        printNative_ = new Function{globalFrame, {"s"}, nullptr};
-        inputNative_ = new Function{globalFrame, {}, nullptr};
-        intcastNative_ = new Function{globalFrame, {"s"}, nullptr};
+    void print(Value v)
+    {
+        write(v);
+        out_.put('\n');
+    }
 
-        globalFrame->setVar("print", new Value(printNative_));
-        globalFrame->setVar("input", new Value(inputNative_));
-        globalFrame->setVar("intcast", new Value(intcastNative_));
-        NONE = new Value();
-        globalFrame->setVar("None", NONE);
+    // valueToString(v), written straight into the output
+    void write(Value v)
+    {
+        if (v.is<String *>())
+        {
+            out_.write(v.as<String *>()->view());
+        }
+        else if (v.is<int32_t>())
+        {
+            out_.write(v.as<int32_t>());
+        }
+        else if (v.is<Record *>())
+        {
+            Record *record = v.as<Record *>();
+            if (record->fields.empty())
+            {
+                out_.write("{}");
+                return;
+            }
+            out_.put('{');
+            bool first = true;
+            record->fields.forEachSorted([&](const std::string &name, Value fieldValue)
+            {
+                if (!first)
+                    out_.put(' ');
+                first = false;
+                out_.write(name);
+                out_.put(':');
+                write(fieldValue);
+            });
+            out_.write(" }");
+        }
+        else
+        {
+            out_.write(valueToString(v));
+        }
+    }
 
-        stack_.push(globalFrame);
-        root.accept(*this);
+    Value input()
+    {
+        return makeString(in_.line());
+    }
 
+    Value intcast(Value v)
+    {
+        if (v.is<int32_t>())
+        {
+            return v;
+        }
+        else if (v.is<String *>())
+        {
+            std::string str = v.as<String *>()->str();
+            if (str.empty() || (str[0] != '-' && !isdigit(str[0])))
+            {
+                if (DEBUG_INTERP)
+                    std::cerr << "[DEBUG] IllegalCastException: intcast invalid string" << std::endl;
+                throw IllegalCastException();
+            }
+            for (size_t i = 1; i < str.length(); i++)
+            {
+                if (!isdigit(str[i]))
+                {
+                    if (DEBUG_INTERP)
+                        std::cerr << "[DEBUG] IllegalCastException: intcast invalid string" << std::endl;
+                    throw IllegalCastException();
+                }
+            }
+            return Value(std::atoi(str.c_str()));
+        }
         if (DEBUG_INTERP)
-            std::cerr << "[DEBUG] Interpretation complete" << std::endl;
+            std::cerr << "[DEBUG] IllegalCastException: intcast on invalid type" << std::endl;
+        throw IllegalCastException();
     }
 
-private:
-    // Store pointers to native functions
-    Function *printNative_;
-    Function *inputNative_;
-    Function *intcastNative_;
-    Value *NONE;
+    // Collections only happen between statements, where every live value is
+    // reachable from a frame, rval_ or a TempRoots entry
+    void collectIfNeeded()
+    {
+        if (!heap_.shouldCollect())
+        {
+            return;
+        }
+        if (DEBUG_INTERP)
+            std::cerr << "[DEBUG] Collecting at " << heap_.bytes() << " bytes" << std::endl;
+
+        std::vector<Collectable *> roots(temps_.begin(), temps_.end());
+        for (const Frame &frame : frames_)
+        {
+            roots.push_back(frame.function);
+            for (Value v : frame.locals)
+            {
+                roots.push_back(v.object());
+            }
+            roots.insert(roots.end(), frame.cells.begin(), frame.cells.end());
+        }
+        for (Value v : globals_)
+        {
+            roots.push_back(v.object());
+        }
+        roots.push_back(rval_.object());
+        roots.push_back(printNative_);
+        roots.push_back(inputNative_);
+        roots.push_back(intcastNative_);
+        heap_.gc(roots.begin(), roots.end());
+    }
 
     void visit(ast::IntegerConstant &expr) override
     {
         if (DEBUG_INTERP)
             std::cerr << "[DEBUG] IntegerConstant: " << expr.value << std::endl;
-        rval_ = new Value(expr.value);
+        rval_ = Value(expr.value);
     }
 
     void visit(ast::BooleanConstant &expr) override
     {
         if (DEBUG_INTERP)
             std::cerr << "[DEBUG] BooleanConstant: " << (expr.value ? "true" : "false") << std::endl;
-        rval_ = new Value(expr.value);
+        rval_ = Value(expr.value);
     }
 
     void visit(ast::StringConstant &expr) override
     {
         if (DEBUG_INTERP)
             std::cerr << "[DEBUG] StringConstant: \"" << expr.value << "\"" << std::endl;
-        rval_ = new Value(expr.value);
+        rval_ = makeString(std::string(expr.value));
     }
 
     void visit(ast::NoneConstant &expr) override
     {
         if (DEBUG_INTERP)
             std::cerr << "[DEBUG] NoneConstant" << std::endl;
-        rval_ = NONE;
+        rval_ = Value();
     }
 
     void visit(ast::BinaryExpression &expr) override
@@ -314,57 +658,28 @@ private:
         if (DEBUG_INTERP)
             std::cerr << "[DEBUG] BinaryExpression op=" << expr.op << std::endl;
 
+        TempRoots roots(temps_);
         expr.leftOperand->accept(*this);
-        Value *left = rval_;
+        Value left = rval_;
+        roots.add(left);
         expr.rightOperand->accept(*this);
-        Value *right = rval_;
+        Value right = rval_;
 
         switch (expr.op)
         {
         case ast::BinaryExpression::Add:
-            if (std::holds_alternative<int>(left->data) && std::holds_alternative<int>(right->data))
-            {
-                int result = std::get<int>(left->data) + std::get<int>(right->data);
-                if (DEBUG_INTERP)
-                    std::cerr << "[DEBUG] Integer addition: " << result << std::endl;
-                rval_ = new Value(result);
-            }
-            else if (std::holds_alternative<std::string>(left->data) && std::holds_alternative<std::string>(right->data))
-            {
-                std::string result = std::get<std::string>(left->data) + std::get<std::string>(right->data);
-                if (DEBUG_INTERP)
-                    std::cerr << "[DEBUG] String concatenation: \"" << result << "\"" << std::endl;
-                rval_ = new Value(result);
-            }
-            else if (std::holds_alternative<std::string>(left->data))
-            {
-                std::string result = std::get<std::string>(left->data) + valueToString(right);
-                if (DEBUG_INTERP)
-                    std::cerr << "[DEBUG] String + cast: \"" << result << "\"" << std::endl;
-                rval_ = new Value(result);
-            }
-            else if (std::holds_alternative<std::string>(right->data))
-            {
-                std::string result = valueToString(left) + std::get<std::string>(right->data);
-                if (DEBUG_INTERP)
-                    std::cerr << "[DEBUG] Cast + string: \"" << result << "\"" << std::endl;
-                rval_ = new Value(result);
-            }
-            else
-            {
-                if (DEBUG_INTERP)
-                    std::cerr << "[DEBUG] IllegalCastException in Add" << std::endl;
-                throw IllegalCastException();
-            }
+            rval_ = add(left, right);
+            if (DEBUG_INTERP)
+                std::cerr << "[DEBUG] Addition: " << valueToString(rval_) << std::endl;
             break;
 
         case ast::BinaryExpression::Sub:
-            if (std::holds_alternative<int>(left->data) && std::holds_alternative<int>(right->data))
+            if (left.is<int32_t>() && right.is<int32_t>())
             {
-                int result = std::get<int>(left->data) - std::get<int>(right->data);
+                int32_t result = wrappingSub(left.as<int32_t>(), right.as<int32_t>());
                 if (DEBUG_INTERP)
                     std::cerr << "[DEBUG] Integer subtraction: " << result << std::endl;
-                rval_ = new Value(result);
+                rval_ = Value(result);
             }
             else
             {
@@ -375,12 +690,12 @@ private:
             break;
 
         case ast::BinaryExpression::Mul:
-            if (std::holds_alternative<int>(left->data) && std::holds_alternative<int>(right->data))
+            if (left.is<int32_t>() && right.is<int32_t>())
             {
-                int result = std::get<int>(left->data) * std::get<int>(right->data);
+                int32_t result = wrappingMul(left.as<int32_t>(), right.as<int32_t>());
                 if (DEBUG_INTERP)
                     std::cerr << "[DEBUG] Integer multiplication: " << result << std::endl;
-                rval_ = new Value(result);
+                rval_ = Value(result);
             }
             else
             {
@@ -391,19 +706,21 @@ private:
             break;
 
         case ast::BinaryExpression::Div:
-            if (std::holds_alternative<int>(left->data) && std::holds_alternative<int>(right->data))
+            if (left.is<int32_t>() && right.is<int32_t>())
             {
-                int divisor = std::get<int>(right->data);
+                int divisor = right.as<int32_t>();
                 if (divisor == 0)
                 {
                     if (DEBUG_INTERP)
                         std::cerr << "[DEBUG] IllegalArithmeticException: division by zero" << std::endl;
                     throw IllegalArithmeticException();
                 }
-                int result = std::get<int>(left->data) / divisor;
+                // INT_MIN / -1 overflows, and wraps as in the VM
+                int32_t dividend = left.as<int32_t>();
+                int32_t result = divisor == -1 ? wrappingNeg(dividend) : dividend / divisor;
                 if (DEBUG_INTERP)
                     std::cerr << "[DEBUG] Integer division: " << result << std::endl;
-                rval_ = new Value(result);
+                rval_ = Value(result);
             }
             else
             {
@@ -414,66 +731,18 @@ private:
             break;
 
         case ast::BinaryExpression::Eq:
-            if (std::holds_alternative<int>(left->data) && std::holds_alternative<int>(right->data))
-            {
-                bool result = std::get<int>(left->data) == std::get<int>(right->data);
-                if (DEBUG_INTERP)
-                    std::cerr << "[DEBUG] Integer equality: " << result << std::endl;
-                rval_ = new Value(result);
-            }
-            else if (std::holds_alternative<std::string>(left->data) && std::holds_alternative<std::string>(right->data))
-            {
-                bool result = std::get<std::string>(left->data) == std::get<std::string>(right->data);
-                if (DEBUG_INTERP)
-                    std::cerr << "[DEBUG] String equality: " << result << std::endl;
-                rval_ = new Value(result);
-            }
-            else if (std::holds_alternative<Record *>(left->data) && std::holds_alternative<Record *>(right->data))
-            {
-                bool result = std::get<Record *>(left->data) == std::get<Record *>(right->data);
-                if (DEBUG_INTERP)
-                    std::cerr << "[DEBUG] Record equality: " << result << std::endl;
-                rval_ = new Value(result);
-            }
-            else if (std::holds_alternative<Function *>(left->data) && std::holds_alternative<Function *>(right->data))
-            {
-                Function *f1 = std::get<Function *>(left->data);
-                Function *f2 = std::get<Function *>(right->data);
-                bool equal = (f1->context == f2->context) &&
-                             (f1->arguments == f2->arguments) &&
-                             (f1->body == f2->body);
-                if (DEBUG_INTERP)
-                    std::cerr << "[DEBUG] Function equality: " << equal << std::endl;
-                rval_ = new Value(equal);
-            }
-            else if (std::holds_alternative<bool>(left->data) && std::holds_alternative<bool>(right->data))
-            {
-                bool result = std::get<bool>(left->data) == std::get<bool>(right->data);
-                if (DEBUG_INTERP)
-                    std::cerr << "[DEBUG] Boolean equality: " << result << std::endl;
-                rval_ = new Value(result);
-            }
-            else if (std::holds_alternative<std::monostate>(left->data) && std::holds_alternative<std::monostate>(right->data))
-            {
-                if (DEBUG_INTERP)
-                    std::cerr << "[DEBUG] None equality: true" << std::endl;
-                rval_ = new Value(true);
-            }
-            else
-            {
-                if (DEBUG_INTERP)
-                    std::cerr << "[DEBUG] Type mismatch equality: false" << std::endl;
-                rval_ = new Value(false);
-            }
+            rval_ = Value(equal(left, right));
+            if (DEBUG_INTERP)
+                std::cerr << "[DEBUG] Equality: " << valueToString(rval_) << std::endl;
             break;
 
         case ast::BinaryExpression::Lt:
-            if (std::holds_alternative<int>(left->data) && std::holds_alternative<int>(right->data))
+            if (left.is<int32_t>() && right.is<int32_t>())
             {
-                bool result = std::get<int>(left->data) < std::get<int>(right->data);
+                bool result = left.as<int32_t>() < right.as<int32_t>();
                 if (DEBUG_INTERP)
                     std::cerr << "[DEBUG] Less than: " << result << std::endl;
-                rval_ = new Value(result);
+                rval_ = Value(result);
             }
             else
             {
@@ -484,12 +753,12 @@ private:
             break;
 
         case ast::BinaryExpression::Gt:
-            if (std::holds_alternative<int>(left->data) && std::holds_alternative<int>(right->data))
+            if (left.is<int32_t>() && right.is<int32_t>())
             {
-                bool result = std::get<int>(left->data) > std::get<int>(right->data);
+                bool result = left.as<int32_t>() > right.as<int32_t>();
                 if (DEBUG_INTERP)
                     std::cerr << "[DEBUG] Greater than: " << result << std::endl;
-                rval_ = new Value(result);
+                rval_ = Value(result);
             }
             else
             {
@@ -500,12 +769,12 @@ private:
             break;
 
         case ast::BinaryExpression::Leq:
-            if (std::holds_alternative<int>(left->data) && std::holds_alternative<int>(right->data))
+            if (left.is<int32_t>() && right.is<int32_t>())
             {
-                bool result = std::get<int>(left->data) <= std::get<int>(right->data);
+                bool result = left.as<int32_t>() <= right.as<int32_t>();
                 if (DEBUG_INTERP)
                     std::cerr << "[DEBUG] Less than or equal: " << result << std::endl;
-                rval_ = new Value(result);
+                rval_ = Value(result);
             }
             else
             {
@@ -516,12 +785,12 @@ private:
             break;
 
         case ast::BinaryExpression::Geq:
-            if (std::holds_alternative<int>(left->data) && std::holds_alternative<int>(right->data))
+            if (left.is<int32_t>() && right.is<int32_t>())
             {
-                bool result = std::get<int>(left->data) >= std::get<int>(right->data);
+                bool result = left.as<int32_t>() >= right.as<int32_t>();
                 if (DEBUG_INTERP)
                     std::cerr << "[DEBUG] Greater than or equal: " << result << std::endl;
-                rval_ = new Value(result);
+                rval_ = Value(result);
             }
             else
             {
@@ -532,12 +801,12 @@ private:
             break;
 
         case ast::BinaryExpression::And:
-            if (std::holds_alternative<bool>(left->data) && std::holds_alternative<bool>(right->data))
+            if (left.is<bool>() && right.is<bool>())
             {
-                bool result = std::get<bool>(left->data) && std::get<bool>(right->data);
+                bool result = left.as<bool>() && right.as<bool>();
                 if (DEBUG_INTERP)
                     std::cerr << "[DEBUG] Logical AND: " << result << std::endl;
-                rval_ = new Value(result);
+                rval_ = Value(result);
             }
             else
             {
@@ -548,12 +817,12 @@ private:
             break;
 
         case ast::BinaryExpression::Or:
-            if (std::holds_alternative<bool>(left->data) && std::holds_alternative<bool>(right->data))
+            if (left.is<bool>() && right.is<bool>())
             {
-                bool result = std::get<bool>(left->data) || std::get<bool>(right->data);
+                bool result = left.as<bool>() || right.as<bool>();
                 if (DEBUG_INTERP)
                     std::cerr << "[DEBUG] Logical OR: " << result << std::endl;
-                rval_ = new Value(result);
+                rval_ = Value(result);
             }
             else
             {
@@ -574,17 +843,17 @@ private:
             std::cerr << "[DEBUG] UnaryExpression op=" << expr.op << std::endl;
 
         expr.operand->accept(*this);
-        Value *operand = rval_;
+        Value operand = rval_;
 
         switch (expr.op)
         {
         case ast::UnaryExpression::Neg:
-            if (std::holds_alternative<int>(operand->data))
+            if (operand.is<int32_t>())
             {
-                int result = -std::get<int>(operand->data);
+                int32_t result = wrappingNeg(operand.as<int32_t>());
                 if (DEBUG_INTERP)
                     std::cerr << "[DEBUG] Unary negation: " << result << std::endl;
-                rval_ = new Value(result);
+                rval_ = Value(result);
             }
             else
             {
@@ -595,12 +864,12 @@ private:
             break;
 
         case ast::UnaryExpression::Not:
-            if (std::holds_alternative<bool>(operand->data))
+            if (operand.is<bool>())
             {
-                bool result = !std::get<bool>(operand->data);
+                bool result = !operand.as<bool>();
                 if (DEBUG_INTERP)
                     std::cerr << "[DEBUG] Logical NOT: " << result << std::endl;
-                rval_ = new Value(result);
+                rval_ = Value(result);
             }
             else
             {
@@ -620,84 +889,94 @@ private:
         if (DEBUG_INTERP)
             std::cerr << "[DEBUG] Assignment" << std::endl;
 
-        if (auto *ident = dynamic_cast<ast::Identifier *>(assn.lhs.get()))
+        switch (assn.lhs->kind)
+        {
+        case ast::Kind::Identifier:
         {
+            auto *ident = static_cast<ast::Identifier *>(assn.lhs);
             if (DEBUG_INTERP)
                 std::cerr << "[DEBUG] Variable assignment to '" << ident->name << "'" << std::endl;
             assn.expr->accept(*this);
-            Value *v = rval_;
-            Frame *targetFrame = Frame::lookupWrite(ident->name, stack_.top());
-            targetFrame->setVar(ident->name, v);
+            Value v = rval_;
+            Frame &frame = frames_.back();
+            switch (ident->slot.kind)
+            {
+            case ast::VariableSlot::Global:
+                setGlobal(ident->slot.index, v);
+                break;
+            case ast::VariableSlot::Local:
+                frame.locals[ident->slot.index] = v;
+                break;
+            case ast::VariableSlot::Cell:
+                frame.cells[ident->slot.index]->value = v;
+                heap_.writeBarrier(frame.cells[ident->slot.index], v.object());
+                break;
+            case ast::VariableSlot::Free:
+                frame.function->freeCells[ident->slot.index]->value = v;
+                heap_.writeBarrier(frame.function->freeCells[ident->slot.index], v.object());
+                break;
+            case ast::VariableSlot::Unresolved:
+                throw RuntimeException();
+            }
+            break;
         }
-        else if (auto *fieldDeref = dynamic_cast<ast::FieldDereference *>(assn.lhs.get()))
+        case ast::Kind::FieldDereference:
         {
+            auto *fieldDeref = static_cast<ast::FieldDereference *>(assn.lhs);
             if (DEBUG_INTERP)
                 std::cerr << "[DEBUG] Field assignment to field '" << fieldDeref->field << "'" << std::endl;
+            TempRoots roots(temps_);
             fieldDeref->baseExpression->accept(*this);
-            Value *a1 = rval_;
+            Value a1 = rval_;
+            roots.add(a1);
 
             assn.expr->accept(*this);
-            Value *v = rval_;
+            Value v = rval_;
 
-            if (!std::holds_alternative<Record *>(a1->data))
+            if (!a1.is<Record *>())
             {
                 if (DEBUG_INTERP)
                     std::cerr << "[DEBUG] IllegalCastException: field assignment on non-record" << std::endl;
                 throw IllegalCastException();
             }
-            Record *record = std::get<Record *>(a1->data);
+            Record *record = a1.as<Record *>();
             // Update existing field or append new one
-            bool found = false;
-            for (auto &field : record->fields)
-            {
-                if (field.first == fieldDeref->field)
-                {
-                    field.second = v;
-                    found = true;
-                    break;
-                }
-            }
-            if (!found)
-            {
-                record->fields.push_back({fieldDeref->field, v});
-            }
+            record->fields.set(fieldDeref->field, v, fieldCaches_[fieldDeref->cache]);
+            heap_.writeBarrier(record, v.object());
+            break;
         }
-        else if (auto *indexExpr = dynamic_cast<ast::IndexExpression *>(assn.lhs.get()))
+        case ast::Kind::IndexExpression:
         {
+            auto *indexExpr = static_cast<ast::IndexExpression *>(assn.lhs);
             if (DEBUG_INTERP)
                 std::cerr << "[DEBUG] Index assignment" << std::endl;
+            TempRoots roots(temps_);
             indexExpr->baseExpression->accept(*this);
-            Value *a1 = rval_;
+            Value a1 = rval_;
+            roots.add(a1);
 
             indexExpr->index->accept(*this);
-            Value *indexValue = rval_;
+            Value indexValue = rval_;
             std::string fieldName = valueToString(indexValue);
 
             assn.expr->accept(*this);
-            Value *v2 = rval_;
+            Value v2 = rval_;
 
-            if (!std::holds_alternative<Record *>(a1->data))
+            if (!a1.is<Record *>())
             {
                 if (DEBUG_INTERP)
                     std::cerr << "[DEBUG] IllegalCastException: index assignment on non-record" << std::endl;
-                throw IllegalCastException();
-            }
-            Record *record = std::get<Record *>(a1->data);
-            // Update existing field or append new one
-            bool found = false;
-            for (auto &field : record->fields)
-            {
-                if (field.first == fieldName)
-                {
-                    field.second = v2;
-                    found = true;
-                    break;
-                }
-            }
-            if (!found)
-            {
-                record->fields.push_back({fieldName, v2});
+                throw IllegalCastException();
             }
+            Record *record = a1.as<Record *>();
+            // Update existing field or append new one
+            record->fields.setIndexed(fieldName, v2);
+            heap_.writeBarrier(record, v2.object());
+            break;
+        }
+        default:
+            // The parser only assigns to locations
+            throw RuntimeException();
         }
     }
 
@@ -707,11 +986,11 @@ private:
             std::cerr << "[DEBUG] IfStatement" << std::endl;
 
         stmt.condition->accept(*this);
-        Value *v = rval_;
+        Value v = rval_;
 
-        if (std::holds_alternative<bool>(v->data))
+        if (v.is<bool>())
         {
-            bool b = std::get<bool>(v->data);
+            bool b = v.as<bool>();
             if (DEBUG_INTERP)
                 std::cerr << "[DEBUG] Condition is " << (b ? "true" : "false") << std::endl;
             if (b)
@@ -737,11 +1016,11 @@ private:
             std::cerr << "[DEBUG] WhileLoop" << std::endl;
 
         stmt.condition->accept(*this);
-        Value *v = rval_;
+        Value v = rval_;
 
-        if (std::holds_alternative<bool>(v->data))
+        if (v.is<bool>())
         {
-            bool b = std::get<bool>(v->data);
+            bool b = v.as<bool>();
             if (b)
             {
                 if (DEBUG_INTERP)
@@ -773,6 +1052,7 @@ private:
 
         for (auto &statement : stmt.statements)
         {
+            collectIfNeeded();
             statement->accept(*this);
             if (hasReturned_)
             {
@@ -802,7 +1082,30 @@ private:
     {
         if (DEBUG_INTERP)
             std::cerr << "[DEBUG] Identifier: " << expr.name << std::endl;
-        rval_ = Frame::lookupRead(expr.name, stack_.top());
+        Frame &frame = frames_.back();
+        switch (expr.slot.kind)
+        {
+        case ast::VariableSlot::Global:
+            if (!globalDefined_[expr.slot.index])
+            {
+                if (DEBUG_INTERP)
+                    std::cerr << "[DEBUG] '" << expr.name << "' not initialized in global frame" << std::endl;
+                throw UninitializedVariableException();
+            }
+            rval_ = globals_[expr.slot.index];
+            break;
+        case ast::VariableSlot::Local:
+            rval_ = frame.locals[expr.slot.index];
+            break;
+        case ast::VariableSlot::Cell:
+            rval_ = frame.cells[expr.slot.index]->value;
+            break;
+        case ast::VariableSlot::Free:
+            rval_ = frame.function->freeCells[expr.slot.index]->value;
+            break;
+        case ast::VariableSlot::Unresolved:
+            throw RuntimeException();
+        }
     }
 
     void visit(ast::Record &expr) override
@@ -810,15 +1113,21 @@ private:
         if (DEBUG_INTERP)
             std::cerr << "[DEBUG] Record with " << expr.fields.size() << " fields" << std::endl;
 
-        Record *r = new Record();
+        TempRoots roots(temps_);
+        Record *r = heap_.allocate<Record>(shapes_.empty());
+        roots.add(r);
+        int cache = expr.cache;
         for (auto &field : expr.fields)
         {
             if (DEBUG_INTERP)
                 std::cerr << "[DEBUG] Evaluating field '" << field.first << "'" << std::endl;
             field.second->accept(*this);
-            r->fields.push_back({field.first, rval_});
+            r->fields.set(field.first, rval_, fieldCaches_[cache++]);
+            // A field expression that calls a function may have let a
+            // collection promote r
+            heap_.writeBarrier(r, rval_.object());
         }
-        rval_ = new Value(r);
+        rval_ = Value(r);
     }
 
     void visit(ast::FieldDereference &expr) override
@@ -827,26 +1136,13 @@ private:
             std::cerr << "[DEBUG] FieldDereference: field '" << expr.field << "'" << std::endl;
 
         expr.baseExpression->accept(*this);
-        Value *a1 = rval_;
+        Value a1 = rval_;
 
-        if (std::holds_alternative<Record *>(a1->data))
+        if (a1.is<Record *>())
         {
-            Record *record = std::get<Record *>(a1->data);
-            // Search for field in vector
-            for (auto &field : record->fields)
-            {
-                if (field.first == expr.field)
-                {
-                    if (DEBUG_INTERP)
-                        std::cerr << "[DEBUG] Field '" << expr.field << "' found" << std::endl;
-                    rval_ = field.second;
-                    return;
-                }
-            }
-            // Field not found
-            if (DEBUG_INTERP)
-                std::cerr << "[DEBUG] Field '" << expr.field << "' not found, returning None" << std::endl;
-            rval_ = new Value();
+            // A missing field reads as None
+            Record *record = a1.as<Record *>();
+            rval_ = record->fields.get(expr.field, fieldCaches_[expr.cache]);
         }
         else
         {
@@ -861,34 +1157,23 @@ private:
         if (DEBUG_INTERP)
             std::cerr << "[DEBUG] IndexExpression" << std::endl;
 
+        TempRoots roots(temps_);
         expr.baseExpression->accept(*this);
-        Value *a1 = rval_;
+        Value a1 = rval_;
+        roots.add(a1);
 
-        if (std::holds_alternative<Record *>(a1->data))
+        if (a1.is<Record *>())
         {
-            Record *record = std::get<Record *>(a1->data);
+            Record *record = a1.as<Record *>();
             expr.index->accept(*this);
-            Value *indexValue = rval_;
+            Value indexValue = rval_;
             std::string fieldName = valueToString(indexValue);
 
             if (DEBUG_INTERP)
                 std::cerr << "[DEBUG] Index field name: '" << fieldName << "'" << std::endl;
 
-            // Search for field in vector
-            for (auto &field : record->fields)
-            {
-                if (field.first == fieldName)
-                {
-                    if (DEBUG_INTERP)
-                        std::cerr << "[DEBUG] Index field found" << std::endl;
-                    rval_ = field.second;
-                    return;
-                }
-            }
-            // Field not found
-            if (DEBUG_INTERP)
-                std::cerr << "[DEBUG] Index field not found, returning None" << std::endl;
-            rval_ = new Value();
+            // A missing field reads as None
+            rval_ = record->fields.lookup(fieldName);
         }
         else
         {
@@ -903,12 +1188,18 @@ private:
         if (DEBUG_INTERP)
             std::cerr << "[DEBUG] FunctionDeclaration with " << stmt.arguments.size() << " arguments" << std::endl;
 
-        Function *f = new Function{
-            stack_.top(),
-            stmt.arguments,
-            dynamic_cast<ast::Block *>(stmt.body.get())};
+        const FunctionLayout *layout = layouts_[stmt.layout].get();
+        Frame &frame = frames_.back();
+        std::vector<Reference *> cells;
+        for (const ast::VariableSlot &capture : layout->captures)
+        {
+            cells.push_back(capture.kind == ast::VariableSlot::Cell
+                                ? frame.cells[capture.index]
+                                : frame.function->freeCells[capture.index]);
+        }
+        Function *f = heap_.allocate<Function>(layout, std::move(cells));
 
-        rval_ = new Value(f);
+        rval_ = Value(f);
     }
 
     void visit(ast::Call &expr) override
@@ -917,22 +1208,22 @@ private:
             std::cerr << "[DEBUG] Function call with " << expr.arguments.size() << " arguments" << std::endl;
 
         expr.targetExpression->accept(*this);
-        Value *target = rval_;
+        Value target = rval_;
 
-        if (!std::holds_alternative<Function *>(target->data))
+        if (!target.is<Function *>())
         {
             if (DEBUG_INTERP)
                 std::cerr << "[DEBUG] IllegalCastException: calling non-function" << std::endl;
             throw IllegalCastException();
         }
 
-        Function *f = std::get<Function *>(target->data);
+        Function *f = target.as<Function *>();
 
-        if (f->arguments.size() != expr.arguments.size())
+        if (f->layout->parameterCount != expr.arguments.size())
         {
             if (DEBUG_INTERP)
                 std::cerr << "[DEBUG] RuntimeException: argument count mismatch (expected "
-                          << f->arguments.size() << ", got " << expr.arguments.size() << ")" << std::endl;
+                          << f->layout->parameterCount << ", got " << expr.arguments.size() << ")" << std::endl;
             throw RuntimeException();
         }
 
@@ -942,17 +1233,15 @@ private:
             if (DEBUG_INTERP)
                 std::cerr << "[DEBUG] Executing native print()" << std::endl;
             expr.arguments[0]->accept(*this);
-            std::cout << valueToString(rval_) << std::endl;
-            rval_ = new Value();
+            print(rval_);
+            rval_ = Value();
             return;
         }
         else if (f == inputNative_)
         {
             if (DEBUG_INTERP)
                 std::cerr << "[DEBUG] Executing native input()" << std::endl;
-            std::string input;
-            std::getline(std::cin, input);
-            rval_ = new Value(input);
+            rval_ = input();
             return;
         }
         else if (f == intcastNative_)
@@ -960,36 +1249,7 @@ private:
             if (DEBUG_INTERP)
                 std::cerr << "[DEBUG] Executing native intcast()" << std::endl;
             expr.arguments[0]->accept(*this);
-            if (std::holds_alternative<int>(rval_->data))
-            {
-                rval_ = new Value(std::get<int>(rval_->data));
-            }
-            else if (std::holds_alternative<std::string>(rval_->data))
-            {
-                std::string str = std::get<std::string>(rval_->data);
-                if (str.empty() || (str[0] != '-' && !isdigit(str[0])))
-                {
-                    if (DEBUG_INTERP)
-                        std::cerr << "[DEBUG] IllegalCastException: intcast invalid string" << std::endl;
-                    throw IllegalCastException();
-                }
-                for (size_t i = 1; i < str.length(); i++)
-                {
-                    if (!isdigit(str[i]))
-                    {
-                        if (DEBUG_INTERP)
-                            std::cerr << "[DEBUG] IllegalCastException: intcast invalid string" << std::endl;
-                        throw IllegalCastException();
-                    }
-                }
-                rval_ = new Value(std::atoi(str.c_str()));
-            }
-            else
-            {
-                if (DEBUG_INTERP)
-                    std::cerr << "[DEBUG] IllegalCastException: intcast on invalid type" << std::endl;
-                throw IllegalCastException();
-            }
+            rval_ = intcast(rval_);
             return;
         }
 
@@ -997,209 +1257,740 @@ private:
         if (DEBUG_INTERP)
             std::cerr << "[DEBUG] Evaluating arguments for user-defined function" << std::endl;
 
-        std::vector<Value *> args;
+        // The callee and the evaluated arguments are only reachable from
+        // here until the new frame is built, so root them for the call
+        TempRoots roots(temps_);
+        roots.add(target);
+        std::vector<Value> args;
         for (size_t i = 0; i < expr.arguments.size(); i++)
         {
             if (DEBUG_INTERP)
                 std::cerr << "[DEBUG] Evaluating argument " << i << std::endl;
             expr.arguments[i]->accept(*this);
             args.push_back(rval_);
+            roots.add(rval_);
         }
 
         if (DEBUG_INTERP)
             std::cerr << "[DEBUG] Creating new frame for function call" << std::endl;
 
-        Frame *newFrame = new Frame(f->context);
-
-        // Extract globals from function body
-        std::unordered_set<std::string> globals = extractGlobals(f->body);
-
-        Frame *contextGlobalFrame = f->context->getGlobal()->globalFrame;
-
-        newFrame->setGlobal(contextGlobalFrame, globals);
-
-        // Initialize all assigned variables to None (except function parameters)
-        std::unordered_set<std::string> assigns = extractAssigns(f->body);
-        for (const auto &varName : assigns)
-        {
-            // Don't initialize parameters or global variables
-            if (std::find(f->arguments.begin(), f->arguments.end(), varName) == f->arguments.end() &&
-                globals.find(varName) == globals.end())
-            {
-                if (DEBUG_INTERP)
-                    std::cerr << "[DEBUG] Initializing local variable '" << varName << "' to None" << std::endl;
-                newFrame->setVar(varName, new Value());
-            }
-        }
-
-        // Set function parameters
-        for (size_t i = 0; i < f->arguments.size(); i++)
+        // Locals that are not parameters start out as None
+        checkStack();
+        const FunctionLayout *layout = f->layout;
+        Frame frame{f, std::vector<Value>(layout->localCount), {}};
+        std::copy(args.begin(), args.end(), frame.locals.begin());
+        for (int local : layout->cellLocals)
         {
-            if (DEBUG_INTERP)
-                std::cerr << "[DEBUG] Setting parameter '" << f->arguments[i] << "'" << std::endl;
-            newFrame->setVar(f->arguments[i], args[i]);
+            frame.cells.push_back(heap_.allocate<Reference>(frame.locals[local]));
         }
-
-        stack_.push(newFrame);
+        frames_.push_back(std::move(frame));
 
         bool oldReturnState = hasReturned_;
         hasReturned_ = false;
 
-        f->body->accept(*this);
+        layout->body->accept(*this);
 
         if (!hasReturned_)
         {
             if (DEBUG_INTERP)
                 std::cerr << "[DEBUG] Function ended without return, returning None" << std::endl;
-            rval_ = new Value();
+            rval_ = Value();
         }
 
         hasReturned_ = oldReturnState;
-        stack_.pop();
+        frames_.pop_back();
 
         if (DEBUG_INTERP)
             std::cerr << "[DEBUG] Function call complete" << std::endl;
     }
 
-    std::string valueToString(Value *v)
+    /*
+      The closure mode.  Every node is compiled once, before the program runs,
+      into a closure specialized for what the Resolver and the tree already
+      say about it: the slot an identifier lives in, the operator of an
+      expression, whether an operand is an integer constant, whether a field
+      site's cache exists.  Closures return their results, so there is no
+      rval_ and no hasReturned_ to thread through.
+
+      Evaluation order, the checks made and the exceptions thrown are those
+      of the visitor above.  Values held in C++ locals are rooted only across
+      operands that contain a call, since collections only happen between
+      the statements of a function body.
+    */
+
+    // Whether evaluating node can run a function body, and so collect
+    static bool mayCollect(ast::ASTNode &n)
+    {
+        switch (n.kind)
+        {
+        case ast::Kind::Call:
+            return true;
+        case ast::Kind::BinaryExpression:
+        {
+            auto &expr = static_cast<ast::BinaryExpression &>(n);
+            return mayCollect(*expr.leftOperand) || mayCollect(*expr.rightOperand);
+        }
+        case ast::Kind::UnaryExpression:
+            return mayCollect(*static_cast<ast::UnaryExpression &>(n).operand);
+        case ast::Kind::FieldDereference:
+            return mayCollect(*static_cast<ast::FieldDereference &>(n).baseExpression);
+        case ast::Kind::IndexExpression:
+        {
+            auto &expr = static_cast<ast::IndexExpression &>(n);
+            return mayCollect(*expr.baseExpression) || mayCollect(*expr.index);
+        }
+        case ast::Kind::Record:
+            for (const auto &field : static_cast<ast::Record &>(n).fields)
+            {
+                if (mayCollect(*field.second))
+                    return true;
+            }
+            return false;
+        default:
+            // Constants, identifiers, and function declarations, whose
+            // bodies do not run where they are declared
+            return false;
+        }
+    }
+
+    static int32_t integer(Value v)
+    {
+        if (!v.is<int32_t>())
+            throw IllegalCastException();
+        return v.as<int32_t>();
+    }
+
+    static bool boolean(Value v)
+    {
+        if (!v.is<bool>())
+            throw IllegalCastException();
+        return v.as<bool>();
+    }
+
+    CompiledExpr compile(ast::ASTNode &node)
     {
-        if (std::holds_alternative<std::string>(v->data))
+        switch (node.kind)
         {
-            return std::get<std::string>(v->data);
+        case ast::Kind::IntegerConstant:
+        {
+            Value v(static_cast<ast::IntegerConstant &>(node).value);
+            return [v] { return v; };
         }
-        else if (std::holds_alternative<int>(v->data))
+        case ast::Kind::BooleanConstant:
         {
-            return std::to_string(std::get<int>(v->data));
+            Value v(static_cast<ast::BooleanConstant &>(node).value);
+            return [v] { return v; };
         }
-        else if (std::holds_alternative<bool>(v->data))
+        case ast::Kind::NoneConstant:
+            return [] { return Value(); };
+        case ast::Kind::StringConstant:
         {
-            return std::get<bool>(v->data) ? "true" : "false";
+            std::string text(static_cast<ast::StringConstant &>(node).value);
+            return [this, text] { return makeString(text); };
         }
-        else if (std::holds_alternative<std::monostate>(v->data))
+        case ast::Kind::Identifier:
+            return compileLoad(static_cast<ast::Identifier &>(node));
+        case ast::Kind::BinaryExpression:
+            return compileBinary(static_cast<ast::BinaryExpression &>(node));
+        case ast::Kind::UnaryExpression:
         {
-            return "None";
+            auto &expr = static_cast<ast::UnaryExpression &>(node);
+            CompiledExpr operand = compile(*expr.operand);
+            if (expr.op == ast::UnaryExpression::Neg)
+                return [operand] { return Value(wrappingNeg(integer(operand()))); };
+            return [operand] { return Value(!boolean(operand())); };
         }
-        else if (std::holds_alternative<Function *>(v->data))
+        case ast::Kind::FieldDereference:
         {
-            return "FUNCTION";
+            auto &expr = static_cast<ast::FieldDereference &>(node);
+            CompiledExpr base = compile(*expr.baseExpression);
+            FieldCache *cache = &fieldCaches_[expr.cache];
+            Symbol field = expr.field;
+            return [base, cache, field]
+            {
+                Value a1 = base();
+                if (!a1.is<Record *>())
+                    throw IllegalCastException();
+                // A missing field reads as None
+                return a1.as<Record *>()->fields.get(field, *cache);
+            };
         }
-        else if (std::holds_alternative<Record *>(v->data))
+        case ast::Kind::IndexExpression:
         {
-            Record *record = std::get<Record *>(v->data);
+            auto &expr = static_cast<ast::IndexExpression &>(node);
+            CompiledExpr base = compile(*expr.baseExpression);
+            CompiledExpr index = compile(*expr.index);
+            return [this, base, index]
+            {
+                TempRoots roots(temps_);
+                Value a1 = base();
+                roots.add(a1);
+                if (!a1.is<Record *>())
+                    throw IllegalCastException();
+                std::string fieldName = valueToString(index());
+                // A missing field reads as None
+                return a1.as<Record *>()->fields.lookup(fieldName);
+            };
+        }
+        case ast::Kind::Record:
+            return compileRecord(static_cast<ast::Record &>(node));
+        case ast::Kind::FunctionDeclaration:
+            return compileFunction(static_cast<ast::FunctionDeclaration &>(node));
+        case ast::Kind::Call:
+            return compileCall(static_cast<ast::Call &>(node));
+        default:
+            // The parser never puts a statement where an expression goes
+            throw RuntimeException();
+        }
+    }
 
-            // Collect field names and sort them lexicographically for output
-            std::vector<std::string> fieldNames;
-            for (const auto &field : record->fields)
+    CompiledExpr compileLoad(ast::Identifier &expr)
+    {
+        int index = expr.slot.index;
+        switch (expr.slot.kind)
+        {
+        case ast::VariableSlot::Global:
+            return [this, index]
             {
-                fieldNames.push_back(field.first);
-            }
-            std::sort(fieldNames.begin(), fieldNames.end());
+                if (!globalDefined_[index])
+                    throw UninitializedVariableException();
+                return globals_[index];
+            };
+        case ast::VariableSlot::Local:
+            return [this, index] { return frames_.back().locals[index]; };
+        case ast::VariableSlot::Cell:
+            return [this, index] { return frames_.back().cells[index]->value; };
+        case ast::VariableSlot::Free:
+            return [this, index] { return frames_.back().function->freeCells[index]->value; };
+        case ast::VariableSlot::Unresolved:
+            break;
+        }
+        return []() -> Value { throw RuntimeException(); };
+    }
 
-            std::string result = "{";
-            for (size_t i = 0; i < fieldNames.size(); i++)
+    // The integer operators with a constant right operand, as in i + 1 or
+    // n - 1, need neither evaluate nor check it
+    CompiledExpr compileWithConstant(ast::BinaryExpression::BinaryOp op, CompiledExpr left, int32_t c)
+    {
+        switch (op)
+        {
+        case ast::BinaryExpression::Add:
+            return [this, left, c]
             {
-                if (i > 0)
-                    result += " ";
+                Value l = left();
+                return l.is<int32_t>() ? Value(wrappingAdd(l.as<int32_t>(), c)) : add(l, Value(c));
+            };
+        case ast::BinaryExpression::Sub:
+            return [left, c] { return Value(wrappingSub(integer(left()), c)); };
+        case ast::BinaryExpression::Mul:
+            return [left, c] { return Value(wrappingMul(integer(left()), c)); };
+        case ast::BinaryExpression::Eq:
+            return [left, c]
+            {
+                Value l = left();
+                return Value(l.is<int32_t>() && l.as<int32_t>() == c);
+            };
+        default:
+            return nullptr;
+        }
+    }
 
-                // Find the value for this field name
-                Value *fieldValue = nullptr;
-                for (const auto &field : record->fields)
-                {
-                    if (field.first == fieldNames[i])
-                    {
-                        fieldValue = field.second;
-                        break;
-                    }
-                }
+    CompiledExpr compileBinary(ast::BinaryExpression &expr)
+    {
+        CompiledExpr left = compile(*expr.leftOperand);
+        if (auto *constant = expr.rightOperand->as<ast::IntegerConstant>())
+        {
+            if (CompiledExpr folded = compileWithConstant(expr.op, left, constant->value))
+                return folded;
+        }
+        if (isComparison(expr.op))
+        {
+            CompiledTest test = compileComparison(expr);
+            return [test] { return Value(test()); };
+        }
 
-                result += fieldNames[i] + ":" + valueToString(fieldValue);
+        CompiledExpr right = compile(*expr.rightOperand);
+        bool root = mayCollect(*expr.rightOperand);
+        // Both operands are evaluated before either is checked
+        auto operands = [this, left, right, root](Value &l, Value &r)
+        {
+            if (!root)
+            {
+                l = left();
+                r = right();
+                return;
             }
-            result += " }";
+            TempRoots roots(temps_);
+            l = left();
+            roots.add(l);
+            r = right();
+        };
 
-            return result == "{ }" ? "{}" : result;
+        switch (expr.op)
+        {
+        case ast::BinaryExpression::Add:
+            return [this, operands]
+            {
+                Value l, r;
+                operands(l, r);
+                return add(l, r);
+            };
+        case ast::BinaryExpression::Sub:
+            return [operands]
+            {
+                Value l, r;
+                operands(l, r);
+                if (!l.is<int32_t>() || !r.is<int32_t>())
+                    throw IllegalCastException();
+                return Value(wrappingSub(l.as<int32_t>(), r.as<int32_t>()));
+            };
+        case ast::BinaryExpression::Mul:
+            return [operands]
+            {
+                Value l, r;
+                operands(l, r);
+                if (!l.is<int32_t>() || !r.is<int32_t>())
+                    throw IllegalCastException();
+                return Value(wrappingMul(l.as<int32_t>(), r.as<int32_t>()));
+            };
+        case ast::BinaryExpression::Div:
+            return [operands]
+            {
+                Value l, r;
+                operands(l, r);
+                if (!l.is<int32_t>() || !r.is<int32_t>())
+                    throw IllegalCastException();
+                int32_t divisor = r.as<int32_t>();
+                if (divisor == 0)
+                    throw IllegalArithmeticException();
+                if (divisor == -1)
+                    return Value(wrappingNeg(l.as<int32_t>()));
+                return Value(l.as<int32_t>() / divisor);
+            };
+        case ast::BinaryExpression::Eq:
+            return [this, operands]
+            {
+                Value l, r;
+                operands(l, r);
+                return Value(equal(l, r));
+            };
+        case ast::BinaryExpression::And:
+            return [operands]
+            {
+                Value l, r;
+                operands(l, r);
+                if (!l.is<bool>() || !r.is<bool>())
+                    throw IllegalCastException();
+                return Value(l.as<bool>() && r.as<bool>());
+            };
+        case ast::BinaryExpression::Or:
+            return [operands]
+            {
+                Value l, r;
+                operands(l, r);
+                if (!l.is<bool>() || !r.is<bool>())
+                    throw IllegalCastException();
+                return Value(l.as<bool>() || r.as<bool>());
+            };
+        default:
+            throw RuntimeException();
         }
-        else
+    }
+
+    static bool isComparison(ast::BinaryExpression::BinaryOp op)
+    {
+        return op == ast::BinaryExpression::Lt || op == ast::BinaryExpression::Gt ||
+               op == ast::BinaryExpression::Leq || op == ast::BinaryExpression::Geq;
+    }
+
+    template <typename Compare>
+    static CompiledTest comparison(CompiledExpr left, CompiledExpr right, Compare compare)
+    {
+        return [left, right, compare]
         {
-            throw IllegalCastException();
+            // Integers need no rooting, and anything else fails the check
+            Value l = left();
+            Value r = right();
+            if (!l.is<int32_t>() || !r.is<int32_t>())
+                throw IllegalCastException();
+            return compare(l.as<int32_t>(), r.as<int32_t>());
+        };
+    }
+
+    template <typename Compare>
+    static CompiledTest comparison(CompiledExpr left, int32_t c, Compare compare)
+    {
+        return [left, c, compare] { return compare(integer(left()), c); };
+    }
+
+    template <typename Right>
+    static CompiledTest comparisonFor(ast::BinaryExpression::BinaryOp op, CompiledExpr left, Right right)
+    {
+        switch (op)
+        {
+        case ast::BinaryExpression::Lt:
+            return comparison(left, right, std::less<int32_t>());
+        case ast::BinaryExpression::Gt:
+            return comparison(left, right, std::greater<int32_t>());
+        case ast::BinaryExpression::Leq:
+            return comparison(left, right, std::less_equal<int32_t>());
+        default:
+            return comparison(left, right, std::greater_equal<int32_t>());
         }
     }
 
-    std::unordered_set<std::string> extractGlobals(ast::ASTNode *node)
+    CompiledTest compileComparison(ast::BinaryExpression &expr)
     {
-        std::unordered_set<std::string> result;
+        CompiledExpr left = compile(*expr.leftOperand);
+        if (auto *constant = expr.rightOperand->as<ast::IntegerConstant>())
+            return comparisonFor(expr.op, left, constant->value);
+        return comparisonFor(expr.op, left, compile(*expr.rightOperand));
+    }
 
-        if (auto *block = dynamic_cast<ast::Block *>(node))
+    // Conditions that compare integers are tested without making a boolean
+    CompiledTest compileTest(ast::ASTNode &node)
+    {
+        if (auto *expr = node.as<ast::BinaryExpression>())
         {
-            for (auto &stmt : block->statements)
-            {
-                auto stmtGlobals = extractGlobals(stmt.get());
-                result.insert(stmtGlobals.begin(), stmtGlobals.end());
-            }
+            if (isComparison(expr->op))
+                return compileComparison(*expr);
         }
-        else if (auto *globalStmt = dynamic_cast<ast::Global *>(node))
+        CompiledExpr condition = compile(node);
+        return [condition] { return boolean(condition()); };
+    }
+
+    CompiledExpr compileRecord(ast::Record &expr)
+    {
+        std::vector<std::pair<Symbol, CompiledExpr>> fields;
+        for (const auto &field : expr.fields)
         {
-            result.insert(globalStmt->name);
+            fields.emplace_back(field.first, compile(*field.second));
         }
-        else if (auto *ifStmt = dynamic_cast<ast::IfStatement *>(node))
+        FieldCache *caches = fieldCaches_.data() + expr.cache;
+        return [this, fields, caches]
         {
-            auto thenGlobals = extractGlobals(ifStmt->thenPart.get());
-            result.insert(thenGlobals.begin(), thenGlobals.end());
+            TempRoots roots(temps_);
+            Record *r = heap_.allocate<Record>(shapes_.empty());
+            roots.add(r);
+            FieldCache *cache = caches;
+            for (const auto &field : fields)
+            {
+                Value v = field.second();
+                r->fields.set(field.first, v, *cache++);
+                // A field expression that calls a function may have let a
+                // collection promote r
+                heap_.writeBarrier(r, v.object());
+            }
+            return Value(r);
+        };
+    }
 
-            if (ifStmt->elsePart)
+    CompiledExpr compileFunction(ast::FunctionDeclaration &stmt)
+    {
+        FunctionLayout *layout = layouts_[stmt.layout].get();
+        layout->code = compileStatement(*layout->body);
+        return [this, layout]
+        {
+            Frame &frame = frames_.back();
+            std::vector<Reference *> cells;
+            for (const ast::VariableSlot &capture : layout->captures)
             {
-                auto elseGlobals = extractGlobals(ifStmt->elsePart.get());
-                result.insert(elseGlobals.begin(), elseGlobals.end());
+                cells.push_back(capture.kind == ast::VariableSlot::Cell
+                                    ? frame.cells[capture.index]
+                                    : frame.function->freeCells[capture.index]);
             }
-        }
-        else if (auto *whileLoop = dynamic_cast<ast::WhileLoop *>(node))
+            return Value(heap_.allocate<Function>(layout, std::move(cells)));
+        };
+    }
+
+    CompiledExpr compileCall(ast::Call &expr)
+    {
+        CompiledExpr target = compile(*expr.targetExpression);
+        std::vector<CompiledExpr> arguments;
+        for (ast::ASTNode *argument : expr.arguments)
         {
-            auto bodyGlobals = extractGlobals(whileLoop->body.get());
-            result.insert(bodyGlobals.begin(), bodyGlobals.end());
+            arguments.push_back(compile(*argument));
         }
+        return [this, target, arguments]
+        {
+            Value callee = target();
+            if (!callee.is<Function *>())
+                throw IllegalCastException();
+            Function *f = callee.as<Function *>();
+            const FunctionLayout *layout = f->layout;
+            if (layout->parameterCount != arguments.size())
+                throw RuntimeException();
+
+            if (f == printNative_)
+            {
+                print(arguments[0]());
+                return Value();
+            }
+            else if (f == inputNative_)
+            {
+                return input();
+            }
+            else if (f == intcastNative_)
+            {
+                return intcast(arguments[0]());
+            }
 
-        return result;
+            // The callee and the arguments are only reachable from here
+            // until the frame is pushed. Locals that are not parameters
+            // start out as None.
+            checkStack();
+            TempRoots roots(temps_);
+            roots.add(f);
+            Frame frame{f, std::vector<Value>(layout->localCount), {}};
+            for (size_t i = 0; i < arguments.size(); i++)
+            {
+                frame.locals[i] = arguments[i]();
+                roots.add(frame.locals[i]);
+            }
+            for (int local : layout->cellLocals)
+            {
+                frame.cells.push_back(heap_.allocate<Reference>(frame.locals[local]));
+            }
+            frames_.push_back(std::move(frame));
+            std::optional<Value> result = layout->code();
+            frames_.pop_back();
+            return result.value_or(Value());
+        };
     }
 
-    std::unordered_set<std::string> extractAssigns(ast::ASTNode *node)
+    CompiledStmt compileStatement(ast::ASTNode &node)
     {
-        std::unordered_set<std::string> result;
-
-        if (auto *block = dynamic_cast<ast::Block *>(node))
+        switch (node.kind)
         {
-            for (auto &stmt : block->statements)
+        case ast::Kind::Block:
+        {
+            std::vector<CompiledStmt> statements;
+            for (ast::ASTNode *statement : static_cast<ast::Block &>(node).statements)
             {
-                auto stmtAssigns = extractAssigns(stmt.get());
-                result.insert(stmtAssigns.begin(), stmtAssigns.end());
+                statements.push_back(compileStatement(*statement));
             }
+            return [this, statements]() -> std::optional<Value>
+            {
+                for (const CompiledStmt &statement : statements)
+                {
+                    collectIfNeeded();
+                    if (std::optional<Value> result = statement())
+                        return result;
+                }
+                return std::nullopt;
+            };
         }
-        else if (auto *assn = dynamic_cast<ast::Assignment *>(node))
+        case ast::Kind::Assignment:
+            return compileAssignment(static_cast<ast::Assignment &>(node));
+        case ast::Kind::Global:
+            return [] { return std::optional<Value>(); };
+        case ast::Kind::IfStatement:
         {
-            if (auto *ident = dynamic_cast<ast::Identifier *>(assn->lhs.get()))
+            auto &stmt = static_cast<ast::IfStatement &>(node);
+            CompiledTest test = compileTest(*stmt.condition);
+            CompiledStmt thenPart = compileStatement(*stmt.thenPart);
+            if (!stmt.elsePart)
             {
-                result.insert(ident->name);
+                return [test, thenPart]() -> std::optional<Value>
+                {
+                    return test() ? thenPart() : std::nullopt;
+                };
             }
+            CompiledStmt elsePart = compileStatement(*stmt.elsePart);
+            return [test, thenPart, elsePart] { return test() ? thenPart() : elsePart(); };
+        }
+        case ast::Kind::WhileLoop:
+        {
+            auto &stmt = static_cast<ast::WhileLoop &>(node);
+            CompiledTest test = compileTest(*stmt.condition);
+            CompiledStmt body = compileStatement(*stmt.body);
+            return [test, body]() -> std::optional<Value>
+            {
+                while (test())
+                {
+                    if (std::optional<Value> result = body())
+                        return result;
+                }
+                return std::nullopt;
+            };
         }
-        else if (auto *ifStmt = dynamic_cast<ast::IfStatement *>(node))
+        case ast::Kind::Return:
         {
-            auto thenAssigns = extractAssigns(ifStmt->thenPart.get());
-            result.insert(thenAssigns.begin(), thenAssigns.end());
+            CompiledExpr expression = compile(*static_cast<ast::Return &>(node).expression);
+            return [expression] { return std::optional<Value>(expression()); };
+        }
+        default:
+        {
+            // A call made for its effect
+            CompiledExpr expression = compile(node);
+            return [expression]() -> std::optional<Value>
+            {
+                expression();
+                return std::nullopt;
+            };
+        }
+        }
+    }
 
-            if (ifStmt->elsePart)
+    CompiledStmt compileAssignment(ast::Assignment &assn)
+    {
+        CompiledExpr value = compile(*assn.expr);
+        switch (assn.lhs->kind)
+        {
+        case ast::Kind::Identifier:
+        {
+            auto *ident = static_cast<ast::Identifier *>(assn.lhs);
+            int index = ident->slot.index;
+            // The frame is looked up after the value, whose calls may have
+            // grown frames_
+            switch (ident->slot.kind)
             {
-                auto elseAssigns = extractAssigns(ifStmt->elsePart.get());
-                result.insert(elseAssigns.begin(), elseAssigns.end());
+            case ast::VariableSlot::Global:
+                return [this, value, index]() -> std::optional<Value>
+                {
+                    setGlobal(index, value());
+                    return std::nullopt;
+                };
+            case ast::VariableSlot::Local:
+                return [this, value, index]() -> std::optional<Value>
+                {
+                    Value v = value();
+                    frames_.back().locals[index] = v;
+                    return std::nullopt;
+                };
+            case ast::VariableSlot::Cell:
+                return [this, value, index]() -> std::optional<Value>
+                {
+                    Value v = value();
+                    Reference *cell = frames_.back().cells[index];
+                    cell->value = v;
+                    heap_.writeBarrier(cell, v.object());
+                    return std::nullopt;
+                };
+            case ast::VariableSlot::Free:
+                return [this, value, index]() -> std::optional<Value>
+                {
+                    Value v = value();
+                    Reference *cell = frames_.back().function->freeCells[index];
+                    cell->value = v;
+                    heap_.writeBarrier(cell, v.object());
+                    return std::nullopt;
+                };
+            case ast::VariableSlot::Unresolved:
+                break;
             }
+            return [value]() -> std::optional<Value>
+            {
+                value();
+                throw RuntimeException();
+            };
+        }
+        case ast::Kind::FieldDereference:
+        {
+            auto *fieldDeref = static_cast<ast::FieldDereference *>(assn.lhs);
+            CompiledExpr base = compile(*fieldDeref->baseExpression);
+            FieldCache *cache = &fieldCaches_[fieldDeref->cache];
+            Symbol field = fieldDeref->field;
+            return [this, base, value, cache, field]() -> std::optional<Value>
+            {
+                TempRoots roots(temps_);
+                Value a1 = base();
+                roots.add(a1);
+                Value v = value();
+                if (!a1.is<Record *>())
+                    throw IllegalCastException();
+                Record *record = a1.as<Record *>();
+                record->fields.set(field, v, *cache);
+                heap_.writeBarrier(record, v.object());
+                return std::nullopt;
+            };
         }
-        else if (auto *whileLoop = dynamic_cast<ast::WhileLoop *>(node))
+        case ast::Kind::IndexExpression:
         {
-            auto bodyAssigns = extractAssigns(whileLoop->body.get());
-            result.insert(bodyAssigns.begin(), bodyAssigns.end());
+            auto *indexExpr = static_cast<ast::IndexExpression *>(assn.lhs);
+            CompiledExpr base = compile(*indexExpr->baseExpression);
+            CompiledExpr index = compile(*indexExpr->index);
+            return [this, base, index, value]() -> std::optional<Value>
+            {
+                TempRoots roots(temps_);
+                Value a1 = base();
+                roots.add(a1);
+                std::string fieldName = valueToString(index());
+                Value v = value();
+                if (!a1.is<Record *>())
+                    throw IllegalCastException();
+                Record *record = a1.as<Record *>();
+                record->fields.setIndexed(fieldName, v);
+                heap_.writeBarrier(record, v.object());
+                return std::nullopt;
+            };
+        }
+        default:
+            // The parser only assigns to locations
+            throw RuntimeException();
+        }
+    }
+
+    std::string valueToString(Value v)
+    {
+        if (v.is<String *>())
+        {
+            return v.as<String *>()->str();
+        }
+        else if (v.is<int32_t>())
+        {
+            return std::to_string(v.as<int32_t>());
+        }
+        else if (v.is<bool>())
+        {
+            return v.as<bool>() ? "true" : "false";
+        }
+        else if (v.is<std::monostate>())
+        {
+            return "None";
+        }
+        else if (v.is<Function *>())
+        {
+            return "FUNCTION";
         }
+        else if (v.is<Record *>())
+        {
+            Record *record = v.as<Record *>();
+
+            // Fields are listed sorted by name; the shape caches the order
+            std::string result = "{";
+            bool first = true;
+            record->fields.forEachSorted([&](const std::string &name, Value fieldValue)
+            {
+                if (!first)
+                    result += " ";
+                first = false;
+                result += name + ":" + valueToString(fieldValue);
+            });
+            result += " }";
 
-        return result;
+            return result == "{ }" ? "{}" : result;
+        }
+        else
+        {
+            throw IllegalCastException();
+        }
     }
 
-    Value *rval_;
-    std::stack<Frame *> stack_;
+    CollectedHeap heap_;
+    OutputBuffer out_;
+    InputReader in_;
+    Value rval_;
+    std::vector<Frame> frames_;
+    std::unordered_map<Symbol, int> globalIndex_;
+    std::vector<Value> globals_;
+    std::vector<bool> globalDefined_;
+    std::vector<std::unique_ptr<FunctionLayout>> layouts_;
+    ShapeTable shapes_;
+    std::vector<FieldCache> fieldCaches_;
+    std::vector<Collectable *> temps_;
     bool hasReturned_ = false;
+    bool closures_;
+    // Lowest address the native stack may grow down to
+    uintptr_t stackFloor_ = 0;
 };
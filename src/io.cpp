@@ -0,0 +1,102 @@
+#include "io.hpp"
+
+#include <cstdio>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define IO_POSIX 1
+#include <cerrno>
+#include <unistd.h>
+#else
+#define IO_POSIX 0
+#endif
+
+OutputBuffer::OutputBuffer(std::ostream &out) : out_(out), buffer_(new char[kCapacity]) {}
+
+void OutputBuffer::drain()
+{
+    out_.write(buffer_.get(), static_cast<std::streamsize>(size_));
+    size_ = 0;
+}
+
+void OutputBuffer::spill(std::string_view text)
+{
+    drain();
+    if (text.size() >= kCapacity)
+    {
+        out_.write(text.data(), static_cast<std::streamsize>(text.size()));
+        return;
+    }
+    std::memcpy(buffer_.get(), text.data(), text.size());
+    size_ = text.size();
+}
+
+void OutputBuffer::flush()
+{
+    drain();
+    out_.flush();
+}
+
+InputReader::InputReader(std::FILE *file, OutputBuffer *tie) : file_(file), tie_(tie), buffer_(new char[capacity_]) {}
+
+bool InputReader::fill()
+{
+    // What is left of a line longer than the buffer moves to the front, and
+    // the buffer grows only when that line fills all of it
+    if (begin_ > 0)
+    {
+        std::memmove(buffer_.get(), buffer_.get() + begin_, end_ - begin_);
+        end_ -= begin_;
+        begin_ = 0;
+    }
+    if (end_ == capacity_)
+    {
+        std::unique_ptr<char[]> larger(new char[capacity_ * 2]);
+        std::memcpy(larger.get(), buffer_.get(), end_);
+        buffer_ = std::move(larger);
+        capacity_ *= 2;
+    }
+
+    if (file_ == nullptr)
+        return false;
+#if IO_POSIX
+    ssize_t n;
+    do
+    {
+        n = ::read(fileno(file_), buffer_.get() + end_, capacity_ - end_);
+    } while (n < 0 && errno == EINTR);
+#else
+    size_t n = std::fread(buffer_.get() + end_, 1, capacity_ - end_, file_);
+#endif
+    if (n <= 0)
+        return false;
+    end_ += static_cast<size_t>(n);
+    return true;
+}
+
+std::string InputReader::line()
+{
+    if (tie_ != nullptr)
+        tie_->flush();
+
+    size_t scanned = begin_;
+    while (true)
+    {
+        const void *newline = std::memchr(buffer_.get() + scanned, '\n', end_ - scanned);
+        if (newline != nullptr)
+        {
+            size_t at = static_cast<const char *>(newline) - buffer_.get();
+            std::string result(buffer_.get() + begin_, at - begin_);
+            begin_ = at + 1;
+            return result;
+        }
+        // fill() moves what is buffered to the front
+        scanned = end_ - begin_;
+        if (!fill())
+        {
+            // The last line need not end in a newline
+            std::string result(buffer_.get() + begin_, end_ - begin_);
+            begin_ = end_;
+            return result;
+        }
+    }
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+/*
+  The output of print, gathered in one large buffer and handed to the
+  stream in blocks instead of a line at a time.  The buffer is written out
+  when it fills, when input is read (so a prompt shows before the program
+  waits for its answer) and when the buffer is destroyed, which also
+  happens while an exception unwinds out of the interpreter or VM that owns
+  it, before the error is reported.
+*/
+class OutputBuffer
+{
+public:
+    static constexpr size_t kCapacity = size_t(1) << 16;
+
+    explicit OutputBuffer(std::ostream &out);
+    OutputBuffer(const OutputBuffer &) = delete;
+    OutputBuffer &operator=(const OutputBuffer &) = delete;
+    ~OutputBuffer() { flush(); }
+
+    void write(std::string_view text)
+    {
+        if (text.size() > kCapacity - size_)
+        {
+            spill(text);
+            return;
+        }
+        std::memcpy(buffer_.get() + size_, text.data(), text.size());
+        size_ += text.size();
+    }
+
+    void put(char c)
+    {
+        if (size_ == kCapacity)
+            drain();
+        buffer_[size_++] = c;
+    }
+
+    void write(int32_t n)
+    {
+        // The longest int32_t, "-2147483648", has 11 characters
+        if (kCapacity - size_ < 11)
+            drain();
+        char *start = buffer_.get() + size_;
+        size_ += std::to_chars(start, start + 11, n).ptr - start;
+    }
+
+    // Writes out everything buffered and flushes the stream
+    void flush();
+
+private:
+    // Writes out everything buffered without flushing the stream
+    void drain();
+    // Writes text that does not fit in what is left of the buffer
+    void spill(std::string_view text);
+
+    std::ostream &out_;
+    std::unique_ptr<char[]> buffer_;
+    size_t size_ = 0;
+};
+
+/*
+  Lines of input for input(), read from a file, usually standard input, in
+  large blocks rather than through std::cin.  Reading never waits for more
+  than the terminal or pipe has ready, so interactive input still works a
+  line at a time.
+*/
+class InputReader
+{
+public:
+    // Reads from file, or nothing when it is null.  Output waiting in tie,
+    // if any, is written out whenever a line is asked for.
+    explicit InputReader(std::FILE *file = stdin, OutputBuffer *tie = nullptr);
+    InputReader(const InputReader &) = delete;
+    InputReader &operator=(const InputReader &) = delete;
+
+    // The next line without its newline, or the empty string at the end of
+    // the input, as std::getline leaves it
+    std::string line();
+
+private:
+    // Reads more input after what is buffered; false at the end of input
+    bool fill();
+
+    std::FILE *file_;
+    OutputBuffer *tie_;
+    size_t capacity_ = size_t(1) << 16;
+    std::unique_ptr<char[]> buffer_;
+    // The buffered input not yet returned
+    size_t begin_ = 0;
+    size_t end_ = 0;
+};
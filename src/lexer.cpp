@@ -1,176 +1,181 @@
 #include "lexer.hpp"
 
+#include <array>
 #include <iostream>
-#include <sstream>
-#include <fstream>
-#include <unordered_map>
-#include <optional>
-#include <algorithm>
-#include <cctype>
-
-static bool isComment(const std::string &contents, int i)
-{
-    return i + 1 < contents.size() && contents[i] == '/' && contents[i + 1] == '/';
-}
-
-static bool isWhitespace(char c)
-{
-    return std::isspace(static_cast<unsigned char>(c));
-}
+#include <utility>
 
-static const std::unordered_map<char, TokenType> symbolTable = {
-    {';', TokenType::Semicolon},
-    {'=', TokenType::Assign},
-    {',', TokenType::Comma},
-    {'{', TokenType::LBrace},
-    {'}', TokenType::RBrace},
-    {'(', TokenType::LParen},
-    {')', TokenType::RParen},
-    {'[', TokenType::LSquareBrace},
-    {']', TokenType::RSquareBrace},
-    {'+', TokenType::Add},
-    {'-', TokenType::Sub},
-    {'*', TokenType::Mul},
-    {'/', TokenType::Div},
-    {'&', TokenType::And},
-    {'|', TokenType::Or},
-    {'!', TokenType::Not},
-    {'.', TokenType::Dot},
-    {':', TokenType::Colon}};
-
-std::optional<Token> Lexer::readSymbol(const std::string &contents, int &i, int lineNum)
+namespace
 {
-    auto it = symbolTable.find(contents[i]);
-    if (it == symbolTable.end())
-        return std::nullopt;
-    Token tok{it->second, std::string(1, contents[i]), lineNum};
-    i++;
-    return tok;
-}
-
-std::optional<Token> Lexer::readNumber(const std::string &contents, int &i, int lineNum)
-{
-    if (!std::isdigit(contents[i]))
-        return std::nullopt;
-
-    int start = i;
+    // What each byte can start, so the scanner decides with one lookup
+    // which kind of token comes next
+    enum CharClass : uint8_t
+    {
+        Other,
+        Space,
+        Newline,
+        Digit,
+        Letter, // and underscore
+        Quote,
+        Single, // a token of one character
+        Compare, // <, > or =, alone or followed by =
+        Slash, // division or the start of a comment
+    };
+
+    struct Tables
+    {
+        std::array<CharClass, 256> classes{};
+        // The token of a Single, Compare or Slash character on its own
+        std::array<TokenType, 256> singles{};
+    };
 
-    // Handle the case where number starts with 0
-    if (contents[i] == '0')
+    constexpr Tables makeTables()
     {
-        i++;
-        // If next character is a digit, this is invalid (leading zero)
-        if (i < contents.size() && std::isdigit(contents[i]))
+        Tables t{};
+        for (unsigned char c : {' ', '\t', '\v', '\f', '\r'})
+            t.classes[c] = Space;
+        t.classes['\n'] = Newline;
+        for (int c = '0'; c <= '9'; c++)
+            t.classes[c] = Digit;
+        for (int c = 'a'; c <= 'z'; c++)
+            t.classes[c] = Letter;
+        for (int c = 'A'; c <= 'Z'; c++)
+            t.classes[c] = Letter;
+        t.classes['_'] = Letter;
+        t.classes['"'] = Quote;
+
+        const std::pair<unsigned char, TokenType> singles[] = {
+            {';', TokenType::Semicolon},
+            {',', TokenType::Comma},
+            {'{', TokenType::LBrace},
+            {'}', TokenType::RBrace},
+            {'(', TokenType::LParen},
+            {')', TokenType::RParen},
+            {'[', TokenType::LSquareBrace},
+            {']', TokenType::RSquareBrace},
+            {'+', TokenType::Add},
+            {'-', TokenType::Sub},
+            {'*', TokenType::Mul},
+            {'&', TokenType::And},
+            {'|', TokenType::Or},
+            {'!', TokenType::Not},
+            {'.', TokenType::Dot},
+            {':', TokenType::Colon}};
+        for (const auto &[c, type] : singles)
         {
-            // Consume the rest of the invalid number
-            while (i < contents.size() && std::isdigit(contents[i]))
-            {
-                i++;
-            }
-            return Token{TokenType::Error, "invalid number with leading zero", lineNum};
+            t.classes[c] = Single;
+            t.singles[c] = type;
         }
-        // Single '0' is valid
-        return Token{TokenType::IntLiteral, "0", lineNum};
+        t.classes['='] = Compare;
+        t.singles['='] = TokenType::Assign;
+        t.classes['<'] = Compare;
+        t.singles['<'] = TokenType::Lt;
+        t.classes['>'] = Compare;
+        t.singles['>'] = TokenType::Gt;
+        t.classes['/'] = Slash;
+        t.singles['/'] = TokenType::Div;
+        return t;
     }
 
-    // Regular number - consume all digits
-    while (i < contents.size() && std::isdigit(contents[i]))
+    constexpr Tables tables = makeTables();
+
+    CharClass classOf(char c)
     {
-        i++;
+        return tables.classes[static_cast<unsigned char>(c)];
     }
 
-    // Check if number is followed by invalid characters (like letters)
-    if (i < contents.size() && (std::isalpha(contents[i]) || contents[i] == '_'))
+    struct Keyword
     {
-        // This is an invalid token like "123abc" or "456_"
-        int errorStart = start;
-        while (i < contents.size() && (std::isalnum(contents[i]) || contents[i] == '_'))
+        std::string_view word;
+        TokenType type;
+    };
+
+    constexpr Keyword keywords[] = {
+        {"global", TokenType::Keyword},
+        {"return", TokenType::Keyword},
+        {"while", TokenType::Keyword},
+        {"if", TokenType::Keyword},
+        {"else", TokenType::Keyword},
+        {"fun", TokenType::Keyword},
+        {"None", TokenType::Keyword},
+        {"true", TokenType::BooleanLiteral},
+        {"false", TokenType::BooleanLiteral}};
+
+    TokenType wordType(std::string_view word)
+    {
+        for (const Keyword &keyword : keywords)
         {
-            i++;
+            if (keyword.word == word)
+                return keyword.type;
         }
-        return Token{TokenType::Error,
-                     "invalid token '" + contents.substr(errorStart, i - errorStart) + "'", lineNum};
+        return TokenType::Identifier;
     }
 
-    return Token{TokenType::IntLiteral, contents.substr(start, i - start), lineNum};
+    bool isValidChar(char c)
+    {
+        // ASCII values between 32 and 126 inclusive, excluding quote (") and backslash (\)
+        return (32 <= c && c <= 126 && c != '"' && c != '\\');
+    }
+}
+
+Lexer::Lexer(std::string_view input) : input_(input) {}
+
+Token Lexer::token(TokenType type, size_t start, size_t end, int line) const
+{
+    return Token{type, static_cast<uint32_t>(start), static_cast<uint32_t>(end - start), line};
 }
 
-static bool isValidChar(char c)
+Token Lexer::error(std::string message, int line)
 {
-    // ASCII values between 32 and 126 inclusive, excluding quote (") and backslash (\)
-    return (32 <= c && c <= 126 && c != '"' && c != '\\');
+    errors_.push_back(std::move(message));
+    return Token{TokenType::Error, static_cast<uint32_t>(errors_.size() - 1), 0, line};
 }
 
-std::optional<Token> Lexer::readString(const std::string &contents, int &i, int lineNum)
+std::string_view Lexer::text(const Token &token) const
 {
-    if (contents[i] != '"')
-        return std::nullopt;
+    if (token.type == TokenType::Error)
+        return token.offset < errors_.size() ? std::string_view(errors_[token.offset]) : std::string_view();
+    return input_.substr(token.offset, token.length);
+}
 
-    int start = i;
-    i++;                       // skip opening quote
-    std::string result = "\""; // include opening quote in result
+// The token views the literal as written, quotes and escapes included; the
+// parser decodes it
+Token Lexer::readString(size_t &i, int line)
+{
+    size_t start = i;
+    i++; // skip opening quote
     bool hasError = false;
-    std::string errorMsg = "";
+    std::string errorMsg;
 
-    while (i < contents.size())
+    while (i < input_.size() && input_[i] != '\n')
     {
-        char c = contents[i];
+        char c = input_[i];
 
         // Check for closing quote
         if (c == '"')
         {
-            result += '"'; // include closing quote
             i++;
             if (hasError)
-            {
-                return Token{TokenType::Error, errorMsg, lineNum};
-            }
-            return Token{TokenType::StringLiteral, result, lineNum};
+                return error(errorMsg, line);
+            return token(TokenType::StringLiteral, start, i, line);
         }
 
         // Handle escape sequences
         if (c == '\\')
         {
-            if (i + 1 >= contents.size())
+            if (i + 1 >= input_.size() || input_[i + 1] == '\n')
+                return error("unterminated escape sequence", line);
+            char next = input_[i + 1];
+            if (next != '"' && next != '\\' && next != 'n' && next != 't' && !hasError)
             {
-                return Token{TokenType::Error, "unterminated escape sequence", lineNum};
-            }
-            char next = contents[i + 1];
-            switch (next)
-            {
-            case '"':
-                result += "\\\"";
-                i += 2;
-                break;
-            case '\\':
-                result += "\\\\";
-                i += 2;
-                break;
-            case 'n':
-                result += "\\n";
-                i += 2;
-                break;
-            case 't':
-                result += "\\t";
-                i += 2;
-                break;
-            default:
                 // Invalid escape sequence
-                if (!hasError)
-                {
-                    hasError = true;
-                    errorMsg = std::string("invalid escape sequence \\") + next;
-                }
-                result += "\\";
-                result += next;
-                i += 2;
-                break;
+                hasError = true;
+                errorMsg = std::string("invalid escape sequence \\") + next;
             }
+            i += 2;
         }
         // Handle regular characters
         else if (isValidChar(c))
         {
-            result.push_back(c);
             i++;
         }
         // Handle invalid characters in string
@@ -180,181 +185,140 @@ std::optional<Token> Lexer::readString(const std::string &contents, int &i, int
             {
                 hasError = true;
                 if (c < 32 || c > 126)
-                {
                     errorMsg = "invalid character in string (ASCII " + std::to_string(static_cast<int>(c)) + ")";
-                }
                 else
-                {
                     errorMsg = std::string("invalid character in string: '") + c + "'";
-                }
             }
-            // Continue parsing but mark as error
-            result.push_back(c);
+            // Continue scanning but mark as error
             i++;
         }
     }
 
     // Reached end of line without closing quote
-    return Token{TokenType::Error, "unterminated string literal", lineNum};
+    return error("unterminated string literal", line);
 }
 
-static const std::unordered_map<std::string, TokenType> keywordTable = {
-    {"global", TokenType::Keyword},
-    {"return", TokenType::Keyword},
-    {"while", TokenType::Keyword},
-    {"if", TokenType::Keyword},
-    {"else", TokenType::Keyword},
-    {"fun", TokenType::Keyword},
-    {"None", TokenType::Keyword},
-    {"true", TokenType::BooleanLiteral},
-    {"false", TokenType::BooleanLiteral}};
-
-std::optional<Token> Lexer::readIdentifierOrKeyword(const std::string &contents, int &i, int lineNum)
+Token Lexer::readNumber(size_t &i, int line)
 {
-    if (!std::isalpha(contents[i]) && contents[i] != '_')
-        return std::nullopt;
-
-    int start = i;
+    size_t start = i;
 
-    // Consume first character (letter or underscore)
-    i++;
-
-    // Consume remaining alphanumeric characters and underscores
-    while (i < contents.size() && (std::isalnum(contents[i]) || contents[i] == '_'))
-        i++;
-
-    std::string word = contents.substr(start, i - start);
-
-    // Check for keywords and boolean literals
-    auto it = keywordTable.find(word);
-    if (it != keywordTable.end())
-        return Token{it->second, word, lineNum};
-
-    return Token{TokenType::Identifier, word, lineNum};
-}
-
-std::optional<Token> Lexer::readComparison(const std::string &contents, int &i, int lineNum)
-{
-    if (i + 1 < contents.size())
+    // Handle the case where number starts with 0
+    if (input_[i] == '0')
     {
-        std::string two = contents.substr(i, 2);
-        if (two == "<=")
-        {
-            i += 2;
-            return Token{TokenType::Leq, two, lineNum};
-        }
-        else if (two == ">=")
-        {
-            i += 2;
-            return Token{TokenType::Geq, two, lineNum};
-        }
-        else if (two == "==")
+        i++;
+        // If next character is a digit, this is invalid (leading zero)
+        if (i < input_.size() && classOf(input_[i]) == Digit)
         {
-            i += 2;
-            return Token{TokenType::Eq, two, lineNum};
+            // Consume the rest of the invalid number
+            while (i < input_.size() && classOf(input_[i]) == Digit)
+                i++;
+            return error("invalid number with leading zero", line);
         }
+        // Single '0' is valid
+        return token(TokenType::IntLiteral, start, i, line);
     }
-    if (i < contents.size())
+
+    // Regular number - consume all digits
+    while (i < input_.size() && classOf(input_[i]) == Digit)
+        i++;
+
+    // Check if number is followed by invalid characters (like letters)
+    if (i < input_.size() && classOf(input_[i]) == Letter)
     {
-        if (contents[i] == '<')
-        {
-            return Token{TokenType::Lt, std::string(1, contents[i++]), lineNum};
-        }
-        if (contents[i] == '>')
-        {
-            return Token{TokenType::Gt, std::string(1, contents[i++]), lineNum};
-        }
+        // This is an invalid token like "123abc" or "456_"
+        while (i < input_.size() && (classOf(input_[i]) == Letter || classOf(input_[i]) == Digit))
+            i++;
+        return error("invalid token '" + std::string(input_.substr(start, i - start)) + "'", line);
     }
 
-    return std::nullopt;
+    return token(TokenType::IntLiteral, start, i, line);
 }
 
-Lexer::Lexer(const std::string &input) : input_(input) {}
+Token Lexer::readWord(size_t &i, int line)
+{
+    size_t start = i;
+    while (i < input_.size() && (classOf(input_[i]) == Letter || classOf(input_[i]) == Digit))
+        i++;
+    return token(wordType(input_.substr(start, i - start)), start, i, line);
+}
 
-std::vector<Token> Lexer::lex()
+const std::vector<Token> &Lexer::lex()
 {
-    std::stringstream lines(input_);
-    std::string line;
-    int numLines = 0;
+    tokens_.clear();
+    errors_.clear();
+    open_.clear();
 
-    while (std::getline(lines, line))
+    size_t i = 0;
+    int line = 1;
+    while (i < input_.size())
     {
-        numLines++;
-
-        // Process the line character by character
-        for (int i = 0; i < line.size();)
+        char c = input_[i];
+        switch (classOf(c))
         {
+        case Space:
+            i++;
+            break;
+        case Newline:
+            line++;
+            i++;
+            break;
+        case Slash:
             // Skip comments
-            if (isComment(line, i))
+            if (i + 1 < input_.size() && input_[i + 1] == '/')
             {
+                while (i < input_.size() && input_[i] != '\n')
+                    i++;
                 break;
             }
-
-            // Skip whitespace
-            if (isWhitespace(line[i]))
-            {
-                i++;
-                continue;
-            }
-
-            std::optional<Token> t;
-
-            // Try to read different token types in order of precedence
-
-            // 1. String literals (must be before other symbols because of quote)
-            if ((t = readString(line, i, numLines)).has_value())
-            {
-                addToken(t.value());
-                continue;
-            }
-
-            // 2. Numbers (must be before identifiers to avoid confusion)
-            if ((t = readNumber(line, i, numLines)).has_value())
-            {
-                addToken(t.value());
-                continue;
-            }
-
-            // 3. Identifiers and keywords
-            if ((t = readIdentifierOrKeyword(line, i, numLines)).has_value())
-            {
-                addToken(t.value());
-                continue;
-            }
-
-            // 4. Comparison operators (multi-character, before single-character)
-            if ((t = readComparison(line, i, numLines)).has_value())
-            {
-                addToken(t.value());
-                continue;
-            }
-
-            // 5. Single-character symbols
-            if ((t = readSymbol(line, i, numLines)).has_value())
+            tokens_.push_back(token(TokenType::Div, i, i + 1, line));
+            i++;
+            break;
+        case Quote:
+            tokens_.push_back(readString(i, line));
+            break;
+        case Digit:
+            tokens_.push_back(readNumber(i, line));
+            break;
+        case Letter:
+            tokens_.push_back(readWord(i, line));
+            break;
+        case Compare:
+            if (i + 1 < input_.size() && input_[i + 1] == '=')
             {
-                handleBrackets(t.value());
-                addToken(t.value());
-                continue;
+                TokenType type = c == '<' ? TokenType::Leq : c == '>' ? TokenType::Geq : TokenType::Eq;
+                tokens_.push_back(token(type, i, i + 2, line));
+                i += 2;
+                break;
             }
-
-            // 6. If we get here, we have an unrecognized character sequence
-            // This should be rare due to our earlier validation, but handle it
-            std::string unrecognizedChar(1, line[i]);
-            addToken(Token{TokenType::Error,
-                           "unrecognized character '" + unrecognizedChar + "'", numLines});
+            tokens_.push_back(token(tables.singles[static_cast<unsigned char>(c)], i, i + 1, line));
             i++;
+            break;
+        case Single:
+        {
+            Token t = token(tables.singles[static_cast<unsigned char>(c)], i, i + 1, line);
+            handleBrackets(t);
+            tokens_.push_back(t);
+            i++;
+            break;
+        }
+        default:
+            tokens_.push_back(error("unrecognized character '" + std::string(1, c) + "'", line));
+            i++;
+            break;
         }
     }
 
     // Check for unmatched opening brackets at end of input
-    while (!stack_.empty())
+    while (!open_.empty())
     {
-        Token t = stack_.top();
-        addToken(Token{TokenType::Error, "unmatched '" + t.str + "'", t.line});
-        stack_.pop();
+        Token t = tokens_[open_.back()];
+        tokens_.push_back(error("unmatched '" + std::string(text(t)) + "'", t.line));
+        open_.pop_back();
     }
 
-    addToken(Token{TokenType::EoF, "", numLines});
+    // The last line is the one the final newline ends, if there is one
+    int lines = input_.empty() ? 0 : input_.back() == '\n' ? line - 1 : line;
+    tokens_.push_back(token(TokenType::EoF, input_.size(), input_.size(), lines));
     return tokens_;
 }
 
@@ -383,7 +347,7 @@ void Lexer::printTokens(std::ostream &outstream)
         }
 
         if (t.type != TokenType::EoF && t.type != TokenType::Error)
-            outstream << t.line << type << " " << t.str << std::endl;
+            outstream << t.line << type << " " << text(t) << std::endl;
     }
 }
 
@@ -415,43 +379,36 @@ void Lexer::printErrors(std::ostream &outstream)
         }
 
         if (t.type != TokenType::EoF)
-            outstream << t.line << type << " " << t.str << std::endl;
+            outstream << t.line << type << " " << text(t) << std::endl;
     }
 }
 
-void Lexer::addToken(const Token &t)
-{
-    tokens_.push_back(t);
-}
-
+// Opening brackets wait on open_ for the bracket that closes them; a
+// closing bracket that matches nothing is reported just before it
 void Lexer::handleBrackets(const Token &t)
 {
+    TokenType opening;
     switch (t.type)
     {
     case TokenType::LBrace:
     case TokenType::LParen:
     case TokenType::LSquareBrace:
-        stack_.push(t);
-        break;
+        open_.push_back(tokens_.size());
+        return;
     case TokenType::RBrace:
-        if (!stack_.empty() && stack_.top().type == TokenType::LBrace)
-            stack_.pop();
-        else
-            addToken(Token{TokenType::Error, "unmatched '}'", t.line});
+        opening = TokenType::LBrace;
         break;
     case TokenType::RParen:
-        if (!stack_.empty() && stack_.top().type == TokenType::LParen)
-            stack_.pop();
-        else
-            addToken(Token{TokenType::Error, "unmatched ')'", t.line});
+        opening = TokenType::LParen;
         break;
     case TokenType::RSquareBrace:
-        if (!stack_.empty() && stack_.top().type == TokenType::LSquareBrace)
-            stack_.pop();
-        else
-            addToken(Token{TokenType::Error, "unmatched ']'", t.line});
+        opening = TokenType::LSquareBrace;
         break;
     default:
-        break;
+        return;
     }
+    if (!open_.empty() && tokens_[open_.back()].type == opening)
+        open_.pop_back();
+    else
+        tokens_.push_back(error("unmatched '" + std::string(text(t)) + "'", t.line));
 }
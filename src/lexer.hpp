@@ -1,10 +1,12 @@
 #pragma once
 
+#include "symbol.hpp"
+
+#include <cstdint>
+#include <ostream>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <stack>
-#include <optional>
-#include <algorithm>
 
 enum class TokenType
 {
@@ -41,33 +43,41 @@ enum class TokenType
     EoF
 };
 
+// A token is a view of its text in the lexer's input, which is never
+// copied; Lexer::text gives the text back. Error tokens view a message held
+// by the lexer instead.
 struct Token
 {
     TokenType type;
-    std::string str;
+    uint32_t offset;
+    uint32_t length;
     int line;
 };
 
 class Lexer
 {
 public:
-    explicit Lexer(const std::string &input);
+    // input must outlive the lexer and every token it returns
+    explicit Lexer(std::string_view input);
 
-    std::vector<Token> lex();
+    const std::vector<Token> &lex();
+    const std::vector<Token> &tokens() const { return tokens_; }
+    std::string_view text(const Token &token) const;
     void printTokens(std::ostream &outstream);
     void printErrors(std::ostream &outstream);
 
 private:
-    std::string input_;
+    std::string_view input_;
     std::vector<Token> tokens_;
-    std::stack<Token> stack_;
+    std::vector<std::string> errors_;
+    // Indices into tokens_ of the brackets still open
+    std::vector<size_t> open_;
 
-    std::optional<Token> readString(const std::string &contents, int &i, int lineNum);
-    std::optional<Token> readNumber(const std::string &contents, int &i, int lineNum);
-    std::optional<Token> readIdentifierOrKeyword(const std::string &contents, int &i, int lineNum);
-    std::optional<Token> readComparison(const std::string &contents, int &i, int lineNum);
-    std::optional<Token> readSymbol(const std::string &contents, int &i, int lineNum);
-    void addToken(const Token &t);
+    Token token(TokenType type, size_t start, size_t end, int line) const;
+    Token error(std::string message, int line);
+    Token readString(size_t &i, int line);
+    Token readNumber(size_t &i, int line);
+    Token readWord(size_t &i, int line);
     void handleBrackets(const Token &t);
 };
 
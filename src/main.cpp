@@ -1,18 +1,29 @@
 #include "cli.hpp"
 
+#include "batch.hpp"
+#include "cache.hpp"
+
+#include "bytecode/image.hpp"
+#include "bytecode/optimizer.hpp"
 #include "bytecode/parser.hpp"
 #include "bytecode/prettyprinter.hpp"
 #include "lexer.hpp"
 #include "parser.hpp"
 #include "ast.hpp"
 #include "interp.hpp"
+#include "vm/vm.hpp"
+#include "compiler/compiler.hpp"
 
 #include <sstream>
 #include <fstream>
+#include <filesystem>
 
+#include <memory>
 #include <optional>
+#include <algorithm>
+#include <memory>
+#include <string_view>
 #include <iostream>
-#include <stack>
 
 static std::string
 read_istream(std::istream &is)
@@ -21,11 +32,313 @@ read_istream(std::istream &is)
                      std::istreambuf_iterator<char>());
 }
 
+// Lexes and parses a MITScript program, reporting errors the same way the
+// interpret subcommand does
+static ast::ASTNode *
+parse_program(Lexer &lexer, ast::Arena &arena, std::ostream &out = std::cout,
+              std::ostream &err = std::cerr)
+{
+  const std::vector<Token> &tokens = lexer.lex();
+  if (std::any_of(tokens.begin(), tokens.end(), [](const Token &token)
+                  { return token.type == TokenType::Error; }))
+  {
+    lexer.printErrors(err);
+    return nullptr;
+  }
+  Parser parser(lexer, arena, err);
+  ast::ASTNode *ast = parser.parse();
+  if (!ast)
+  {
+    out << "parse error" << std::endl;
+  }
+  return ast;
+}
+
+// The -m budget is given in MB and bounds the collected heap
+static HeapOptions
+heap_options(const Command &command)
+{
+  HeapOptions options;
+  options.limit = command.mem * 1024 * 1024;
+  options.markThreads = command.gc_threads;
+  options.stats = command.gc_stats;
+  return options;
+}
+
+static vm::Tier
+vm_tier(const Command &command)
+{
+  switch (command.tier)
+  {
+  case TierKind::REGISTER:
+    return vm::Tier::Register;
+  case TierKind::JIT:
+    return vm::Tier::Jit;
+  default:
+    return vm::Tier::Stack;
+  }
+}
+
+// Bytecode for the vm subcommand, as an image or as text. A file is mapped
+// rather than read, so an image loads straight from the page cache.
+static std::unique_ptr<bytecode::Function>
+load_bytecode(Command &command)
+{
+  if (command.input_filename != "-")
+  {
+    bytecode::MappedFile file(command.input_filename);
+    if (file.mapped())
+    {
+      if (bytecode::is_image(file.data()))
+      {
+        return bytecode::load_image(file.data());
+      }
+      return std::unique_ptr<bytecode::Function>(bytecode::parse(std::string(file.data())));
+    }
+  }
+  std::string contents = read_istream(*command.input_stream);
+  if (bytecode::is_image(contents))
+  {
+    return bytecode::load_image(contents);
+  }
+  return std::unique_ptr<bytecode::Function>(bytecode::parse(contents));
+}
+
+// The passes -O or --passes asks for. An unknown pass is reported like
+// any other bad option.
+static bytecode::Pipeline
+optimizer(const Command &command)
+{
+  if (command.passes.empty())
+  {
+    return bytecode::make_pipeline(command.opt_level);
+  }
+  bytecode::Pipeline pipeline;
+  std::string_view list = command.passes;
+  while (!list.empty())
+  {
+    size_t comma = std::min(list.find(','), list.size());
+    std::string_view name = list.substr(0, comma);
+    list.remove_prefix(std::min(comma + 1, list.size()));
+    std::unique_ptr<bytecode::Pass> pass = bytecode::make_pass(name);
+    if (!pass)
+    {
+      std::cerr << "Error: Unknown pass '" << name << "'\n";
+      exit(1);
+    }
+    pipeline.add(std::move(pass));
+  }
+  return pipeline;
+}
+
+static void
+optimize(bytecode::Pipeline &pipeline, bytecode::Function *function,
+         const Command &command, std::ostream &err = std::cerr)
+{
+  pipeline.run(function);
+  if (command.opt_stats)
+  {
+    pipeline.report(err);
+  }
+}
+
+// Writes what the profiler saw, also for a program that failed
+static void
+write_profile(const vm::Profiler &profiler, const Command &command)
+{
+  std::ofstream out(command.profile);
+  profiler.writeFolded(out);
+  if (!out)
+  {
+    std::cerr << "Error: Cannot write profile '" << command.profile << "'\n";
+  }
+  profiler.report(std::cerr);
+}
+
+// Runs function with print writing to out, input reading in and errors
+// going to err
+static int
+run_bytecode(const bytecode::Function *function, const Command &command,
+             std::ostream &out, std::FILE *in, std::ostream &err)
+{
+  std::optional<vm::Profiler> profiler;
+  if (!command.profile.empty())
+  {
+    profiler.emplace();
+  }
+  int status = 0;
+  try
+  {
+    vm::VirtualMachine machine(function, out, in, heap_options(command),
+                               vm_tier(command), command.stats,
+                               profiler ? &*profiler : nullptr);
+    machine.run();
+    if (command.stats)
+    {
+      machine.report(err);
+    }
+  }
+  catch (const std::exception &e)
+  {
+    out.flush();
+    err << e.what() << std::endl;
+    status = 1;
+  }
+  if (profiler)
+  {
+    write_profile(*profiler, command);
+  }
+  return status;
+}
+
+static int
+run_bytecode(const bytecode::Function *function, Command &command)
+{
+  return run_bytecode(function, command, *command.output_stream, stdin,
+                      std::cerr);
+}
+
+// Compiles a script of a batch the way run does, with what run would print
+// about one that does not compile kept in the program
+static BatchProgram
+compile_script(const std::string &script, const Command &command,
+               const CompilationCache *cache)
+{
+  BatchProgram program;
+  bytecode::MappedFile file(script);
+  std::string buffer;
+  std::string_view contents;
+  if (file.mapped())
+  {
+    contents = file.data();
+  }
+  else
+  {
+    std::ifstream in(script, std::ios::binary);
+    if (!in)
+    {
+      program.errors = "Error: Input file '" + script + "' does not exist\n";
+      return program;
+    }
+    buffer = read_istream(in);
+    contents = buffer;
+  }
+  if (cache)
+  {
+    program.function = cache->find(contents);
+    if (program.function)
+    {
+      return program;
+    }
+  }
+
+  Lexer lexer(contents);
+  ast::Arena arena;
+  std::ostringstream out;
+  std::ostringstream err;
+  ast::ASTNode *ast = parse_program(lexer, arena, out, err);
+  if (ast)
+  {
+    std::unique_ptr<bytecode::Function> function = compiler::compile(*ast);
+    // Pipelines keep statistics, so every script gets one
+    bytecode::Pipeline pipeline = optimizer(command);
+    optimize(pipeline, function.get(), command, err);
+    if (cache)
+    {
+      cache->store(contents, function.get());
+    }
+    program.function = std::move(function);
+  }
+  program.output = out.str();
+  program.errors = err.str();
+  return program;
+}
+
+// The batch subcommand. A script the manifest lists more than once is
+// compiled once, and every job runs on a VM of its own.
+static int
+run_manifest(Command &command)
+{
+  std::filesystem::path base;
+  if (command.input_filename != "-")
+  {
+    base = std::filesystem::path(command.input_filename).parent_path();
+  }
+  std::vector<BatchJob> jobs;
+  try
+  {
+    jobs = read_manifest(*command.input_stream, base);
+  }
+  catch (const std::exception &e)
+  {
+    std::cerr << "Error: " << e.what() << "\n";
+    return 1;
+  }
+
+  std::optional<CompilationCache> cache;
+  if (!command.cache_dir.empty())
+  {
+    bytecode::Pipeline pipeline = optimizer(command);
+    cache.emplace(command.cache_dir, pipeline.empty() ? "" : pipeline.describe());
+  }
+  BatchPrograms programs([&](const std::string &script)
+                         { return compile_script(script, command, cache ? &*cache : nullptr); });
+  size_t failed = run_batch(
+      jobs, command.jobs,
+      [&](const BatchJob &job, std::FILE *input, std::ostream &out, std::ostream &err)
+      {
+        const BatchProgram &program = programs.get(job.script);
+        out << program.output;
+        err << program.errors;
+        if (!program.function)
+        {
+          return 1;
+        }
+        return run_bytecode(program.function.get(), command, out, input, err);
+      },
+      *command.output_stream, std::cerr);
+  if (failed > 0)
+  {
+    std::cerr << "Error: " << failed << " of " << jobs.size()
+              << " scripts failed\n";
+    return 1;
+  }
+  return 0;
+}
+
 int main(int argc, char **argv)
 {
   Command command = cli_parse(argc, argv);
+  bytecode::Pipeline pipeline = optimizer(command);
+  if (command.kind == CommandKind::BATCH)
+  {
+    return run_manifest(command);
+  }
+  if (command.kind == CommandKind::VM)
+  {
+    std::unique_ptr<bytecode::Function> function = load_bytecode(command);
+    optimize(pipeline, function.get(), command);
+    return run_bytecode(function.get(), command);
+  }
 
-  std::string contents = read_istream(*command.input_stream);
+  // Source files are mapped rather than read; the lexer's tokens view the
+  // mapping directly
+  std::optional<bytecode::MappedFile> file;
+  std::string buffer;
+  std::string_view contents;
+  if (command.input_filename != "-")
+  {
+    file.emplace(command.input_filename);
+  }
+  if (file && file->mapped())
+  {
+    contents = file->data();
+  }
+  else
+  {
+    buffer = read_istream(*command.input_stream);
+    contents = buffer;
+  }
   std::string input_filename = command.input_filename;
   std::string output_filename = command.output_filename;
 
@@ -34,14 +347,14 @@ int main(int argc, char **argv)
   //           << "Input file contents: " << contents << "\n"
   //           << "Output filename: " << output_filename << "\n";
 
-  Lexer lexer = Lexer(contents);
-  std::vector<Token> tokens;
-  Interpreter interpreter;
+  Lexer lexer(contents);
+  ast::Arena arena;
+  const std::vector<Token> &tokens = lexer.tokens();
 
   switch (command.kind)
   {
   case CommandKind::SCAN:
-    tokens = lexer.lex();
+    lexer.lex();
     lexer.printTokens(*command.output_stream);
     if (std::any_of(tokens.begin(), tokens.end(), [](const Token &token)
                     { return token.type == TokenType::Error; }))
@@ -50,13 +363,13 @@ int main(int argc, char **argv)
     }
     break;
   case CommandKind::PARSE:
-    tokens = lexer.lex();
+    lexer.lex();
     if (!std::any_of(tokens.begin(), tokens.end(), [](const Token &token)
                      { return token.type == TokenType::Error; }))
     {
-      Parser parser(tokens);
-      auto ast = parser.parse();
-      if (!ast.has_value())
+      Parser parser(lexer, arena);
+      ast::ASTNode *ast = parser.parse();
+      if (!ast)
       {
         std::cout << "parse error" << std::endl;
         return 1;
@@ -69,16 +382,32 @@ int main(int argc, char **argv)
     }
     break;
   case CommandKind::COMPILE:
-    std::cerr << "Error: Compile command not yet implemented" << std::endl;
+  {
+    ast::ASTNode *ast = parse_program(lexer, arena);
+    if (!ast)
+    {
+      return 1;
+    }
+    std::unique_ptr<bytecode::Function> function = compiler::compile(*ast);
+    optimize(pipeline, function.get(), command);
+    if (command.binary)
+    {
+      bytecode::write_image(function.get(), *command.output_stream);
+    }
+    else
+    {
+      bytecode::prettyprint(function.get(), *command.output_stream);
+    }
     break;
+  }
   case CommandKind::INTERPRET:
-    tokens = lexer.lex();
+    lexer.lex();
     if (!std::any_of(tokens.begin(), tokens.end(), [](const Token &token)
                      { return token.type == TokenType::Error; }))
     {
-      Parser parser(tokens);
-      auto ast = parser.parse();
-      if (!ast.has_value())
+      Parser parser(lexer, arena);
+      ast::ASTNode *ast = parser.parse();
+      if (!ast)
       {
         std::cout << "parse error" << std::endl;
         return 1;
@@ -87,7 +416,12 @@ int main(int argc, char **argv)
       {
         try
         {
-          interpreter.interpret(*ast.value());
+          Interpreter interpreter(*command.output_stream, stdin, heap_options(command), command.closures);
+          interpreter.interpret(*ast);
+          if (command.stats)
+          {
+            interpreter.report(std::cerr);
+          }
         }
         catch (const std::exception &e)
         {
@@ -103,10 +437,35 @@ int main(int argc, char **argv)
     }
     break;
   case CommandKind::VM:
-  {
-    auto bytecode = bytecode::parse(contents);
-    bytecode::prettyprint(bytecode, *command.output_stream);
+  case CommandKind::BATCH:
+    // Handled before the input is read
     break;
+  case CommandKind::RUN:
+  {
+    // A program compiled by an earlier run skips the lexer, parser,
+    // compiler and optimizer entirely. Code optimized differently is kept
+    // apart. Cached code has no source lines for a profile.
+    std::optional<CompilationCache> cache;
+    if (!command.cache_dir.empty() && command.profile.empty())
+    {
+      cache.emplace(command.cache_dir, pipeline.empty() ? "" : pipeline.describe());
+      if (std::unique_ptr<bytecode::Function> function = cache->find(contents))
+      {
+        return run_bytecode(function.get(), command);
+      }
+    }
+    ast::ASTNode *ast = parse_program(lexer, arena);
+    if (!ast)
+    {
+      return 1;
+    }
+    std::unique_ptr<bytecode::Function> function = compiler::compile(*ast);
+    optimize(pipeline, function.get(), command);
+    if (cache)
+    {
+      cache->store(contents, function.get());
+    }
+    return run_bytecode(function.get(), command);
   }
   }
 
@@ -2,11 +2,40 @@
 
 #include <iostream>
 #include <algorithm>
-#include <optional>
 
-Parser::Parser(const std::vector<Token> &tokens) : tokens_(tokens), current_(0) {}
+// Decode the escape sequences the lexer accepted inside a string literal
+static std::string unescape(std::string_view str)
+{
+    std::string result;
+    for (size_t i = 0; i < str.length(); i++)
+    {
+        if (str[i] == '\\' && i + 1 < str.length())
+        {
+            switch (str[++i])
+            {
+            case 'n':
+                result += '\n';
+                break;
+            case 't':
+                result += '\t';
+                break;
+            default:
+                result += str[i];
+                break;
+            }
+        }
+        else
+        {
+            result += str[i];
+        }
+    }
+    return result;
+}
 
-std::optional<std::unique_ptr<ast::ASTNode>> Parser::parse()
+Parser::Parser(const Lexer &lexer, ast::Arena &arena, std::ostream &errors)
+    : lexer_(lexer), tokens_(lexer.tokens()), arena_(arena), errors_(errors), current_(0) {}
+
+ast::ASTNode *Parser::parse()
 {
     try
     {
@@ -14,58 +43,64 @@ std::optional<std::unique_ptr<ast::ASTNode>> Parser::parse()
     }
     catch (const std::exception &e)
     {
-        // Print the error message using std::cerr
-        std::cerr << "Caught exception: " << e.what() << std::endl;
-        return std::nullopt;
+        errors_ << "Caught exception: " << e.what() << std::endl;
+        return nullptr;
     }
 }
 
 // Grammar rules
-std::unique_ptr<ast::ASTNode> Parser::program()
+ast::ASTNode *Parser::program()
 {
-    std::vector<std::unique_ptr<ast::ASTNode>> statements;
+    std::vector<ast::ASTNode *> statements;
 
     while (!isAtEnd())
     {
         auto stmt = statement();
         if (stmt)
         {
-            statements.push_back(std::move(stmt));
+            statements.push_back(stmt);
         }
     }
 
-    return std::make_unique<ast::Block>(std::move(statements));
+    return arena_.make<ast::Block>(arena_.list(statements));
 }
 
-std::unique_ptr<ast::ASTNode> Parser::statement()
+ast::ASTNode *Parser::statement()
 {
+    int line = peek().line;
+    ast::ASTNode *stmt = nullptr;
     // Check if the current token is a keyword
     if (check(TokenType::Keyword))
     {
-        std::string keyword = peek().str;
+        std::string_view keyword = text(peek());
         if (keyword == "if")
         {
-            return ifStatement();
+            stmt = ifStatement();
         }
         else if (keyword == "while")
         {
-            return whileStatement();
+            stmt = whileStatement();
         }
         else if (keyword == "return")
         {
-            return returnStatement();
+            stmt = returnStatement();
         }
         else if (keyword == "global")
         {
-            return globalDeclaration();
+            stmt = globalDeclaration();
         }
     }
 
     // Parse assignment or call statement
-    return parse_assignment_or_call();
+    if (!stmt)
+    {
+        stmt = parse_assignment_or_call();
+    }
+    stmt->line = line;
+    return stmt;
 }
 
-std::unique_ptr<ast::ASTNode> Parser::parse_assignment_or_call()
+ast::ASTNode *Parser::parse_assignment_or_call()
 {
     // First try to parse a location (could be complex with dots, brackets, etc.)
     auto expr = location();
@@ -77,12 +112,12 @@ std::unique_ptr<ast::ASTNode> Parser::parse_assignment_or_call()
 
     if (check(TokenType::Assign))
     {
-        return assignment(std::move(expr));
+        return assignment(expr);
     }
 
     if (check(TokenType::LParen))
     {
-        expr = function_call(std::move(expr));
+        expr = function_call(expr);
         if (!consume(TokenType::Semicolon, "Expect ';' after arguments"))
         {
             throw std::runtime_error("Invalid call expression");
@@ -92,11 +127,12 @@ std::unique_ptr<ast::ASTNode> Parser::parse_assignment_or_call()
     throw std::runtime_error("Invalid expression");
 }
 
-std::unique_ptr<ast::ASTNode> Parser::function_call(std::unique_ptr<ast::ASTNode> expr)
+ast::ASTNode *Parser::function_call(ast::ASTNode *expr)
 {
+    int line = peek().line;
     consume(TokenType::LParen, "Expect '(' after function name");
     // Function call
-    std::vector<std::unique_ptr<ast::ASTNode>> args;
+    std::vector<ast::ASTNode *> args;
     if (!check(TokenType::RParen))
     {
         do
@@ -104,7 +140,7 @@ std::unique_ptr<ast::ASTNode> Parser::function_call(std::unique_ptr<ast::ASTNode
             auto arg = expression();
             if (!arg)
                 throw std::runtime_error("Invalid argument expression");
-            args.push_back(std::move(arg));
+            args.push_back(arg);
         } while (match({TokenType::Comma}));
     }
     // Functions can have zero arguments according to the spec
@@ -113,10 +149,12 @@ std::unique_ptr<ast::ASTNode> Parser::function_call(std::unique_ptr<ast::ASTNode
     {
         throw std::runtime_error("Invalid call expression");
     }
-    return std::make_unique<ast::Call>(std::move(expr), std::move(args));
+    ast::Call *call = arena_.make<ast::Call>(expr, arena_.list(args));
+    call->line = line;
+    return call;
 }
 
-std::unique_ptr<ast::ASTNode> Parser::location()
+ast::ASTNode *Parser::location()
 {
     auto expr = idTerm();
     if (!expr)
@@ -133,8 +171,8 @@ std::unique_ptr<ast::ASTNode> Parser::location()
             {
                 throw std::runtime_error("Expect identifier after '.'");
             }
-            std::string field = advance().str;
-            expr = std::make_unique<ast::FieldDereference>(std::move(expr), std::move(field));
+            Symbol field = symbol(advance());
+            expr = arena_.make<ast::FieldDereference>(expr, field);
         }
         else if (match({TokenType::LSquareBrace}))
         {
@@ -144,7 +182,7 @@ std::unique_ptr<ast::ASTNode> Parser::location()
             {
                 throw std::runtime_error("Invalid index expression");
             }
-            expr = std::make_unique<ast::IndexExpression>(std::move(expr), std::move(index));
+            expr = arena_.make<ast::IndexExpression>(expr, index);
         }
         else
         {
@@ -154,16 +192,16 @@ std::unique_ptr<ast::ASTNode> Parser::location()
     return expr;
 }
 
-std::unique_ptr<ast::ASTNode> Parser::idTerm()
+ast::ASTNode *Parser::idTerm()
 {
     if (check(TokenType::Identifier))
     {
-        return std::make_unique<ast::Identifier>(advance().str);
+        return arena_.make<ast::Identifier>(symbol(advance()));
     }
     throw std::runtime_error("Expected identifier");
 }
 
-std::unique_ptr<ast::ASTNode> Parser::assignment(std::unique_ptr<ast::ASTNode> location)
+ast::ASTNode *Parser::assignment(ast::ASTNode *location)
 {
     if (!consume(TokenType::Assign, "Expected '='"))
     {
@@ -181,24 +219,24 @@ std::unique_ptr<ast::ASTNode> Parser::assignment(std::unique_ptr<ast::ASTNode> l
         throw std::runtime_error("Invalid assignment");
     }
 
-    return std::make_unique<ast::Assignment>(std::move(location), std::move(expr));
+    return arena_.make<ast::Assignment>(location, expr);
 }
 
-std::unique_ptr<ast::ASTNode> Parser::block()
+ast::ASTNode *Parser::block()
 {
     if (!consume(TokenType::LBrace, "Expect '{'"))
     {
         throw std::runtime_error("Invalid block");
     }
 
-    std::vector<std::unique_ptr<ast::ASTNode>> statements;
+    std::vector<ast::ASTNode *> statements;
 
     while (!check(TokenType::RBrace) && !isAtEnd())
     {
         auto stmt = statement();
         if (stmt)
         {
-            statements.push_back(std::move(stmt));
+            statements.push_back(stmt);
         }
     }
 
@@ -206,10 +244,10 @@ std::unique_ptr<ast::ASTNode> Parser::block()
     {
         throw std::runtime_error("Invalid block");
     }
-    return std::make_unique<ast::Block>(std::move(statements));
+    return arena_.make<ast::Block>(arena_.list(statements));
 }
 
-std::unique_ptr<ast::ASTNode> Parser::ifStatement()
+ast::ASTNode *Parser::ifStatement()
 {
     if (!consume(TokenType::Keyword, "Expect 'if'"))
     {
@@ -232,8 +270,8 @@ std::unique_ptr<ast::ASTNode> Parser::ifStatement()
         throw std::runtime_error("Invalid if statement");
     }
 
-    std::unique_ptr<ast::ASTNode> elseBranch = nullptr;
-    if (check(TokenType::Keyword) && peek().str == "else")
+    ast::ASTNode *elseBranch = nullptr;
+    if (check(TokenType::Keyword) && text(peek()) == "else")
     {
         if (!consume(TokenType::Keyword, "Expect 'else'"))
         {
@@ -246,10 +284,10 @@ std::unique_ptr<ast::ASTNode> Parser::ifStatement()
         }
     }
 
-    return std::make_unique<ast::IfStatement>(std::move(condition), std::move(thenBranch), std::move(elseBranch));
+    return arena_.make<ast::IfStatement>(condition, thenBranch, elseBranch);
 }
 
-std::unique_ptr<ast::ASTNode> Parser::whileStatement()
+ast::ASTNode *Parser::whileStatement()
 {
     if (!consume(TokenType::Keyword, "Expect 'while'"))
     {
@@ -272,10 +310,10 @@ std::unique_ptr<ast::ASTNode> Parser::whileStatement()
         throw std::runtime_error("Invalid while statement");
     }
 
-    return std::make_unique<ast::WhileLoop>(std::move(condition), std::move(body));
+    return arena_.make<ast::WhileLoop>(condition, body);
 }
 
-std::unique_ptr<ast::ASTNode> Parser::returnStatement()
+ast::ASTNode *Parser::returnStatement()
 {
     if (!consume(TokenType::Keyword, "Expect 'return'"))
     {
@@ -292,10 +330,10 @@ std::unique_ptr<ast::ASTNode> Parser::returnStatement()
     {
         throw std::runtime_error("Invalid return statement");
     }
-    return std::make_unique<ast::Return>(std::move(expr));
+    return arena_.make<ast::Return>(expr);
 }
 
-std::unique_ptr<ast::ASTNode> Parser::globalDeclaration()
+ast::ASTNode *Parser::globalDeclaration()
 {
     if (!consume(TokenType::Keyword, "Expect 'global'"))
     {
@@ -307,19 +345,19 @@ std::unique_ptr<ast::ASTNode> Parser::globalDeclaration()
         throw std::runtime_error("Expect identifier after 'global'");
     }
 
-    std::string id = advance().str;
+    Symbol id = symbol(advance());
     if (!consume(TokenType::Semicolon, "Expect ';' after global declaration"))
     {
         throw std::runtime_error("Invalid global declaration");
     }
 
-    return std::make_unique<ast::Global>(std::move(id));
+    return arena_.make<ast::Global>(id);
 }
 
-std::unique_ptr<ast::ASTNode> Parser::expression()
+ast::ASTNode *Parser::expression()
 {
     // Function declaration: fun ( [id+,] ) block
-    if (check(TokenType::Keyword) && peek().str == "fun")
+    if (check(TokenType::Keyword) && text(peek()) == "fun")
     {
         return functionDeclaration();
     }
@@ -343,7 +381,7 @@ std::unique_ptr<ast::ASTNode> Parser::expression()
 // & conditional and
 // | conditional or (lowest)
 
-std::unique_ptr<ast::ASTNode> Parser::logical_or()
+ast::ASTNode *Parser::logical_or()
 {
     auto expr = logical_and();
 
@@ -352,13 +390,13 @@ std::unique_ptr<ast::ASTNode> Parser::logical_or()
         auto right = logical_and();
         if (!right)
             throw std::runtime_error("Invalid logical OR expression");
-        expr = std::make_unique<ast::BinaryExpression>(std::move(expr), ast::BinaryExpression::Or, std::move(right));
+        expr = arena_.make<ast::BinaryExpression>(expr, ast::BinaryExpression::Or, right);
     }
 
     return expr;
 }
 
-std::unique_ptr<ast::ASTNode> Parser::logical_and()
+ast::ASTNode *Parser::logical_and()
 {
     auto expr = logical_not();
 
@@ -367,26 +405,26 @@ std::unique_ptr<ast::ASTNode> Parser::logical_and()
         auto right = logical_not();
         if (!right)
             throw std::runtime_error("Invalid logical AND expression");
-        expr = std::make_unique<ast::BinaryExpression>(std::move(expr), ast::BinaryExpression::And, std::move(right));
+        expr = arena_.make<ast::BinaryExpression>(expr, ast::BinaryExpression::And, right);
     }
 
     return expr;
 }
 
-std::unique_ptr<ast::ASTNode> Parser::logical_not()
+ast::ASTNode *Parser::logical_not()
 {
     if (match({TokenType::Not}))
     {
         auto expr = logical_not();
         if (!expr)
             throw std::runtime_error("Invalid logical NOT expression");
-        return std::make_unique<ast::UnaryExpression>(ast::UnaryExpression::UnaryOp::Not, std::move(expr));
+        return arena_.make<ast::UnaryExpression>(ast::UnaryExpression::UnaryOp::Not, expr);
     }
 
     return equality();
 }
 
-std::unique_ptr<ast::ASTNode> Parser::equality()
+ast::ASTNode *Parser::equality()
 {
     auto expr = relational();
 
@@ -395,13 +433,13 @@ std::unique_ptr<ast::ASTNode> Parser::equality()
         auto right = relational();
         if (!right)
             throw std::runtime_error("Invalid equality expression");
-        expr = std::make_unique<ast::BinaryExpression>(std::move(expr), ast::BinaryExpression::Eq, std::move(right));
+        expr = arena_.make<ast::BinaryExpression>(expr, ast::BinaryExpression::Eq, right);
     }
 
     return expr;
 }
 
-std::unique_ptr<ast::ASTNode> Parser::relational()
+ast::ASTNode *Parser::relational()
 {
     auto expr = additive();
 
@@ -412,28 +450,28 @@ std::unique_ptr<ast::ASTNode> Parser::relational()
             auto right = additive();
             if (!right)
                 throw std::runtime_error("Invalid relational expression");
-            expr = std::make_unique<ast::BinaryExpression>(std::move(expr), ast::BinaryExpression::Lt, std::move(right));
+            expr = arena_.make<ast::BinaryExpression>(expr, ast::BinaryExpression::Lt, right);
         }
         else if (match({TokenType::Gt}))
         {
             auto right = additive();
             if (!right)
                 throw std::runtime_error("Invalid relational expression");
-            expr = std::make_unique<ast::BinaryExpression>(std::move(expr), ast::BinaryExpression::Gt, std::move(right));
+            expr = arena_.make<ast::BinaryExpression>(expr, ast::BinaryExpression::Gt, right);
         }
         else if (match({TokenType::Leq}))
         {
             auto right = additive();
             if (!right)
                 throw std::runtime_error("Invalid relational expression");
-            expr = std::make_unique<ast::BinaryExpression>(std::move(expr), ast::BinaryExpression::Leq, std::move(right));
+            expr = arena_.make<ast::BinaryExpression>(expr, ast::BinaryExpression::Leq, right);
         }
         else if (match({TokenType::Geq}))
         {
             auto right = additive();
             if (!right)
                 throw std::runtime_error("Invalid relational expression");
-            expr = std::make_unique<ast::BinaryExpression>(std::move(expr), ast::BinaryExpression::Geq, std::move(right));
+            expr = arena_.make<ast::BinaryExpression>(expr, ast::BinaryExpression::Geq, right);
         }
         else
         {
@@ -444,7 +482,7 @@ std::unique_ptr<ast::ASTNode> Parser::relational()
     return expr;
 }
 
-std::unique_ptr<ast::ASTNode> Parser::additive()
+ast::ASTNode *Parser::additive()
 {
     auto expr = multiplicative();
 
@@ -455,14 +493,14 @@ std::unique_ptr<ast::ASTNode> Parser::additive()
             auto right = multiplicative();
             if (!right)
                 throw std::runtime_error("Invalid additive expression");
-            expr = std::make_unique<ast::BinaryExpression>(std::move(expr), ast::BinaryExpression::Add, std::move(right));
+            expr = arena_.make<ast::BinaryExpression>(expr, ast::BinaryExpression::Add, right);
         }
         else if (match({TokenType::Sub}))
         {
             auto right = multiplicative();
             if (!right)
                 throw std::runtime_error("Invalid additive expression");
-            expr = std::make_unique<ast::BinaryExpression>(std::move(expr), ast::BinaryExpression::Sub, std::move(right));
+            expr = arena_.make<ast::BinaryExpression>(expr, ast::BinaryExpression::Sub, right);
         }
         else
         {
@@ -473,7 +511,7 @@ std::unique_ptr<ast::ASTNode> Parser::additive()
     return expr;
 }
 
-std::unique_ptr<ast::ASTNode> Parser::multiplicative()
+ast::ASTNode *Parser::multiplicative()
 {
     auto expr = unary();
 
@@ -484,14 +522,14 @@ std::unique_ptr<ast::ASTNode> Parser::multiplicative()
             auto right = unary();
             if (!right)
                 throw std::runtime_error("Invalid multiplicative expression");
-            expr = std::make_unique<ast::BinaryExpression>(std::move(expr), ast::BinaryExpression::Mul, std::move(right));
+            expr = arena_.make<ast::BinaryExpression>(expr, ast::BinaryExpression::Mul, right);
         }
         else if (match({TokenType::Div}))
         {
             auto right = unary();
             if (!right)
                 throw std::runtime_error("Invalid multiplicative expression");
-            expr = std::make_unique<ast::BinaryExpression>(std::move(expr), ast::BinaryExpression::Div, std::move(right));
+            expr = arena_.make<ast::BinaryExpression>(expr, ast::BinaryExpression::Div, right);
         }
         else
         {
@@ -502,7 +540,7 @@ std::unique_ptr<ast::ASTNode> Parser::multiplicative()
     return expr;
 }
 
-std::unique_ptr<ast::ASTNode> Parser::unary()
+ast::ASTNode *Parser::unary()
 {
     // Handle unary minus (highest precedence according to spec)
     if (match({TokenType::Sub}))
@@ -510,14 +548,14 @@ std::unique_ptr<ast::ASTNode> Parser::unary()
         auto expr = unary();
         if (!expr)
             throw std::runtime_error("Invalid unary expression");
-        return std::make_unique<ast::UnaryExpression>(ast::UnaryExpression::UnaryOp::Neg, std::move(expr));
+        return arena_.make<ast::UnaryExpression>(ast::UnaryExpression::UnaryOp::Neg, expr);
     }
 
     // No unary operator, parse as primary
     return primary();
 }
 
-std::unique_ptr<ast::ASTNode> Parser::primary()
+ast::ASTNode *Parser::primary()
 {
     // Handle parenthesized expressions
     if (match({TokenType::LParen}))
@@ -533,30 +571,31 @@ std::unique_ptr<ast::ASTNode> Parser::primary()
     // Handle literals
     if (check(TokenType::IntLiteral))
     {
-        int value = std::stoi(advance().str);
-        return std::make_unique<ast::IntegerConstant>(value);
+        int value = std::stoi(std::string(text(advance())));
+        return arena_.make<ast::IntegerConstant>(value);
     }
 
     if (check(TokenType::StringLiteral))
     {
-        std::string value = advance().str;
-        value = value.substr(1, value.length() - 2); // Remove quotes
-        return std::make_unique<ast::StringConstant>(std::move(value));
+        std::string_view literal = text(advance());
+        literal = literal.substr(1, literal.length() - 2); // Remove quotes
+        std::string_view value = literal.find('\\') == std::string_view::npos ? arena_.string(literal) : arena_.string(unescape(literal));
+        return arena_.make<ast::StringConstant>(value);
     }
 
     if (check(TokenType::BooleanLiteral))
     {
-        bool value = advance().str == "true";
-        return std::make_unique<ast::BooleanConstant>(value);
+        bool value = text(advance()) == "true";
+        return arena_.make<ast::BooleanConstant>(value);
     }
 
     if (check(TokenType::Keyword))
     {
-        std::string keyword = peek().str;
+        std::string_view keyword = text(peek());
         if (keyword == "None")
         {
             advance();
-            return std::make_unique<ast::NoneConstant>();
+            return arena_.make<ast::NoneConstant>();
         }
     }
 
@@ -564,7 +603,7 @@ std::unique_ptr<ast::ASTNode> Parser::primary()
     return parse_location_or_call();
 }
 
-std::unique_ptr<ast::ASTNode> Parser::parse_location_or_call()
+ast::ASTNode *Parser::parse_location_or_call()
 {
     // First try to parse a location
     auto expr = location();
@@ -575,13 +614,14 @@ std::unique_ptr<ast::ASTNode> Parser::parse_location_or_call()
     }
     if (check(TokenType::LParen))
     {
-        return function_call(std::move(expr));
+        return function_call(expr);
     }
     return expr;
 }
 
-std::unique_ptr<ast::ASTNode> Parser::functionDeclaration()
+ast::ASTNode *Parser::functionDeclaration()
 {
+    int line = peek().line;
     if (!(consume(TokenType::Keyword, "Expect 'fun'")))
     {
         throw std::runtime_error("Invalid function declaration");
@@ -592,7 +632,7 @@ std::unique_ptr<ast::ASTNode> Parser::functionDeclaration()
         throw std::runtime_error("Invalid function declaration");
     }
 
-    std::vector<std::string> parameters;
+    std::vector<Symbol> parameters;
     if (!check(TokenType::RParen))
     {
         do
@@ -601,7 +641,7 @@ std::unique_ptr<ast::ASTNode> Parser::functionDeclaration()
             {
                 throw std::runtime_error("Expect parameter name");
             }
-            parameters.push_back(advance().str);
+            parameters.push_back(symbol(advance()));
         } while (match({TokenType::Comma}));
     }
     // Functions can have zero parameters according to the spec
@@ -617,17 +657,19 @@ std::unique_ptr<ast::ASTNode> Parser::functionDeclaration()
         throw std::runtime_error("Invalid function body");
     }
 
-    return std::make_unique<ast::FunctionDeclaration>(std::move(parameters), std::move(body));
+    ast::FunctionDeclaration *function = arena_.make<ast::FunctionDeclaration>(arena_.list(parameters), body);
+    function->line = line;
+    return function;
 }
 
-std::unique_ptr<ast::ASTNode> Parser::record()
+ast::ASTNode *Parser::record()
 {
     if (!consume(TokenType::LBrace, "Expect '{'"))
     {
         throw std::runtime_error("Invalid record");
     }
 
-    std::vector<std::pair<std::string, std::unique_ptr<ast::ASTNode>>> fields;
+    std::vector<std::pair<Symbol, ast::ASTNode *>> fields;
 
     while (!check(TokenType::RBrace) && !isAtEnd())
     {
@@ -636,7 +678,7 @@ std::unique_ptr<ast::ASTNode> Parser::record()
             throw std::runtime_error("Expect field name");
         }
 
-        std::string key = advance().str;
+        Symbol key = symbol(advance());
 
         if (!consume(TokenType::Colon, "Expect ':' after record key"))
         {
@@ -648,14 +690,14 @@ std::unique_ptr<ast::ASTNode> Parser::record()
             throw std::runtime_error("Invalid record field");
         }
 
-        fields.push_back({key, std::move(value)});
+        fields.push_back({key, value});
     }
 
     if (!consume(TokenType::RBrace, "Expect '}' after record"))
     {
         throw std::runtime_error("Invalid record");
     }
-    return std::make_unique<ast::Record>(std::move(fields));
+    return arena_.make<ast::Record>(arena_.list(fields));
 }
 
 // Helper methods
@@ -668,7 +710,7 @@ const Token &Parser::peek() const
 {
     if (isAtEnd())
     {
-        static Token eofToken{TokenType::None, "", -1};
+        static Token eofToken{TokenType::None, 0, 0, -1};
         return eofToken;
     }
     return tokens_[current_];
@@ -679,7 +721,7 @@ const Token &Parser::previous() const
     if (current_ > 0)
         return tokens_[current_ - 1];
 
-    static Token dummyToken{TokenType::Error, "", 0};
+    static Token dummyToken{TokenType::Error, 0, 0, 0};
     return dummyToken;
 }
 
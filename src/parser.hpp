@@ -2,23 +2,32 @@
 
 #include "lexer.hpp"
 #include "ast.hpp"
+#include <iostream>
 #include <string>
-#include <map>
-#include <memory>
+#include <string_view>
 #include <vector>
-#include <optional>
 
 class Parser
 {
 public:
-    explicit Parser(const std::vector<Token> &tokens);
+    // Parses the tokens lexer has already produced, building the tree in
+    // arena.  A syntax error is described on errors.
+    Parser(const Lexer &lexer, ast::Arena &arena, std::ostream &errors = std::cerr);
 
-    std::optional<std::unique_ptr<ast::ASTNode>> parse();
+    // The program, allocated in arena, or nullptr after a syntax error
+    ast::ASTNode *parse();
 
 private:
+    const Lexer &lexer_;
     const std::vector<Token> &tokens_;
+    ast::Arena &arena_;
+    std::ostream &errors_;
     size_t current_;
 
+    // Identifiers are interned only here, as the parser takes them
+    std::string_view text(const Token &token) const { return lexer_.text(token); }
+    Symbol symbol(const Token &token) const { return Symbol(lexer_.text(token)); }
+
     // Helper methods
     bool isAtEnd() const;
     const Token &peek() const;
@@ -30,33 +39,33 @@ private:
     bool consume(TokenType type, const std::string &message);
 
     // Grammar rules
-    std::unique_ptr<ast::ASTNode> program();
-    std::unique_ptr<ast::ASTNode> statement();
-    std::unique_ptr<ast::ASTNode> block();
-    std::unique_ptr<ast::ASTNode> expression();
-    std::unique_ptr<ast::ASTNode> location();
+    ast::ASTNode *program();
+    ast::ASTNode *statement();
+    ast::ASTNode *block();
+    ast::ASTNode *expression();
+    ast::ASTNode *location();
 
     // Statement types
-    std::unique_ptr<ast::ASTNode> ifStatement();
-    std::unique_ptr<ast::ASTNode> whileStatement();
-    std::unique_ptr<ast::ASTNode> returnStatement();
-    std::unique_ptr<ast::ASTNode> functionDeclaration();
-    std::unique_ptr<ast::ASTNode> globalDeclaration();
-    std::unique_ptr<ast::ASTNode> record();
-
-    std::unique_ptr<ast::ASTNode> idTerm();
-    std::unique_ptr<ast::ASTNode> assignment(std::unique_ptr<ast::ASTNode> loc);
-    std::unique_ptr<ast::ASTNode> parse_assignment_or_call();
-    std::unique_ptr<ast::ASTNode> function_call(std::unique_ptr<ast::ASTNode> expr);
-    std::unique_ptr<ast::ASTNode> parse_location_or_call();
-
-    std::unique_ptr<ast::ASTNode> logical_or();     // Lowest precedence: |
-    std::unique_ptr<ast::ASTNode> logical_and();    // &
-    std::unique_ptr<ast::ASTNode> logical_not();    // !
-    std::unique_ptr<ast::ASTNode> equality();       // ==
-    std::unique_ptr<ast::ASTNode> relational();     // <, >, <=, >=
-    std::unique_ptr<ast::ASTNode> additive();       // +, -
-    std::unique_ptr<ast::ASTNode> multiplicative(); // *, /
-    std::unique_ptr<ast::ASTNode> unary();          // unary - (highest precedence)
-    std::unique_ptr<ast::ASTNode> primary();        // literals, identifiers, ()
+    ast::ASTNode *ifStatement();
+    ast::ASTNode *whileStatement();
+    ast::ASTNode *returnStatement();
+    ast::ASTNode *functionDeclaration();
+    ast::ASTNode *globalDeclaration();
+    ast::ASTNode *record();
+
+    ast::ASTNode *idTerm();
+    ast::ASTNode *assignment(ast::ASTNode *loc);
+    ast::ASTNode *parse_assignment_or_call();
+    ast::ASTNode *function_call(ast::ASTNode *expr);
+    ast::ASTNode *parse_location_or_call();
+
+    ast::ASTNode *logical_or();     // Lowest precedence: |
+    ast::ASTNode *logical_and();    // &
+    ast::ASTNode *logical_not();    // !
+    ast::ASTNode *equality();       // ==
+    ast::ASTNode *relational();     // <, >, <=, >=
+    ast::ASTNode *additive();       // +, -
+    ast::ASTNode *multiplicative(); // *, /
+    ast::ASTNode *unary();          // unary - (highest precedence)
+    ast::ASTNode *primary();        // literals, identifiers, ()
 };
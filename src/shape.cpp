@@ -0,0 +1,79 @@
+#include "shape.hpp"
+
+#include <algorithm>
+
+Shape *Shape::withField(Symbol name)
+{
+    auto it = transitions_.find(name);
+    if (it != transitions_.end())
+    {
+        return it->second.get();
+    }
+
+    // The copies of names_ and slots_ dominate what a shape costs
+    size_t bytes = sizeof(Shape) +
+                   (names_.size() + 1) * (2 * sizeof(Symbol) + sizeof(int) + 2 * sizeof(void *));
+    if (transitions_.size() >= kMaxTransitions || !table_->reserve(bytes))
+    {
+        return nullptr;
+    }
+
+    std::unique_ptr<Shape> next(new Shape(table_));
+    next->names_ = names_;
+    next->names_.push_back(name);
+    next->slots_ = slots_;
+    next->slots_[name] = static_cast<int>(names_.size());
+
+    Shape *result = next.get();
+    transitions_[name] = std::move(next);
+    return result;
+}
+
+const std::vector<int> &Shape::sortedSlots() const
+{
+    if (!sortedValid_)
+    {
+        sorted_.resize(names_.size());
+        for (size_t i = 0; i < names_.size(); i++)
+        {
+            sorted_[i] = static_cast<int>(i);
+        }
+        std::sort(sorted_.begin(), sorted_.end(),
+                  [this](int a, int b) { return names_[a] < names_[b]; });
+        sortedValid_ = true;
+    }
+    return sorted_;
+}
+
+Dictionary::Dictionary(const Shape &shape) : slots_(shape.names_.size())
+{
+    names_.reserve(shape.names_.size());
+    for (const Symbol &name : shape.names_)
+    {
+        slots_.emplace(name.str(), static_cast<int>(names_.size()));
+        names_.push_back(name.str());
+    }
+}
+
+void Dictionary::add(std::string_view name)
+{
+    slots_.emplace(name, static_cast<int>(names_.size()));
+    names_.emplace_back(name);
+    sortedValid_ = false;
+}
+
+const std::vector<int> &Dictionary::sortedSlots() const
+{
+    if (!sortedValid_)
+    {
+        sorted_.resize(names_.size());
+        for (size_t i = 0; i < names_.size(); i++)
+        {
+            sorted_[i] = static_cast<int>(i);
+        }
+        std::sort(sorted_.begin(), sorted_.end(),
+                  [this](int a, int b) { return names_[a] < names_[b]; });
+        sortedValid_ = true;
+    }
+    return sorted_;
+}
@@ -0,0 +1,305 @@
+#pragma once
+
+#include "symbol.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class ShapeTable;
+
+/*
+  A hidden class: the ordered list of field names shared by every record that
+  gained the same fields in the same order.  Shapes form a tree rooted at the
+  empty shape of a ShapeTable, and adding a field follows (or creates) a
+  transition edge, so records built the same way end up with the same Shape
+  and an access site can cache the slot it resolved for that shape.
+
+  Shapes live as long as the ShapeTable that created them, so the table
+  bounds how many it makes: a shape has at most kMaxTransitions children and
+  all shared shapes together stay within the table's byte limit.  A record
+  that needs a shape past either bound, that grows past kMaxSharedFields
+  fields, or that gains a field through an index store (one used as an
+  array or a map), switches to a Dictionary of its own.  Otherwise every
+  such record would leave a chain of shapes behind, each holding a copy of
+  all the names before it.
+*/
+class Shape
+{
+public:
+    static constexpr size_t kMaxSharedFields = 64;
+    static constexpr size_t kMaxTransitions = 64;
+
+    size_t fieldCount() const { return names_.size(); }
+    Symbol fieldName(size_t slot) const { return names_[slot]; }
+
+    // Slot of the field in records of this shape, or -1 if they lack it
+    int find(Symbol name) const
+    {
+        auto it = slots_.find(name);
+        return it == slots_.end() ? -1 : it->second;
+    }
+
+    // The shape a record of this shape has after gaining the field, which
+    // then occupies slot fieldCount(), or nullptr if the table cannot make
+    // another shape
+    Shape *withField(Symbol name);
+
+    // Slots in order of field name, for printing records sorted by field
+    const std::vector<int> &sortedSlots() const;
+
+private:
+    friend class ShapeTable;
+    friend class Dictionary;
+    explicit Shape(ShapeTable *table) : table_(table) {}
+
+    ShapeTable *table_;
+    std::vector<Symbol> names_;
+    std::unordered_map<Symbol, int> slots_;
+    std::unordered_map<Symbol, std::unique_ptr<Shape>> transitions_;
+    mutable std::vector<int> sorted_;
+    mutable bool sortedValid_ = false;
+};
+
+/*
+  The field names of a record that left the shared shapes.  It belongs to
+  that one record and gains fields in place.  Names are kept as plain
+  strings, so keys computed at runtime are never interned.
+*/
+class Dictionary
+{
+public:
+    // A dictionary with the fields of shape, in the same slots
+    explicit Dictionary(const Shape &shape);
+
+    size_t fieldCount() const { return names_.size(); }
+    const std::string &fieldName(size_t slot) const { return names_[slot]; }
+
+    int find(std::string_view name) const
+    {
+        auto it = slots_.find(name);
+        return it == slots_.end() ? -1 : it->second;
+    }
+
+    // Adds the field, which then occupies slot fieldCount() - 1
+    void add(std::string_view name);
+
+    const std::vector<int> &sortedSlots() const;
+
+private:
+    std::vector<std::string> names_;
+    std::unordered_map<std::string, int, TextHash, std::equal_to<>> slots_;
+    mutable std::vector<int> sorted_;
+    mutable bool sortedValid_ = false;
+};
+
+class ShapeTable
+{
+public:
+    ShapeTable() : empty_(new Shape(this)) {}
+
+    Shape *empty() { return empty_.get(); }
+
+    // Bytes the shared shapes may take up, past which records that need a
+    // new shape get a dictionary shape instead
+    void setLimit(size_t bytes) { limit_ = bytes; }
+    size_t bytes() const { return bytes_; }
+
+private:
+    friend class Shape;
+
+    // Takes bytes for a new shape out of the limit, if they fit
+    bool reserve(size_t bytes)
+    {
+        if (bytes > limit_ - std::min(bytes_, limit_))
+        {
+            return false;
+        }
+        bytes_ += bytes;
+        return true;
+    }
+
+    std::unique_ptr<Shape> empty_;
+    size_t limit_ = SIZE_MAX;
+    size_t bytes_ = 0;
+};
+
+/*
+  Inline cache for one field access site: the shape last seen there and the
+  slot it resolved to.  A store that added the field also remembers the shape
+  it transitioned to, so building records of the same layout skips the
+  transition lookup as well.
+*/
+struct FieldCache
+{
+    const Shape *shape = nullptr;
+    Shape *next = nullptr;
+    int slot = -1;
+};
+
+/*
+  Field storage of a record: a shape plus one value per slot.  V must be
+  default-constructible to the value returned for a missing field.  Once the
+  record has a dictionary its shape is no longer used, and inline caches are
+  bypassed, since the dictionary changes in place.
+*/
+template <typename V>
+class ShapedFields
+{
+public:
+    explicit ShapedFields(Shape *empty) : shape_(empty) {}
+
+    const std::vector<V> &values() const { return slots_; }
+    bool empty() const { return slots_.empty(); }
+
+    V get(Symbol name) const
+    {
+        int slot = dictionary_ ? dictionary_->find(name.str()) : shape_->find(name);
+        return slot < 0 ? V() : slots_[slot];
+    }
+
+    // Lookup with a name computed at runtime
+    V lookup(std::string_view name) const
+    {
+        int slot = find(name);
+        return slot < 0 ? V() : slots_[slot];
+    }
+
+    V get(Symbol name, FieldCache &cache) const
+    {
+        if (dictionary_)
+        {
+            return get(name);
+        }
+        if (cache.shape != shape_)
+        {
+            cache.shape = shape_;
+            cache.next = nullptr;
+            cache.slot = shape_->find(name);
+        }
+        return cache.slot < 0 ? V() : slots_[cache.slot];
+    }
+
+    void set(Symbol name, V v)
+    {
+        if (dictionary_)
+        {
+            setIndexed(name.str(), v);
+            return;
+        }
+        int slot = shape_->find(name);
+        if (slot >= 0)
+        {
+            slots_[slot] = v;
+            return;
+        }
+        Shape *next = shape_->fieldCount() < Shape::kMaxSharedFields ? shape_->withField(name) : nullptr;
+        if (next == nullptr)
+        {
+            addToDictionary(name.str(), v);
+            return;
+        }
+        shape_ = next;
+        slots_.push_back(v);
+    }
+
+    // Store through an index, whose keys are computed at runtime: a record
+    // gaining fields this way gets a dictionary rather than one shape per
+    // distinct key
+    void setIndexed(std::string_view name, V v)
+    {
+        int slot = find(name);
+        if (slot >= 0)
+        {
+            slots_[slot] = v;
+            return;
+        }
+        addToDictionary(name, v);
+    }
+
+    void set(Symbol name, V v, FieldCache &cache)
+    {
+        if (dictionary_)
+        {
+            set(name, v);
+            return;
+        }
+        if (cache.shape != shape_)
+        {
+            int slot = shape_->find(name);
+            Shape *next = nullptr;
+            if (slot < 0)
+            {
+                next = shape_->fieldCount() < Shape::kMaxSharedFields ? shape_->withField(name) : nullptr;
+                if (next == nullptr)
+                {
+                    addToDictionary(name.str(), v);
+                    return;
+                }
+            }
+            cache.shape = shape_;
+            cache.slot = slot;
+            cache.next = next;
+        }
+        if (cache.next != nullptr)
+        {
+            shape_ = cache.next;
+            slots_.push_back(v);
+        }
+        else
+        {
+            slots_[cache.slot] = v;
+        }
+    }
+
+    // Calls f(name, value) for every field in order of field name
+    template <typename F>
+    void forEachSorted(F f) const
+    {
+        if (dictionary_)
+        {
+            for (int slot : dictionary_->sortedSlots())
+            {
+                f(dictionary_->fieldName(slot), slots_[slot]);
+            }
+            return;
+        }
+        for (int slot : shape_->sortedSlots())
+        {
+            f(shape_->fieldName(slot).str(), slots_[slot]);
+        }
+    }
+
+private:
+    // A name that was never interned cannot be a field of a shared shape
+    int find(std::string_view name) const
+    {
+        if (dictionary_)
+        {
+            return dictionary_->find(name);
+        }
+        std::optional<Symbol> symbol = Symbol::find(name);
+        return symbol ? shape_->find(*symbol) : -1;
+    }
+
+    void addToDictionary(std::string_view name, V v)
+    {
+        if (!dictionary_)
+        {
+            dictionary_ = std::make_unique<Dictionary>(*shape_);
+        }
+        dictionary_->add(name);
+        slots_.push_back(v);
+    }
+
+    Shape *shape_;
+    // Set once the record has left the shared shapes
+    std::unique_ptr<Dictionary> dictionary_;
+    std::vector<V> slots_;
+};
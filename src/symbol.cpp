@@ -0,0 +1,68 @@
+#include "symbol.hpp"
+
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_set>
+
+namespace
+{
+    // Nodes of an unordered_set never move, so the stored strings can be
+    // handed out by address.  Most texts are interned already, so lookups
+    // share the lock and only adding a text takes it alone.
+    struct SymbolTable
+    {
+        std::shared_mutex lock;
+        std::unordered_set<std::string, TextHash, std::equal_to<>> texts;
+    };
+
+    SymbolTable &table()
+    {
+        static SymbolTable instance;
+        return instance;
+    }
+}
+
+Symbol::Symbol(std::string_view text)
+{
+    if (text.empty())
+    {
+        return;
+    }
+    SymbolTable &symbols = table();
+    {
+        std::shared_lock<std::shared_mutex> guard(symbols.lock);
+        auto it = symbols.texts.find(text);
+        if (it != symbols.texts.end())
+        {
+            text_ = &*it;
+            return;
+        }
+    }
+    std::unique_lock<std::shared_mutex> guard(symbols.lock);
+    // Another thread may have added it in between
+    text_ = &*symbols.texts.emplace(text).first;
+}
+
+std::optional<Symbol> Symbol::find(std::string_view text)
+{
+    if (text.empty())
+    {
+        return Symbol();
+    }
+    SymbolTable &symbols = table();
+    std::shared_lock<std::shared_mutex> guard(symbols.lock);
+    auto it = symbols.texts.find(text);
+    if (it == symbols.texts.end())
+    {
+        return std::nullopt;
+    }
+    Symbol result;
+    result.text_ = &*it;
+    return result;
+}
+
+const std::string &Symbol::empty()
+{
+    static const std::string text;
+    return text;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+/*
+  An interned string.  Every distinct text is stored once in a process-wide
+  table and a Symbol is just a pointer to that copy, so two symbols are equal
+  exactly when their pointers are, and hashing one costs nothing.  The parser
+  interns identifiers as it takes them from the lexer, and the interpreter,
+  compiler and bytecode parser pass the same symbols along.
+
+  Interned texts are never freed, so only names and constants that appear
+  in programs are interned: identifiers, field names and string constants.
+  Keys computed while a program runs, such as the index of a record store,
+  stay plain strings.  The table is shared by every program in the process,
+  including all the jobs of a batch, and is guarded by a lock, so symbols
+  may be created from several threads.
+*/
+class Symbol
+{
+public:
+    // The empty string
+    Symbol() = default;
+
+    explicit Symbol(std::string_view text);
+    explicit Symbol(const char *text) : Symbol(std::string_view(text)) {}
+    explicit Symbol(const std::string &text) : Symbol(std::string_view(text)) {}
+
+    // The symbol for text if it has been interned already.  Used by lookups
+    // with a name computed at runtime, which cannot match a field that was
+    // never written when the name is not in the table.
+    static std::optional<Symbol> find(std::string_view text);
+
+    const std::string &str() const { return text_ == nullptr ? empty() : *text_; }
+    size_t size() const { return str().size(); }
+
+    bool operator==(const Symbol &other) const { return text_ == other.text_; }
+    bool operator!=(const Symbol &other) const { return text_ != other.text_; }
+    bool operator==(std::string_view text) const { return str() == text; }
+    bool operator!=(std::string_view text) const { return str() != text; }
+
+    // Orders by text, not by address, so sorted output is deterministic
+    bool operator<(const Symbol &other) const { return str() < other.str(); }
+
+    size_t hash() const { return std::hash<const void *>()(text_); }
+
+private:
+    static const std::string &empty();
+
+    const std::string *text_ = nullptr;
+};
+
+inline std::ostream &operator<<(std::ostream &out, const Symbol &symbol)
+{
+    return out << symbol.str();
+}
+
+// Hashes strings and string views alike, for tables keyed by text that are
+// searched without building a string
+struct TextHash
+{
+    using is_transparent = void;
+    size_t operator()(std::string_view text) const { return std::hash<std::string_view>()(text); }
+};
+
+template <>
+struct std::hash<Symbol>
+{
+    size_t operator()(const Symbol &symbol) const { return symbol.hash(); }
+};
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "gc/gc.hpp"
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+/*
+  An immutable string on the collected heap whose concatenation with a suffix
+  is amortised constant time.  The characters of a Text are a prefix of the
+  buffer owned by its storage Text.  Appending to the Text that ends a buffer
+  extends that buffer in place and returns a longer prefix of it, so a script
+  that builds its output with s = s + x copies nothing; shorter prefixes held
+  elsewhere keep seeing the same characters, since a buffer only ever grows
+  at its end.  Appending to any other Text starts a new buffer with a copy.
+
+  A Text is always flat, so printing and comparing read the characters where
+  they are and nothing is ever rebuilt.  Strings created from literals or
+  input are never extended, so their buffers stay the size of the value.
+*/
+class Text : public Collectable
+{
+public:
+    explicit Text(std::string s) : buffer_(std::move(s)), storage_(this), length_(buffer_.size()) {}
+
+    // The first length characters of storage's buffer; made by concat()
+    Text(Text *storage, size_t length) : storage_(storage), length_(length) {}
+
+    std::string_view view() const { return std::string_view(storage_->buffer_.data(), length_); }
+    std::string str() const { return std::string(view()); }
+    size_t length() const { return length_; }
+
+    // Prefix followed by suffix.  Suffix may point into prefix's own buffer.
+    static Text *concat(CollectedHeap &heap, Text *prefix, std::string_view suffix)
+    {
+        Text *storage = prefix->storage_;
+        if (!storage->growable_ || storage->buffer_.size() != prefix->length_)
+        {
+            std::string copy;
+            copy.reserve(prefix->length_ + suffix.size());
+            copy.append(prefix->view());
+            copy.append(suffix);
+            Text *result = heap.allocate<Text>(std::move(copy));
+            result->growable_ = true;
+            return result;
+        }
+
+        const char *begin = storage->buffer_.data();
+        if (std::less_equal<const char *>()(begin, suffix.data()) &&
+            std::less<const char *>()(suffix.data(), begin + storage->buffer_.size()))
+        {
+            // Growing the buffer would move the characters being appended
+            std::string own(suffix);
+            storage->buffer_.append(own);
+        }
+        else
+        {
+            storage->buffer_.append(suffix);
+        }
+        return heap.allocate<Text>(storage, prefix->length_ + suffix.size());
+    }
+
+    // A buffer's later growth is charged to the prefixes made from it, so
+    // the heap budget sees what a flat string of each length would hold
+    size_t extraBytes() const { return storage_ == this ? buffer_.capacity() : length_; }
+
+protected:
+    void follow(CollectedHeap &heap) override
+    {
+        if (storage_ != this)
+        {
+            heap.markSuccessors(storage_);
+        }
+    }
+
+private:
+    std::string buffer_;
+    Text *storage_;
+    size_t length_;
+    // Only buffers started by concat() are extended in place
+    bool growable_ = false;
+};
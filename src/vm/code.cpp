@@ -0,0 +1,237 @@
+#include "./code.hpp"
+
+#include "./value.hpp"
+
+namespace vm {
+
+namespace {
+
+using bytecode::Instruction;
+using bytecode::Operation;
+
+bool inRange(int32_t i, size_t size) {
+  return i >= 0 && static_cast<size_t>(i) < size;
+}
+
+// The pc a jump by offset from pc lands on, or End when it leaves the code
+int32_t jumpTarget(size_t pc, int32_t offset, size_t size) {
+  int64_t target = static_cast<int64_t>(pc) + offset;
+  if (target < 0 || target > static_cast<int64_t>(size)) {
+    return static_cast<int32_t>(size);
+  }
+  return static_cast<int32_t>(target);
+}
+
+Code plain(Op op, int32_t a = 0) {
+  Code code;
+  code.op = op;
+  code.a = a;
+  return code;
+}
+
+Code decodeOne(const FunctionInfo &info, size_t pc) {
+  const bytecode::Function *function = info.function;
+  const Instruction &inst = function->instructions[pc];
+  size_t size = function->instructions.size();
+  int32_t i = inst.operand0.value_or(-1);
+
+  auto named = [&](Op op) {
+    if (!inRange(i, function->names_.size())) {
+      return plain(Op::Invalid);
+    }
+    Code code = plain(op);
+    code.name = function->names_[i];
+    return code;
+  };
+
+  switch (inst.operation) {
+  case Operation::LoadConst:
+    return inRange(i, info.constants.size()) ? plain(Op::LoadConst, i)
+                                             : plain(Op::Invalid);
+  case Operation::LoadFunc:
+    return inRange(i, info.functions.size()) ? plain(Op::LoadFunc, i)
+                                             : plain(Op::Invalid);
+  case Operation::LoadLocal:
+  case Operation::StoreLocal: {
+    if (!inRange(i, info.local_ref_slot.size())) {
+      return plain(Op::Invalid);
+    }
+    bool load = inst.operation == Operation::LoadLocal;
+    int32_t slot = info.local_ref_slot[i];
+    if (slot >= 0) {
+      return plain(load ? Op::LoadLocalRef : Op::StoreLocalRef, slot);
+    }
+    return plain(load ? Op::LoadLocal : Op::StoreLocal, i);
+  }
+  case Operation::LoadGlobal:
+    return named(Op::LoadGlobal);
+  case Operation::StoreGlobal:
+    return named(Op::StoreGlobal);
+  case Operation::PushReference: {
+    if (i < 0) {
+      return plain(Op::Invalid);
+    }
+    int32_t refs = static_cast<int32_t>(function->local_reference_vars_.size());
+    return i < refs ? plain(Op::PushLocalRef, i) : plain(Op::PushFreeRef, i - refs);
+  }
+  case Operation::LoadReference:
+    return plain(Op::LoadReference);
+  case Operation::StoreReference:
+    return plain(Op::StoreReference);
+  case Operation::AllocRecord:
+    return plain(Op::AllocRecord);
+  case Operation::FieldLoad:
+    return named(Op::FieldLoad);
+  case Operation::FieldStore:
+    return named(Op::FieldStore);
+  case Operation::IndexLoad:
+    return plain(Op::IndexLoad);
+  case Operation::IndexStore:
+    return plain(Op::IndexStore);
+  case Operation::AllocClosure:
+    return inst.operand0 ? plain(Op::AllocClosure, i) : plain(Op::Invalid);
+  case Operation::Call:
+    return inst.operand0 ? plain(Op::Call, i) : plain(Op::Invalid);
+  case Operation::Return:
+    return plain(Op::Return);
+  case Operation::Add:
+    return plain(Op::Add);
+  case Operation::Sub:
+    return plain(Op::Sub);
+  case Operation::Mul:
+    return plain(Op::Mul);
+  case Operation::Div:
+    return plain(Op::Div);
+  case Operation::Neg:
+    return plain(Op::Neg);
+  case Operation::Gt:
+    return plain(Op::Gt);
+  case Operation::Geq:
+    return plain(Op::Geq);
+  case Operation::Eq:
+    return plain(Op::Eq);
+  case Operation::And:
+    return plain(Op::And);
+  case Operation::Or:
+    return plain(Op::Or);
+  case Operation::Not:
+    return plain(Op::Not);
+  case Operation::Goto:
+    return inst.operand0 ? plain(Op::Goto, jumpTarget(pc, i, size))
+                         : plain(Op::Invalid);
+  case Operation::If:
+    return inst.operand0 ? plain(Op::If, jumpTarget(pc, i, size))
+                         : plain(Op::Invalid);
+  case Operation::Dup:
+    return plain(Op::Dup);
+  case Operation::Swap:
+    return plain(Op::Swap);
+  case Operation::Pop:
+    return plain(Op::Pop);
+  }
+  return plain(Op::Invalid);
+}
+
+// load_local a; load_local b or load_const b; add; store_local c, on locals
+// that are not captured and an integer constant
+bool fuseAdd(const std::vector<Code> &code, const FunctionInfo &info,
+             size_t pc, Code &fused) {
+  if (pc + 3 >= info.function->instructions.size()) {
+    return false;
+  }
+  const Code &load = code[pc];
+  const Code &operand = code[pc + 1];
+  const Code &store = code[pc + 3];
+  if (load.op != Op::LoadLocal || code[pc + 2].op != Op::Add ||
+      store.op != Op::StoreLocal) {
+    return false;
+  }
+  if (operand.op == Op::LoadLocal) {
+    fused = plain(Op::AddLocals, load.a);
+    fused.b = operand.a;
+  } else if (operand.op == Op::LoadConst &&
+             info.constants[operand.a].is<int32_t>()) {
+    fused = plain(Op::AddLocalConst, load.a);
+    fused.b = info.constants[operand.a].as<int32_t>();
+  } else {
+    return false;
+  }
+  fused.c = store.a;
+  return true;
+}
+
+// [swap;] gt, geq or eq; if; and the goto the compiler puts after an if of
+// two instructions to skip the true branch
+bool fuseBranch(const std::vector<Code> &code, size_t size, size_t pc,
+                Code &fused) {
+  bool swapped = code[pc].op == Op::Swap;
+  size_t compare = swapped ? pc + 1 : pc;
+  if (compare + 1 >= size || code[compare + 1].op != Op::If) {
+    return false;
+  }
+  Op op;
+  switch (code[compare].op) {
+  case Op::Gt:
+    op = swapped ? Op::LtBranch : Op::GtBranch;
+    break;
+  case Op::Geq:
+    op = swapped ? Op::LeqBranch : Op::GeqBranch;
+    break;
+  case Op::Eq:
+    op = Op::EqBranch;
+    break;
+  default:
+    return false;
+  }
+  // eq is symmetric, so a swap before it changes nothing
+  fused = plain(op, code[compare + 1].a);
+  size_t next = compare + 2;
+  fused.b = next < size && code[next].op == Op::Goto ? code[next].a
+                                                     : static_cast<int32_t>(next);
+  return true;
+}
+
+// call; return, which needs no frame of its own
+bool fuseTailCall(const std::vector<Code> &code, size_t size, size_t pc,
+                  Code &fused) {
+  if (code[pc].op != Op::Call || pc + 1 >= size ||
+      code[pc + 1].op != Op::Return) {
+    return false;
+  }
+  fused = plain(Op::TailCall, code[pc].a);
+  return true;
+}
+
+} // namespace
+
+std::vector<Code> decodeInstructions(const FunctionInfo &info) {
+  size_t size = info.function->instructions.size();
+  std::vector<Code> code;
+  code.reserve(size + 1);
+  for (size_t pc = 0; pc < size; ++pc) {
+    code.push_back(decodeOne(info, pc));
+  }
+  code.push_back(plain(Op::End));
+  return code;
+}
+
+std::vector<Code> decode(const FunctionInfo &info, bool superinstructions) {
+  size_t size = info.function->instructions.size();
+  std::vector<Code> code = decodeInstructions(info);
+
+  // Each entry is fused from the plain decoding of the ones after it, so a
+  // jump into the middle of a fused sequence still finds plain entries
+  std::vector<Code> fused = code;
+  for (size_t pc = 0; pc < size; ++pc) {
+    Code superinstruction;
+    if ((superinstructions &&
+         (fuseAdd(code, info, pc, superinstruction) ||
+          fuseBranch(code, size, pc, superinstruction))) ||
+        fuseTailCall(code, size, pc, superinstruction)) {
+      fused[pc] = superinstruction;
+    }
+  }
+  return fused;
+}
+
+} // namespace vm
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "symbol.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace vm {
+
+struct FunctionInfo;
+
+// Operations of the pre-decoded code the VM executes. The first group are
+// the bytecode operations with their operands resolved against the function;
+// the second fuse sequences the compiler emits for loops, arithmetic and
+// returning the result of a call.
+#define VM_OPERATIONS(X)                                                       \
+  X(LoadConst)                                                                 \
+  X(LoadFunc)                                                                  \
+  X(LoadLocal)                                                                 \
+  X(LoadLocalRef)                                                              \
+  X(StoreLocal)                                                                \
+  X(StoreLocalRef)                                                             \
+  X(LoadGlobal)                                                                \
+  X(StoreGlobal)                                                               \
+  X(PushLocalRef)                                                              \
+  X(PushFreeRef)                                                               \
+  X(LoadReference)                                                             \
+  X(StoreReference)                                                            \
+  X(AllocRecord)                                                               \
+  X(FieldLoad)                                                                 \
+  X(FieldStore)                                                                \
+  X(IndexLoad)                                                                 \
+  X(IndexStore)                                                                \
+  X(AllocClosure)                                                              \
+  X(Call)                                                                      \
+  X(Return)                                                                    \
+  X(Add)                                                                       \
+  X(Sub)                                                                       \
+  X(Mul)                                                                       \
+  X(Div)                                                                       \
+  X(Neg)                                                                       \
+  X(Gt)                                                                        \
+  X(Geq)                                                                       \
+  X(Eq)                                                                        \
+  X(And)                                                                       \
+  X(Or)                                                                        \
+  X(Not)                                                                       \
+  X(Goto)                                                                      \
+  X(If)                                                                        \
+  X(Dup)                                                                       \
+  X(Swap)                                                                      \
+  X(Pop)                                                                       \
+  X(End)                                                                       \
+  X(Invalid)                                                                   \
+  X(AddLocalConst)                                                             \
+  X(AddLocals)                                                                 \
+  X(GtBranch)                                                                  \
+  X(GeqBranch)                                                                 \
+  X(LtBranch)                                                                  \
+  X(LeqBranch)                                                                 \
+  X(EqBranch)                                                                  \
+  X(TailCall)
+
+enum class Op : uint8_t {
+#define VM_OPERATION_ENUM(name) name,
+  VM_OPERATIONS(VM_OPERATION_ENUM)
+#undef VM_OPERATION_ENUM
+};
+
+// One pre-decoded instruction. The code of a function has one entry per
+// bytecode instruction, so pcs, jump targets and the per-pc field caches
+// mean the same in both. A fused instruction sits at the pc of the first
+// instruction it replaces and continues past the last one, and the entries
+// it covers stay decoded for jumps that land among them.
+//
+//   LoadConst, LoadFunc, LoadLocal, StoreLocal   a = index
+//   LoadLocalRef, StoreLocalRef, PushLocalRef    a = index into frame refs
+//   PushFreeRef                                  a = index into free vars
+//   LoadGlobal, StoreGlobal, FieldLoad/Store     name
+//   AllocClosure, Call                           a = operand
+//   Goto, If                                     a = target pc
+//   AddLocalConst    locals[c] = locals[a] + b
+//   AddLocals        locals[c] = locals[a] + locals[b]
+//   *Branch          compare the top two values, go to a if true, else b
+//   TailCall         call with a arguments whose result is returned, run in
+//                    the caller's frame
+//
+// A jump whose target lies outside the function goes to End, which returns
+// None like falling off the last instruction. Invalid stands for an
+// instruction whose operand does not fit the function and throws when run.
+struct Code {
+  // Address of the handler for op when the VM dispatches through labels
+  const void *handler = nullptr;
+  Op op = Op::Invalid;
+  int32_t a = 0;
+  int32_t b = 0;
+  int32_t c = 0;
+  Symbol name;
+};
+
+// Decodes info's bytecode, one entry per instruction followed by End.
+// Without superinstructions only tail calls are fused, which keeps deep
+// tail recursion from growing the stack, and every other entry runs just
+// the instruction at its pc.
+std::vector<Code> decode(const FunctionInfo &info,
+                         bool superinstructions = true);
+
+// The same without superinstructions, for lowering to other forms
+std::vector<Code> decodeInstructions(const FunctionInfo &info);
+
+} // namespace vm
@@ -0,0 +1,450 @@
+#include "./jit.hpp"
+
+#include "./value.hpp"
+
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__x86_64__) && defined(__unix__)
+#define VM_JIT_X86_64 1
+#include <sys/mman.h>
+#include <unistd.h>
+#else
+#define VM_JIT_X86_64 0
+#endif
+
+namespace vm {
+
+#if VM_JIT_X86_64
+
+namespace {
+
+// The generated code keeps the slots in rdi, where they are passed, and
+// works in rax, rcx and rdx. It calls nothing, so it needs no stack frame
+// and saves no registers.
+enum Reg : uint8_t { Rax = 0, Rcx = 1, Rdx = 2, Rdi = 7 };
+
+// Condition codes, as the low nibble of jcc and setcc
+enum Condition : uint8_t {
+  Equal = 0x4,
+  NotEqual = 0x5,
+  GreaterEqual = 0xD,
+  Greater = 0xF,
+};
+
+constexpr uint64_t kTrue = uint64_t{1} << 32 | Value::BoolTag;
+constexpr uint64_t kFalse = Value::BoolTag;
+// String is the first of the pointees of Value
+constexpr uint8_t kStringTag = Value::FirstPointerTag;
+
+class Assembler {
+public:
+  size_t size() const { return bytes_.size(); }
+  const std::vector<uint8_t> &bytes() const { return bytes_; }
+
+  void emit(std::initializer_list<uint8_t> bytes) {
+    bytes_.insert(bytes_.end(), bytes);
+  }
+  void emit32(uint32_t v) {
+    for (int i = 0; i < 4; ++i) {
+      bytes_.push_back(static_cast<uint8_t>(v >> (8 * i)));
+    }
+  }
+  void emit64(uint64_t v) {
+    emit32(static_cast<uint32_t>(v));
+    emit32(static_cast<uint32_t>(v >> 32));
+  }
+
+  // mov reg, [rdi + 8 * slot]
+  void load(Reg reg, int32_t slot) {
+    emit({0x48, 0x8B, static_cast<uint8_t>(0x80 | reg << 3 | Rdi)});
+    emit32(static_cast<uint32_t>(8 * slot));
+  }
+  // mov [rdi + 8 * slot], reg
+  void store(int32_t slot, Reg reg) {
+    emit({0x48, 0x89, static_cast<uint8_t>(0x80 | reg << 3 | Rdi)});
+    emit32(static_cast<uint32_t>(8 * slot));
+  }
+  // mov reg, imm64
+  void move(Reg reg, uint64_t imm) {
+    emit({0x48, static_cast<uint8_t>(0xB8 | reg)});
+    emit64(imm);
+  }
+  // cmp a, b
+  void compare(Reg a, Reg b) {
+    emit({0x48, 0x39, static_cast<uint8_t>(0xC0 | b << 3 | a)});
+  }
+  // mov edx, reg; and edx, 7; cmp edx, tag
+  void compareTag(Reg reg, uint8_t tag) {
+    emit({0x89, static_cast<uint8_t>(0xC0 | reg << 3 | Rdx), 0x83, 0xE2,
+          0x07, 0x83, 0xFA, tag});
+  }
+  // mov eax, pc; ret
+  void leave(size_t pc) {
+    emit({0xB8});
+    emit32(static_cast<uint32_t>(pc));
+    emit({0xC3});
+  }
+
+  // A jump, or a jump on cc, whose displacement is patched once the target
+  // is known; returns where the displacement is
+  size_t jump() {
+    emit({0xE9});
+    emit32(0);
+    return size() - 4;
+  }
+  size_t jump(Condition cc) {
+    emit({0x0F, static_cast<uint8_t>(0x80 | cc)});
+    emit32(0);
+    return size() - 4;
+  }
+  void patch(size_t at, size_t target) {
+    int32_t displacement = static_cast<int32_t>(target - (at + 4));
+    std::memcpy(&bytes_[at], &displacement, sizeof(displacement));
+  }
+
+private:
+  std::vector<uint8_t> bytes_;
+};
+
+// Translates one function, instruction by instruction. Each instruction
+// loads its operands from their slots, or as immediates for constants, and
+// stores its result back, so machine code and interpreter always agree on
+// the state of the frame.
+class Compiler {
+public:
+  explicit Compiler(const FunctionInfo &info)
+      : info_(info), code_(info.register_code), exits_(code_.size()) {}
+
+  // Returns the code, which starts by jumping to the address in rsi, and
+  // sets offsets to where the code of each pc starts
+  std::vector<uint8_t> compile(std::vector<size_t> &offsets) {
+    offsets.resize(code_.size());
+    asm_.emit({0xFF, 0xE6}); // jmp rsi
+    for (size_t pc = 0; pc < code_.size(); ++pc) {
+      offsets[pc] = asm_.size();
+      instruction(pc);
+    }
+    for (const auto &[at, target] : jumps_) {
+      asm_.patch(at, offsets[target]);
+    }
+    // Guards that fail leave through one shared exit per pc
+    for (size_t pc = 0; pc < code_.size(); ++pc) {
+      if (exits_[pc].empty()) {
+        continue;
+      }
+      size_t exit = asm_.size();
+      asm_.leave(pc);
+      for (size_t at : exits_[pc]) {
+        asm_.patch(at, exit);
+      }
+    }
+    return asm_.bytes();
+  }
+
+private:
+  void instruction(size_t pc) {
+    const RegisterCode &inst = code_[pc];
+    switch (inst.op) {
+    case RegisterOp::Move:
+      load(Rax, inst.a);
+      asm_.store(inst.dst, Rax);
+      break;
+    case RegisterOp::Swap:
+      asm_.load(Rax, inst.dst);
+      asm_.load(Rcx, inst.a);
+      asm_.store(inst.dst, Rcx);
+      asm_.store(inst.a, Rax);
+      break;
+    case RegisterOp::Add:
+    case RegisterOp::AddInt:
+      // Tags of 2 add up to 4, and the carry out of the payload falls off
+      // the top of the word, which wraps like the interpreter does
+      if (!speculate(pc) || !operands(inst, Value::IntTag, pc)) {
+        break;
+      }
+      asm_.emit({0x48, 0x8D, 0x44, 0x08, 0xFE}); // lea rax, [rax + rcx - 2]
+      asm_.store(inst.dst, Rax);
+      break;
+    case RegisterOp::Sub:
+      if (!operands(inst, Value::IntTag, pc)) {
+        break;
+      }
+      asm_.emit({0x48, 0x29, 0xC8});       // sub rax, rcx
+      asm_.emit({0x48, 0x83, 0xC0, 0x02}); // add rax, 2
+      asm_.store(inst.dst, Rax);
+      break;
+    case RegisterOp::Mul:
+      if (!operands(inst, Value::IntTag, pc)) {
+        break;
+      }
+      payloads();
+      asm_.emit({0x0F, 0xAF, 0xC1}); // imul eax, ecx
+      integer(inst.dst, Rax);
+      break;
+    case RegisterOp::Div:
+      // Division by zero throws and INT_MIN / -1 traps, so the interpreter
+      // does both
+      if (!operands(inst, Value::IntTag, pc)) {
+        break;
+      }
+      payloads();
+      asm_.emit({0x85, 0xC9}); // test ecx, ecx
+      exit(asm_.jump(Equal), pc);
+      asm_.emit({0x83, 0xF9, 0xFF}); // cmp ecx, -1
+      exit(asm_.jump(Equal), pc);
+      asm_.emit({0x99, 0xF7, 0xF9}); // cdq; idiv ecx
+      integer(inst.dst, Rax);
+      break;
+    case RegisterOp::Neg:
+      load(Rax, inst.a);
+      if (!guard(Rax, inst.a, Value::IntTag, pc)) {
+        asm_.leave(pc);
+        break;
+      }
+      asm_.emit({0x48, 0xF7, 0xD8});       // neg rax
+      asm_.emit({0x48, 0x83, 0xC0, 0x04}); // add rax, 4
+      asm_.store(inst.dst, Rax);
+      break;
+    case RegisterOp::Gt:
+      if (operands(inst, Value::IntTag, pc)) {
+        boolean(inst.dst, Greater);
+      }
+      break;
+    case RegisterOp::Geq:
+      if (operands(inst, Value::IntTag, pc)) {
+        boolean(inst.dst, GreaterEqual);
+      }
+      break;
+    case RegisterOp::Eq:
+      // Only strings compare by more than their words
+      if (!seenStrings(pc) && comparable(inst, pc)) {
+        boolean(inst.dst, Equal);
+      }
+      break;
+    case RegisterOp::EqInt:
+      if (operands(inst, Value::IntTag, pc)) {
+        boolean(inst.dst, Equal);
+      }
+      break;
+    case RegisterOp::And:
+      if (operands(inst, Value::BoolTag, pc)) {
+        asm_.emit({0x48, 0x21, 0xC8}); // and rax, rcx
+        asm_.store(inst.dst, Rax);
+      }
+      break;
+    case RegisterOp::Or:
+      if (operands(inst, Value::BoolTag, pc)) {
+        asm_.emit({0x48, 0x09, 0xC8}); // or rax, rcx
+        asm_.store(inst.dst, Rax);
+      }
+      break;
+    case RegisterOp::Not:
+      load(Rax, inst.a);
+      if (!guard(Rax, inst.a, Value::BoolTag, pc)) {
+        asm_.leave(pc);
+        break;
+      }
+      asm_.move(Rcx, kTrue ^ kFalse);
+      asm_.emit({0x48, 0x31, 0xC8}); // xor rax, rcx
+      asm_.store(inst.dst, Rax);
+      break;
+    case RegisterOp::Goto:
+      jumpTo(asm_.jump(), inst.a);
+      break;
+    case RegisterOp::If:
+      load(Rax, inst.a);
+      asm_.move(Rcx, kTrue);
+      asm_.compare(Rax, Rcx);
+      jumpTo(asm_.jump(Equal), inst.b);
+      asm_.emit({0x48, 0x83, 0xF8, static_cast<uint8_t>(kFalse)}); // cmp rax
+      exit(asm_.jump(NotEqual), pc);
+      break;
+    case RegisterOp::BranchGt:
+      if (operands(inst, Value::IntTag, pc)) {
+        branch(inst, Greater);
+      }
+      break;
+    case RegisterOp::BranchGeq:
+      if (operands(inst, Value::IntTag, pc)) {
+        branch(inst, GreaterEqual);
+      }
+      break;
+    case RegisterOp::BranchEq:
+      if (!seenStrings(pc) && comparable(inst, pc)) {
+        branch(inst, Equal);
+      }
+      break;
+    case RegisterOp::BranchEqInt:
+      if (operands(inst, Value::IntTag, pc)) {
+        branch(inst, Equal);
+      }
+      break;
+    default:
+      asm_.leave(pc);
+      break;
+    }
+  }
+
+  // Whether to compile the instruction at pc for integers. One whose
+  // feedback has seen other types would only leave through its guards, so
+  // it leaves straight away.
+  bool speculate(size_t pc) {
+    if (info_.feedback[pc].polymorphic()) {
+      asm_.leave(pc);
+      return false;
+    }
+    return true;
+  }
+  // The same for an eq, which compiles for anything but strings
+  bool seenStrings(size_t pc) {
+    if (info_.feedback[pc].seen(kStringTag)) {
+      asm_.leave(pc);
+      return true;
+    }
+    return false;
+  }
+
+  // Constants are immediates; the collector never moves what they point to
+  void load(Reg reg, int32_t operand) {
+    if (operand >= 0) {
+      asm_.load(reg, operand);
+    } else {
+      asm_.move(reg, info_.constants[~operand].bits());
+    }
+  }
+
+  // Leaves for the interpreter at pc unless the value of operand in reg
+  // has tag. False when operand is a constant of another type, which the
+  // instruction can never take here.
+  bool guard(Reg reg, int32_t operand, uint8_t tag, size_t pc) {
+    if (operand < 0) {
+      return info_.constants[~operand].tag() == tag;
+    }
+    asm_.compareTag(reg, tag);
+    exit(asm_.jump(NotEqual), pc);
+    return true;
+  }
+
+  // Loads a into rax and b into rcx, guarded on both having tag. When
+  // that cannot hold the instruction is left to the interpreter.
+  bool operands(const RegisterCode &inst, uint8_t tag, size_t pc) {
+    load(Rax, inst.a);
+    load(Rcx, inst.b);
+    if (guard(Rax, inst.a, tag, pc) && guard(Rcx, inst.b, tag, pc)) {
+      return true;
+    }
+    asm_.leave(pc);
+    return false;
+  }
+
+  // The same, guarded on neither being a string
+  bool comparable(const RegisterCode &inst, size_t pc) {
+    load(Rax, inst.a);
+    load(Rcx, inst.b);
+    for (auto [reg, operand] : {std::pair{Rax, inst.a}, std::pair{Rcx, inst.b}}) {
+      if (operand < 0) {
+        if (info_.constants[~operand].tag() == kStringTag) {
+          asm_.leave(pc);
+          return false;
+        }
+        continue;
+      }
+      asm_.compareTag(reg, kStringTag);
+      exit(asm_.jump(Equal), pc);
+    }
+    return true;
+  }
+
+  // Shifts the payloads of two integers in rax and rcx into eax and ecx
+  void payloads() {
+    asm_.emit({0x48, 0xC1, 0xE8, 0x20}); // shr rax, 32
+    asm_.emit({0x48, 0xC1, 0xE9, 0x20}); // shr rcx, 32
+  }
+
+  // Stores the integer with the payload in the low half of reg into dst
+  void integer(int32_t dst, Reg reg) {
+    asm_.emit({0x48, 0xC1, static_cast<uint8_t>(0xE0 | reg), 0x20}); // shl 32
+    asm_.emit({0x48, 0x83, static_cast<uint8_t>(0xC8 | reg),
+               static_cast<uint8_t>(Value::IntTag)}); // or tag
+    asm_.store(dst, reg);
+  }
+
+  // Stores whether rax cc rcx into dst
+  void boolean(int32_t dst, Condition cc) {
+    asm_.emit({0x31, 0xD2}); // xor edx, edx
+    asm_.compare(Rax, Rcx);
+    asm_.emit({0x0F, static_cast<uint8_t>(0x90 | cc), 0xC2}); // setcc dl
+    asm_.emit({0x48, 0xC1, 0xE2, 0x20});                       // shl rdx, 32
+    asm_.emit({0x48, 0x83, 0xCA, static_cast<uint8_t>(Value::BoolTag)});
+    asm_.store(dst, Rdx);
+  }
+
+  void branch(const RegisterCode &inst, Condition cc) {
+    asm_.compare(Rax, Rcx);
+    jumpTo(asm_.jump(cc), inst.c);
+    jumpTo(asm_.jump(), inst.dst);
+  }
+
+  void jumpTo(size_t at, int32_t target) {
+    jumps_.emplace_back(at, static_cast<size_t>(target));
+  }
+  void exit(size_t at, size_t pc) { exits_[pc].push_back(at); }
+
+  const FunctionInfo &info_;
+  const std::vector<RegisterCode> &code_;
+  Assembler asm_;
+  std::vector<std::pair<size_t, size_t>> jumps_;
+  std::vector<std::vector<size_t>> exits_;
+};
+
+} // namespace
+
+bool Jit::supported() { return true; }
+
+bool Jit::compile(FunctionInfo &info) {
+  std::vector<size_t> offsets;
+  std::vector<uint8_t> bytes = Compiler(info).compile(offsets);
+
+  // Written while writable, then only ever executable
+  size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t size = (bytes.size() + page - 1) / page * page;
+  void *address = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (address == MAP_FAILED) {
+    return false;
+  }
+  std::memcpy(address, bytes.data(), bytes.size());
+  if (mprotect(address, size, PROT_READ | PROT_EXEC) != 0) {
+    munmap(address, size);
+    return false;
+  }
+  mappings_.push_back(Mapping{address, size});
+
+  auto code = std::make_unique<MachineCode>();
+  code->entry_ = reinterpret_cast<MachineCode::Entry>(address);
+  for (size_t offset : offsets) {
+    code->pcs_.push_back(static_cast<const uint8_t *>(address) + offset);
+  }
+  info.machine_code = code.get();
+  code_.push_back(std::move(code));
+  return true;
+}
+
+Jit::~Jit() {
+  for (const Mapping &mapping : mappings_) {
+    munmap(mapping.address, mapping.size);
+  }
+}
+
+#else
+
+bool Jit::supported() { return false; }
+
+bool Jit::compile(FunctionInfo &) { return false; }
+
+Jit::~Jit() {}
+
+#endif
+
+} // namespace vm
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace vm {
+
+struct FunctionInfo;
+struct Value;
+
+// Machine code for the register code of one function. It reads and writes
+// the frame's slots in place, so it can stop before any instruction and
+// leave the interpreter to go on from there with nothing to rebuild.
+class MachineCode {
+public:
+  // Runs from pc until an instruction the machine code does not handle, or
+  // one whose operands are not of the types it was specialized for, and
+  // returns the pc of that instruction
+  size_t run(Value *slots, size_t pc) const { return entry_(slots, pcs_[pc]); }
+
+private:
+  friend class Jit;
+
+  using Entry = uint32_t (*)(Value *slots, const void *start);
+
+  Entry entry_ = nullptr;
+  // Address of the code of each pc
+  std::vector<const void *> pcs_;
+};
+
+// Compiles the register code of hot functions to x86-64 and owns the
+// executable memory it lives in. Integer arithmetic and comparisons, the
+// boolean operations and branches become machine code, guarded on the tags
+// of their operands, unless type feedback shows the guards would fail;
+// every other instruction returns to the interpreter.
+class Jit {
+public:
+  Jit() = default;
+  Jit(const Jit &) = delete;
+  Jit &operator=(const Jit &) = delete;
+  ~Jit();
+
+  // Whether this build can generate code for the machine it runs on
+  static bool supported();
+
+  // Sets info.machine_code; false when no executable memory could be had
+  bool compile(FunctionInfo &info);
+
+private:
+  struct Mapping {
+    void *address;
+    size_t size;
+  };
+
+  std::vector<Mapping> mappings_;
+  std::vector<std::unique_ptr<MachineCode>> code_;
+};
+
+} // namespace vm
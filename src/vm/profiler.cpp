@@ -0,0 +1,200 @@
+#include "./profiler.hpp"
+
+#include "./value.hpp"
+#include "bytecode/prettyprinter.hpp"
+
+#include <algorithm>
+#include <csignal>
+#include <iomanip>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define VM_PROFILER_TIMER 1
+#include <sys/time.h>
+#else
+#define VM_PROFILER_TIMER 0
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace vm {
+
+namespace {
+
+// Set by the timer's signal, which can do nothing else safely
+volatile std::sig_atomic_t fired = 0;
+
+#if VM_PROFILER_TIMER
+struct sigaction previous;
+
+void onTimer(int) { fired = 1; }
+#endif
+
+// The time stamp counter where there is one, which counts cycles, and
+// nanoseconds elsewhere
+#if defined(__x86_64__) || defined(__i386__)
+const char *const kTickUnit = "cycles";
+uint64_t ticks() { return __rdtsc(); }
+#else
+const char *const kTickUnit = "ns";
+uint64_t ticks() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+#endif
+
+} // namespace
+
+Profiler::Profiler(std::chrono::microseconds interval) : interval_(interval) {}
+
+Profiler::~Profiler() { stop(); }
+
+void Profiler::start(const FunctionInfo *main) {
+  main_ = main;
+  fired = 0;
+  since_ = ticks();
+  running_ = true;
+#if VM_PROFILER_TIMER
+  struct sigaction action = {};
+  action.sa_handler = onTimer;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGPROF, &action, &previous);
+
+  struct itimerval timer = {};
+  timer.it_interval.tv_sec = interval_.count() / 1000000;
+  timer.it_interval.tv_usec = interval_.count() % 1000000;
+  timer.it_value = timer.it_interval;
+  setitimer(ITIMER_PROF, &timer, nullptr);
+#endif
+}
+
+void Profiler::stop() {
+  if (!running_) {
+    return;
+  }
+  running_ = false;
+  if (current_ != nullptr) {
+    current_->ticks += ticks() - since_;
+    current_ = nullptr;
+  }
+  for (const auto &[site, count] : calls_) {
+    sites_[frame(site)] += count;
+  }
+  calls_.clear();
+#if VM_PROFILER_TIMER
+  struct itimerval timer = {};
+  setitimer(ITIMER_PROF, &timer, nullptr);
+  sigaction(SIGPROF, &previous, nullptr);
+#endif
+}
+
+void Profiler::step(const FunctionInfo *info, size_t pc) {
+  if (current_ != nullptr) {
+    current_->ticks += ticks() - since_;
+  }
+  current_ = nullptr;
+  const bytecode::InstructionList &instructions = info->function->instructions;
+  if (pc < instructions.size()) {
+    bytecode::Operation op = instructions[pc].operation;
+    current_ = &operations_[static_cast<size_t>(op)];
+    current_->executed++;
+    if (op == bytecode::Operation::Call) {
+      calls_[Location(info, pc)]++;
+    }
+  }
+  // What the profiler itself costs is left out
+  since_ = ticks();
+}
+
+bool Profiler::due() const { return fired != 0; }
+
+void Profiler::sample(const std::vector<Location> &stack, size_t skipped) {
+  fired = 0;
+  std::string folded;
+  for (size_t i = 0; i < stack.size(); ++i) {
+    if (i > 0) {
+      folded += i == 1 && skipped > 0 ? ";...;" : ";";
+    }
+    folded += frame(stack[i]);
+  }
+  stacks_[folded]++;
+  samples_++;
+  since_ = ticks();
+}
+
+std::string Profiler::name(const FunctionInfo *info) const {
+  const bytecode::Function *function = info->function;
+  if (function->name_ != "") {
+    return function->name_.str();
+  }
+  if (function->line_ > 0) {
+    return "<fun@" + std::to_string(function->line_) + ">";
+  }
+  return info == main_ ? "<main>" : "<fun>";
+}
+
+std::string Profiler::frame(const Location &location) const {
+  auto [info, pc] = location;
+  std::string text = name(info);
+  const bytecode::InstructionList &instructions = info->function->instructions;
+  if (pc < instructions.size() && instructions[pc].line > 0) {
+    text += ':' + std::to_string(instructions[pc].line);
+  }
+  return text;
+}
+
+void Profiler::writeFolded(std::ostream &os) const {
+  for (const auto &[stack, count] : stacks_) {
+    os << stack << ' ' << count << '\n';
+  }
+  os.flush();
+}
+
+void Profiler::report(std::ostream &os) const {
+  os << "[profile] " << samples_ << " samples, one per "
+     << interval_.count() << " us of CPU time\n";
+
+  std::vector<size_t> ops;
+  uint64_t total = 0;
+  for (size_t op = 0; op < std::size(operations_); ++op) {
+    if (operations_[op].executed > 0) {
+      ops.push_back(op);
+      total += operations_[op].ticks;
+    }
+  }
+  std::sort(ops.begin(), ops.end(), [&](size_t a, size_t b) {
+    return operations_[a].ticks > operations_[b].ticks;
+  });
+  os << "[profile] " << std::left << std::setw(14) << "operation"
+     << std::right << std::setw(14) << "executed" << std::setw(16) << kTickUnit
+     << std::setw(8) << "share" << std::setw(10) << "each" << '\n';
+  for (size_t op : ops) {
+    const OperationCount &count = operations_[op];
+    os << "[profile] " << std::left << std::setw(14)
+       << bytecode::mnemonic(static_cast<bytecode::Operation>(op))
+       << std::right << std::setw(14) << count.executed << std::setw(16)
+       << count.ticks << std::setw(7) << std::fixed << std::setprecision(1)
+       << (total > 0 ? 100.0 * count.ticks / total : 0.0) << '%'
+       << std::setw(10)
+       << static_cast<double>(count.ticks) / count.executed << '\n';
+  }
+
+  std::vector<std::pair<std::string, uint64_t>> sites(sites_.begin(),
+                                                      sites_.end());
+  std::stable_sort(sites.begin(), sites.end(), [](const auto &a, const auto &b) {
+    return a.second > b.second;
+  });
+  os << "[profile] " << std::left << std::setw(28) << "call site"
+     << std::right << std::setw(14) << "calls" << '\n';
+  for (const auto &[site, count] : sites) {
+    os << "[profile] " << std::left << std::setw(28) << site
+       << std::right << std::setw(14) << count << '\n';
+  }
+  os << std::defaultfloat;
+  os.flush();
+}
+
+} // namespace vm
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "bytecode/instructions.hpp"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace vm {
+
+struct FunctionInfo;
+
+// Where a run of the stack form spends its time, for --profile. The VM
+// reports every instruction before it runs it: that counts it by operation,
+// charges the time since the one before to that one's operation, and counts
+// calls by call site. Once the profiling timer has fired, the next
+// instruction also records the functions and lines on the stack.
+//
+// The timer is a signal for the whole process, so only one profiler may be
+// started at a time.
+class Profiler {
+public:
+  // A function and the pc it is at
+  using Location = std::pair<const FunctionInfo *, size_t>;
+
+  // Frames a sample keeps. Deeper stacks keep their outermost frame and
+  // their innermost ones, so a sample costs the same however deep the
+  // recursion goes.
+  static constexpr size_t kMaxDepth = 128;
+
+  // Samples once per interval of CPU time
+  explicit Profiler(std::chrono::microseconds interval =
+                        std::chrono::microseconds(1000));
+  Profiler(const Profiler &) = delete;
+  Profiler &operator=(const Profiler &) = delete;
+  ~Profiler();
+
+  // main names the outermost frame. What was seen no longer refers to the
+  // functions once stopped, so they may go away.
+  void start(const FunctionInfo *main);
+  void stop();
+
+  // Called before the instruction at pc of info runs
+  void step(const FunctionInfo *info, size_t pc);
+  // True once the timer has fired since the last sample
+  bool due() const;
+  // Records stack, whose outermost frame comes first, with skipped frames
+  // left out after that one
+  void sample(const std::vector<Location> &stack, size_t skipped = 0);
+
+  // One line per distinct stack, as flamegraph.pl reads them: the frames
+  // from the outermost in, each a function and a line, separated by ';',
+  // and then the number of samples
+  void writeFolded(std::ostream &os) const;
+  // Counts and time per operation, and calls per call site
+  void report(std::ostream &os) const;
+
+private:
+  struct OperationCount {
+    uint64_t executed = 0;
+    uint64_t ticks = 0;
+  };
+
+  std::string name(const FunctionInfo *info) const;
+  std::string frame(const Location &location) const;
+
+  std::chrono::microseconds interval_;
+  bool running_ = false;
+  const FunctionInfo *main_ = nullptr;
+
+  OperationCount operations_[static_cast<size_t>(bytecode::Operation::Pop) + 1];
+  // The operation the time until the next step goes to
+  OperationCount *current_ = nullptr;
+  uint64_t since_ = 0;
+
+  std::map<Location, uint64_t> calls_;
+  // calls_ by name, once stopped
+  std::map<std::string, uint64_t> sites_;
+  std::map<std::string, uint64_t> stacks_;
+  uint64_t samples_ = 0;
+};
+
+} // namespace vm
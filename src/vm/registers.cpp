@@ -0,0 +1,612 @@
+#include "./registers.hpp"
+
+#include "./value.hpp"
+
+#include <algorithm>
+
+namespace vm {
+
+namespace {
+
+struct Effect {
+  int32_t pops;
+  int32_t pushes;
+};
+
+// Values an instruction takes off and puts on the operand stack, or -1 pops
+// for instructions that have no register form
+Effect effect(const Code &code) {
+  switch (code.op) {
+  case Op::LoadConst:
+  case Op::LoadFunc:
+  case Op::LoadLocal:
+  case Op::LoadLocalRef:
+  case Op::LoadGlobal:
+  case Op::PushLocalRef:
+  case Op::PushFreeRef:
+  case Op::AllocRecord:
+    return {0, 1};
+  case Op::StoreLocal:
+  case Op::StoreLocalRef:
+  case Op::StoreGlobal:
+  case Op::Return:
+  case Op::If:
+  case Op::Pop:
+    return {1, 0};
+  case Op::LoadReference:
+  case Op::FieldLoad:
+  case Op::Neg:
+  case Op::Not:
+    return {1, 1};
+  case Op::StoreReference:
+  case Op::FieldStore:
+    return {2, 0};
+  case Op::IndexLoad:
+  case Op::Add:
+  case Op::Sub:
+  case Op::Mul:
+  case Op::Div:
+  case Op::Gt:
+  case Op::Geq:
+  case Op::Eq:
+  case Op::And:
+  case Op::Or:
+    return {2, 1};
+  case Op::IndexStore:
+    return {3, 0};
+  case Op::AllocClosure:
+  case Op::Call:
+    return code.a < 0 ? Effect{-1, 0} : Effect{code.a + 1, 1};
+  case Op::Dup:
+    return {1, 2};
+  case Op::Swap:
+    return {2, 2};
+  case Op::Goto:
+    return {0, 0};
+  default:
+    return {-1, 0};
+  }
+}
+
+// The stack depth before every reachable instruction, -1 for unreachable
+// ones. False when some depth is not fixed or an instruction cannot run.
+bool stackDepths(const std::vector<Code> &code, std::vector<int32_t> &depth,
+                 int32_t &maxDepth) {
+  size_t size = code.size() - 1;
+  depth.assign(code.size(), -1);
+  depth[0] = 0;
+  maxDepth = 0;
+  std::vector<size_t> work{0};
+  while (!work.empty()) {
+    size_t pc = work.back();
+    work.pop_back();
+    if (pc == size) {
+      continue;
+    }
+    Effect e = effect(code[pc]);
+    if (e.pops < 0 || e.pops > depth[pc]) {
+      return false;
+    }
+    int32_t next = depth[pc] - e.pops + e.pushes;
+    maxDepth = std::max(maxDepth, next);
+
+    size_t successors[2];
+    size_t count = 0;
+    switch (code[pc].op) {
+    case Op::Goto:
+      successors[count++] = code[pc].a;
+      break;
+    case Op::If:
+      successors[count++] = code[pc].a;
+      successors[count++] = pc + 1;
+      break;
+    case Op::Return:
+      break;
+    default:
+      successors[count++] = pc + 1;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      size_t s = successors[i];
+      if (s == size) {
+        // Leaving the function discards the stack, whatever its depth
+        continue;
+      }
+      if (depth[s] < 0) {
+        depth[s] = next;
+        work.push_back(s);
+      } else if (depth[s] != next) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+/*
+  Lowers one function by running its code on a symbolic operand stack. A
+  load_local or load_const only records where the value is; the instruction
+  that consumes it reads that slot or constant directly, and a store_local
+  of a freshly computed value makes the computation write the local. Values
+  that have to exist on the stack are kept in the slot of their depth, which
+  is where every value is at the start of a basic block.
+*/
+class Lowering {
+public:
+  Lowering(const std::vector<Code> &code, const std::vector<int32_t> &depth,
+           int32_t locals)
+      : code_(code), depth_(depth), locals_(locals) {}
+
+  std::vector<RegisterCode> lower() {
+    size_t size = code_.size() - 1;
+    std::vector<bool> leader(size + 1, false);
+    leader[0] = true;
+    for (size_t pc = 0; pc < size; ++pc) {
+      if (depth_[pc] < 0) {
+        continue;
+      }
+      switch (code_[pc].op) {
+      case Op::Goto:
+        leader[code_[pc].a] = true;
+        leader[pc + 1] = true;
+        break;
+      case Op::If:
+        leader[code_[pc].a] = true;
+        leader[pc + 1] = true;
+        break;
+      case Op::Return:
+        leader[pc + 1] = true;
+        break;
+      default:
+        break;
+      }
+    }
+
+    start_.assign(size + 1, 0);
+    bool fallsThrough = false;
+    for (size_t pc = 0; pc < size; ++pc) {
+      if (leader[pc]) {
+        if (fallsThrough) {
+          flush();
+        }
+        stack_.clear();
+        for (int32_t k = 0; depth_[pc] >= 0 && k < depth_[pc]; ++k) {
+          stack_.push_back(Slot{Slot::Temp, temp(k)});
+        }
+        blockStart_ = out_.size();
+      }
+      start_[pc] = static_cast<int32_t>(out_.size());
+      if (depth_[pc] < 0) {
+        fallsThrough = false;
+        continue;
+      }
+      if (fuseBranch(pc, leader)) {
+        // The instruction after the if starts a block and the branch
+        // covers both ways out of this one
+        start_[pc + 1] = start_[pc];
+        ++pc;
+        fallsThrough = false;
+        continue;
+      }
+      fallsThrough = lowerOne(pc);
+    }
+    start_[size] = static_cast<int32_t>(out_.size());
+    emit(RegisterOp::End);
+
+    for (RegisterCode &inst : out_) {
+      switch (inst.op) {
+      case RegisterOp::Goto:
+        inst.a = start_[inst.a];
+        break;
+      case RegisterOp::If:
+        inst.b = start_[inst.b];
+        break;
+      case RegisterOp::BranchGt:
+      case RegisterOp::BranchGeq:
+      case RegisterOp::BranchEq:
+        inst.c = start_[inst.c];
+        inst.dst = start_[inst.dst];
+        break;
+      default:
+        break;
+      }
+    }
+    return std::move(out_);
+  }
+
+private:
+  struct Slot {
+    enum Kind { Local, Constant, Temp } kind;
+    int32_t index;
+  };
+
+  int32_t temp(size_t depth) const {
+    return locals_ + static_cast<int32_t>(depth);
+  }
+  // The slot the next value pushed is computed into
+  int32_t result() const { return temp(stack_.size()); }
+
+  static int32_t operand(const Slot &slot) {
+    return slot.kind == Slot::Constant ? ~slot.index : slot.index;
+  }
+
+  RegisterCode &emit(RegisterOp op) {
+    out_.emplace_back();
+    out_.back().op = op;
+    return out_.back();
+  }
+
+  Slot pop() {
+    Slot slot = stack_.back();
+    stack_.pop_back();
+    return slot;
+  }
+
+  void pushTemp() { stack_.push_back(Slot{Slot::Temp, result()}); }
+
+  void materialize(size_t depth) {
+    Slot &slot = stack_[depth];
+    if (slot.kind == Slot::Temp) {
+      return;
+    }
+    RegisterCode &move = emit(RegisterOp::Move);
+    move.dst = temp(depth);
+    move.a = operand(slot);
+    slot = Slot{Slot::Temp, temp(depth)};
+  }
+
+  void flush() {
+    for (size_t k = 0; k < stack_.size(); ++k) {
+      materialize(k);
+    }
+  }
+
+  static bool writesDst(RegisterOp op) {
+    switch (op) {
+    case RegisterOp::Swap:
+    case RegisterOp::StoreRef:
+    case RegisterOp::StoreGlobal:
+    case RegisterOp::StoreReference:
+    case RegisterOp::FieldStore:
+    case RegisterOp::IndexStore:
+    case RegisterOp::Return:
+    case RegisterOp::End:
+    case RegisterOp::Goto:
+    case RegisterOp::If:
+    case RegisterOp::BranchGt:
+    case RegisterOp::BranchGeq:
+    case RegisterOp::BranchEq:
+      return false;
+    default:
+      return true;
+    }
+  }
+
+  void storeLocal(int32_t local, Slot value) {
+    // Values still waiting to be read from the local have to be read now
+    for (size_t k = 0; k < stack_.size(); ++k) {
+      if (stack_[k].kind == Slot::Local && stack_[k].index == local) {
+        materialize(k);
+      }
+    }
+    if (value.kind == Slot::Local && value.index == local) {
+      return;
+    }
+    if (value.kind == Slot::Temp && out_.size() > blockStart_ &&
+        writesDst(out_.back().op) && out_.back().dst == value.index) {
+      out_.back().dst = local;
+      return;
+    }
+    RegisterCode &move = emit(RegisterOp::Move);
+    move.dst = local;
+    move.a = operand(value);
+  }
+
+  void binary(RegisterOp op) {
+    Slot right = pop();
+    Slot left = pop();
+    RegisterCode &inst = emit(op);
+    inst.dst = result();
+    inst.a = operand(left);
+    inst.b = operand(right);
+    pushTemp();
+  }
+
+  void unary(RegisterOp op) {
+    Slot value = pop();
+    RegisterCode &inst = emit(op);
+    inst.dst = result();
+    inst.a = operand(value);
+    pushTemp();
+  }
+
+  // The callee or function, then count values, in consecutive slots
+  int32_t gather(int32_t count) {
+    size_t base = stack_.size() - count - 1;
+    for (size_t k = base; k < stack_.size(); ++k) {
+      materialize(k);
+    }
+    stack_.resize(base);
+    return temp(base);
+  }
+
+  // gt, geq or eq followed by an if become one compare-and-branch
+  bool fuseBranch(size_t pc, const std::vector<bool> &leader) {
+    RegisterOp op;
+    switch (code_[pc].op) {
+    case Op::Gt:
+      op = RegisterOp::BranchGt;
+      break;
+    case Op::Geq:
+      op = RegisterOp::BranchGeq;
+      break;
+    case Op::Eq:
+      op = RegisterOp::BranchEq;
+      break;
+    default:
+      return false;
+    }
+    if (code_[pc + 1].op != Op::If || leader[pc + 1]) {
+      return false;
+    }
+    Slot right = pop();
+    Slot left = pop();
+    flush();
+    RegisterCode &branch = emit(op);
+    branch.a = operand(left);
+    branch.b = operand(right);
+    branch.c = code_[pc + 1].a;
+    // Skip the goto the compiler puts after an if over two instructions
+    size_t next = pc + 2;
+    const Code &after = code_[next];
+    branch.dst = after.op == Op::Goto ? after.a : static_cast<int32_t>(next);
+    return true;
+  }
+
+  // Lowers the instruction at pc, returning false if control never goes on
+  // to the next one
+  bool lowerOne(size_t pc) {
+    const Code &code = code_[pc];
+    switch (code.op) {
+    case Op::LoadConst:
+      stack_.push_back(Slot{Slot::Constant, code.a});
+      break;
+    case Op::LoadLocal:
+      stack_.push_back(Slot{Slot::Local, code.a});
+      break;
+    case Op::LoadFunc:
+    case Op::LoadLocalRef:
+    case Op::PushLocalRef:
+    case Op::PushFreeRef: {
+      RegisterOp op = code.op == Op::LoadFunc       ? RegisterOp::LoadFunc
+                      : code.op == Op::LoadLocalRef ? RegisterOp::LoadRef
+                      : code.op == Op::PushLocalRef ? RegisterOp::PushLocalRef
+                                                    : RegisterOp::PushFreeRef;
+      RegisterCode &inst = emit(op);
+      inst.dst = result();
+      inst.a = code.a;
+      pushTemp();
+      break;
+    }
+    case Op::StoreLocal:
+      storeLocal(code.a, pop());
+      break;
+    case Op::StoreLocalRef: {
+      Slot value = pop();
+      RegisterCode &inst = emit(RegisterOp::StoreRef);
+      inst.a = code.a;
+      inst.b = operand(value);
+      break;
+    }
+    case Op::LoadGlobal: {
+      RegisterCode &inst = emit(RegisterOp::LoadGlobal);
+      inst.dst = result();
+      inst.name = code.name;
+      pushTemp();
+      break;
+    }
+    case Op::StoreGlobal: {
+      Slot value = pop();
+      RegisterCode &inst = emit(RegisterOp::StoreGlobal);
+      inst.a = operand(value);
+      inst.name = code.name;
+      break;
+    }
+    case Op::LoadReference:
+      unary(RegisterOp::LoadReference);
+      break;
+    case Op::StoreReference: {
+      Slot value = pop();
+      Slot ref = pop();
+      RegisterCode &inst = emit(RegisterOp::StoreReference);
+      inst.a = operand(ref);
+      inst.b = operand(value);
+      break;
+    }
+    case Op::AllocRecord: {
+      RegisterCode &inst = emit(RegisterOp::AllocRecord);
+      inst.dst = result();
+      pushTemp();
+      break;
+    }
+    case Op::FieldLoad: {
+      Slot record = pop();
+      RegisterCode &inst = emit(RegisterOp::FieldLoad);
+      inst.dst = result();
+      inst.a = operand(record);
+      inst.c = static_cast<int32_t>(pc);
+      inst.name = code.name;
+      pushTemp();
+      break;
+    }
+    case Op::FieldStore: {
+      Slot value = pop();
+      Slot record = pop();
+      RegisterCode &inst = emit(RegisterOp::FieldStore);
+      inst.a = operand(record);
+      inst.b = operand(value);
+      inst.c = static_cast<int32_t>(pc);
+      inst.name = code.name;
+      break;
+    }
+    case Op::IndexLoad:
+      binary(RegisterOp::IndexLoad);
+      break;
+    case Op::IndexStore: {
+      Slot value = pop();
+      Slot index = pop();
+      Slot record = pop();
+      RegisterCode &inst = emit(RegisterOp::IndexStore);
+      inst.a = operand(record);
+      inst.b = operand(index);
+      inst.c = operand(value);
+      break;
+    }
+    case Op::AllocClosure:
+    case Op::Call: {
+      int32_t base = gather(code.a);
+      RegisterCode &inst = emit(code.op == Op::Call ? RegisterOp::Call
+                                                    : RegisterOp::AllocClosure);
+      inst.dst = base;
+      inst.a = base;
+      inst.b = code.a;
+      pushTemp();
+      break;
+    }
+    case Op::Return: {
+      Slot value = pop();
+      emit(RegisterOp::Return).a = operand(value);
+      return false;
+    }
+    case Op::Add:
+      binary(RegisterOp::Add);
+      break;
+    case Op::Sub:
+      binary(RegisterOp::Sub);
+      break;
+    case Op::Mul:
+      binary(RegisterOp::Mul);
+      break;
+    case Op::Div:
+      binary(RegisterOp::Div);
+      break;
+    case Op::Gt:
+      binary(RegisterOp::Gt);
+      break;
+    case Op::Geq:
+      binary(RegisterOp::Geq);
+      break;
+    case Op::Eq:
+      binary(RegisterOp::Eq);
+      break;
+    case Op::And:
+      binary(RegisterOp::And);
+      break;
+    case Op::Or:
+      binary(RegisterOp::Or);
+      break;
+    case Op::Neg:
+      unary(RegisterOp::Neg);
+      break;
+    case Op::Not:
+      unary(RegisterOp::Not);
+      break;
+    case Op::Goto:
+      flush();
+      emit(RegisterOp::Goto).a = code.a;
+      return false;
+    case Op::If: {
+      Slot condition = pop();
+      flush();
+      RegisterCode &inst = emit(RegisterOp::If);
+      inst.a = operand(condition);
+      inst.b = code.a;
+      break;
+    }
+    case Op::Dup: {
+      Slot top = stack_.back();
+      if (top.kind == Slot::Temp) {
+        RegisterCode &move = emit(RegisterOp::Move);
+        move.dst = result();
+        move.a = top.index;
+        pushTemp();
+      } else {
+        stack_.push_back(top);
+      }
+      break;
+    }
+    case Op::Swap: {
+      size_t d = stack_.size() - 2;
+      Slot below = stack_[d];
+      Slot top = stack_[d + 1];
+      // A value kept in a slot has to move with it to its new depth
+      if (below.kind == Slot::Temp && top.kind == Slot::Temp) {
+        RegisterCode &swap = emit(RegisterOp::Swap);
+        swap.dst = temp(d);
+        swap.a = temp(d + 1);
+      } else if (below.kind == Slot::Temp) {
+        RegisterCode &move = emit(RegisterOp::Move);
+        move.dst = temp(d + 1);
+        move.a = temp(d);
+        stack_[d] = top;
+        stack_[d + 1] = Slot{Slot::Temp, temp(d + 1)};
+      } else if (top.kind == Slot::Temp) {
+        RegisterCode &move = emit(RegisterOp::Move);
+        move.dst = temp(d);
+        move.a = temp(d + 1);
+        stack_[d] = Slot{Slot::Temp, temp(d)};
+        stack_[d + 1] = below;
+      } else {
+        std::swap(stack_[d], stack_[d + 1]);
+      }
+      break;
+    }
+    case Op::Pop:
+      pop();
+      break;
+    default:
+      break;
+    }
+    return true;
+  }
+
+  const std::vector<Code> &code_;
+  const std::vector<int32_t> &depth_;
+  int32_t locals_;
+
+  std::vector<RegisterCode> out_;
+  // Index in out_ of the register code of every pc
+  std::vector<int32_t> start_;
+  std::vector<Slot> stack_;
+  // Where the current basic block starts in out_
+  size_t blockStart_ = 0;
+};
+
+} // namespace
+
+bool lowerToRegisters(FunctionInfo &info) {
+  std::vector<Code> code = decodeInstructions(info);
+  std::vector<int32_t> depth;
+  int32_t maxDepth;
+  if (!stackDepths(code, depth, maxDepth)) {
+    return false;
+  }
+
+  int32_t locals = static_cast<int32_t>(
+      std::max<size_t>(info.function->local_vars_.size(), info.parameter_count));
+  info.register_code = Lowering(code, depth, locals).lower();
+
+  // A call whose result is returned at once needs no frame of its own.
+  // Jumps to the return still find it.
+  std::vector<RegisterCode> &out = info.register_code;
+  for (size_t i = 0; i + 1 < out.size(); ++i) {
+    if (out[i].op == RegisterOp::Call && out[i + 1].op == RegisterOp::Return &&
+        out[i + 1].a == out[i].dst) {
+      out[i].op = RegisterOp::TailCall;
+    }
+  }
+  info.feedback.assign(info.register_code.size(), TypeFeedback());
+  info.frame_size = static_cast<size_t>(locals + maxDepth);
+  return true;
+}
+
+} // namespace vm
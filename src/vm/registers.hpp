@@ -0,0 +1,111 @@
+#pragma once
+
+#include "symbol.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace vm {
+
+struct FunctionInfo;
+
+// Operations of the register form of a function. Each reads its operands
+// from and writes its result to frame slots directly instead of going
+// through the operand stack.
+#define VM_REGISTER_OPERATIONS(X)                                              \
+  X(Move)                                                                      \
+  X(Swap)                                                                      \
+  X(LoadFunc)                                                                  \
+  X(LoadRef)                                                                   \
+  X(StoreRef)                                                                  \
+  X(LoadGlobal)                                                                \
+  X(StoreGlobal)                                                               \
+  X(PushLocalRef)                                                              \
+  X(PushFreeRef)                                                               \
+  X(LoadReference)                                                             \
+  X(StoreReference)                                                            \
+  X(AllocRecord)                                                               \
+  X(FieldLoad)                                                                 \
+  X(FieldStore)                                                                \
+  X(IndexLoad)                                                                 \
+  X(IndexStore)                                                                \
+  X(AllocClosure)                                                              \
+  X(Call)                                                                      \
+  X(TailCall)                                                                  \
+  X(Return)                                                                    \
+  X(End)                                                                       \
+  X(Add)                                                                       \
+  X(Sub)                                                                       \
+  X(Mul)                                                                       \
+  X(Div)                                                                       \
+  X(Neg)                                                                       \
+  X(Gt)                                                                        \
+  X(Geq)                                                                       \
+  X(Eq)                                                                        \
+  X(And)                                                                       \
+  X(Or)                                                                        \
+  X(Not)                                                                       \
+  X(Goto)                                                                      \
+  X(If)                                                                        \
+  X(BranchGt)                                                                  \
+  X(BranchGeq)                                                                 \
+  X(BranchEq)                                                                  \
+  X(AddInt)                                                                    \
+  X(EqInt)                                                                     \
+  X(BranchEqInt)
+
+enum class RegisterOp : uint8_t {
+#define VM_REGISTER_OPERATION_ENUM(name) name,
+  VM_REGISTER_OPERATIONS(VM_REGISTER_OPERATION_ENUM)
+#undef VM_REGISTER_OPERATION_ENUM
+};
+
+// One three-address instruction. Slots 0 to the local count are the
+// function's locals and the rest hold the values the stack form would keep
+// on its operand stack, one slot per depth. A source operand s names slot s
+// when s >= 0 and constant ~s otherwise.
+//
+//   Move, Neg, Not, LoadReference        dst = op a
+//   Add ... Or                           dst = a op b
+//   Swap                                 exchanges slots dst and a
+//   LoadFunc, LoadRef, PushLocalRef      dst = function/ref/ref value a
+//   PushFreeRef                          dst = free var a
+//   StoreRef                             ref slot a = b
+//   LoadGlobal, StoreGlobal              dst = name, name = a
+//   StoreReference                       *a = b
+//   FieldLoad, FieldStore                dst = a.name, a.name = b; c is the
+//                                        pc of the field cache
+//   IndexLoad, IndexStore                dst = a[b], a[b] = c
+//   AllocClosure                         dst = closure of slot a with the b
+//                                        references in the slots after it
+//   Call                                 dst = call of slot a with the b
+//                                        arguments in the slots after it
+//   TailCall                             the same for a call the next
+//                                        instruction returns from, run in
+//                                        place of the caller's frame
+//   Return                               returns a
+//   Goto, If                             go to a; go to b if a
+//   Branch*                              go to c if a op b, else to dst
+//
+// AddInt, EqInt and BranchEqInt are Add, Eq and BranchEq for instructions
+// that have only ever seen integers. The lowering never emits them; the VM
+// rewrites an instruction to one from its type feedback, and back when an
+// operand turns out not to be an integer.
+struct RegisterCode {
+  // Address of the handler for op when the VM dispatches through labels
+  const void *handler = nullptr;
+  RegisterOp op = RegisterOp::End;
+  int32_t dst = 0;
+  int32_t a = 0;
+  int32_t b = 0;
+  int32_t c = 0;
+  Symbol name;
+};
+
+// Lowers info's decoded code to register form, setting info.register_code
+// and info.frame_size. Fails, leaving info alone, when the stack depth
+// differs between paths into an instruction or could go below zero; such
+// code needs the checks of the stack form.
+bool lowerToRegisters(FunctionInfo &info);
+
+} // namespace vm
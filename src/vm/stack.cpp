@@ -0,0 +1,52 @@
+#include "./stack.hpp"
+
+#include "./value.hpp"
+
+#include <new>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define VM_STACK_MMAP 1
+#include <sys/mman.h>
+#else
+#define VM_STACK_MMAP 0
+#endif
+
+namespace vm {
+
+// Zeroed pages read as None, so a fresh mapping needs no initializing. Where
+// the whole reservation cannot be mapped, a smaller one is tried.
+#if VM_STACK_MMAP
+
+ValueStack::ValueStack() {
+  for (size_t capacity = kCapacity; capacity >= 1024; capacity /= 2) {
+    size_t bytes = capacity * sizeof(Value);
+    void *address = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (address != MAP_FAILED) {
+      begin_ = static_cast<Value *>(address);
+      end_ = begin_ + capacity;
+      bytes_ = bytes;
+      return;
+    }
+  }
+  throw std::bad_alloc();
+}
+
+ValueStack::~ValueStack() { munmap(begin_, bytes_); }
+
+#else
+
+// Without pages committed on demand, every value is initialized up front,
+// so the reservation is kept smaller
+ValueStack::ValueStack() {
+  size_t capacity = kCapacity / 16;
+  begin_ = new Value[capacity];
+  end_ = begin_ + capacity;
+  bytes_ = capacity * sizeof(Value);
+}
+
+ValueStack::~ValueStack() { delete[] begin_; }
+
+#endif
+
+} // namespace vm
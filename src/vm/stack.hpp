@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstddef>
+
+namespace vm {
+
+struct Value;
+
+// The one region every frame's slots and operands live in, reserved once
+// when the VM starts. Nothing in it ever moves, so frames keep plain
+// pointers to their slots, and a call leaves its arguments where the caller
+// pushed them for the callee to use as its first locals. Memory is only
+// committed as deep as the stack actually grows.
+class ValueStack {
+public:
+  // Room for this many values
+  static constexpr size_t kCapacity = size_t(1) << 25;
+
+  ValueStack();
+  ValueStack(const ValueStack &) = delete;
+  ValueStack &operator=(const ValueStack &) = delete;
+  ~ValueStack();
+
+  Value *begin() const { return begin_; }
+  Value *end() const { return end_; }
+
+private:
+  Value *begin_ = nullptr;
+  Value *end_ = nullptr;
+  size_t bytes_ = 0;
+};
+
+} // namespace vm
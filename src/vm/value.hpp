@@ -0,0 +1,126 @@
+#pragma once
+
+#include "./code.hpp"
+#include "./jit.hpp"
+#include "./registers.hpp"
+#include "bytecode/types.hpp"
+#include "gc/gc.hpp"
+#include "gc/tagged.hpp"
+#include "shape.hpp"
+#include "text.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace vm {
+
+// Concatenation extends a shared buffer in place where it can; see Text
+using String = ::Text;
+struct Record;
+struct Closure;
+struct Reference;
+struct FunctionInfo;
+
+// Values live directly on the operand stack and in frames as single tagged
+// words; only strings, records, closures and references are heap objects
+// owned by the collector.
+struct Value : public TaggedValue<String, Record, Closure, Reference,
+                                  FunctionInfo> {
+  using TaggedValue::TaggedValue;
+
+  // The heap object this value points to, or nullptr for immediates and
+  // function infos
+  Collectable *object() const;
+
+  void follow(CollectedHeap &heap) const;
+};
+
+// The operand types an instruction has run with, one bit per tag of Value
+struct TypeFeedback {
+  uint8_t tags = 0;
+
+  void record(const Value &v) { tags |= static_cast<uint8_t>(1u << v.tag()); }
+  bool integers() const { return tags == 1u << Value::IntTag; }
+  bool seen(uintptr_t tag) const { return (tags >> tag & 1) != 0; }
+  // Something besides integers has been seen
+  bool polymorphic() const { return tags != 0 && !integers(); }
+};
+
+struct Record : public Collectable {
+  ShapedFields<Value> fields;
+
+  explicit Record(Shape *empty) : fields(empty) {}
+
+protected:
+  void follow(CollectedHeap &heap) override {
+    for (const Value &v : fields.values()) {
+      v.follow(heap);
+    }
+  }
+};
+
+// A boxed variable shared between a frame and the closures that capture it
+struct Reference : public Collectable {
+  Value value;
+
+protected:
+  void follow(CollectedHeap &heap) override { value.follow(heap); }
+};
+
+enum class NativeKind { NotNative, Print, Input, Intcast };
+
+// Per-function data derived once from a bytecode::Function when the VM is
+// created, so the interpreter loop never has to search names at runtime.
+struct FunctionInfo {
+  const bytecode::Function *function = nullptr;
+  NativeKind native = NativeKind::NotNative;
+  uint32_t parameter_count = 0;
+  std::vector<FunctionInfo *> functions;
+  std::vector<Value> constants;
+  // Inline caches of the field_load and field_store instructions, by pc
+  std::vector<FieldCache> field_caches;
+
+  // local_ref_slot[i] is the index into local_reference_vars_ of local
+  // variable i, or -1 when the variable is never captured by reference
+  std::vector<int32_t> local_ref_slot;
+
+  // The instructions as the VM executes them; see decode()
+  std::vector<Code> code;
+  // The same in register form when the VM runs that tier, and the number
+  // of slots its frames need
+  std::vector<RegisterCode> register_code;
+  size_t frame_size = 0;
+  // Calls and loop iterations on the register tier so far, and the machine
+  // code compiled once they reach the JIT threshold
+  uint32_t hotness = 0;
+  const MachineCode *machine_code = nullptr;
+  // Type feedback of the register code by pc, kept for the add and eq
+  // instructions, whose operands need not be integers
+  std::vector<TypeFeedback> feedback;
+};
+
+struct Closure : public Collectable {
+  FunctionInfo *info;
+  std::vector<Reference *> free_vars;
+
+  Closure(FunctionInfo *f, std::vector<Reference *> refs)
+      : info(f), free_vars(std::move(refs)) {}
+
+protected:
+  void follow(CollectedHeap &heap) override {
+    for (Reference *ref : free_vars) {
+      heap.markSuccessors(ref);
+    }
+  }
+};
+
+// Defined once every pointee is complete, so pointer<> can tell which of them
+// are collectable
+inline Collectable *Value::object() const { return pointer<Collectable>(); }
+
+inline void Value::follow(CollectedHeap &heap) const {
+  heap.markSuccessors(object());
+}
+
+} // namespace vm
@@ -0,0 +1,1332 @@
+#include "./vm.hpp"
+
+#include "exceptions.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <stdexcept>
+
+namespace vm {
+
+VirtualMachine::VirtualMachine(const bytecode::Function *main,
+                               std::ostream &out, std::FILE *in,
+                               const HeapOptions &heap, Tier tier, bool count,
+                               Profiler *profiler)
+    : out_(out), in_(in, &out_), counting_(count), profiler_(profiler),
+      sp_(stack_.begin()) {
+  heap_.configure(heap);
+  // Shapes are never freed, so they get a share of the budget of their own
+  shapes_.setLimit(heap.limit / 8);
+  main_ = prepare(main);
+
+  if (tier != Tier::Stack && profiler_ == nullptr) {
+    registers_ = std::all_of(infos_.begin(), infos_.end(), [](const auto &info) {
+      return lowerToRegisters(*info);
+    });
+    if (!registers_) {
+      for (const auto &info : infos_) {
+        info->register_code.clear();
+        info->feedback.clear();
+        info->frame_size = 0;
+      }
+    } else if (tier == Tier::Jit && Jit::supported() && !counting_) {
+      jit_ = std::make_unique<Jit>();
+    }
+  }
+
+  globals_[Symbol("print")] = heap_.allocate<Closure>(native(NativeKind::Print, 1),
+                                              std::vector<Reference *>{});
+  globals_[Symbol("input")] = heap_.allocate<Closure>(native(NativeKind::Input, 0),
+                                              std::vector<Reference *>{});
+  globals_[Symbol("intcast")] = heap_.allocate<Closure>(
+      native(NativeKind::Intcast, 1), std::vector<Reference *>{});
+}
+
+FunctionInfo *VirtualMachine::prepare(const bytecode::Function *function) {
+  infos_.push_back(std::make_unique<FunctionInfo>());
+  FunctionInfo *info = infos_.back().get();
+  info->function = function;
+  info->parameter_count = function->parameter_count_;
+
+  for (const bytecode::Function *child : function->functions_) {
+    info->functions.push_back(prepare(child));
+  }
+
+  for (const bytecode::Constant *constant : function->constants_) {
+    if (auto *b = dynamic_cast<const bytecode::Constant::Boolean *>(constant)) {
+      info->constants.emplace_back(b->value);
+    } else if (auto *i =
+                   dynamic_cast<const bytecode::Constant::Integer *>(constant)) {
+      info->constants.emplace_back(i->value);
+    } else if (auto *s =
+                   dynamic_cast<const bytecode::Constant::String *>(constant)) {
+      info->constants.emplace_back(heap_.allocate<String>(s->value));
+    } else {
+      info->constants.emplace_back();
+    }
+  }
+
+  info->field_caches.resize(function->instructions.size());
+
+  info->local_ref_slot.assign(function->local_vars_.size(), -1);
+  for (size_t r = 0; r < function->local_reference_vars_.size(); ++r) {
+    for (size_t l = 0; l < function->local_vars_.size(); ++l) {
+      if (function->local_vars_[l] == function->local_reference_vars_[r]) {
+        info->local_ref_slot[l] = static_cast<int32_t>(r);
+        break;
+      }
+    }
+  }
+
+  info->code = decode(*info, profiler_ == nullptr);
+  return info;
+}
+
+FunctionInfo *VirtualMachine::native(NativeKind kind,
+                                     uint32_t parameter_count) {
+  infos_.push_back(std::make_unique<FunctionInfo>());
+  FunctionInfo *info = infos_.back().get();
+  info->native = kind;
+  info->parameter_count = parameter_count;
+  return info;
+}
+
+void VirtualMachine::run() {
+  Closure *closure =
+      heap_.allocate<Closure>(main_, std::vector<Reference *>{});
+  push(closure);
+  pushFrame(closure, sp_ - 1, 0);
+  if (profiler_ == nullptr) {
+    if (registers_) {
+      executeRegisters();
+    } else {
+      execute();
+    }
+    return;
+  }
+  // The profile names functions from infos_, so it is finished while they
+  // are still here, also when the program fails
+  profiler_->start(main_);
+  try {
+    execute();
+  } catch (...) {
+    profiler_->stop();
+    throw;
+  }
+  profiler_->stop();
+}
+
+void VirtualMachine::sample(size_t pc) {
+  size_t kept = std::min(frames_.size(), Profiler::kMaxDepth);
+  size_t skipped = frames_.size() - kept;
+  std::vector<Profiler::Location> stack;
+  stack.reserve(kept);
+  for (size_t i = 0; i < frames_.size(); i = i == 0 ? skipped + 1 : i + 1) {
+    // A caller's pc is that of its call plus one
+    stack.emplace_back(frames_[i].info, frames_[i].pc - 1);
+  }
+  stack.back().second = pc;
+  profiler_->sample(stack, skipped);
+}
+
+void VirtualMachine::report(std::ostream &os) const {
+  os << "[stats] ";
+  if (counting_) {
+    os << executed_ << " instructions executed, ";
+  }
+  os << heap_.allocations() << " objects allocated, "
+     << heap_.allocatedBytes() << " bytes allocated, "
+     << heap_.collections() << " collections" << std::endl;
+}
+
+void VirtualMachine::collect() {
+  // A register frame may end below its caller's slots, which stay live
+  Value *top = sp_;
+  for (const Frame &frame : frames_) {
+    top = std::max(top, frame.base);
+  }
+  std::vector<Collectable *> roots;
+  for (const Value *v = stack_.begin(); v != top; ++v) {
+    roots.push_back(v->object());
+  }
+  for (const Frame &frame : frames_) {
+    roots.push_back(frame.closure);
+  }
+  roots.insert(roots.end(), refs_.begin(), refs_.end());
+  for (const auto &global : globals_) {
+    roots.push_back(global.second.object());
+  }
+  for (const auto &info : infos_) {
+    for (const Value &v : info->constants) {
+      roots.push_back(v.object());
+    }
+  }
+  heap_.gc(roots.begin(), roots.end());
+}
+
+Value VirtualMachine::pop() {
+  if (sp_ <= frames_.back().base) {
+    throw RuntimeException();
+  }
+  return *--sp_;
+}
+
+Value &VirtualMachine::top() {
+  if (sp_ <= frames_.back().base) {
+    throw RuntimeException();
+  }
+  return sp_[-1];
+}
+
+void VirtualMachine::pushFrame(Closure *closure, Value *target, size_t argc) {
+  FunctionInfo *info = closure->info;
+  const bytecode::Function *function = info->function;
+
+  Frame frame;
+  frame.info = info;
+  frame.closure = closure;
+  frame.locals = target + 1;
+  frame.refs = refs_.size();
+  frame.pc = 0;
+
+  size_t slots =
+      std::max({function->local_vars_.size(), info->frame_size, argc});
+  // Running out of stack is an error of the program, like any other
+  if (static_cast<size_t>(stack_.end() - frame.locals) < slots) {
+    throw RuntimeException();
+  }
+  // Locals that are not parameters start out as None, and so do register
+  // slots, which the collector sees before they are written
+  std::fill(frame.locals + argc, frame.locals + slots, Value());
+  frame.base = frame.locals + slots;
+  sp_ = frame.base;
+
+  refs_.resize(frame.refs + function->local_reference_vars_.size(), nullptr);
+  Reference **refs = refs_.data() + frame.refs;
+  for (size_t l = 0; l < info->local_ref_slot.size(); ++l) {
+    int32_t slot = info->local_ref_slot[l];
+    if (slot >= 0) {
+      Reference *ref = heap_.allocate<Reference>();
+      ref->value = frame.locals[l];
+      refs[slot] = ref;
+    }
+  }
+  for (size_t r = 0; r < function->local_reference_vars_.size(); ++r) {
+    if (refs[r] == nullptr) {
+      refs[r] = heap_.allocate<Reference>();
+    }
+  }
+
+  frames_.push_back(frame);
+}
+
+Value *VirtualMachine::popFrame() {
+  const Frame &frame = frames_.back();
+  Value *target = frame.locals - 1;
+  refs_.resize(frame.refs);
+  frames_.pop_back();
+  return target;
+}
+
+Closure *VirtualMachine::callee(const Value *target, int32_t argc) {
+  if (!target->is<Closure *>()) {
+    throw IllegalCastException();
+  }
+  Closure *closure = target->as<Closure *>();
+  if (closure->info->parameter_count != static_cast<uint32_t>(argc)) {
+    throw RuntimeException();
+  }
+  return closure;
+}
+
+bool VirtualMachine::call(Value *target, int32_t argc) {
+  Closure *closure = callee(target, argc);
+  if (closure->info->native != NativeKind::NotNative) {
+    callNative(closure->info->native, target);
+    return false;
+  }
+  pushFrame(closure, target, argc);
+  return true;
+}
+
+bool VirtualMachine::tailCall(Value *target, int32_t argc) {
+  Closure *closure = callee(target, argc);
+  if (closure->info->native != NativeKind::NotNative) {
+    callNative(closure->info->native, target);
+    return false;
+  }
+  // The closure and arguments move down over the frame's own slot, which
+  // comes before them, so copying forwards is safe
+  Value *slot = popFrame();
+  std::copy(target, target + argc + 1, slot);
+  pushFrame(closure, slot, argc);
+  return true;
+}
+
+void VirtualMachine::callNative(NativeKind kind, Value *target) {
+  const Value *args = target + 1;
+
+  switch (kind) {
+  case NativeKind::Print:
+    write(args[0]);
+    out_.put('\n');
+    *target = Value();
+    break;
+  case NativeKind::Input:
+    *target = heap_.allocate<String>(in_.line());
+    break;
+  case NativeKind::Intcast: {
+    const Value &arg = args[0];
+    if (arg.is<int32_t>()) {
+      *target = arg;
+      break;
+    }
+    if (!arg.is<String *>()) {
+      throw IllegalCastException();
+    }
+    std::string str = arg.as<String *>()->str();
+    if (str.empty() || (str[0] != '-' && !std::isdigit(str[0]))) {
+      throw IllegalCastException();
+    }
+    for (size_t i = 1; i < str.length(); i++) {
+      if (!std::isdigit(str[i])) {
+        throw IllegalCastException();
+      }
+    }
+    *target = static_cast<int32_t>(std::atoi(str.c_str()));
+    break;
+  }
+  case NativeKind::NotNative:
+    break;
+  }
+}
+
+std::string VirtualMachine::toString(const Value &v) {
+  if (v.is<String *>()) {
+    return v.as<String *>()->str();
+  } else if (v.is<int32_t>()) {
+    return std::to_string(v.as<int32_t>());
+  } else if (v.is<bool>()) {
+    return v.as<bool>() ? "true" : "false";
+  } else if (v.is<std::monostate>()) {
+    return "None";
+  } else if (v.is<Closure *>()) {
+    return "FUNCTION";
+  } else if (v.is<Record *>()) {
+    Record *record = v.as<Record *>();
+    if (record->fields.empty()) {
+      return "{}";
+    }
+    std::string result = "{";
+    bool first = true;
+    record->fields.forEachSorted([&](const std::string &name, Value field) {
+      if (!first) {
+        result += " ";
+      }
+      first = false;
+      result += name + ":" + toString(field);
+    });
+    return result + " }";
+  }
+  throw IllegalCastException();
+}
+
+void VirtualMachine::write(const Value &v) {
+  if (v.is<String *>()) {
+    out_.write(v.as<String *>()->view());
+  } else if (v.is<int32_t>()) {
+    out_.write(v.as<int32_t>());
+  } else if (v.is<Record *>()) {
+    Record *record = v.as<Record *>();
+    if (record->fields.empty()) {
+      out_.write("{}");
+      return;
+    }
+    out_.put('{');
+    bool first = true;
+    record->fields.forEachSorted([&](const std::string &name, Value field) {
+      if (!first) {
+        out_.put(' ');
+      }
+      first = false;
+      out_.write(name);
+      out_.put(':');
+      write(field);
+    });
+    out_.write(" }");
+  } else {
+    out_.write(toString(v));
+  }
+}
+
+Value VirtualMachine::add(const Value &left, const Value &right) {
+  if (left.is<int32_t>() && right.is<int32_t>()) {
+    return static_cast<int32_t>(static_cast<uint32_t>(left.as<int32_t>()) +
+                                static_cast<uint32_t>(right.as<int32_t>()));
+  }
+  if (left.is<String *>()) {
+    if (right.is<String *>()) {
+      return String::concat(heap_, left.as<String *>(),
+                            right.as<String *>()->view());
+    }
+    return String::concat(heap_, left.as<String *>(), toString(right));
+  }
+  if (right.is<String *>()) {
+    std::string result = toString(left);
+    result += right.as<String *>()->view();
+    return heap_.allocate<String>(std::move(result));
+  }
+  throw IllegalCastException();
+}
+
+bool VirtualMachine::equals(const Value &left, const Value &right) {
+  if (left.is<String *>() && right.is<String *>()) {
+    return left.as<String *>()->view() == right.as<String *>()->view();
+  }
+  // Same-typed immediates compare by value, heap objects by identity, and
+  // values of different types are never equal. So a closure equals only
+  // itself, in the interpreter as well, which is what lets the JIT compare
+  // raw words.
+  return left == right;
+}
+
+Record *VirtualMachine::asRecord(const Value &v) {
+  if (!v.is<Record *>()) {
+    throw IllegalCastException();
+  }
+  return v.as<Record *>();
+}
+
+int32_t VirtualMachine::asInt(const Value &v) {
+  if (!v.is<int32_t>()) {
+    throw IllegalCastException();
+  }
+  return v.as<int32_t>();
+}
+
+bool VirtualMachine::asBool(const Value &v) {
+  if (!v.is<bool>()) {
+    throw IllegalCastException();
+  }
+  return v.as<bool>();
+}
+
+// Each handler jumps straight to the handler of the next instruction where
+// the compiler can take the address of a label, and goes back through a
+// switch otherwise
+#if defined(__GNUC__) || defined(__clang__)
+#define VM_THREADED_DISPATCH 1
+#else
+#define VM_THREADED_DISPATCH 0
+#endif
+
+#if VM_THREADED_DISPATCH
+#define VM_CASE(name) op_##name:
+#define VM_DISPATCH() goto *ip->handler
+// Label addresses are a GNU extension
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#else
+#define VM_CASE(name) case VM_OPERATION_TYPE::name:
+#define VM_DISPATCH() goto dispatch
+#endif
+
+// Only operations that allocate check whether a collection is due, once
+// their result is where the collector can see it
+#define VM_DISPATCH_COLLECT()                                                  \
+  do {                                                                         \
+    if (heap_.shouldCollect()) {                                               \
+      collect();                                                               \
+    }                                                                          \
+    VM_DISPATCH();                                                             \
+  } while (0)
+
+#define VM_OPERATION_TYPE Op
+void VirtualMachine::execute() {
+  if (frames_.empty()) {
+    return;
+  }
+
+#if VM_THREADED_DISPATCH
+  static const void *const labels[] = {
+#define VM_OPERATION_LABEL(name) &&op_##name,
+      VM_OPERATIONS(VM_OPERATION_LABEL)
+#undef VM_OPERATION_LABEL
+  };
+  // When counting or profiling, every instruction goes through one handler
+  // that looks at it and then jumps to its own, so other runs pay nothing
+  const void *observed = profiler_ != nullptr ? &&profiled : &&counted;
+  for (const auto &function : infos_) {
+    for (Code &code : function->code) {
+      code.handler = counting_ || profiler_ != nullptr
+                         ? observed
+                         : labels[static_cast<size_t>(code.op)];
+    }
+  }
+#endif
+
+  Frame *frame;
+  FunctionInfo *info;
+  const Code *code;
+  const Code *ip;
+  Value *locals;
+  Reference **refs;
+  // frames_ and refs_ may reallocate on a call, so the innermost frame is
+  // reloaded after every call and return
+  auto enter = [&]() {
+    frame = &frames_.back();
+    info = frame->info;
+    code = info->code.data();
+    ip = code + frame->pc;
+    locals = frame->locals;
+    refs = refs_.data() + frame->refs;
+  };
+  // The slot of the closure a call with argc arguments calls
+  auto target = [&](int32_t argc) {
+    if (argc < 0 || sp_ - frame->base < argc + 1) {
+      throw RuntimeException();
+    }
+    return sp_ - argc - 1;
+  };
+
+  auto profile = [&]() {
+    if (counting_) {
+      ++executed_;
+    }
+    size_t pc = static_cast<size_t>(ip - code);
+    profiler_->step(info, pc);
+    if (profiler_->due()) {
+      sample(pc);
+    }
+  };
+
+  enter();
+  if (heap_.shouldCollect()) {
+    collect();
+  }
+#if VM_THREADED_DISPATCH
+  VM_DISPATCH();
+counted:
+  ++executed_;
+  goto *labels[static_cast<size_t>(ip->op)];
+profiled:
+  profile();
+  goto *labels[static_cast<size_t>(ip->op)];
+#else
+dispatch:
+  if (profiler_ != nullptr) {
+    profile();
+  } else if (counting_) {
+    ++executed_;
+  }
+  switch (ip->op) {
+#endif
+
+  VM_CASE(LoadConst) {
+    push(info->constants[ip->a]);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(LoadFunc) {
+    push(info->functions[ip->a]);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(LoadLocal) {
+    push(locals[ip->a]);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(LoadLocalRef) {
+    push(refs[ip->a]->value);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(StoreLocal) {
+    locals[ip->a] = pop();
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(StoreLocalRef) {
+    Value v = pop();
+    Reference *ref = refs[ip->a];
+    ref->value = v;
+    heap_.writeBarrier(ref, v.object());
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(LoadGlobal) {
+    auto it = globals_.find(ip->name);
+    if (it == globals_.end()) {
+      throw UninitializedVariableException();
+    }
+    push(it->second);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(StoreGlobal) {
+    Value v = pop();
+    // Globals are roots of every collection, so need no write barrier
+    globals_[ip->name] = v;
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(PushLocalRef) {
+    push(refs[ip->a]);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(PushFreeRef) {
+    push(frame->closure->free_vars.at(ip->a));
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(LoadReference) {
+    Value ref = pop();
+    if (!ref.is<Reference *>()) {
+      throw RuntimeException();
+    }
+    push(ref.as<Reference *>()->value);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(StoreReference) {
+    Value v = pop();
+    Value ref = pop();
+    if (!ref.is<Reference *>()) {
+      throw RuntimeException();
+    }
+    ref.as<Reference *>()->value = v;
+    heap_.writeBarrier(ref.as<Reference *>(), v.object());
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(AllocRecord) {
+    push(heap_.allocate<Record>(shapes_.empty()));
+    ++ip;
+    VM_DISPATCH_COLLECT();
+  }
+  VM_CASE(FieldLoad) {
+    Record *record = asRecord(pop());
+    push(record->fields.get(ip->name, info->field_caches[ip - code]));
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(FieldStore) {
+    Value v = pop();
+    Record *record = asRecord(pop());
+    record->fields.set(ip->name, v, info->field_caches[ip - code]);
+    heap_.writeBarrier(record, v.object());
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(IndexLoad) {
+    Value index = pop();
+    Record *record = asRecord(pop());
+    push(record->fields.lookup(toString(index)));
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(IndexStore) {
+    Value v = pop();
+    Value index = pop();
+    Record *record = asRecord(pop());
+    record->fields.setIndexed(toString(index), v);
+    heap_.writeBarrier(record, v.object());
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(AllocClosure) {
+    int32_t m = ip->a;
+    std::vector<Reference *> refs(m);
+    for (int32_t i = m - 1; i >= 0; --i) {
+      Value ref = pop();
+      if (!ref.is<Reference *>()) {
+        throw RuntimeException();
+      }
+      refs[i] = ref.as<Reference *>();
+    }
+    Value f = pop();
+    if (!f.is<FunctionInfo *>()) {
+      throw RuntimeException();
+    }
+    push(heap_.allocate<Closure>(f.as<FunctionInfo *>(), std::move(refs)));
+    ++ip;
+    VM_DISPATCH_COLLECT();
+  }
+  VM_CASE(Call) {
+    Value *callee = target(ip->a);
+    frame->pc = ip - code + 1;
+    if (call(callee, ip->a)) {
+      enter();
+    } else {
+      sp_ = callee + 1;
+      ++ip;
+    }
+    VM_DISPATCH_COLLECT();
+  }
+  VM_CASE(TailCall) {
+    Value *callee = target(ip->a);
+    if (tailCall(callee, ip->a)) {
+      enter();
+    } else {
+      // A native function's result goes to the return after the call
+      sp_ = callee + 1;
+      ++ip;
+    }
+    VM_DISPATCH_COLLECT();
+  }
+  VM_CASE(Return) {
+    Value v = pop();
+    sp_ = popFrame();
+    push(v);
+    if (frames_.empty()) {
+      return;
+    }
+    enter();
+    VM_DISPATCH();
+  }
+  VM_CASE(End) {
+    // Falling off the end of a function returns None
+    sp_ = popFrame();
+    push(Value());
+    if (frames_.empty()) {
+      return;
+    }
+    enter();
+    VM_DISPATCH();
+  }
+  VM_CASE(Add) {
+    Value right = pop();
+    Value left = pop();
+    push(add(left, right));
+    ++ip;
+    VM_DISPATCH_COLLECT();
+  }
+  VM_CASE(Sub) {
+    int32_t right = asInt(pop());
+    int32_t left = asInt(pop());
+    push(static_cast<int32_t>(static_cast<uint32_t>(left) -
+                              static_cast<uint32_t>(right)));
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Mul) {
+    int32_t right = asInt(pop());
+    int32_t left = asInt(pop());
+    push(static_cast<int32_t>(static_cast<uint32_t>(left) *
+                              static_cast<uint32_t>(right)));
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Div) {
+    int32_t right = asInt(pop());
+    int32_t left = asInt(pop());
+    if (right == 0) {
+      throw IllegalArithmeticException();
+    }
+    push(right == -1 ? static_cast<int32_t>(0u - static_cast<uint32_t>(left))
+                     : left / right);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Neg) {
+    int32_t v = asInt(pop());
+    push(static_cast<int32_t>(0u - static_cast<uint32_t>(v)));
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Gt) {
+    int32_t right = asInt(pop());
+    int32_t left = asInt(pop());
+    push(left > right);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Geq) {
+    int32_t right = asInt(pop());
+    int32_t left = asInt(pop());
+    push(left >= right);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Eq) {
+    Value right = pop();
+    Value left = pop();
+    push(equals(left, right));
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(And) {
+    bool right = asBool(pop());
+    bool left = asBool(pop());
+    push(left && right);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Or) {
+    bool right = asBool(pop());
+    bool left = asBool(pop());
+    push(left || right);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Not) {
+    push(!asBool(pop()));
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Goto) {
+    ip = code + ip->a;
+    VM_DISPATCH();
+  }
+  VM_CASE(If) {
+    ip = asBool(pop()) ? code + ip->a : ip + 1;
+    VM_DISPATCH();
+  }
+  VM_CASE(Dup) {
+    push(top());
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Swap) {
+    Value a = pop();
+    Value b = pop();
+    push(a);
+    push(b);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Pop) {
+    pop();
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Invalid) {
+    throw std::out_of_range("bytecode operand out of range");
+  }
+  VM_CASE(AddLocalConst) {
+    locals[ip->c] = add(locals[ip->a], Value(ip->b));
+    ip += 4;
+    VM_DISPATCH_COLLECT();
+  }
+  VM_CASE(AddLocals) {
+    locals[ip->c] = add(locals[ip->a], locals[ip->b]);
+    ip += 4;
+    VM_DISPATCH_COLLECT();
+  }
+  VM_CASE(GtBranch) {
+    int32_t right = asInt(pop());
+    int32_t left = asInt(pop());
+    ip = code + (left > right ? ip->a : ip->b);
+    VM_DISPATCH();
+  }
+  VM_CASE(GeqBranch) {
+    int32_t right = asInt(pop());
+    int32_t left = asInt(pop());
+    ip = code + (left >= right ? ip->a : ip->b);
+    VM_DISPATCH();
+  }
+  VM_CASE(LtBranch) {
+    // The swap puts the top value on the left of the comparison
+    Value top = pop();
+    Value below = pop();
+    int32_t right = asInt(below);
+    int32_t left = asInt(top);
+    ip = code + (left > right ? ip->a : ip->b);
+    VM_DISPATCH();
+  }
+  VM_CASE(LeqBranch) {
+    Value top = pop();
+    Value below = pop();
+    int32_t right = asInt(below);
+    int32_t left = asInt(top);
+    ip = code + (left >= right ? ip->a : ip->b);
+    VM_DISPATCH();
+  }
+  VM_CASE(EqBranch) {
+    Value right = pop();
+    Value left = pop();
+    ip = code + (equals(left, right) ? ip->a : ip->b);
+    VM_DISPATCH();
+  }
+
+#if !VM_THREADED_DISPATCH
+  }
+#endif
+}
+
+#undef VM_OPERATION_TYPE
+
+// Calls plus loop iterations of a function after which the JIT compiles it
+static constexpr uint32_t kJitThreshold = 1000;
+
+// The same over register code, whose operands name frame slots. The stack
+// only passes arguments to call(), and depths were checked when lowering,
+// so there are no underflow checks.
+#define VM_OPERATION_TYPE RegisterOp
+void VirtualMachine::executeRegisters() {
+  if (frames_.empty()) {
+    return;
+  }
+
+#if VM_THREADED_DISPATCH
+  static const void *const labels[] = {
+#define VM_OPERATION_LABEL(name) &&op_##name,
+      VM_REGISTER_OPERATIONS(VM_OPERATION_LABEL)
+#undef VM_OPERATION_LABEL
+  };
+  const void *counted = &&counted;
+  for (const auto &function : infos_) {
+    for (RegisterCode &code : function->register_code) {
+      code.handler = counting_ ? counted : labels[static_cast<size_t>(code.op)];
+    }
+  }
+#endif
+
+  Frame *frame;
+  FunctionInfo *info;
+  RegisterCode *code;
+  RegisterCode *ip;
+  Value *slots;
+  Reference **refs;
+  const Value *constants;
+  auto enter = [&]() {
+    frame = &frames_.back();
+    info = frame->info;
+    code = info->register_code.data();
+    ip = code + frame->pc;
+    slots = frame->locals;
+    refs = refs_.data() + frame->refs;
+    constants = info->constants.data();
+    sp_ = frame->base;
+  };
+  auto value = [&](int32_t operand) -> const Value & {
+    return operand >= 0 ? slots[operand] : constants[~operand];
+  };
+  // Rewrites the instruction at ip to op, which the next dispatch runs
+  auto rewrite = [&](RegisterOp op) {
+    ip->op = op;
+#if VM_THREADED_DISPATCH
+    if (!counting_) {
+      ip->handler = labels[static_cast<size_t>(op)];
+    }
+#endif
+  };
+  // Once the function has machine code, runs it from ip and goes on from
+  // wherever it stopped
+  auto resume = [&]() {
+    if (info->machine_code != nullptr) {
+      ip = code + info->machine_code->run(slots, ip - code);
+    }
+  };
+  // The same on entering a function or going round a loop, which counts
+  // towards compiling the function
+  auto hot = [&]() {
+    if (jit_ != nullptr && info->machine_code == nullptr &&
+        ++info->hotness == kJitThreshold) {
+      jit_->compile(*info);
+    }
+    resume();
+  };
+
+  enter();
+  if (heap_.shouldCollect()) {
+    collect();
+  }
+#if VM_THREADED_DISPATCH
+  VM_DISPATCH();
+counted:
+  ++executed_;
+  goto *labels[static_cast<size_t>(ip->op)];
+#else
+dispatch:
+  if (counting_) {
+    ++executed_;
+  }
+  switch (ip->op) {
+#endif
+
+  VM_CASE(Move) {
+    slots[ip->dst] = value(ip->a);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Swap) {
+    std::swap(slots[ip->dst], slots[ip->a]);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(LoadFunc) {
+    slots[ip->dst] = info->functions[ip->a];
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(LoadRef) {
+    slots[ip->dst] = refs[ip->a]->value;
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(StoreRef) {
+    Value v = value(ip->b);
+    Reference *ref = refs[ip->a];
+    ref->value = v;
+    heap_.writeBarrier(ref, v.object());
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(LoadGlobal) {
+    auto it = globals_.find(ip->name);
+    if (it == globals_.end()) {
+      throw UninitializedVariableException();
+    }
+    slots[ip->dst] = it->second;
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(StoreGlobal) {
+    // Globals are roots of every collection, so need no write barrier
+    globals_[ip->name] = value(ip->a);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(PushLocalRef) {
+    slots[ip->dst] = refs[ip->a];
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(PushFreeRef) {
+    slots[ip->dst] = frame->closure->free_vars.at(ip->a);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(LoadReference) {
+    Value ref = value(ip->a);
+    if (!ref.is<Reference *>()) {
+      throw RuntimeException();
+    }
+    slots[ip->dst] = ref.as<Reference *>()->value;
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(StoreReference) {
+    Value v = value(ip->b);
+    Value ref = value(ip->a);
+    if (!ref.is<Reference *>()) {
+      throw RuntimeException();
+    }
+    ref.as<Reference *>()->value = v;
+    heap_.writeBarrier(ref.as<Reference *>(), v.object());
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(AllocRecord) {
+    slots[ip->dst] = heap_.allocate<Record>(shapes_.empty());
+    ++ip;
+    VM_DISPATCH_COLLECT();
+  }
+  VM_CASE(FieldLoad) {
+    Record *record = asRecord(value(ip->a));
+    slots[ip->dst] = record->fields.get(ip->name, info->field_caches[ip->c]);
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(FieldStore) {
+    Value v = value(ip->b);
+    Record *record = asRecord(value(ip->a));
+    record->fields.set(ip->name, v, info->field_caches[ip->c]);
+    heap_.writeBarrier(record, v.object());
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(IndexLoad) {
+    Value index = value(ip->b);
+    Record *record = asRecord(value(ip->a));
+    slots[ip->dst] = record->fields.lookup(toString(index));
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(IndexStore) {
+    Value v = value(ip->c);
+    Value index = value(ip->b);
+    Record *record = asRecord(value(ip->a));
+    record->fields.setIndexed(toString(index), v);
+    heap_.writeBarrier(record, v.object());
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(AllocClosure) {
+    int32_t m = ip->b;
+    std::vector<Reference *> refs(m);
+    for (int32_t i = m - 1; i >= 0; --i) {
+      const Value &ref = slots[ip->a + 1 + i];
+      if (!ref.is<Reference *>()) {
+        throw RuntimeException();
+      }
+      refs[i] = ref.as<Reference *>();
+    }
+    const Value &f = slots[ip->a];
+    if (!f.is<FunctionInfo *>()) {
+      throw RuntimeException();
+    }
+    slots[ip->dst] =
+        heap_.allocate<Closure>(f.as<FunctionInfo *>(), std::move(refs));
+    ++ip;
+    VM_DISPATCH_COLLECT();
+  }
+  VM_CASE(Call) {
+    // The callee's frame starts at the arguments, and its return writes the
+    // result into dst of this instruction
+    frame->pc = ip - code;
+    if (call(slots + ip->a, ip->b)) {
+      enter();
+      hot();
+    } else {
+      slots[ip->dst] = slots[ip->a];
+      ++ip;
+    }
+    VM_DISPATCH_COLLECT();
+  }
+  VM_CASE(TailCall) {
+    if (tailCall(slots + ip->a, ip->b)) {
+      enter();
+      hot();
+    } else {
+      slots[ip->dst] = slots[ip->a];
+      ++ip;
+    }
+    VM_DISPATCH_COLLECT();
+  }
+  VM_CASE(Return) {
+    Value v = value(ip->a);
+    Value *callee = popFrame();
+    if (frames_.empty()) {
+      sp_ = callee;
+      push(v);
+      return;
+    }
+    enter();
+    slots[ip->dst] = v;
+    ++ip;
+    resume();
+    VM_DISPATCH();
+  }
+  VM_CASE(End) {
+    // Falling off the end of a function returns None
+    Value *callee = popFrame();
+    if (frames_.empty()) {
+      sp_ = callee;
+      push(Value());
+      return;
+    }
+    enter();
+    slots[ip->dst] = Value();
+    ++ip;
+    resume();
+    VM_DISPATCH();
+  }
+  VM_CASE(Add) {
+    TypeFeedback &feedback = info->feedback[ip - code];
+    const Value &left = value(ip->a);
+    const Value &right = value(ip->b);
+    feedback.record(left);
+    feedback.record(right);
+    slots[ip->dst] = add(left, right);
+    if (feedback.integers()) {
+      rewrite(RegisterOp::AddInt);
+    }
+    ++ip;
+    VM_DISPATCH_COLLECT();
+  }
+  VM_CASE(Sub) {
+    int32_t right = asInt(value(ip->b));
+    int32_t left = asInt(value(ip->a));
+    slots[ip->dst] = static_cast<int32_t>(static_cast<uint32_t>(left) -
+                                          static_cast<uint32_t>(right));
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Mul) {
+    int32_t right = asInt(value(ip->b));
+    int32_t left = asInt(value(ip->a));
+    slots[ip->dst] = static_cast<int32_t>(static_cast<uint32_t>(left) *
+                                          static_cast<uint32_t>(right));
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Div) {
+    int32_t right = asInt(value(ip->b));
+    int32_t left = asInt(value(ip->a));
+    if (right == 0) {
+      throw IllegalArithmeticException();
+    }
+    slots[ip->dst] =
+        right == -1 ? static_cast<int32_t>(0u - static_cast<uint32_t>(left))
+                    : left / right;
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Neg) {
+    int32_t v = asInt(value(ip->a));
+    slots[ip->dst] = static_cast<int32_t>(0u - static_cast<uint32_t>(v));
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Gt) {
+    int32_t right = asInt(value(ip->b));
+    int32_t left = asInt(value(ip->a));
+    slots[ip->dst] = left > right;
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Geq) {
+    int32_t right = asInt(value(ip->b));
+    int32_t left = asInt(value(ip->a));
+    slots[ip->dst] = left >= right;
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Eq) {
+    TypeFeedback &feedback = info->feedback[ip - code];
+    const Value &left = value(ip->a);
+    const Value &right = value(ip->b);
+    feedback.record(left);
+    feedback.record(right);
+    slots[ip->dst] = equals(left, right);
+    if (feedback.integers()) {
+      rewrite(RegisterOp::EqInt);
+    }
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(And) {
+    bool right = asBool(value(ip->b));
+    bool left = asBool(value(ip->a));
+    slots[ip->dst] = left && right;
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Or) {
+    bool right = asBool(value(ip->b));
+    bool left = asBool(value(ip->a));
+    slots[ip->dst] = left || right;
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(Not) {
+    slots[ip->dst] = !asBool(value(ip->a));
+    ++ip;
+    VM_DISPATCH();
+  }
+  // A jump to an earlier pc goes round a loop
+  VM_CASE(Goto) {
+    const RegisterCode *from = ip;
+    ip = code + ip->a;
+    if (ip <= from) {
+      hot();
+    }
+    VM_DISPATCH();
+  }
+  VM_CASE(If) {
+    const RegisterCode *from = ip;
+    ip = asBool(value(ip->a)) ? code + ip->b : ip + 1;
+    if (ip <= from) {
+      hot();
+    }
+    VM_DISPATCH();
+  }
+  VM_CASE(BranchGt) {
+    const RegisterCode *from = ip;
+    int32_t right = asInt(value(ip->b));
+    int32_t left = asInt(value(ip->a));
+    ip = code + (left > right ? ip->c : ip->dst);
+    if (ip <= from) {
+      hot();
+    }
+    VM_DISPATCH();
+  }
+  VM_CASE(BranchGeq) {
+    const RegisterCode *from = ip;
+    int32_t right = asInt(value(ip->b));
+    int32_t left = asInt(value(ip->a));
+    ip = code + (left >= right ? ip->c : ip->dst);
+    if (ip <= from) {
+      hot();
+    }
+    VM_DISPATCH();
+  }
+  VM_CASE(BranchEq) {
+    const RegisterCode *from = ip;
+    TypeFeedback &feedback = info->feedback[ip - code];
+    const Value &left = value(ip->a);
+    const Value &right = value(ip->b);
+    feedback.record(left);
+    feedback.record(right);
+    if (feedback.integers()) {
+      rewrite(RegisterOp::BranchEqInt);
+    }
+    ip = code + (equals(left, right) ? ip->c : ip->dst);
+    if (ip <= from) {
+      hot();
+    }
+    VM_DISPATCH();
+  }
+  // Speculate that the operands are integers, as they always have been.
+  // When they are not, the instruction goes back to the generic form for
+  // good, since its feedback then shows another type.
+  VM_CASE(AddInt) {
+    const Value &left = value(ip->a);
+    const Value &right = value(ip->b);
+    if (!left.is<int32_t>() || !right.is<int32_t>()) {
+      rewrite(RegisterOp::Add);
+      VM_DISPATCH();
+    }
+    slots[ip->dst] =
+        static_cast<int32_t>(static_cast<uint32_t>(left.as<int32_t>()) +
+                             static_cast<uint32_t>(right.as<int32_t>()));
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(EqInt) {
+    const Value &left = value(ip->a);
+    const Value &right = value(ip->b);
+    if (!left.is<int32_t>() || !right.is<int32_t>()) {
+      rewrite(RegisterOp::Eq);
+      VM_DISPATCH();
+    }
+    slots[ip->dst] = left == right;
+    ++ip;
+    VM_DISPATCH();
+  }
+  VM_CASE(BranchEqInt) {
+    const Value &left = value(ip->a);
+    const Value &right = value(ip->b);
+    if (!left.is<int32_t>() || !right.is<int32_t>()) {
+      rewrite(RegisterOp::BranchEq);
+      VM_DISPATCH();
+    }
+    const RegisterCode *from = ip;
+    ip = code + (left == right ? ip->c : ip->dst);
+    if (ip <= from) {
+      hot();
+    }
+    VM_DISPATCH();
+  }
+
+#if !VM_THREADED_DISPATCH
+  }
+#endif
+}
+#undef VM_OPERATION_TYPE
+
+#if VM_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
+#undef VM_DISPATCH_COLLECT
+#undef VM_DISPATCH
+#undef VM_CASE
+#undef VM_THREADED_DISPATCH
+
+} // namespace vm
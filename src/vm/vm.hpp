@@ -0,0 +1,131 @@
+#pragma once
+
+#include "bytecode/types.hpp"
+#include "exceptions.hpp"
+#include "gc/gc.hpp"
+#include "io.hpp"
+#include "./profiler.hpp"
+#include "./stack.hpp"
+#include "./value.hpp"
+
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace vm {
+
+// Which form of the bytecode the VM executes. Register code is lowered
+// from the stack form when the VM is created; a program with a function
+// that cannot be lowered runs on the stack form. Jit runs register code and
+// compiles the functions that get hot to machine code where it can.
+enum class Tier { Stack, Register, Jit };
+
+class VirtualMachine {
+public:
+  // input() reads lines of in, or nothing when it is null. heap.limit
+  // bounds the bytes of live heap objects before a collection.
+  // With count set every instruction executed is counted for report(), and
+  // nothing is compiled to machine code, which could not count them. A
+  // profiler is told about every instruction run, and the stack form always
+  // runs, without superinstructions, so that each pc is one bytecode
+  // instruction.
+  VirtualMachine(const bytecode::Function *main, std::ostream &out,
+                 std::FILE *in = stdin, const HeapOptions &heap = HeapOptions(),
+                 Tier tier = Tier::Stack, bool count = false,
+                 Profiler *profiler = nullptr);
+
+  // Runs the top-level function to completion. Runtime errors surface as the
+  // exceptions declared in exceptions.hpp.
+  void run();
+
+  // Instructions executed, when counted, and what the program allocated
+  void report(std::ostream &os) const;
+
+private:
+  // A frame's values sit on the value stack right after the slot of the
+  // closure it runs: first its locals, starting with the arguments, or for
+  // register code all of its slots, and then its operand stack. The
+  // references of locals that closures capture are kept apart in refs_, so
+  // a register frame can start among its caller's slots, which are dead
+  // from the callee's slot up.
+  struct Frame {
+    FunctionInfo *info;
+    Closure *closure;
+    Value *locals;
+    // Where the operand stack starts
+    Value *base;
+    // Index in refs_ of the frame's first reference
+    size_t refs;
+    size_t pc;
+  };
+
+  FunctionInfo *prepare(const bytecode::Function *function);
+  FunctionInfo *native(NativeKind kind, uint32_t parameter_count);
+
+  void execute();
+  void executeRegisters();
+  // Gives the profiler a sample of the frames, the innermost at pc
+  void sample(size_t pc);
+  // Marks from every value the VM can still reach and sweeps the rest. Only
+  // safe between instructions, when no value is held outside the stack.
+  void collect();
+  // The closure in slot target, checked to take argc arguments
+  Closure *callee(const Value *target, int32_t argc);
+  // Calls the closure in slot target with the argc arguments after it. A
+  // native function's result replaces the closure; any other function gets
+  // a frame whose locals start at the arguments, and true is returned.
+  bool call(Value *target, int32_t argc);
+  // Leaves the result in target
+  void callNative(NativeKind kind, Value *target);
+  void pushFrame(Closure *closure, Value *target, size_t argc);
+  // Drops the frame on top, returning the slot of the closure it ran
+  Value *popFrame();
+  // Calls from the frame on top in place of it, as for a call whose result
+  // the frame returns straight away, so the frame's caller gets the result.
+  // The frame's slots are reused and the stack does not grow.
+  bool tailCall(Value *target, int32_t argc);
+
+  Value pop();
+  Value &top();
+  void push(Value v) {
+    if (sp_ == stack_.end()) {
+      throw RuntimeException();
+    }
+    *sp_++ = v;
+  }
+
+  std::string toString(const Value &v);
+  // toString(v), written straight into the output
+  void write(const Value &v);
+  Value add(const Value &left, const Value &right);
+  bool equals(const Value &left, const Value &right);
+  Record *asRecord(const Value &v);
+  int32_t asInt(const Value &v);
+  bool asBool(const Value &v);
+
+  CollectedHeap heap_;
+  OutputBuffer out_;
+  InputReader in_;
+  std::vector<std::unique_ptr<FunctionInfo>> infos_;
+  FunctionInfo *main_;
+
+  bool registers_ = false;
+  bool counting_ = false;
+  uint64_t executed_ = 0;
+  Profiler *profiler_ = nullptr;
+  // Set when machine code may be compiled
+  std::unique_ptr<Jit> jit_;
+
+  ShapeTable shapes_;
+  std::unordered_map<Symbol, Value> globals_;
+  ValueStack stack_;
+  // One past the last value in use, which collections see up to
+  Value *sp_;
+  std::vector<Reference *> refs_;
+  std::vector<Frame> frames_;
+};
+
+} // namespace vm